@@ -322,6 +322,24 @@ void PackedContour::printData(FILE* f,bool add_newline)
   else fprintf(f,"%s",output);
 }
 
+// Binary dump and restore, for checkpoints
+bool PackedContour::writeState(FILE* f) const
+{
+  if (!dumpRaw(f,x_start) || !dumpRaw(f,y_start) || !dumpRaw(f,size)) return false;
+  if (bits==NULL) return true;
+  int n = (size+3)/4 + 1;
+  return (int)fwrite(bits,1,n,f) == n;
+}
+bool PackedContour::readState(FILE* f)
+{
+  if (bits!=NULL) { delete[] bits; bits=NULL; }
+  if (!undumpRaw(f,x_start) || !undumpRaw(f,y_start) || !undumpRaw(f,size)) return false;
+  if (size<=0) return true;
+  int n = (size+3)/4 + 1;
+  bits = new unsigned char[n];
+  return (int)fread(bits,1,n,f) == n;
+}
+
 
 /****************************************************************
                           Blob Methods
@@ -404,7 +422,7 @@ int Blob::find(Mask* old_mask,Mask* exclusion_mask)
   
   ManagedList<FloodData>& found = dancer->candidates;
   found.flush();
-  im->floodRect( dancer->fill_I , &(dancer->ssstore) , &(dancer->lsstore) , found , im->getBounds() );
+  im->floodRect( dancer->fill_I , found , im->getBounds() );
   if (found.size==0) {
 		return 0;
 	}
@@ -471,8 +489,12 @@ void Blob::extraStats(Range fill_I , FPoint previous_direction)
     data().major = -data().major;
     data().minor = -data().minor;
   }
-  
-  if (mask().pixel_count==0 || dancer==NULL || !(dancer->find_skel || dancer->find_outline)) return;
+}
+
+// Outline and skeleton; nothing else about tracking depends on them, so they can wait (see Performance::startTail)
+void Blob::shapeStats()
+{
+  if (stats==NULL || mask().pixel_count==0 || dancer==NULL || !(dancer->find_skel || dancer->find_outline)) return;
   
   // Find contour around mask
   Contour* c;
@@ -521,6 +543,63 @@ void Blob::extraStats(Range fill_I , FPoint previous_direction)
   }
 }
 
+// How far off the center line the nose or tail is pointing (whichever deviates further), in radians
+// Nose and tail are arbitrary; they refer to two ends, but may not correspond to organism's nose and tail
+// Returns false if there's no full-length skeleton to measure
+bool Blob::endWiggle(float& wiggle)
+{
+  if (skeleton==NULL) return false;
+  Contour* c = &(spine());
+  if (c->size() != SKELETON_SIZE) return false;
+  
+  int i;
+  float f;
+  float nose_angle,tail_angle;
+  FPoint nose,tail,noseless,tailless;
+  
+  c->start();
+  for (i=0 ; (i+1)*5 < SKELETON_SIZE ; i++) c->advance();  // Pick off first 20% of dancer (nose)
+  nose = c->h() - c->i();
+  for ( ; (i+1)*3 < SKELETON_SIZE ; i++) c->advance();  // Pick off last 2/3 of dancer (all but nose)
+  noseless = c->i() - c->t();
+  f = nose.length();
+  if (f==0) nose_angle = 0;
+  else
+  {
+    nose /= f;
+    f = noseless.length();
+    if (f==0) nose_angle = 0;
+    else
+    {
+      noseless /= f;
+      nose_angle = nose * noseless;
+    }
+  }
+  
+  c->end();
+  for (i=0 ; (i+1)*5 < SKELETON_SIZE ; i++) c->retreat();  // Pick off last 20% of dancer (tail)
+  tail = c->t() - c->i();
+  for ( ; (i+1)*3 < SKELETON_SIZE ; i++) c->retreat();  // Pick off first 2/3 of dancer (all but tail)
+  tailless = c->i() - c->h();
+  f = tail.length();
+  if (f==0) tail_angle = 0;
+  else
+  {
+    tail /= f;
+    f = tailless.length();
+    if (f==0) tail_angle = 0;
+    else
+    {
+      tailless /= f;
+      tail_angle = tail * tailless;
+    }
+  }
+  
+  if (nose_angle < tail_angle) wiggle = acos(nose_angle);
+  else wiggle = acos(tail_angle);
+  return true;
+}
+
 void Blob::packOutline()
 {
   if (outline==NULL || dancer==NULL) return;
@@ -584,10 +663,86 @@ bool Blob::print(FILE* f,const char* prefix)
 }
 
 
+// Binary dump of whatever we still have, for checkpoints
+bool Blob::writeState(FILE* f) const
+{
+  bool has[5] = { stats!=NULL , im!=NULL , skeleton!=NULL , outline!=NULL , packedline!=NULL };
+  if (!dumpRaw(f,frame) || !dumpRaw(f,time) || !dumpRaw(f,pixel_count)) return false;
+  if (fwrite(has,sizeof(bool),5,f)!=5) return false;
+  if (has[0] && !stats->data.writeState(f)) return false;
+  if (has[1] && !im->writeState(f)) return false;
+  if (has[2] && !skeleton->data.writeState(f)) return false;
+  if (has[3] && !outline->data.writeState(f)) return false;
+  if (has[4] && !packedline->data.writeState(f)) return false;
+  return true;
+}
+
+// Read back what writeState wrote, using our dancer's storage just as if we'd found it all
+bool Blob::readState(FILE* f)
+{
+  bool has[5];
+  int n;
+  if (dancer==NULL) return false;
+  if (!undumpRaw(f,frame) || !undumpRaw(f,time) || !undumpRaw(f,n)) return false;
+  if (fread(has,sizeof(bool),5,f)!=5) return false;
+  if (has[0])
+  {
+    FloodData* fd = new( dancer->candidates.Append() ) FloodData();
+    dancer->candidates.end();
+    adoptCandidate();
+    if (!fd->readState(f)) return false;
+  }
+  pixel_count = n;
+  if (has[1] && (im = Image::readState(f))==NULL) return false;
+  if (has[2])
+  {
+    skeleton = dancer->contourstore.create(false);
+    new( &(skeleton->data) ) Contour( &(dancer->lpstore) );
+    if (!skeleton->data.readState(f)) return false;
+  }
+  if (has[3])
+  {
+    outline = dancer->contourstore.create(false);
+    new( &(outline->data) ) Contour( &(dancer->lpstore) );
+    if (!outline->data.readState(f)) return false;
+  }
+  if (has[4])
+  {
+    packedline = dancer->packedstore.create(false);
+    new( &(packedline->data) ) PackedContour();
+    if (!packedline->data.readState(f)) return false;
+  }
+  return true;
+}
+
+
 /****************************************************************
                          Dancer Methods
 ****************************************************************/
 
+// Storage comes from the performance's pools (n only matters without one), so making a dancer is cheap
+Dancer::Dancer(Performance *p,int n,bool bid,const DualRange& fI,const DualRange& fs,int b,int nkf,int nle,int id,int f,double t) :
+  performance(p) ,
+  blob_is_dark(bid) ,
+  fill_I(fI) , fill_size(fs) ,
+  border(b) , find_skel(false) , find_outline(false) , 
+  n_keep_full(nkf) , n_long_enough( (nle<2)?2:nle ) ,
+  data_fname(NULL) , img_namer(NULL) ,
+  floodstore( (p==NULL) ? NULL : &p->floodpool , n , true ) ,
+  lpstore( (p==NULL) ? NULL : &p->pointpool , 11*n , false ) ,
+  contourstore( (p==NULL) ? NULL : &p->contourpool , n , true ) ,
+  packedstore( (p==NULL) ? NULL : &p->packedpool , n , true ) ,
+  blobstore( (p==NULL) ? NULL : &p->blobpool , n , false ) ,
+  movie(&blobstore) , clear_til(NULL) , n_cleared(0) ,
+  candidates(&floodstore) ,
+  ID(id) , frames(f,f) , times(t,t) , 
+  last_speed(0.0) , last_speed_time(t) , last_angularspeed(0.0) ,
+  accumulated_length() , accumulated_width() , accumulated_aspect() ,
+  validated(false)
+{
+  movie.my_xtor = true;
+}
+
 Dancer::~Dancer()
 {
   // First, figure out whether we need to write any files, write them if so, and leave error messages if something went wrong
@@ -648,7 +803,7 @@ void Dancer::setFirst(Image *im,FloodData* fd,int frame,double time)
   
   // Make a local copy of flood data
   candidates.flush();
-  FloodData *new_fd = new( candidates.Append() ) FloodData(&lsstore);
+  FloodData *new_fd = new( candidates.Append() ) FloodData();
   new_fd->duplicate(*fd);
   candidates.start(); candidates.advance();
   
@@ -670,7 +825,7 @@ Blob* Dancer::makeFirst(int frame,double time)
   frames = Range(frame,frame);
   times = FRange(time,time);
   candidates.flush();
-  new( candidates.Append() ) FloodData(&lsstore);
+  new( candidates.Append() ) FloodData();
   candidates.start(); candidates.advance();
   resetMovie();
   Blob *new_b = new( movie.Append() ) Blob(frame,time);
@@ -738,7 +893,7 @@ bool Dancer::findAnother(bool best_guess,Mask* exclusion_mask)
     candidates.start();
     while (candidates.advance())
     {
-      ratio = movie.i().mask().overlapRatio(candidates.i().stencil);
+      ratio = movie.i().data().overlapRatio(candidates.i());
       candidates.i().score = sqrt(ratio.x*ratio.y);             // Geometric mean
       if (ratio.y < MIN_OVERLAP_RATIO) candidates.Backspace();  // New object doesn't overlap existing object enough
     }
@@ -763,6 +918,15 @@ void Dancer::validate()
 {
   if (validated) return;
   
+  measure();
+  movie.t().shapeStats();
+  tidyHistory();
+}
+
+
+// Compute the stats for the candidate we've settled on; writes nothing, so is safe on any thread
+void Dancer::measure()
+{
   validated = true;
   
   // Find extra stats--need previous frame to keep direction vectors aligned
@@ -783,8 +947,6 @@ void Dancer::validate()
     movie.Behead();
     frames.lo() = movie.h().frame;
   }
-  
-  tidyHistory();
 }
 
 
@@ -915,6 +1077,61 @@ bool Dancer::printData(FILE* f,const char* prefix)
 }
 
 
+// Binary dump of everything but the filenames (the performance makes those again)
+bool Dancer::writeState(FILE* f) const
+{
+  // Remember where we stopped tidying as a position in the movie
+  int clear_index = -1;
+  int j = 0;
+  Listable<Blob>* lb;
+  movie.start(lb);
+  while (clear_til!=NULL && movie.advance(lb))
+  {
+    if (lb==clear_til) { clear_index = j; break; }
+    j++;
+  }
+  
+  if (!dumpRaw(f,ID) || !dumpRaw(f,blob_is_dark) || !dumpRaw(f,fill_I) || !dumpRaw(f,fill_size) || !dumpRaw(f,border)) return false;
+  if (!dumpRaw(f,find_skel) || !dumpRaw(f,find_outline) || !dumpRaw(f,n_keep_full) || !dumpRaw(f,n_long_enough)) return false;
+  if (!dumpRaw(f,n_cleared) || !dumpRaw(f,clear_index) || !dumpRaw(f,frames) || !dumpRaw(f,times)) return false;
+  if (!dumpRaw(f,last_speed) || !dumpRaw(f,last_speed_time) || !dumpRaw(f,last_angularspeed)) return false;
+  if (!dumpRaw(f,accumulated_length) || !dumpRaw(f,accumulated_width) || !dumpRaw(f,accumulated_aspect) || !dumpRaw(f,validated)) return false;
+  
+  if (!dumpRaw(f,movie.size)) return false;
+  movie.start(lb);
+  while (movie.advance(lb))
+  {
+    if (!lb->data.writeState(f)) return false;
+  }
+  return true;
+}
+
+// Read back what writeState wrote
+bool Dancer::readState(FILE* f)
+{
+  int clear_index,n,j;
+  
+  resetMovie();
+  if (!undumpRaw(f,ID) || !undumpRaw(f,blob_is_dark) || !undumpRaw(f,fill_I) || !undumpRaw(f,fill_size) || !undumpRaw(f,border)) return false;
+  if (!undumpRaw(f,find_skel) || !undumpRaw(f,find_outline) || !undumpRaw(f,n_keep_full) || !undumpRaw(f,n_long_enough)) return false;
+  if (!undumpRaw(f,n_cleared) || !undumpRaw(f,clear_index) || !undumpRaw(f,frames) || !undumpRaw(f,times)) return false;
+  if (!undumpRaw(f,last_speed) || !undumpRaw(f,last_speed_time) || !undumpRaw(f,last_angularspeed)) return false;
+  if (!undumpRaw(f,accumulated_length) || !undumpRaw(f,accumulated_width) || !undumpRaw(f,accumulated_aspect) || !undumpRaw(f,validated)) return false;
+  
+  if (!undumpRaw(f,n) || n<0 || clear_index>=n) return false;
+  for (j=0 ; j<n ; j++)
+  {
+    Blob* b = new( movie.Append() ) Blob();
+    b->dancer = this;
+    if (!b->readState(f)) return false;
+  }
+  
+  movie.start(clear_til);
+  for (j=0 ; j<=clear_index ; j++) movie.advance(clear_til);
+  return true;
+}
+
+
 // Report velocity since the last time we were asked
 float Dancer::recentSpeed(float min_interval)
 {
@@ -947,6 +1164,422 @@ float Dancer::recentSpeed(float min_interval)
 
 
 
+/****************************************************************
+                       DancerCrew Methods
+****************************************************************/
+
+DancerCrew::DancerCrew(int n) :
+  n_threads( (n<1) ? 1 : n ) , task(NULL) , task_room(0) , shares(NULL) ,
+  stage(ready_stage) , fg(NULL) , frame(0) , time(0.0)
+{
+#ifdef MWT_NO_THREADS
+  n_threads = 1;
+#else
+  n_started = 0;
+  generation = 0;
+  n_busy = 0;
+  quitting = false;
+  later_stage = shape_stage;
+  later_task = NULL;
+  later_n = later_next = later_left = 0;
+  pthread_mutex_init(&lock,NULL);
+  pthread_cond_init(&go,NULL);
+  pthread_cond_init(&done,NULL);
+  threads = new pthread_t[n_threads];
+  share_locks = new pthread_mutex_t[n_threads];
+  for (int j=0;j<n_threads;j++) pthread_mutex_init(&share_locks[j],NULL);
+  
+  // The caller is thread 0; if we can't start as many as asked for, make do with fewer
+  int j;
+  for (j=1;j<n_threads;j++)
+  {
+    if (pthread_create(&threads[j],NULL,threadEntry,this)!=0) break;
+  }
+  n_threads = j;
+#endif
+  shares = new Share[n_threads];
+}
+
+DancerCrew::~DancerCrew()
+{
+  finish();
+#ifndef MWT_NO_THREADS
+  pthread_mutex_lock(&lock);
+  quitting = true;
+  pthread_cond_broadcast(&go);
+  pthread_mutex_unlock(&lock);
+  for (int j=1;j<n_threads;j++) pthread_join(threads[j],NULL);
+  for (int j=0;j<n_threads;j++) pthread_mutex_destroy(&share_locks[j]);
+  delete[] share_locks;
+  delete[] threads;
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&go);
+  pthread_mutex_destroy(&lock);
+#endif
+  delete[] shares;
+  if (task!=NULL) delete[] task;
+}
+
+DancerTask* DancerCrew::tasks(int n)
+{
+  if (n > task_room)
+  {
+    if (task!=NULL) delete[] task;
+    task_room = (n<16) ? 16 : n + n/2;
+    task = new DancerTask[task_room];
+  }
+  return task;
+}
+
+// Do the first n tasks; returns once they are all done
+void DancerCrew::run(Stage s,int n,Image* f,int fr,double t)
+{
+  stage = s;
+  fg = f;
+  frame = fr;
+  time = t;
+  
+  if (n_threads<2 || n<2)
+  {
+    for (int k=0;k<n;k++) perform(s,task[k]);
+    return;
+  }
+  
+#ifndef MWT_NO_THREADS
+  // Everyone starts with a run of neighbouring dancers
+  for (int j=0;j<n_threads;j++)
+  {
+    shares[j].lo = (int)( ((long long)n*j)/n_threads );
+    shares[j].hi = (int)( ((long long)n*(j+1))/n_threads );
+  }
+  
+  pthread_mutex_lock(&lock);
+  generation++;
+  n_busy = n_threads-1;
+  pthread_cond_broadcast(&go);
+  pthread_mutex_unlock(&lock);
+  
+  work(0);
+  
+  pthread_mutex_lock(&lock);
+  while (n_busy>0) pthread_cond_wait(&done,&lock);
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+// Hand over a batch for idle threads to work through; only one batch at a time, so finish() the last one first
+void DancerCrew::start(Stage s,DancerTask* t,int n)
+{
+#ifndef MWT_NO_THREADS
+  if (n_threads>=2 && n>=2)
+  {
+    pthread_mutex_lock(&lock);
+    later_stage = s;
+    later_task = t;
+    later_n = later_left = n;
+    later_next = 0;
+    pthread_cond_broadcast(&go);
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+#endif
+  for (int k=0;k<n;k++) perform(s,t[k]);
+}
+
+// Do whatever nobody has taken from the background batch yet, then wait for the rest
+void DancerCrew::finish()
+{
+#ifndef MWT_NO_THREADS
+  int k;
+  while (takeLater(k))
+  {
+    perform(later_stage,later_task[k]);
+    pthread_mutex_lock(&lock);
+    later_left--;
+    pthread_mutex_unlock(&lock);
+  }
+  pthread_mutex_lock(&lock);
+  while (later_left>0) pthread_cond_wait(&done,&lock);
+  later_n = later_next = 0;
+  later_task = NULL;
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+// Take a task from our own share, or else steal one from the end of someone else's
+bool DancerCrew::take(int me,int& k)
+{
+#ifndef MWT_NO_THREADS
+  for (int j=0;j<n_threads;j++)
+  {
+    int v = (me+j) % n_threads;
+    Share& sh = shares[v];
+    pthread_mutex_lock(&share_locks[v]);
+    bool got = (sh.lo < sh.hi);
+    if (got) k = (j==0) ? sh.lo++ : --sh.hi;
+    pthread_mutex_unlock(&share_locks[v]);
+    if (got) return true;
+  }
+#endif
+  return false;
+}
+
+void DancerCrew::work(int me)
+{
+  int k;
+  while (take(me,k)) perform(stage,task[k]);
+}
+
+void DancerCrew::perform(Stage s,DancerTask& t)
+{
+  switch (s)
+  {
+    case ready_stage:
+      t.dancer->readyAnother(fg,t.bg,frame,time);
+      break;
+    case find_stage:
+      t.found = t.dancer->findAnother(t.best_guess,t.exclusion_mask);
+      break;
+    case measure_stage:
+      t.dancer->measure();
+      break;
+    case shape_stage:
+      if (t.blob!=NULL) t.blob->shapeStats();
+      break;
+  }
+}
+
+#ifndef MWT_NO_THREADS
+bool DancerCrew::takeLater(int& k)
+{
+  pthread_mutex_lock(&lock);
+  bool got = (later_next < later_n);
+  if (got) k = later_next++;
+  pthread_mutex_unlock(&lock);
+  return got;
+}
+
+// A run comes before the background batch, since the caller is waiting on it
+void DancerCrew::threadLoop()
+{
+  pthread_mutex_lock(&lock);
+  int me = ++n_started;
+  int seen = 0;  // Not generation: a run may have started before we got here
+  for (;;)
+  {
+    while (generation==seen && later_next==later_n && !quitting) pthread_cond_wait(&go,&lock);
+    if (quitting) break;
+    if (generation!=seen)
+    {
+      seen = generation;
+      pthread_mutex_unlock(&lock);
+      
+      work(me);
+      
+      pthread_mutex_lock(&lock);
+      n_busy--;
+      if (n_busy==0) pthread_cond_broadcast(&done);
+    }
+    else
+    {
+      Stage s = later_stage;
+      DancerTask& t = later_task[later_next++];
+      pthread_mutex_unlock(&lock);
+      
+      perform(s,t);
+      
+      pthread_mutex_lock(&lock);
+      later_left--;
+      if (later_left==0) pthread_cond_broadcast(&done);
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void* DancerCrew::threadEntry(void* crew)
+{
+  ((DancerCrew*)crew)->threadLoop();
+  return NULL;
+}
+#endif
+
+
+
+/****************************************************************
+                       DancerGrid Methods
+****************************************************************/
+
+DancerGrid::~DancerGrid()
+{
+  if (head!=NULL) { delete[] head; head=NULL; }
+  if (entries!=NULL) { delete[] entries; entries=NULL; }
+  if (items!=NULL) { delete[] items; items=NULL; }
+  if (hits!=NULL) { delete[] hits; hits=NULL; }
+}
+
+void DancerGrid::reset(const Rectangle& a,int n)
+{
+  arena = a;
+  cols = (arena.width() + CELL_SIZE - 1)/CELL_SIZE;
+  rows = (arena.height() + CELL_SIZE - 1)/CELL_SIZE;
+  if (cols<1) cols = 1;
+  if (rows<1) rows = 1;
+  if (cols*rows > cell_room)
+  {
+    if (head!=NULL) delete[] head;
+    cell_room = cols*rows;
+    head = new int[cell_room];
+  }
+  for (int c=0 ; c<cols*rows ; c++) head[c] = -1;
+
+  if (n > item_room)
+  {
+    if (items!=NULL) delete[] items;
+    item_room = (n<16) ? 16 : n + n/2;
+    items = new Item[item_room];
+  }
+  n_items = 0;
+  n_entries = 0;
+  n_hits = 0;
+  query = 0;
+}
+
+int DancerGrid::add(const Rectangle& r,Listable<Dancer>* ld)
+{
+  int k,x,y,x0,x1,y0,y1;
+
+  if (n_items >= item_room)
+  {
+    Item* old = items;
+    item_room = (item_room<16) ? 16 : item_room*2;
+    items = new Item[item_room];
+    for (k=0 ; k<n_items ; k++) items[k] = old[k];
+    if (old!=NULL) delete[] old;
+  }
+  k = n_items++;
+  items[k].r = r;
+  items[k].node = ld;
+  items[k].gone = false;
+  items[k].mark = 0;
+
+  x0 = cellX(r.near.x); x1 = cellX(r.far.x);
+  y0 = cellY(r.near.y); y1 = cellY(r.far.y);
+  if (n_entries + (1+x1-x0)*(1+y1-y0) > entry_room)
+  {
+    Entry* old = entries;
+    entry_room = n_entries + (1+x1-x0)*(1+y1-y0);
+    entry_room = (entry_room<64) ? 64 : entry_room*2;
+    entries = new Entry[entry_room];
+    for (x=0 ; x<n_entries ; x++) entries[x] = old[x];
+    if (old!=NULL) delete[] old;
+  }
+  for (y=y0 ; y<=y1 ; y++) for (x=x0 ; x<=x1 ; x++)
+  {
+    entries[n_entries].item = k;
+    entries[n_entries].next = head[y*cols+x];
+    head[y*cols+x] = n_entries++;
+  }
+  return k;
+}
+
+int DancerGrid::find(const Rectangle& r,int after)
+{
+  int e,h,k,x,y,x0,x1,y0,y1;
+
+  query++;
+  n_hits = 0;
+  x0 = cellX(r.near.x); x1 = cellX(r.far.x);
+  y0 = cellY(r.near.y); y1 = cellY(r.far.y);
+  for (y=y0 ; y<=y1 ; y++) for (x=x0 ; x<=x1 ; x++)
+  {
+    for (e=head[y*cols+x] ; e>=0 ; e=entries[e].next)
+    {
+      k = entries[e].item;
+      if (k<=after || items[k].gone || items[k].mark==query) continue;
+      items[k].mark = query;  // Big ones sit in several cells
+      if (!items[k].r.overlaps(r)) continue;
+      if (n_hits >= hit_room)
+      {
+        int* old = hits;
+        hit_room = (hit_room<16) ? 16 : hit_room*2;
+        hits = new int[hit_room];
+        for (h=0 ; h<n_hits ; h++) hits[h] = old[h];
+        if (old!=NULL) delete[] old;
+      }
+      // Keep them in order as we go; there are only ever a few
+      for (h=n_hits++ ; h>0 && hits[h-1]>k ; h--) hits[h] = hits[h-1];
+      hits[h] = k;
+    }
+  }
+  return n_hits;
+}
+
+
+
+/****************************************************************
+                       DancerIndex Methods
+****************************************************************/
+
+DancerIndex::~DancerIndex()
+{
+  if (slots!=NULL) { delete[] slots; slots=NULL; }
+  if (table!=NULL) { delete[] table; table=NULL; }
+}
+
+void DancerIndex::rebuild(ManagedList<Dancer>& dancers)
+{
+  Listable<Dancer>* ld;
+  int k,h;
+  
+  if (dancers.size > slot_room)
+  {
+    if (slots!=NULL) delete[] slots;
+    slot_room = (dancers.size<16) ? 16 : dancers.size + dancers.size/2;
+    slots = new Slot[slot_room];
+  }
+  if (2*dancers.size > table_size || table==NULL)
+  {
+    if (table!=NULL) delete[] table;
+    for (table_size=32 ; table_size < 2*slot_room ; table_size *= 2) { }
+    table = new int[table_size];
+  }
+  for (h=0 ; h<table_size ; h++) table[h] = -1;
+  
+  n_slots = 0;
+  dancers.start(ld);
+  while (dancers.advance(ld))
+  {
+    k = n_slots++;
+    slots[k].ID = ld->data.ID;
+    slots[k].node = ld;
+    if (ld->data.movie.size>0 && ld->data.movie.t().stats!=NULL)
+    {
+      slots[k].bounds = ld->data.movie.t().data().stencil.bounds;
+      slots[k].centroid = ld->data.movie.t().data().centroid;
+    }
+    else
+    {
+      slots[k].bounds = Rectangle(0,0,0,0);
+      slots[k].centroid = FPoint(0.0,0.0);
+    }
+    for (h=ld->data.ID & (table_size-1) ; table[h]>=0 ; h=(h+1)&(table_size-1)) { }
+    table[h] = k;
+  }
+  stale = false;
+}
+
+int DancerIndex::find(int id) const
+{
+  if (table==NULL) return -1;
+  for (int h=id & (table_size-1) ; table[h]>=0 ; h=(h+1)&(table_size-1))
+  {
+    if (slots[table[h]].ID==id) return table[h];
+  }
+  return -1;
+}
+
+
+
 /****************************************************************
                        Performance Methods
 ****************************************************************/
@@ -954,6 +1587,7 @@ float Dancer::recentSpeed(float min_interval)
 // Clean up everything we may have allocated
 Performance::~Performance()
 {
+  finishTail();
   if( combine_blobs ) {
     if( output_file != NULL ) {
       fclose(output_file);
@@ -967,6 +1601,8 @@ Performance::~Performance()
   dancers.flush();
   
   // Now toss everything we may explicitly have allocated
+  if (crew!=NULL) { delete crew; crew=NULL; }
+  if (tail!=NULL) { delete[] tail; tail=NULL; }
   if (date!=NULL) { delete date; date=NULL; }
   if (foreground!=NULL) { delete foreground; foreground=NULL; }
   if (background!=NULL) { delete background; background=NULL; }
@@ -974,6 +1610,7 @@ Performance::~Performance()
   if (danger_zone!=NULL) { delete danger_zone; danger_zone=NULL; }
   if (band!=NULL) { delete band; band=NULL; }
   if (band_area!=NULL) { delete band_area; band_area=NULL; }
+  if (band_cover!=NULL) { delete band_cover; band_cover=NULL; }
   if (dance_fname!=NULL) { delete dance_fname; dance_fname=NULL; }
 	if (blobs_fname!=NULL) { delete blobs_fname; blobs_fname=NULL; }
   if (sit_fname!=NULL) { delete sit_fname; sit_fname=NULL; }
@@ -1029,7 +1666,7 @@ void Performance::setROI(const Rectangle& r)
   if( background != NULL ) { delete background; background = NULL; }
   if (full_area!=NULL) delete full_area;
   if (danger_zone!=NULL) { delete danger_zone; danger_zone=NULL; }
-  full_area = new Mask(r , &lsstore);
+  full_area = new Mask(r);
   full_area->findBounds();
 }
 void Performance::setROI(const Ellipse& e)
@@ -1038,7 +1675,7 @@ void Performance::setROI(const Ellipse& e)
   if( background != NULL ) { delete background; background = NULL; }
   if (full_area!=NULL) delete full_area;
   if (danger_zone!=NULL) { delete danger_zone; danger_zone=NULL; }
-  full_area = new Mask(e, &lsstore);
+  full_area = new Mask(e);
   full_area->findBounds();
 }
 void Performance::setROI(Mask &m)
@@ -1047,7 +1684,7 @@ void Performance::setROI(Mask &m)
   if( background != NULL ) { delete background; background = NULL; }
   if (full_area!=NULL) delete full_area;
   if (danger_zone!=NULL) { delete danger_zone; danger_zone=NULL; }
-  full_area = new Mask(&lsstore);
+  full_area = new Mask;
   full_area->imitate(m);
   full_area->findBounds();
 }
@@ -1059,7 +1696,7 @@ void Performance::setNotInROI(Image *im)
   if (danger_zone==NULL || !danger_zone->bounds.contains( im->getBounds() ))
   {
     if (danger_zone!=NULL) danger_zone->flush();
-    else danger_zone = new Mask(&lsstore);
+    else danger_zone = new Mask;
     danger_zone->imitate(*full_area);
     Rectangle r = im->getBounds();
     r.include( full_area->bounds );
@@ -1077,7 +1714,7 @@ int Performance::scanImage(Image *im)
 {
   // Flood fill all possible candidates
   if (candidates.size>0) candidates.flush();
-  im->floodMask( fill_I , &ssstore , &lsstore , candidates , (*full_area) );  // Be sure to recover FloodData items!
+  im->floodMask( fill_I , candidates , (*full_area) );  // Be sure to recover FloodData items!
   if (candidates.size==0) return 0;
 
   // Throw away everything that's not the right size or overlaps the border
@@ -1101,6 +1738,7 @@ void Performance::adoptScan(Image* im)
   
   Dancer* d;
   
+  roster.stale = true;
   candidates.start();
   while (candidates.advance())
   {
@@ -1123,8 +1761,10 @@ int Performance::initialScan(Image *fg,double time)
   next_dancer_ID = 1;
   
   // If we found anything last time, better clean it up.
+  finishTail();
   if (dancers.size>0)  dancers.flush();
-  if (full_area==NULL) full_area = new Mask( fg->getBounds() , &lsstore );
+  roster.stale = true;
+  if (full_area==NULL) full_area = new Mask( fg->getBounds() );
   else mask_was_set = true;
   if (background==NULL)  // First try ever--need to set up background image and exclusion zone
   {
@@ -1166,7 +1806,8 @@ int Performance::initialScan(Image *fg,double time)
      *       is that this function is based off an image which may or may not exist when the binning change function is called.
      */
     setNotInROI(foreground);
-    foreground->diffAdaptCopy( (*fg) , (*full_area) , (*background) , adapt_rate );
+    if (static_background) foreground->diffCopy( (*fg) , (*full_area) , (*background) );
+    else foreground->diffAdaptCopy( (*fg) , (*full_area) , (*background) , adapt_rate );
     
     n = scanImage(foreground);
     if (n==0) return 0;
@@ -1176,6 +1817,19 @@ int Performance::initialScan(Image *fg,double time)
 }
 
 
+// Replace the background with an image of the scene (e.g. one computed elsewhere); the image
+// is at foreground depth and gets shifted up to background depth.  Only the part of the
+// background that bg covers is changed.  Returns false if there is no background yet.
+bool Performance::loadBackground(Image *bg)
+{
+  if (background==NULL) return false;
+  Rectangle r = background->getBounds() * bg->getBounds();
+  if (r.width()<1 || r.height()<1) return true;
+  background->copy( r.near , *bg , r.size() , true );
+  return true;
+}
+
+
 // Find reference objects initially
 // Removes any points that get filled--make a copy if you want to preserve point list!
 // Returns the number of points successfully filled
@@ -1194,7 +1848,7 @@ int Performance::initialRefs(Image* fg,ManagedList<Point>& locations,double time
   while (locations.advance())
   {
     if (!fg->getBounds().contains(locations.i())) continue;
-    if (fd==NULL) fd = new( candidates.Append() ) FloodData(&lsstore);
+    if (fd==NULL) fd = new( candidates.Append() ) FloodData();
     i = fg->floodFind( locations.i() , ref_I , &ssstore , fd );
     if (!ref_size.start.excludes(i))
     {
@@ -1273,7 +1927,7 @@ bool Performance::findNextItemBounds(Rectangle& im_bound)
         // Now find the position of these bands
         int i,j,x0,x1,y0,y1;
         j = n_scan_bands*2 + 1;  // Regular bands plus half-overlapping bands
-        i = (current_frame*4) % j; // Go up in uneven pattern--4 is relatively prime to odd numbers, so this covers everyone
+        i = ((current_frame+band_phase)*4) % j; // Go up in uneven pattern--4 is relatively prime to odd numbers, so this covers everyone
         x0 = (i-1)*band_cols/2 + r.near.x;
         x1 = x0 + band_cols - 1;
         if (x0 < r.near.x) x0 = r.near.x;
@@ -1293,8 +1947,24 @@ bool Performance::findNextItemBounds(Rectangle& im_bound)
           y1 = full_area->i().y1;
           band_area->addStrip(full_area->i().x,y0,y1);
         }
+        // Only worms that reach into the band count, and they all come out in one pass
+        if (band_cover==NULL) band_cover = new Mask(band_cols*2);
+        else band_cover->flush();
         dancers.start();
-        while(dancers.advance()) { *band_area -= dancers.i().movie.t().im->getBounds(); } 
+        while (dancers.advance())
+        {
+          Rectangle wr = dancers.i().movie.t().im->getBounds();
+          if (wr.far.x < x0 || wr.near.x > x1) continue;
+          if (wr.near.x < x0) wr.near.x = x0;
+          if (wr.far.x > x1) wr.far.x = x1;
+          for (int x=wr.near.x ; x<=wr.far.x ; x++) band_cover->addStrip(x,wr.near.y,wr.far.y);
+        }
+        if (band_cover->lines.size>0)
+        {
+          band_cover->sort();
+          band_cover->tidy();
+          *band_area -= *band_cover;
+        }
 
         // Make the band the right size--ready to load image data
         if (band!=NULL)
@@ -1355,7 +2025,8 @@ void Performance::loadNextSingleItem(Image* fg)
       // We already prepared the image when we checked it, so we just need to load it
       band->depth = fg->depth+1;
       *band = 1 << (band->depth-1);  // Initialize to gray
-      band->diffAdaptCopy(*fg,*band_area,*background,adapt_rate);
+      if (static_background) band->diffCopy(*fg,*band_area,*background);
+      else band->diffAdaptCopy(*fg,*band_area,*background,adapt_rate);
       load_state = all_loaded;
       break;
     case all_loaded:
@@ -1365,11 +2036,43 @@ void Performance::loadNextSingleItem(Image* fg)
 }
   
 
+// The crew to share out per-dancer work, or NULL if we're working alone or there's too little to share
+DancerCrew* Performance::crewFor(int n_tasks)
+{
+  if (n_threads<2 || n_tasks<2) return NULL;
+  if (crew==NULL) crew = new DancerCrew(n_threads);
+  return crew;
+}
+
+
+// Whether the crew already did dancer d's task (the next one, since tasks are in list order)
+static inline bool crewDid(DancerTask* tasks,int n_tasks,int& k,Dancer& d)
+{
+  if (k<n_tasks && tasks[k].dancer==&d) { k++; return true; }
+  return false;
+}
+
+
 // Load data into appropriate images--use the one-item-at-a-time routines above
 void Performance::readyNext(Image* fg,double time)
 {
   anticipateNext(time);
   
+  // Each sitter and dancer clips out its own piece, so the crew can do those; then only the band is left
+  DancerCrew* c = crewFor(sitters.size + dancers.size);
+  if (c!=NULL)
+  {
+    DancerTask* t = c->tasks(sitters.size + dancers.size);
+    int n = 0;
+    sitters.start();
+    while (sitters.advance()) t[n++] = DancerTask(&sitters.i(),NULL,NULL,true);
+    dancers.start();
+    while (dancers.advance()) t[n++] = DancerTask(&dancers.i(),background,NULL,false);
+    c->run(DancerCrew::ready_stage,n,fg,current_frame,current_time);
+    sitters.end();
+    dancers.end();
+  }
+  
   Rectangle single_bound;
   while (findNextItemBounds(single_bound))
   {
@@ -1385,12 +2088,32 @@ int Performance::findNext()
 {
   bool found;
   Dancer* d;  
+  DancerTask* t = NULL;
+  int n_tasks = 0;
+  int k = 0;
+  
+  roster.stale = true;
+  
+  // Everyone looks for themselves first; the crew can do that, leaving what to do about it in order below
+  DancerCrew* c = crewFor(sitters.size + dancers.size);
+  if (c!=NULL)
+  {
+    t = c->tasks(sitters.size + dancers.size);
+    sitters.start();
+    while (sitters.advance()) t[n_tasks++] = DancerTask(&sitters.i(),NULL,NULL,true);
+    dancers.start();
+    while (dancers.advance()) t[n_tasks++] = DancerTask(&dancers.i(),NULL,danger_zone,false);
+    c->run(DancerCrew::find_stage,n_tasks,NULL,current_frame,current_time);
+  }
+  
+  // The last frame's outlines had until now; from here on dancers may be thrown away or printed
+  finishTail();
   
   // First get reference objects
   sitters.start();
   while(sitters.advance())
   {
-    found = sitters.i().findAnother(true,NULL);
+    found = (crewDid(t,n_tasks,k,sitters.i())) ? t[k-1].found : sitters.i().findAnother(true,NULL);
     if (found) sitters.i().validate();
     else sitters.i().invalidate();
     if (sit_fname!=NULL && current_frame<3) enableOutput(sitters.i(),true); // Only enable at beginning since we never lose these
@@ -1400,7 +2123,7 @@ int Performance::findNext()
   dancers.start();
   while (dancers.advance())
   {
-    found = dancers.i().findAnother(false,danger_zone);
+    found = (crewDid(t,n_tasks,k,dancers.i())) ? t[k-1].found : dancers.i().findAnother(false,danger_zone);
     if (!found)
     {
       if (dancers.i().candidates.size==0)  // Lost blob
@@ -1433,7 +2156,7 @@ int Performance::findNext()
   }
   // Then get new objects from strip
   if (candidates.size>0) candidates.flush();
-  band->floodMask( fill_I , &ssstore , &lsstore , candidates , (*band_area) );
+  band->floodMask( fill_I , candidates , (*band_area) );
   candidates.start();
   while (candidates.advance())
   {
@@ -1453,19 +2176,23 @@ int Performance::findNext()
   Blob *b;
   Rectangle r;
   Image *im;
-  if (dancers.size>1) dancers.mergeSort();
+  int j,h,n;
+  if (dancers.size>1) dancers.insertionSort();  // Order hardly changes between frames
+  collisions.reset(background->getBounds(),dancers.size);
   dancers.start();
-  while (dancers.advance())
+  while (dancers.advance()) collisions.add(dancers.i().movie.t().stats->data.stencil.bounds,dancers.current);
+  for (j=0 ; j<collisions.size() ; j++)
   {
+    if (collisions.gone(j)) continue;
+    dancers.current = collisions.node(j);
     fd = &dancers.i().movie.t().stats->data;
-    ld = dancers.current;
-    while (dancers.advance(ld))
+    n = collisions.find(fd->stencil.bounds,j);
+    for (h=0 ; h<n ; h++)
     {
-      // See if the two blobs overlap
+      // See if the two blobs overlap (the grid only checked their bounds)
+      ld = collisions.node(collisions.hit(h));
       fd2 = &ld->data.movie.t().stats->data;
-      if (fd->stencil.bounds.far.x < fd2->stencil.bounds.near.x) break;
-      if (!fd->stencil.bounds.overlaps(fd2->stencil.bounds)) continue;
-      if (!fd->stencil.overlaps(fd2->stencil,Point(0,0))) continue;
+      if (!fd->overlaps(*fd2)) continue;
       
       // They do overlap--create merged dancer
       d = new( dancers.Tuck() ) Dancer(this,dance_buf_size,blob_is_dark,fill_I,fill_size,border,n_keep_full,n_long_enough,
@@ -1497,25 +2224,101 @@ int Performance::findNext()
       fates.Append( BlobOriginFate(current_frame,ld->data.ID,d->ID) );
       dancers.i().movie.Truncate();
       ld->data.movie.Truncate();
+      collisions.remove(collisions.hit(h));
       dancers.Destroy(ld);    // Remove 2nd dancer
       dancers.Backspace();   // Current is now our new blob (since we tucked it)
+      collisions.node(j) = dancers.current;
       fd = &dancers.i().movie.t().stats->data;  // Update flood data
-      ld = dancers.current;                     // Start over again
+      n = collisions.find(fd->stencil.bounds,j);  // Start over again with what the bigger blob touches
+      h = -1;
     }
   }
-  // Finally, validate our new list and set up output
+  // Finally, validate our new list and set up output (the crew can measure the new blobs first)
+  // Outlines and skeletons are left for startTail, since nothing here needs them
+  n_tasks = 0;
+  k = 0;
+  c = crewFor(dancers.size);
+  if (c!=NULL) t = c->tasks(dancers.size);
   dancers.start();
   while (dancers.advance())
   {
     if (dancers.i().frames.lo()==0) fates.Append( BlobOriginFate(current_frame,0,dancers.i().ID) );
-    dancers.i().validate();
-    if (dance_fname!=NULL || img_fname!=NULL) enableOutput(dancers.i());
+    if (c!=NULL && !dancers.i().validated) t[n_tasks++] = DancerTask(&dancers.i(),NULL,NULL,false);
+  }
+  if (c!=NULL) c->run(DancerCrew::measure_stage,n_tasks,NULL,current_frame,current_time);
+  if (dancers.size > tail_room)
+  {
+    if (tail!=NULL) delete[] tail;
+    tail_room = (dancers.size<16) ? 16 : dancers.size + dancers.size/2;
+    tail = new DancerTask[tail_room];
+  }
+  tail_size = 0;
+  dancers.start();
+  while (dancers.advance())
+  {
+    d = &dancers.i();
+    if (crewDid(t,n_tasks,k,*d) || !d->validated)
+    {
+      if (!d->validated) d->measure();
+      d->tidyHistory();  // Only ever clears the newest blob if n_keep_full is 0, and then there's nothing left to outline anyway
+      tail[tail_size++] = DancerTask( d , &(d->movie.t()) , d->n_long_enough <= d->frames.length() );
+    }
+    if (dance_fname!=NULL || img_fname!=NULL) enableOutput(*d);
   }
   
+  startTail();
   return dancers.size;
 }
 
 
+// Find outlines and skeletons for the blobs measured this frame; the crew does that in the background
+// while the next frame is loaded and searched, and without a crew it's done right away
+void Performance::startTail()
+{
+  tail_wiggle = report_wiggle;
+  report_wiggle = NULL;
+  tail_pending = true;
+  
+  DancerCrew* c = crewFor(tail_size);
+  if (c!=NULL) c->start(DancerCrew::shape_stage,tail,tail_size);
+  else
+  {
+    for (int k=0;k<tail_size;k++) tail[k].blob->shapeStats();
+    finishTail();
+  }
+}
+
+
+// The dancer with this ID, or NULL if there's none (rebuilds the roster first if the list has changed)
+Dancer* Performance::findDancer(int id)
+{
+  if (roster.stale) roster.rebuild(dancers);
+  int k = roster.find(id);
+  return (k<0) ? NULL : &(roster[k].node->data);
+}
+
+// Wait for startTail's outlines and skeletons to be done, then report the end wiggle from them
+void Performance::finishTail()
+{
+  if (!tail_pending) return;
+  tail_pending = false;
+  if (crew!=NULL) crew->finish();
+  
+  if (tail_wiggle!=NULL)
+  {
+    Datum wiggle;
+    float w;
+    for (int k=0;k<tail_size;k++)
+    {
+      if (tail[k].counted && tail[k].blob->endWiggle(w)) wiggle.add(w);
+    }
+    *tail_wiggle = wiggle.mean();
+    tail_wiggle = NULL;
+  }
+  tail_size = 0;
+}
+
+
 double Performance::generateBackgroundAverageIntensity( int *array ) 
 {
 	int lim = 0;
@@ -1708,16 +2511,171 @@ bool Performance::prepareOutput(const char *path,const char *prefix,bool save_da
 // Write out any dangling output--for now, just delete all the dancers and the destructor will do the rest.
 bool Performance::finishOutput()
 {
+  finishTail();
   sitters.flush();
   dancers.flush();
+  roster.stale = true;
   return true;
 }
 
 
+// Binary dump of the tracking state, for checkpoints; only makes sense between frames
+bool Performance::writeState(FILE* f)
+{
+  finishTail();
+  long byte_offset = -1;
+  if (output_file!=NULL)
+  {
+    fflush(output_file);
+    byte_offset = ftell(output_file);
+  }
+  if (!dumpRaw(f,byte_offset) || !dumpRaw(f,last_blobs_fid) || !dumpRaw(f,output_count)) return false;
+  if (!dumpRaw(f,next_dancer_ID) || !dumpRaw(f,current_frame) || !dumpRaw(f,current_time) || !dumpRaw(f,load_state)) return false;
+  
+  bool has[4] = { background!=NULL , foreground!=NULL , full_area!=NULL , danger_zone!=NULL };
+  if (fwrite(has,sizeof(bool),4,f)!=4) return false;
+  if (has[0] && !background->writeState(f)) return false;
+  if (has[1] && !foreground->writeState(f)) return false;
+  if (has[2] && !full_area->writeState(f)) return false;
+  if (has[3] && !danger_zone->writeState(f)) return false;
+  
+  if (!dumpRawList(f,fates) || !dumpRawList(f,output_fates)) return false;
+  
+  Listable<Dancer>* ld;
+  if (!dumpRaw(f,sitters.size)) return false;
+  sitters.start(ld);
+  while (sitters.advance(ld)) { if (!ld->data.writeState(f)) return false; }
+  if (!dumpRaw(f,dancers.size)) return false;
+  dancers.start(ld);
+  while (dancers.advance(ld)) { if (!ld->data.writeState(f)) return false; }
+  
+  return true;
+}
+
+// Pick up where writeState left off.  We must have prepared output with the same settings (and date),
+// and not have found anything yet.  If it fails, we forget everything we read without writing anything out.
+bool Performance::readState(FILE* f)
+{
+  long byte_offset;
+  int i,n;
+  bool good = true;
+  Dancer* d;
+  
+  finishTail();
+  
+  if (dancers.size>0 || sitters.size>0) return false;
+  
+  if (!undumpRaw(f,byte_offset) || !undumpRaw(f,last_blobs_fid) || !undumpRaw(f,output_count)) return false;
+  if (!undumpRaw(f,next_dancer_ID) || !undumpRaw(f,current_frame) || !undumpRaw(f,current_time) || !undumpRaw(f,load_state)) return false;
+  
+  bool has[4];
+  if (fread(has,sizeof(bool),4,f)!=4) return false;
+  if (background!=NULL) { delete background; background=NULL; }
+  if (foreground!=NULL) { delete foreground; foreground=NULL; }
+  if (has[0] && (background = Image::readState(f))==NULL) return false;
+  if (has[1] && (foreground = Image::readState(f))==NULL) return false;
+  if (full_area!=NULL) full_area->flush();
+  else if (has[2]) full_area = new Mask;
+  if (has[2] && !full_area->readState(f)) return false;
+  if (danger_zone!=NULL) { delete danger_zone; danger_zone=NULL; }
+  if (has[3])
+  {
+    danger_zone = new Mask;
+    if (!danger_zone->readState(f)) return false;
+  }
+  
+  fates.flush();
+  output_fates.flush();
+  if (!undumpRawList(f,fates) || !undumpRawList(f,output_fates)) return false;
+  
+  good = undumpRaw(f,n) && n>=0;
+  for (i=0 ; good && i<n ; i++)
+  {
+    d = new( sitters.Append() ) Dancer(this,dance_buf_size,true,ref_I,fill_size,border,2,2,0,0,0.0);
+    good = d->readState(f);
+    if (good) enableOutput(*d,true);
+  }
+  if (good) good = undumpRaw(f,n) && n>=0;
+  roster.stale = true;
+  for (i=0 ; good && i<n ; i++)
+  {
+    d = new( dancers.Append() ) Dancer(this,dance_buf_size,blob_is_dark,fill_I,fill_size,border,n_keep_full,n_long_enough,0,0,0.0);
+    good = d->readState(f);
+    if (good) enableOutput(*d);
+  }
+  if (good) good = resumeOutput(byte_offset);
+  
+  if (!good)
+  {
+    // Dancers without a performance don't write themselves out when they go
+    sitters.start();
+    while (sitters.advance()) sitters.i().performance = NULL;
+    dancers.start();
+    while (dancers.advance()) dancers.i().performance = NULL;
+    sitters.flush();
+    dancers.flush();
+  }
+  return good;
+}
+
+// Cut the combined blobs file we were writing back to byte_offset (-1 if we hadn't started one), and throw away
+// any we started after that.  Leaves the file open so output carries on at the end of it.
+bool Performance::resumeOutput(long byte_offset)
+{
+  if (output_file!=NULL) { fclose(output_file); output_file=NULL; }
+  if (blobs_fname==NULL) return (byte_offset<0);
+  
+  int n,fid;
+  char *fname;
+  for (fid=last_blobs_fid ; ; fid++)
+  {
+    FilenameComponent::loadValues(*blobs_fname,current_frame,fid,ID);
+    n = FilenameComponent::safeLength(*blobs_fname);
+    fname = new char[ n ];
+    FilenameComponent::toString(*blobs_fname,fname,n);
+    n = remove(fname);
+    delete[] fname;
+    if (n!=0) break;
+  }
+  if (byte_offset<0) return true;
+  
+  FilenameComponent::loadValues(*blobs_fname,current_frame,last_blobs_fid-1,ID);
+  n = FilenameComponent::safeLength(*blobs_fname);
+  fname = new char[ n ];
+  FilenameComponent::toString(*blobs_fname,fname,n);
+  
+  bool good = false;
+  char *kept = new char[ byte_offset+1 ];
+  FILE *f = fopen(fname,"rb");
+  if (f!=NULL)
+  {
+    good = ((long)fread(kept,1,byte_offset,f) == byte_offset);
+    fclose(f);
+  }
+  if (good)
+  {
+    f = fopen(fname,"wb");
+    good = (f!=NULL && (long)fwrite(kept,1,byte_offset,f) == byte_offset);
+    if (f!=NULL) fclose(f);
+  }
+  delete[] kept;
+  
+  if (good)
+  {
+    output_file = fopen(fname,"r+");
+    if (output_file==NULL) good = false;
+    else fseek(output_file,0,SEEK_END);
+  }
+  delete[] fname;
+  return good;
+}
+
+
 // Write some visual cues on an image that shows the current stuff being tracked
 void Performance::imprint(Image* im,short borderI,int borderW,short maskI,int maskW,short dancerI,bool show_dancer,
                           short sitterI,bool show_sitter,short dcenterI,int dcenterR)
 {
+  finishTail();
   if (borderW > 0 && background!=NULL)
   {
     Rectangle r,R;
@@ -1741,7 +2699,7 @@ void Performance::imprint(Image* im,short borderI,int borderW,short maskI,int ma
   }
   if (maskW > 0 && full_area!=NULL)
   {
-    Mask edgemask( *full_area , ManagedList<Strip>::SubordinateList );
+    Mask edgemask( full_area->lines.size );
     full_area->extractEdge(edgemask);
     edgemask.dilate(maskW);
     im->set(edgemask,maskI);
@@ -1878,8 +2836,6 @@ int test_mwt_blob_blob() // Doesn't test find()--need Dancer for that
 {
   Blob *b;
   
-  Storage< Stackable<Strip> > sss(32);
-  Storage< Listable<Strip> > sls(32);
   ManagedList<FloodData> mfd(8,true);
   ManagedList<Blob> mb(8,true);
  
@@ -1889,20 +2845,20 @@ int test_mwt_blob_blob() // Doesn't test find()--need Dancer for that
   *im = im->getGray();
   im->set( Rectangle( Point(10,5) , Point(14,19) ) , im->getGray()/2 );
   int g3_4 = (im->getGray()*3)/4;
-  i = im->floodRect( DualRange(1,g3_4) , &sss , &sls , mfd , im->getBounds() );
+  i = im->floodRect( DualRange(1,g3_4) , mfd , im->getBounds() );
   if (i!=1) return 1;
   
   b = new( mb.Append() ) Blob(1,0.02);
   b->dancer = NULL;
   b->im = im;
-  b->stats = mfd.pop();
+  b->stats = mfd.list_head;  // Left in mfd to be destroyed with it, since with no dancer the blob won't give it back
   b->pixel_count = b->mask().pixel_count;
   b = new( mb.Append() ) Blob(2,0.04);
   b->dancer = NULL;
   b->clip( mb.h() , mb.h().im , NULL , 2 );
   
   if (b->im->getBounds() != Rectangle( Point(8,3) , Point(16,21) )) return 2;
-  if (b->im->get(11,11) != -im->getGray()/2 || b->im->get(9,4) != im->getGray()) return 3;
+  if (b->im->get(11,11) != im->getGray()/2 || b->im->get(9,4) != im->getGray()) return 3;  // Filling leaves the image alone
   if (mb.h().data().centroid != FPoint(12.0,12.0)) return 4;
   mb.h().extraStats( Range(1,g3_4) , FPoint(0.0,0.0) );  // Only finds reference object stats; others require dancer to be non-NULL
   if ( fabs(mb.h().data().major * FPoint(1.0,0.0)) > 1e-4 ) return 5;  // Major axis is Y axis, should be orthogonal to X
@@ -1917,8 +2873,6 @@ int test_mwt_blob_blob() // Doesn't test find()--need Dancer for that
 
 int test_mwt_blob_dancer() // Doesn't test output--need Performance for that
 {
-  Storage< Stackable<Strip> > sss(32);
-  Storage< Listable<Strip> > sls(32);
   ManagedList<FloodData> mfd(4,true);
   ManagedList<Dancer> mld(2,true);
   Dancer* d = new( mld.Append() ) Dancer(NULL,32,true,DualRange(1,768),DualRange(1,999),3,5,4,1,1,0.02);
@@ -1934,7 +2888,7 @@ int test_mwt_blob_dancer() // Doesn't test output--need Performance for that
   
   im = G;
   im.set( r1 , G/2 );
-  i = im.floodRect( DualRange(1,G-1) , &sss , &sls , mfd , im.getBounds() );
+  i = im.floodRect( DualRange(1,G-1) , mfd , im.getBounds() );
   if (i!=1) return 1;
   
   d->setFirst(&im , &mfd.h() , 1 , 0.02);
@@ -2047,6 +3001,9 @@ int test_mwt_blob_performance()
     if ( (p->dancers.h().movie.t().data().centroid - 0.5*(FPoint(r2.far)+FPoint(r2.near))).length() > 2 ) bad = true;
   }
   if (bad) return 9;
+  if (p->findDancer(p->dancers.h().ID) != &p->dancers.h() || p->findDancer(p->next_dancer_ID) != NULL) return 13;
+  Dancer& dh = p->dancers.h();  // Holds nothing of its own, but knows how much of the pools it has
+  if (dh.floodstore.shared != p->floodpool.shared || dh.lpstore.unused != NULL || dh.floodstore.n_used < dh.movie.size) return 14;
   
   p->imprint(&im , 0 , 3 , W-1 , 2 , W-1 , true , 0 , true , 0 , 2);
   im <<= 16-im.depth;
@@ -2069,9 +3026,57 @@ int test_mwt_blob_performance()
   return 0;
 }
 
+// With a static background, frames are subtracted from the background but never change it
+int test_mwt_blob_static_background()
+{
+  ManagedList<Performance> mlp(2,true);
+  Performance *p = new( mlp.Append() ) Performance(1,32);
+  Image im( Point(64,64), false );
+  im.depth = 10;
+  int B = (im.getGray()*3)/2;
+  int N;
+  
+  im = B;
+  p->fill_I = DualRange(1,B/2);
+  p->fill_size = DualRange(10,100);
+  p->border = 5;
+  p->adapt_rate = 2;
+  p->static_background = true;
+  if (p->loadBackground(&im)) return 1;  // Nothing to load into yet
+  p->initialScan(&im , 0.00);
+  p->initialScan(&im , 0.00);
+  short bg = p->background->get(Point(32,32));
+  
+  im = B + 20;  // Lighting changed--an adapting background would follow it
+  for (N=1;N<=2*Performance::DEFAULT_SCAN_BANDS+1;N++)
+  {
+    p->readyNext(&im , 0.02*N);
+    p->findNext();
+  }
+  Rectangle r = p->background->getBounds();
+  for (N=r.near.x;N<=r.far.x;N++) if (p->background->get(Point(N,32))!=bg) return 2;
+  
+  if (!p->loadBackground(&im)) return 3;
+  if (p->background->get(Point(32,32)) != (B+20)<<(p->bg_depth-im.depth)) return 4;
+  
+  p->static_background = false;
+  for (N=1;N<=2*Performance::DEFAULT_SCAN_BANDS+1;N++)
+  {
+    im = B + 20*(N%2);
+    p->readyNext(&im , 0.02*N);
+    p->findNext();
+  }
+  bool adapted = false;
+  for (N=r.near.x;N<=r.far.x;N++) if (p->background->get(Point(N,32))!=(B+20)<<(p->bg_depth-im.depth)) adapted = true;
+  if (!adapted) return 5;
+  
+  return 0;
+}
+
 int test_mwt_blob()
 {
-  return test_mwt_blob_misc() + 10*test_mwt_blob_blob() + 1000*test_mwt_blob_dancer() + 100000*test_mwt_blob_performance();
+  return test_mwt_blob_misc() + 10*test_mwt_blob_blob() + 1000*test_mwt_blob_dancer() + 100000*test_mwt_blob_performance()
+    + 10000000*test_mwt_blob_static_background();
 }
 
 #ifdef UNIT_TEST_OWNER
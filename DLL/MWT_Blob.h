@@ -15,6 +15,9 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#ifndef MWT_NO_THREADS
+#include <pthread.h>
+#endif
 
 #include "MWT_Geometry.h"
 #include "MWT_Lists.h"
@@ -134,6 +137,8 @@ public:
   ~PackedContour() { if (bits!=NULL) { delete[] bits; bits=NULL; } }
   Contour* unpack(Contour* c);
   void printData(FILE* f,bool add_newline);
+  bool writeState(FILE* f) const;  // Binary dump and restore, for checkpoints
+  bool readState(FILE* f);
 };
 
 
@@ -186,10 +191,16 @@ public:
   
   // Stats
   void extraStats(Range fill_I , FPoint previous_direction);
+  void shapeStats();
+  bool endWiggle(float& wiggle);
   void packOutline();
   
   // Output stuff
   bool print(FILE* f,const char* prefix);
+  
+  // Binary dump and restore, for checkpoints--set dancer before reading, since its storage is used
+  bool writeState(FILE* f) const;
+  bool readState(FILE* f);
 };
 
 
@@ -215,13 +226,12 @@ public:
   char* data_fname;
   ManagedList<FilenameComponent>* img_namer;
   
-  // Data management
+  // Data management--borrowed from the performance's pools if we have one, so n_used says how much we hold
   Storage< Listable<FloodData> > floodstore;
-  Storage< Stackable<Strip> > ssstore;
-  Storage< Listable<Strip> > lsstore;
   Storage< Listable<Point> > lpstore;
   Storage< Listable<Contour> > contourstore;
   Storage< Listable<PackedContour> > packedstore;
+  Storage< Listable<Blob> > blobstore;
   
   // The actual data--movement of blob over time
   ManagedList<Blob> movie;
@@ -244,7 +254,7 @@ public:
   bool validated;
   
   Dancer() :  // If this constructor gets called somehow, we'll be using placement new to overwrite it anyway
-    floodstore(0),ssstore(0),lsstore(0),lpstore(0),contourstore(0),packedstore(0),
+    floodstore(0),lpstore(0),contourstore(0),packedstore(0),blobstore(0),
     movie( (Storage< Listable<Blob> >*)NULL ),
     candidates( (Storage< Listable<FloodData> >*)NULL)
   { }
@@ -256,29 +266,15 @@ public:
     border(2) , find_skel(false) , find_outline(false) , 
     n_keep_full(0) , n_long_enough(2) ,
     data_fname(NULL) , img_namer(NULL) ,
-    floodstore(n,true) , ssstore(n,false) , lsstore(n,false) , lpstore(n,false) , contourstore(n,true) , packedstore(n,true) ,
-    movie(n,true) , clear_til(NULL) , n_cleared(0) ,
+    floodstore(n,true) , lpstore(n,false) , contourstore(n,true) , packedstore(n,true) ,
+    blobstore(n,false) , movie(&blobstore) , clear_til(NULL) , n_cleared(0) ,
     candidates(&floodstore) ,
     ID(0) , frames(0,0) , times(0,0) , 
     last_speed(0.0) , last_speed_time(0.0) , last_angularspeed(0.0) ,
     accumulated_length() , accumulated_width() , accumulated_aspect() ,
     validated(false)
-  {	}
-  Dancer(Performance *p,int n,bool bid,const DualRange& fI,const DualRange& fs,int b,int nkf,int nle,int id,int f,double t) :
-    performance(p) ,
-    blob_is_dark(bid) ,
-    fill_I(fI) , fill_size(fs) ,
-    border(b) , find_skel(false) , find_outline(false) , 
-    n_keep_full(nkf) , n_long_enough( (nle<2)?2:nle ) ,
-    data_fname(NULL) , img_namer(NULL) ,
-    floodstore(n,true) , ssstore(n,false) , lsstore(n,false) , lpstore(11*n,false) , contourstore(n,true) , packedstore(n,true) ,
-    movie(n,true) , clear_til(NULL) , n_cleared(0) ,
-    candidates(&floodstore) ,
-    ID(id) , frames(f,f) , times(t,t) , 
-    last_speed(0.0) , last_speed_time(t) , last_angularspeed(0.0) ,
-    accumulated_length() , accumulated_width() , accumulated_aspect() ,
-    validated(false)
-	{ }
+  { movie.my_xtor = true; }
+  Dancer(Performance *p,int n,bool bid,const DualRange& fI,const DualRange& fs,int b,int nkf,int nle,int id,int f,double t);
   ~Dancer();
   
   bool operator<(const Dancer& d) const
@@ -296,6 +292,7 @@ public:
   void readyAnother(Image *fg,Image *bg,int frame,double time);
   bool findAnother(bool best_guess,Mask* exclusion_mask);
   void validate();
+  void measure();  // The part of validate that only touches this dancer (no output), so any thread can do it
   void invalidate();
   
   // Cleanup and output
@@ -305,12 +302,189 @@ public:
   void tidyHistory() { tidyHistoryLeaving(n_keep_full); }
   bool printData(FILE* f,const char* prefix);
   
+  // Binary dump and restore of everything but filenames, for checkpoints; read into a dancer with no movie yet
+  bool writeState(FILE* f) const;
+  bool readState(FILE* f);
+  
   // Statistics reporting
   float recentSpeed(float min_interval = 0.0);  // Also calculates angular speed, so ask for it too!
   float recentAngularSpeed(float min_interval = 0.0) { recentSpeed(min_interval); return last_angularspeed; }
 };
 
 
+// One dancer's share of a stage of tracking a frame; which fields matter depends on the stage
+struct DancerTask
+{
+  Dancer* dancer;
+  Image* bg;             // readyAnother: background to subtract (NULL for sitters)
+  Mask* exclusion_mask;  // findAnother: throw out candidates that touch this
+  bool best_guess;       // findAnother: settle for the best of several candidates
+  bool found;            // findAnother: what it returned
+  Blob* blob;            // shapeStats: blob to outline and skeletonize
+  bool counted;          // shapeStats: dancer was around long enough to count in the frame's summary
+  
+  DancerTask() : dancer(NULL),bg(NULL),exclusion_mask(NULL),best_guess(false),found(false),blob(NULL),counted(false) { }
+  DancerTask(Dancer* d,Image* b,Mask* em,bool bg_ok) :
+    dancer(d),bg(b),exclusion_mask(em),best_guess(bg_ok),found(false),blob(NULL),counted(false) { }
+  DancerTask(Dancer* d,Blob* bl,bool c) :
+    dancer(d),bg(NULL),exclusion_mask(NULL),best_guess(false),found(false),blob(bl),counted(c) { }
+};
+
+
+// Runs one stage (readyAnother, findAnother, or measure) for a list of dancers on a fixed set of
+// threads, counting the one that calls run().  Each thread starts on its own share of the list and
+// then steals from the far end of the others' shares, since a big merged blob can take many times
+// as long as a small larva.  A dancer only touches its own storage and only reads the images and
+// masks it is handed, so nothing else needs locking; anything that involves the whole performance
+// (fates, IDs, collisions, output) is left to the caller, which keeps the results in order.
+// A batch handed to start() instead is worked on by idle threads in the background (outlines and
+// skeletons, which nothing needs until later); finish() helps out with it and waits until it's done.
+// With MWT_NO_THREADS defined, or only one thread, run() just does the list in order and start()
+// does the batch right away.
+class DancerCrew
+{
+public:
+  enum Stage { ready_stage , find_stage , measure_stage , shape_stage };
+  
+  DancerCrew(int n);
+  ~DancerCrew();
+  
+  int size() const { return n_threads; }
+  DancerTask* tasks(int n);  // Room for n tasks; whatever was there before is lost
+  void run(Stage s,int n,Image* fg,int frame,double time);
+  void start(Stage s,DancerTask* t,int n);  // The caller keeps t, and leaves it alone until finish()
+  void finish();
+  
+private:
+  struct Share { int lo; int hi; };  // Tasks lo to hi-1 are untaken; the owner takes from lo, thieves from hi
+  
+  int n_threads;
+  DancerTask* task;
+  int task_room;
+  Share* shares;
+  
+  // What the current run is doing
+  Stage stage;
+  Image* fg;
+  int frame;
+  double time;
+  
+#ifndef MWT_NO_THREADS
+  pthread_t* threads;
+  pthread_mutex_t* share_locks;
+  pthread_mutex_t lock;
+  pthread_cond_t go;
+  pthread_cond_t done;
+  int n_started;
+  int generation;  // Goes up by one each run, so waiting threads can tell there's new work
+  int n_busy;
+  bool quitting;
+  
+  // The background batch, all guarded by lock; tasks from later_next on are untaken
+  Stage later_stage;
+  DancerTask* later_task;
+  int later_n;
+  int later_next;
+  int later_left;  // Not finished yet, taken or not
+  
+  bool takeLater(int& k);
+  void threadLoop();
+  static void* threadEntry(void* crew);
+#endif
+  bool take(int me,int& k);
+  void work(int me);
+  void perform(Stage s,DancerTask& t);
+  
+  DancerCrew(const DancerCrew& dc);
+};
+
+
+// Uniform grid over the arena that finds which dancers' blobs might touch a rectangle, so collisions
+// can be checked without comparing every pair.  Items are numbered in the order they're added (list
+// order, when collisions are resolved) and find() hands back the overlapping ones in that order, so
+// the result is the same as scanning down the list.  Everyone moves each frame, so it's refilled each
+// frame rather than updated; the arrays are kept, so that costs time in proportion to the dancers.
+class DancerGrid
+{
+public:
+  static const int CELL_SIZE = 64;  // Pixels on a side; a few larvae across
+
+  DancerGrid() :
+    cols(0),rows(0),head(NULL),cell_room(0),entries(NULL),n_entries(0),entry_room(0),
+    items(NULL),n_items(0),item_room(0),hits(NULL),n_hits(0),hit_room(0),query(0) { }
+  ~DancerGrid();
+
+  void reset(const Rectangle& arena,int n);  // Empty, with room for n items
+  int add(const Rectangle& r,Listable<Dancer>* ld);  // Returns the new item's number
+  void remove(int k) { items[k].gone = true; }
+  inline int size() const { return n_items; }
+  inline bool gone(int k) const { return items[k].gone; }
+  inline Listable<Dancer>*& node(int k) { return items[k].node; }
+  int find(const Rectangle& r,int after);  // Items numbered after "after" whose rectangles overlap r, in order
+  inline int hit(int h) const { return hits[h]; }
+
+private:
+  struct Item { Rectangle r; Listable<Dancer>* node; bool gone; int mark; };
+  struct Entry { int item; int next; };  // One item in one cell; next is the cell's next entry or -1
+
+  Rectangle arena;
+  int cols;
+  int rows;
+  int* head;  // First entry for each cell, or -1
+  int cell_room;
+  Entry* entries;
+  int n_entries;
+  int entry_room;
+  Item* items;
+  int n_items;
+  int item_room;
+  int* hits;
+  int n_hits;
+  int hit_room;
+  int query;  // Marks items already looked at by the current find()
+
+  int cellX(int x) const { x = (x - arena.near.x)/CELL_SIZE; return (x<0) ? 0 : ((x>=cols) ? cols-1 : x); }
+  int cellY(int y) const { y = (y - arena.near.y)/CELL_SIZE; return (y<0) ? 0 : ((y>=rows) ? rows-1 : y); }
+
+  DancerGrid(const DancerGrid& dg);
+};
+
+
+// Where each dancer was as of its newest blob, packed into one array in list order, with an open
+// addressed table from ID to slot so a dancer can be looked up without walking the list.  The list
+// changes every frame, so Performance just marks it stale and it's rebuilt the next time it's asked.
+class DancerIndex
+{
+public:
+  struct Slot
+  {
+    int ID;
+    Rectangle bounds;  // Of the newest blob's stencil
+    FPoint centroid;
+    Listable<Dancer>* node;
+  };
+
+  bool stale;  // The list has changed since the last rebuild
+
+  DancerIndex() : stale(true),slots(NULL),n_slots(0),slot_room(0),table(NULL),table_size(0) { }
+  ~DancerIndex();
+
+  void rebuild(ManagedList<Dancer>& dancers);
+  inline int size() const { return n_slots; }
+  inline const Slot& operator[](int k) const { return slots[k]; }
+  int find(int id) const;  // Slot of the dancer with that ID, or -1
+
+private:
+  Slot* slots;
+  int n_slots;
+  int slot_room;
+  int* table;      // Slot numbers, -1 where empty; IDs are handed out in order, so the low bits spread them well
+  int table_size;  // Power of two, at least twice n_slots
+
+  DancerIndex(const DancerIndex& di);
+};
+
+
 // Follows a bunch of moving blobs (dancers) and resolves conflicts
 class Performance
 {
@@ -356,20 +530,40 @@ public:
   // Image data
   int bg_depth;        // Depth in bits of background image
   int adapt_rate;      // Background is updated with a decay rate of 2^(-adapt_rate)
+  bool static_background; // Background is only changed by loadBackground, never adapted
   Image *foreground;   // Main image (local copy)
   Image *background;   // Reference image to subtract from main image
   Mask *full_area;     // Place to do background subtraction and find objects
   Mask *danger_zone;   // Objects that intersect this should be excluded (inverted full_area + border)
   int n_scan_bands;    // Divide up image into this many strips for background updating
+  int band_phase;      // Frames to add to current_frame when picking the band, so a tracker started part way through a movie scans like one that saw it all
   Image *band;         // A strip for background updating and worm detection
   Mask *band_area;     // The mask covering the strip that excludes existing worms
+  Mask *band_cover;    // Where the existing worms are in the strip, to take out of band_area all at once
+  
+  // Every dancer's storage is borrowed from these, so one that only lasts a frame or two needs no blocks
+  // of its own; they're shared, since the crew works on several dancers at once
+  Storage< Listable<FloodData> > floodpool;
+  Storage< Listable<Point> > pointpool;
+  Storage< Listable<Contour> > contourpool;
+  Storage< Listable<PackedContour> > packedpool;
+  Storage< Listable<Blob> > blobpool;
   
   // Tracking data
   ManagedList<Dancer> sitters;          // Reference object(s)
   ManagedList<Dancer> dancers;          // Moving object(s)
   ManagedList<FloodData> candidates;    // New objects detected in image
-  Storage< Listable<Strip> > lsstore;   // Storage for image masks
-  Storage< Stackable<Strip> > ssstore;  // Storage for flood fills
+  DancerGrid collisions;                // Finds dancers that might overlap when resolving collisions
+  DancerIndex roster;                   // Finds dancers by ID; marked stale whenever the list changes
+  Storage< Stackable<Strip> > ssstore;  // Storage for floodFind (reference objects)
+  int n_threads;                        // Per-dancer work is shared out over this many threads (1 = all on the caller's)
+  DancerCrew* crew;                     // Made the first time there's work to share out
+  DancerTask* tail;                     // Dancers whose outlines and skeletons from the last frame may still be being found
+  int tail_size;
+  int tail_room;
+  bool tail_pending;                    // Call finishTail() before looking at them (or at report_wiggle)
+  float* report_wiggle;                 // If set, findNext puts the mean end wiggle of the dancers here (see Blob::endWiggle)
+  float* tail_wiggle;
   
 	bool correction_algorithm; // Flag for type of image correction to use. TRUE for division, FALSE for subtraction.
 	
@@ -396,9 +590,13 @@ public:
     blobs_fname(NULL), 
     dance_fname(NULL),    
     sit_fname(NULL),img_fname(NULL),
-    foreground(NULL),background(NULL),full_area(NULL),danger_zone(NULL),band(NULL),band_area(NULL),
-    sitters(2,true),dancers(2,true),candidates(2,true),lsstore(2),ssstore(2),
-    date(NULL),output_fates(2),fates(2),errors(2,true)
+    static_background(false),
+    foreground(NULL),background(NULL),full_area(NULL),danger_zone(NULL),band_phase(0),band(NULL),band_area(NULL),band_cover(NULL),
+    floodpool(2,true,true),pointpool(2,false,true),
+    contourpool(2,true,true),packedpool(2,true,true),blobpool(2,false,true),
+    sitters(2,true),dancers(2,true),candidates(2,true),ssstore(2),n_threads(1),crew(NULL),
+    tail(NULL),tail_size(0),tail_room(0),tail_pending(false),report_wiggle(NULL),tail_wiggle(NULL),
+    correction_algorithm(false),date(NULL),output_fates(2),fates(2),errors(2,true)
   { }
   Performance(int id,int n) :
 		output_file(NULL),
@@ -415,12 +613,15 @@ public:
     dance_fname(NULL),
     sit_fname(NULL) , img_fname(NULL) ,
     path_date_connector(NULL) , base_directory(NULL) , prefix_name(NULL) ,
-    bg_depth(DEFAULT_BG_DEPTH) , adapt_rate(DEFAULT_ADAPT_RATE) ,
+    bg_depth(DEFAULT_BG_DEPTH) , adapt_rate(DEFAULT_ADAPT_RATE) , static_background(false) ,
     foreground(NULL) , background(NULL) , full_area(NULL) , danger_zone(NULL) ,
-    n_scan_bands(DEFAULT_SCAN_BANDS) , band(NULL) , band_area(NULL) ,
+    n_scan_bands(DEFAULT_SCAN_BANDS) , band_phase(0) , band(NULL) , band_area(NULL) , band_cover(NULL) ,
+    floodpool(DEFAULT_BUFFER_SIZE,true,true) , pointpool(11*DEFAULT_BUFFER_SIZE,false,true) , contourpool(DEFAULT_BUFFER_SIZE,true,true) ,
+    packedpool(DEFAULT_BUFFER_SIZE,true,true) , blobpool(DEFAULT_BUFFER_SIZE,false,true) ,
     sitters(n,true) , dancers(n,true) , candidates(n,true) ,
-    lsstore(DEFAULT_BUFFER_SIZE*n,false) , ssstore(DEFAULT_BUFFER_SIZE,false) ,
-    date(NULL) , ID(id) , next_dancer_ID(1) , dance_buf_size(DEFAULT_BUFFER_SIZE) , load_state(no_state) ,
+    ssstore(DEFAULT_BUFFER_SIZE,false) , n_threads(1) , crew(NULL) ,
+    tail(NULL) , tail_size(0) , tail_room(0) , tail_pending(false) , report_wiggle(NULL) , tail_wiggle(NULL) ,
+    correction_algorithm(false) , date(NULL) , ID(id) , next_dancer_ID(1) , dance_buf_size(DEFAULT_BUFFER_SIZE) , load_state(no_state) ,
     expected_n_dancers(99999) , expected_n_sitters(9) , expected_n_performances(1) , expected_n_frames(99999) ,
     output_fates(n,false),fates(n,false) , errors(16,true)
   {
@@ -434,6 +635,13 @@ public:
       combine_blobs = flag;
   }
 
+  void setThreads(int n)
+  {
+    finishTail();
+    n_threads = (n<1) ? 1 : n;
+    if (crew!=NULL) { delete crew; crew=NULL; }
+  }
+
   FILE* getFileHandle();
 
   void addOutputFate(int frame, int idb, long byte_offset); 
@@ -453,12 +661,18 @@ public:
   void adoptScan(Image* im); // Also lower level
   int initialScan(Image *fg,double time);
   int initialRefs(Image *fg,ManagedList<Point>& locations,double time);
+  bool loadBackground(Image *bg);  // Replace the background where bg covers it (only after the first initialScan)
   
   int anticipateNext(double time);
   bool findNextItemBounds(Rectangle& im_bound);
   void loadNextSingleItem(Image* fg);
+  DancerCrew* crewFor(int n_tasks);
   void readyNext(Image *fg,double time);
   int findNext();
+  void startTail();
+  void finishTail();
+  Dancer* findDancer(int id);  // NULL if no dancer has that ID right now
+  const DancerIndex& dancerIndex() { if (roster.stale) roster.rebuild(dancers); return roster; }
   
 	// Image correction 
 	double generateBackgroundAverageIntensity( int *array );	
@@ -468,6 +682,12 @@ public:
   bool prepareOutput(const char* path,const char *prefix,bool save_dance,bool save_sit,bool save_img,struct tm* date_to_use);
   bool logErrors(char* err_fname);
   bool finishOutput();
+  
+  // Checkpoints: binary dump of the tracking state between frames, and restore into a performance with
+  // output prepared the same way but nothing found yet.  Restoring cuts the output back to where it was.
+  bool writeState(FILE* f);
+  bool readState(FILE* f);
+  bool resumeOutput(long byte_offset);
   void imprint(Image* im,short borderI,int borderW,short maskI,int maskW,short dancerI,bool show_dancer,
                short sitterI,bool show_sitter,short dcenterI,int dcenterR);
 };
@@ -482,6 +702,7 @@ int test_mwt_blob_misc();
 int test_mwt_blob_blob();
 int test_mwt_blob_dancer();
 int test_mwt_blob_performance();
+int test_mwt_blob_static_background();
 int test_mwt_blob();
 
 #endif
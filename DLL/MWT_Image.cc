@@ -19,19 +19,107 @@
 
 
 
+/****************************************************************
+                    Strip Array Methods
+****************************************************************/
+
+// Make sure there are at least front free slots before base and back free after the last strip
+void StripArray::makeRoom(int front,int back)
+{
+  int lead = base - data;
+  if (lead >= front && room - lead - size >= back) return;
+  
+  int n = 2*room;
+  if (n < size+front+back) n = size+front+back;
+  if (n < 8) n = 8;
+  if (front > 0) lead = (n - size - back + 1)/2;  // Pushing, so expect more: leave half the slack in front
+  else lead = 0;
+  
+  Strip* d = (Strip*)malloc(n*sizeof(Strip));
+  if (size>0) memcpy(d+lead , base , size*sizeof(Strip));
+  if (data!=NULL) free(data);
+  data = d;
+  base = d + lead;
+  room = n;
+}
+
+// Exchange all strips with another array (iterators go along with them)
+void StripArray::swap(StripArray& sa)
+{
+  Strip* d = data; data = sa.data; sa.data = d;
+  d = base; base = sa.base; sa.base = d;
+  int n = room; room = sa.room; sa.room = n;
+  n = size; size = sa.size; sa.size = n;
+  n = current; current = sa.current; sa.current = n;
+  changes++;
+  sa.changes++;
+}
+
+// Deep copy
+void StripArray::imitate(const StripArray& sa)
+{
+  flush();
+  makeRoom(0,sa.size);
+  if (sa.size>0) memcpy(base , sa.base , sa.size*sizeof(Strip));
+  size = sa.size;
+}
+
+// Take out the strip at k; the first one is free, others shift the rest down
+void StripArray::remove(int k)
+{
+  if (k==0) base++;
+  else if (k < size-1) memmove(base+k , base+k+1 , (size-k-1)*sizeof(Strip));
+  size--;
+  changes++;
+}
+
+// Bottom-up merge sort, ping-ponging with a scratch array; equal strips keep their order
+void StripArray::sort()
+{
+  if (size<2) return;
+  Strip* from = base;
+  Strip* to = (Strip*)malloc(size*sizeof(Strip));
+  Strip* scratch = to;
+  Strip* temp;
+  int w,lo,mid,hi,j,k,n;
+  
+  for (w=1 ; w<size ; w*=2)
+  {
+    for (lo=0 ; lo<size ; lo+=2*w)
+    {
+      mid = (lo+w < size) ? lo+w : size;
+      hi = (lo+2*w < size) ? lo+2*w : size;
+      for (j=lo,k=mid,n=lo ; n<hi ; n++)
+      {
+        if (k<hi && (j>=mid || from[k] < from[j])) to[n] = from[k++];
+        else to[n] = from[j++];
+      }
+    }
+    temp = from; from = to; to = temp;
+  }
+  if (from!=base) memcpy(base , from , size*sizeof(Strip));
+  free(scratch);
+  current = -1;
+  changes++;
+}
+
+
+
 /****************************************************************
                       Image Mask Methods
 ****************************************************************/
 
 // Make a bunch of strips that fill out a rectangle
-Mask::Mask(const Rectangle& rect , Storage< Listable<Strip> >* store) : lines(store)
+Mask::Mask(const Rectangle& rect)
 {
+  pixel_count = 0;
   rectangularize(rect);
 }
 
 // Make a bunch of strips that fill out an ellipse
-Mask::Mask(const Ellipse& ellip , Storage< Listable<Strip> >* store) : lines(store)
+Mask::Mask(const Ellipse& ellip)
 {
+  pixel_count = 0;
   ellipticize(ellip);
 }
 
@@ -40,6 +128,7 @@ Mask::Mask(const Ellipse& ellip , Storage< Listable<Strip> >* store) : lines(sto
 void Mask::rectangularize(const Rectangle& rect)
 {
   flush();
+  lines.makeRoom(0 , 1+rect.far.x-rect.near.x);
   for (int x = rect.near.x ; x <= rect.far.x ; x++) lines.Append( Strip(x,rect.near.y,rect.far.y) );
   bounds = rect;
   pixel_count = rect.area();
@@ -49,6 +138,7 @@ void Mask::rectangularize(const Rectangle& rect)
 void Mask::ellipticize(const Ellipse& ellip)
 {
   flush();
+  lines.makeRoom(0 , 1+2*ellip.axes.x);
   Point p = Point(-ellip.axes.x,0);
   
   // First half of the ellipse plus the center line
@@ -61,13 +151,10 @@ void Mask::ellipticize(const Ellipse& ellip)
   }
   
   // Second half is mirror image of first (skip center line)
-  lines.end();
-  lines.retreat();
-  while (lines.current != NULL)
+  for (int k = lines.size-2 ; k >= 0 ; k--)
   {
-    lines.Append( lines.i() + Point(2*(ellip.center.x - lines.i().x) , 0) );  // Reflect about center
-    pixel_count += lines.i().length();
-    lines.retreat();
+    lines.Append( lines[k] + Point(2*(ellip.center.x - lines[k].x) , 0) );  // Reflect about center
+    pixel_count += lines[k].length();
   }
   bounds = ellip.bounds();
 }
@@ -76,48 +163,50 @@ void Mask::ellipticize(const Ellipse& ellip)
 // Find the bounding box of a mask
 void Mask::findBounds()
 {
-  Listable<Strip>* ls;
-  
-  lines.start(ls);
-  if (lines.advance(ls)) { bounds = Rectangle(ls->data.x,ls->data.x,ls->data.y0,ls->data.y1); }
-  while (lines.advance(ls))
+  if (lines.size>0) bounds = Rectangle(lines[0].x,lines[0].x,lines[0].y0,lines[0].y1);
+  for (int k=1 ; k<lines.size ; k++)
   {
-    bounds.includeX(ls->data.x);
-    bounds.includeYY(ls->data.y0,ls->data.y1);
+    bounds.includeX(lines[k].x);
+    bounds.includeYY(lines[k].y0,lines[k].y1);
   }
 }
 
 // Clean up a mask that might have overlaps (assume sorted)
 void Mask::tidy()
 {
-  Listable<Strip>* ls;
+  int j,k;
   
   pixel_count = 0;
-  start();
-  while (advance())
+  lines.start();
+  if (lines.size==0) return;
+  for (j=0,k=1 ; k<lines.size ; k++)
   {
-    ls = lines.current;
-    while (lines.advance(ls)) // Merge any later strips that overlap us or which touch in y
+    // Merge any later strips that overlap us or which touch in y; sort implies start is earlier, fix end if needed
+    if (lines[k].x == lines[j].x && lines[k].y0 <= lines[j].y1+1)
+    {
+      if (lines[j].y1 < lines[k].y1) lines[j].y1 = lines[k].y1;
+    }
+    else
     {
-      if (ls->data.x > i().x || ls->data.y0 > i().y1+1) break;
-      if (i().y1 < ls->data.y1) i().y1 = ls->data.y1;   // Sort implies start is earlier, fix end if needed
-      lines.Backspace(ls);
+      pixel_count += lines[j].length();
+      j++;
+      lines[j] = lines[k];
     }
-    pixel_count += i().length();
   }
+  pixel_count += lines[j].length();
+  lines.size = j+1;
+  lines.touch();
 }
 
 
 //Various point-inclusion functions; all assume that mask is sorted (points too, if there's a list)
 
-// See whether a point is in the mask (slow, don't do this if you have many points)
+// See whether a point is in the mask (finds the column by bisection, so fine for a few points)
 bool Mask::contains(const Point& p)
 {
-  start();
-  while (advance())
+  for (int k = lines.findColumn(p.x) ; k<lines.size && lines[k].x==p.x ; k++)
   {
-    if (i().beyond(p)) return false;
-    if (!i().before(p)) return true;
+    if (lines[k].y1 >= p.y) return (lines[k].y0 <= p.y);
   }
   return false;
 }
@@ -189,47 +278,33 @@ int Mask::contains(ManagedList<Point>& to_test,ManagedList<Point>& inside)
 
 
 // Fraction of two masks that overlap each other
-FPoint Mask::overlapRatio(Mask& m)
+// Uses its own indices, like overlaps, so the masks can be read elsewhere meanwhile
+FPoint Mask::overlapRatio(const Mask& m) const
 {
-  int N = 0;
-  bool i_have_more,they_have_more;
-  
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
-  {
-    if (i().before(m.i())) i_have_more = advance();
-    else if (m.i().before(i())) they_have_more = m.advance();
-    else
-    {
-      N += 1 + ((m.i().y1<i().y1) ? i().y1 : m.i().y1) - ((m.i().y0<i().y0) ? i().y0 : m.i().y0);
-      if (i().y1 > m.i().y1) they_have_more = m.advance();
-      else i_have_more = advance();
-    }
-  }
-  
+  int N = countOverlap(m);
   if (N==0) return FPoint(0,0);
   else return FPoint( (float)N/(float)pixel_count , (float)N/(float)m.pixel_count );
 }
 
 
 // See if two masks overlap each other at all (assume they're sorted)
-bool Mask::overlaps(Mask& m,Point offset)
+// Uses its own indices, so many threads can check against the same mask at once
+bool Mask::overlaps(const Mask& m,Point offset) const
 {
-  bool i_have_more,they_have_more;
+  int a,b;
+  if (lines.size==0 || m.lines.size==0) return false;
   
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
-  {
-    if (i().x < m.i().x+offset.x) i_have_more = advance();
-    else if (i().x > m.i().x+offset.x) they_have_more = m.advance();
-    else if (i().y1 < m.i().y0+offset.y) i_have_more = advance();
-    else if (i().y0 > m.i().y1+offset.y) they_have_more = m.advance();
+  // Skip straight to the first column both could have
+  a = lines.findColumn(m.lines[0].x + offset.x);
+  b = m.lines.findColumn(lines[0].x - offset.x);
+  while (a<lines.size && b<m.lines.size)
+  {
+    const Strip& sa = lines[a];
+    const Strip& sb = m.lines[b];
+    if (sa.x < sb.x+offset.x) a++;
+    else if (sa.x > sb.x+offset.x) b++;
+    else if (sa.y1 < sb.y0+offset.y) a++;
+    else if (sa.y0 > sb.y1+offset.y) b++;
     else return true;
   }
   return false;
@@ -238,90 +313,71 @@ bool Mask::overlaps(Mask& m,Point offset)
 // Make sure the mask fits within a bounding rectangle
 void Mask::cropTo(const Rectangle& rect)
 {
-  start();
-  while (advance())
+  int j,k;
+  Strip s;
+  
+  pixel_count = 0;
+  for (j=0,k=lines.findColumn(rect.near.x) ; k<lines.size && lines[k].x<=rect.far.x ; k++)
   {
-    if (i().x<rect.near.x) Backspace();
-    else if (i().x>rect.far.x) Backspace();
-    else if (i().y1<rect.near.y || i().y0>rect.far.y) Backspace();
-    else
-    {
-      if (i().y0 < rect.near.y) { pixel_count -= rect.near.y - i().y0; i().y0 = rect.near.y; }
-      if (i().y1 > rect.far.y) { pixel_count -= i().y1 - rect.far.y; i().y1 = rect.far.y; }
-    }
+    s = lines[k];
+    if (s.y1<rect.near.y || s.y0>rect.far.y) continue;
+    if (s.y0 < rect.near.y) s.y0 = rect.near.y;
+    if (s.y1 > rect.far.y) s.y1 = rect.far.y;
+    lines[j++] = s;
+    pixel_count += s.length();
   }
+  lines.size = j;
+  lines.touch();
+  lines.start();
 }
 
 
 // Count the number of pixels in common between two masks.
 // Strips must be sorted in both masks!
-int Mask::countOverlap(Mask &m)
+int Mask::countOverlap(const Mask& m) const
 {
   int n_overlap = 0;
-  bool i_have_more,they_have_more;
+  int a,b;
+  if (lines.size==0 || m.lines.size==0) return 0;
   
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
+  a = lines.findColumn(m.lines[0].x);
+  b = m.lines.findColumn(lines[0].x);
+  while (a<lines.size && b<m.lines.size)
   {
-    if (!i().overlaps(m.i()))
-    {
-      if (i() < m.i()) i_have_more = advance();
-      else they_have_more = m.advance();
-    }
+    const Strip& sa = lines[a];
+    const Strip& sb = m.lines[b];
+    if (sa.before(sb)) a++;
+    else if (sb.before(sa)) b++;
     else
     {
-      if (i().y1 < m.i().y1) // We end first
-      {
-        n_overlap += 1 + i().y1 - ((i().y0<m.i().y0) ? m.i().y0 : i().y0);
-        i_have_more = advance();
-      }
-      else // They end first
-      {
-        n_overlap += 1 + m.i().y1 - ((i().y0<m.i().y0) ? m.i().y0 : i().y0);
-        they_have_more = advance();
-      }
+      n_overlap += 1 + ((sb.y1<sa.y1) ? sb.y1 : sa.y1) - ((sb.y0<sa.y0) ? sa.y0 : sb.y0);
+      if (sa.y1 > sb.y1) b++;  // They end first
+      else a++;                // We end first
     }
   }
   return n_overlap;
 }
 
 
+// The set operations merge the two sorted lists of strips into a new array and then swap it in
+
 // Adds one mask to another
 Mask& Mask::operator+=(Mask &m)
 {
-  bool i_have_more,they_have_more;
+  StripArray sum(lines.size + m.lines.size);
+  int a = 0;
+  int b = 0;
   
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
+  while (a<lines.size || b<m.lines.size)
   {
-    if (i().before(m.i())) i_have_more = advance();
-    else if (i().beyond(m.i()))
+    const Strip& s = (b>=m.lines.size || (a<lines.size && !(m.lines[b] < lines[a]))) ? lines[a++] : m.lines[b++];  // Ours first if tied
+    if (sum.size>0 && sum.t().overlaps(s))
     {
-      pixel_count += m.i().length();
-      lines.Tuck( m.i() );
-      they_have_more = m.advance();
+      if (sum.t().y1 < s.y1) sum.t().y1 = s.y1;
     }
-    else
-    {
-      pixel_count -= i().length();
-      if (i().y0 > m.i().y0) i().y0 = m.i().y0;
-      if (i().y1 < m.i().y1) i().y1 = m.i().y1;
-      pixel_count += i().length();
-      they_have_more = m.advance();
-    }
-  }
-  while (they_have_more)
-  {
-    lines.Append( m.i() );
-    pixel_count += m.i().length();
-    they_have_more = m.advance();
+    else sum.Append(s);
   }
+  takeStrips(sum);
   return *this;
 }
 
@@ -329,50 +385,23 @@ Mask& Mask::operator+=(Mask &m)
 // Removes one mask from another
 Mask& Mask::operator-=(Mask &m)
 {
-  bool i_have_more,they_have_more;
+  StripArray left(lines.size + m.lines.size);
+  Strip s;
+  int a,b,c;
   
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
+  for (a=0,b=0 ; a<lines.size ; a++)
   {
-    while (they_have_more && m.i() < i())
+    s = lines[a];
+    while (b<m.lines.size && m.lines[b].before(s)) b++;  // Also before all our later strips
+    for (c=b ; c<m.lines.size && !m.lines[c].beyond(s) ; c++)
     {
-      if (m.i().x == i().x && m.i().y1 >= i().y0) break;
-      they_have_more = m.advance();
-    }
-    if (m.i().x > i().x) i_have_more = advance();
-    else if (m.i().y0 > i().y1) i_have_more = advance();
-    else
-    {
-      if (m.i().y0 <= i().y0)
-      {
-        if (m.i().y1 >= i().y1)
-        {
-          pixel_count -= i().length();
-          lines.Delete();
-          if (lines.current==NULL) i_have_more = advance();
-        }
-        else
-        {
-          pixel_count -= 1+m.i().y1-i().y0;
-          i().y0 = 1+m.i().y1;
-        }
-      }
-      else if (m.i().y1 >= i().y1)
-      {
-        pixel_count -= 1+i().y1-m.i().y0;
-        i().y1 = m.i().y0-1;
-      }
-      else
-      {
-        pixel_count -= m.i().length();
-        lines.Insert( Strip(i().x , m.i().y1+1 , i().y1) );
-        i().y1 = m.i().y0-1;
-      }
+      if (m.lines[c].y0 > s.y0) left.Append( Strip(s.x , s.y0 , m.lines[c].y0-1 , s.id) );
+      s.y0 = m.lines[c].y1+1;
+      if (s.y0 > s.y1) break;
     }
+    if (s.y0 <= s.y1) left.Append(s);
   }
+  takeStrips(left);
   return *this;
 }
 
@@ -380,48 +409,20 @@ Mask& Mask::operator-=(Mask &m)
 // Removes a rectangle from a mask
 Mask& Mask::operator-=(const Rectangle &rect)
 {
-  bool i_have_more;
-  int x;
-  
-  start();
-  i_have_more = advance();
-  if (!i_have_more) return *this;
+  StripArray left(lines.size + 1+rect.far.x-rect.near.x);
+  int a;
   
-  for ( x = (i().x<rect.near.x) ? rect.near.x : i().x ; x<=rect.far.x && i_have_more ; x++ )
+  for (a=0 ; a<lines.size ; a++)
   {
-    while ( (i().x < x || (i().x==x && i().y1 < rect.near.y)) && i_have_more) i_have_more = advance();
-    while (i_have_more && i().x==x && !(i().y0 > rect.far.y))
+    const Strip& s = lines[a];
+    if (s.x<rect.near.x || s.x>rect.far.x || s.y1<rect.near.y || s.y0>rect.far.y) left.Append(s);
+    else
     {
-      if (rect.near.y <= i().y0)
-      {
-        if (rect.far.y >= i().y1)
-        {
-          pixel_count -= i().length();
-          lines.Backspace();
-        }
-        else
-        {
-          pixel_count -= 1 + rect.far.y - i().y0;
-          i().y0 = rect.far.y+1;
-        }
-      }
-      else
-      {
-        if (rect.far.y >= i().y1)
-        {
-          pixel_count -= 1 + i().y1 - rect.near.y;
-          i().y1 = rect.near.y-1;
-        }
-        else
-        {
-          pixel_count -= 1 + rect.far.y - rect.near.y;
-          lines.Insert( Strip(x,rect.far.y+1,i().y1) );
-          i().y1 = rect.near.y-1;
-        }
-      }
-      i_have_more = advance();
+      if (s.y0 < rect.near.y) left.Append( Strip(s.x , s.y0 , rect.near.y-1 , s.id) );
+      if (s.y1 > rect.far.y) left.Append( Strip(s.x , rect.far.y+1 , s.y1 , s.id) );
     }
   }
+  takeStrips(left);
   return *this;
 }
 
@@ -429,42 +430,29 @@ Mask& Mask::operator-=(const Rectangle &rect)
 // Finds the intersection of two masks
 Mask& Mask::operator*=(Mask &m)
 {
-  bool i_have_more,they_have_more;
+  StripArray both(lines.size + m.lines.size);
+  int a,b;
   
-  start();
-  m.start();
-  i_have_more = advance();
-  they_have_more = m.advance();
-  while (i_have_more && they_have_more)
+  a = b = 0;
+  if (lines.size>0 && m.lines.size>0)
   {
-    if (i().before(m.i()))
-    {
-      Backspace();
-      i_have_more = advance();
-    }
-    else if (i().beyond(m.i())) they_have_more = m.advance();
+    a = lines.findColumn(m.lines[0].x);
+    b = m.lines.findColumn(lines[0].x);
+  }
+  while (a<lines.size && b<m.lines.size)
+  {
+    const Strip& sa = lines[a];
+    const Strip& sb = m.lines[b];
+    if (sa.before(sb)) a++;
+    else if (sb.before(sa)) b++;
     else
     {
-      if (m.i().y0 > i().y0)
-      {
-        pixel_count -= m.i().y0-i().y0;
-        i().y0 = m.i().y0;
-      }
-      if (m.i().y1 <= i().y1)
-      {
-        lines.Insert( Strip(i().x,m.i().y1+1,i().y1) );
-        i().y1 = m.i().y1;
-        they_have_more = m.advance();
-      }
-      i_have_more = advance();
+      both.Append( Strip(sa.x , (sb.y0<sa.y0) ? sa.y0 : sb.y0 , (sb.y1<sa.y1) ? sb.y1 : sa.y1 , sa.id) );
+      if (sa.y1 > sb.y1) b++;
+      else a++;
     }
   }
-  while (i_have_more)
-  {
-    pixel_count -= i().length();
-    lines.Backspace();
-    i_have_more = advance();
-  }
+  takeStrips(both);
   return *this;
 }
 
@@ -475,9 +463,9 @@ Mask& Mask::operator*=(Mask &m)
 void Mask::extractEdge(Mask& edges)
 {
   int y0,y1;
-  Mask coverL( edges , ManagedList<Strip>::SubordinateList );
-  Mask coverR( edges , ManagedList<Strip>::SubordinateList );
-  Listable<Strip>* ls;
+  Mask coverL(8);
+  Mask coverR(8);
+  int ls;
   edges.flush();
   
   start();
@@ -563,6 +551,7 @@ void Mask::extractEdge(Mask& edges)
           if (coverR.lines.h().y0 == i().y0+1)
           {
             coverR.lines.h().y0 = i().y0;   // Extend to end
+            coverR.lines.touch();
             coverR.pixel_count++;
           }
           else  coverR.pushStrip( i().x , i().y0 , i().y0 ); // Add end
@@ -572,6 +561,7 @@ void Mask::extractEdge(Mask& edges)
           if (coverR.lines.t().y1 == i().y1-1)
           {
             coverR.lines.t().y1 = i().y1;  // Extend to end
+            coverR.lines.touch();
             coverR.pixel_count++;
           }
           else coverR.addStrip( i().x,i().y1,i().y1 );
@@ -586,8 +576,9 @@ void Mask::extractEdge(Mask& edges)
 // Invert a mask to a negative mask inside some rectangle
 void Mask::invert(const Rectangle& universe)
 {
-  Listable<Strip> *ls;
+  StripArray gaps(lines.size + 1+universe.far.x-universe.near.x);
   Point p;
+  int k;
   
   if (lines.size==0)
   {
@@ -595,43 +586,35 @@ void Mask::invert(const Rectangle& universe)
     return;
   }
   
-  // Pick out where strips are not and place them at the beginning of the list (in order)
-  ls = lines.list_head; 
+  // Pick out where strips are not (in order)
   p.x = universe.near.x;
   p.y = universe.near.y;
-  start();
-  while (advance())
+  for (k=0 ; k<lines.size ; k++)
   {
-    if (p.x > i().x) continue;
-    while (p.x < i().x && p.x<=universe.far.x)
+    const Strip& s = lines[k];
+    if (p.x > s.x) continue;
+    while (p.x < s.x && p.x<=universe.far.x)
     {
-      if (p.y <= universe.far.y) lines.Tuck(ls , Strip(p.x,p.y,universe.far.y));
+      if (p.y <= universe.far.y) gaps.Append( Strip(p.x,p.y,universe.far.y) );
       p.y = universe.near.y;
       p.x++;
     }
     if (p.x>universe.far.x) break;
     
-    if (p.y < i().y0) lines.Tuck(ls , Strip(p.x,p.y,i().y0-1));
-    p.y = i().y1+1;
+    if (p.y < s.y0) gaps.Append( Strip(p.x,p.y,s.y0-1) );
+    p.y = s.y1+1;
   }
   
   // Add any strip-free region in the universe the last strip in the mask
   while (p.x <= universe.far.x)
   {
-    if (p.y <= universe.far.y) lines.Tuck(ls , Strip(p.x,p.y,universe.far.y));
+    if (p.y <= universe.far.y) gaps.Append( Strip(p.x,p.y,universe.far.y) );
     p.y = universe.near.y;
     p.x++;
   }
   
-  // Remove all the old strips
-  lines.end();
-  while (lines.current != ls) lines.Backspace();
-  lines.Backspace();
-  
-  // Count the pixels in the new strips
-  pixel_count = 0;
-  start();
-  while (advance()) pixel_count += i().length();
+  // Gaps replace the old strips
+  takeStrips(gaps);
 }
   
 
@@ -646,13 +629,13 @@ void Mask::dilate(int n)
   }
   
   n=n-1;
-  int j;
-  start();
-  while (advance())
+  int j,k;
+  StripArray grown( lines.size*(2*n+1) );
+  for (k=0 ; k<lines.size ; k++)
   {
-    for (j = i().x-n ; j <= i().x+n ; j++) pushStrip( j , i().y0-n , i().y1+n );
-    Backspace();
+    for (j = lines[k].x-n ; j <= lines[k].x+n ; j++) grown.Append( Strip( j , lines[k].y0-n , lines[k].y1+n ) );
   }
+  lines.swap(grown);
   sort();
   tidy();
 }
@@ -660,13 +643,15 @@ void Mask::dilate(int n)
 // Dilate an object using another mask as a structuring element
 void Mask::dilate(Mask& structuringElt)
 {
-  start();
-  while (advance())
+  int j,k,n;
+  n = lines.size;
+  lines.makeRoom(0 , n*structuringElt.lines.size);
+  for (k=0 ; k<n ; k++)
   {
-    structuringElt.start();
-    while (structuringElt.advance())
+    for (j=0 ; j<structuringElt.lines.size ; j++)
     {
-      pushStrip( i().x + structuringElt.i().x , i().y0 + structuringElt.i().y0 , i().y1 + structuringElt.i().y1 );
+      const Strip& e = structuringElt.lines[j];
+      addStrip( lines[k].x + e.x , lines[k].y0 + e.y0 , lines[k].y1 + e.y1 );
     }
   }
   sort();
@@ -736,6 +721,151 @@ void Mask::println()
 }
 
 
+// Binary dump of the strips, for checkpoints
+bool Mask::writeState(FILE* f) const
+{
+  if (!dumpRaw(f,pixel_count) || !dumpRaw(f,bounds) || !dumpRaw(f,lines.size)) return false;
+  for (int k=0 ; k<lines.size ; k++) { if (!dumpRaw(f,lines[k])) return false; }
+  return true;
+}
+
+// Read back what writeState wrote; strips are added after any we already have
+bool Mask::readState(FILE* f)
+{
+  int n,k;
+  Strip s;
+  if (!undumpRaw(f,n) || !undumpRaw(f,bounds) || !undumpRaw(f,k) || k<0) return false;
+  for ( ; k>0 ; k--)
+  {
+    if (!undumpRaw(f,s)) return false;
+    lines.Append(s);
+  }
+  pixel_count += n;
+  return true;
+}
+
+
+
+/****************************************************************
+                    Packed Mask Methods
+****************************************************************/
+
+// Count the set bits in a word
+static inline int countBits(unsigned long long v)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(v);
+#else
+  v = v - ((v>>1) & 0x5555555555555555ULL);
+  v = (v & 0x3333333333333333ULL) + ((v>>2) & 0x3333333333333333ULL);
+  v = (v + (v>>4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// The 64 bits of a column starting at bit k (bits past the end of the column are zero)
+static inline unsigned long long columnBits(const unsigned long long* col,int n,int k)
+{
+  int j = k>>6;
+  int s = k&63;
+  unsigned long long v = col[j] >> s;
+  if (s!=0 && j+1<n) v |= col[j+1] << (64-s);
+  return v;
+}
+
+// Pack a (sorted, nonoverlapping) mask into bits unless it's too big
+bool MaskBits::pack(const Mask& m)
+{
+  int j,k,w,lo,hi;
+  int n_strips = m.lines.size;
+  
+  source = &m.lines;
+  changes = m.lines.changes;
+  packed = false;
+  if (n_strips==0) return false;
+  
+  // Sorted, so only y needs looking for
+  bounds = Rectangle(m.lines[0].x,m.lines[n_strips-1].x,m.lines[0].y0,m.lines[0].y1);
+  for (k=1 ; k<n_strips ; k++) bounds.includeYY(m.lines[k].y0,m.lines[k].y1);
+  per_column = (bounds.height()+63)>>6;
+  w = per_column*bounds.width();
+  if (w > MAX_WORDS) return false;
+  
+  if (w > room)
+  {
+    if (words!=NULL) free(words);
+    room = (w<64) ? 64 : w;
+    words = (unsigned long long*)malloc(room*sizeof(unsigned long long));
+  }
+  memset(words , 0 , w*sizeof(unsigned long long));
+  for (k=0 ; k<n_strips ; k++)
+  {
+    const Strip& s = m.lines[k];
+    unsigned long long* col = words + (s.x-bounds.near.x)*per_column;
+    lo = s.y0 - bounds.near.y;
+    hi = s.y1 - bounds.near.y;
+    for (j = lo>>6 ; j <= hi>>6 ; j++)
+    {
+      w = (j == hi>>6) ? (hi&63) : 63;
+      col[j] |= (~0ULL >> (63-w)) & (~0ULL << ((j == lo>>6) ? (lo&63) : 0));
+    }
+  }
+  packed = true;
+  return true;
+}
+
+// Are we still what m was when we packed it?  (Nothing has touched its strips since.)
+bool MaskBits::matches(const Mask& m) const
+{
+  return (source == &m.lines && changes == m.lines.changes);
+}
+
+// Pixels set in both
+int MaskBits::countOverlap(const MaskBits& mb) const
+{
+  int x,y,n;
+  unsigned long long v;
+  Rectangle r = bounds * mb.bounds;
+  if (r.isEmpty()) return 0;
+  
+  n = 0;
+  for (x=r.near.x ; x<=r.far.x ; x++)
+  {
+    const unsigned long long* a = words + (x-bounds.near.x)*per_column;
+    const unsigned long long* b = mb.words + (x-mb.bounds.near.x)*mb.per_column;
+    for (y=r.near.y ; y<=r.far.y ; y+=64)
+    {
+      v = columnBits(a,per_column,y-bounds.near.y) & columnBits(b,mb.per_column,y-mb.bounds.near.y);
+      if (r.far.y-y < 63) v &= ~0ULL >> (63-(r.far.y-y));
+      n += countBits(v);
+    }
+  }
+  return n;
+}
+
+// Any pixel set in both?
+bool MaskBits::overlaps(const MaskBits& mb) const
+{
+  int x,y;
+  unsigned long long v;
+  Rectangle r = bounds * mb.bounds;
+  if (r.isEmpty()) return false;
+  
+  for (x=r.near.x ; x<=r.far.x ; x++)
+  {
+    const unsigned long long* a = words + (x-bounds.near.x)*per_column;
+    const unsigned long long* b = mb.words + (x-mb.bounds.near.x)*mb.per_column;
+    for (y=r.near.y ; y<=r.far.y ; y+=64)
+    {
+      v = columnBits(a,per_column,y-bounds.near.y) & columnBits(b,mb.per_column,y-mb.bounds.near.y);
+      if (r.far.y-y < 63) v &= ~0ULL >> (63-(r.far.y-y));
+      if (v!=0) return true;
+    }
+  }
+  return false;
+}
+
+
 
 /****************************************************************
                      Image Contour Methods
@@ -781,100 +911,101 @@ void Contour::findContour(const Ellipse& e)
 // Contour is not formed from adjacent pixels.  Use fillContour to fill in the gaps.
 // The contour is built starting at the left-most corner and traveling counterclockwise.  Thus, the mask
 // must always be on the left-hand side of someone walking along the contour.
-void Contour::findContour(Mask& m)
+// The mask (iterator included) is left alone.
+void Contour::findContour(const Mask& m)
 {
   int x_last; // The previous x coordinate of the contour
   int y;      // The current y coordinate of the contour (current x is always the x of the current strip)
   int i;      // Temporary variable used to test against ends of strips
   int dir;    // Direction along strips to travel to find more contour (1=travel in +y direction, -1 = -y)
-  Listable<Strip>* ls;
-  Listable<Strip>* next_strip;
+  int ls;
+  int next_strip;
+  int cur;    // Index of the current strip (kept here rather than in m.lines.current)
   
   flush();
   if (m.pixel_count==0) return;
   
-  m.start();
-  m.advance();
+  cur = 0;
   dir = 1;
-  x_last = m.i().x;
-  y = m.i().y0;
+  x_last = m.ii(cur).x;
+  y = m.ii(cur).y0;
   do
   {
     // Add the current pixel unless it's already the last thing in the contour.
     // (Check size() to avoid null deref. on t().)
-    if (size()==0 || t().x != m.i().x || t().y != y) Append( Point(m.i().x,y) );
+    if (size()==0 || t().x != m.ii(cur).x || t().y != y) Append( Point(m.ii(cur).x,y) );
     
     if (dir>0)
     {
       // Where should we look for the next strip?
-      if (x_last<m.i().x) i = y+1;  // Next strip has to be forward a bit or it'd be part of the strip we were just in
+      if (x_last<m.ii(cur).x) i = y+1;  // Next strip has to be forward a bit or it'd be part of the strip we were just in
       else i = y-1;                 // Next strip might be "behind" us.
       
       // Search for the next strip that might be to our right--in +y direction, this is to the -x direction
-      next_strip = NULL;
-      ls = m.lines.current;
+      next_strip = -1;
+      ls = cur;
       while (m.lines.retreat(ls))
       {
-        if (ls->data.x < m.i().x-1) break;  // Too far, not even touching, irrelevant
-        if (ls->data.x == m.i().x) continue;  // Same x strip as we're on, not far enough
-        if (ls->data.y1<i || ls->data.y0 > m.i().y1+1) continue;  // Doesn't touch necessary part of existing strip
+        if (m.lines[ls].x < m.ii(cur).x-1) break;  // Too far, not even touching, irrelevant
+        if (m.lines[ls].x == m.ii(cur).x) continue;  // Same x strip as we're on, not far enough
+        if (m.lines[ls].y1<i || m.lines[ls].y0 > m.ii(cur).y1+1) continue;  // Doesn't touch necessary part of existing strip
         next_strip = ls;
       }
-      if (next_strip==NULL)  // Nobody is on our right--double back!
+      if (next_strip<0)  // Nobody is on our right--double back!
       {
-        y = m.i().y1;
+        y = m.ii(cur).y1;
         dir = -1;
       }
       else  // Someone is on our right!  Let's jump.
       {
-        if (next_strip->data.y0<y)  // Don't travel down our strip, just go up the other one.
+        if (m.lines[next_strip].y0<y)  // Don't travel down our strip, just go up the other one.
         {
           y--;
           dir = -1;
         }
         else
         {
-          if (next_strip->data.y0 > y+1) Append( Point(m.i().x,next_strip->data.y0-1) );  // We got this far in our strip
-          y = next_strip->data.y0;  // Now move to the new one
+          if (m.lines[next_strip].y0 > y+1) Append( Point(m.ii(cur).x,m.lines[next_strip].y0-1) );  // We got this far in our strip
+          y = m.lines[next_strip].y0;  // Now move to the new one
         }
       }
     }
     else // Should be exactly the same as the above with all the directions flipped (see comments above, but flip left/right, up/down).
     {
-      if (x_last>m.i().x) i = y-1;
+      if (x_last>m.ii(cur).x) i = y-1;
       else i = y+1;
       
-      next_strip = NULL;
-      ls = m.lines.current;
+      next_strip = -1;
+      ls = cur;
       while (m.lines.advance(ls))
       {
-        if (ls->data.x > m.i().x+1) break;
-        if (ls->data.x == m.i().x) continue;
-        if (ls->data.y0>i || ls->data.y1 < m.i().y0-1) continue;
+        if (m.lines[ls].x > m.ii(cur).x+1) break;
+        if (m.lines[ls].x == m.ii(cur).x) continue;
+        if (m.lines[ls].y0>i || m.lines[ls].y1 < m.ii(cur).y0-1) continue;
         next_strip = ls;
       }
-      if (next_strip==NULL)
+      if (next_strip<0)
       {
-        y = m.i().y0;
+        y = m.ii(cur).y0;
         dir = 1;
       }
       else
       {
-        if (next_strip->data.y1>y)
+        if (m.lines[next_strip].y1>y)
         {
           y++;
           dir = 1;
         }
         else
         {
-          if (next_strip->data.y1 < y-1) Append( Point(m.i().x,next_strip->data.y1+1) );
-          y = next_strip->data.y1;
+          if (m.lines[next_strip].y1 < y-1) Append( Point(m.ii(cur).x,m.lines[next_strip].y1+1) );
+          y = m.lines[next_strip].y1;
         }
       } 
     }
-    x_last = m.i().x;
-    if (next_strip!=NULL) m.lines.current = next_strip;
-  } while (dir!=1 || m.i()!=m.lines.h());
+    x_last = m.ii(cur).x;
+    if (next_strip>=0) cur = next_strip;
+  } while (dir!=1 || m.ii(cur)!=m.lines.h());
 }
 
 
@@ -1276,6 +1407,21 @@ void Contour::findBounds()
   
   while (advance()) bounds.include( i() );
 }
+
+
+// Binary dump of the points, for checkpoints
+bool Contour::writeState(FILE* f) const
+{
+  if (!dumpRaw(f,bounds)) return false;
+  return dumpRawList(f,boundary);
+}
+
+// Read back what writeState wrote; points are added after any we already have
+bool Contour::readState(FILE* f)
+{
+  if (!undumpRaw(f,bounds)) return false;
+  return undumpRawList(f,boundary);
+}
  
 
 
@@ -1329,17 +1475,41 @@ void FloodInfo::freshen()
 }
 
 
-// Find centroid
+// Fold one strip's weighted sums (weights, weights times dy, times dy^2) into the moments; dx is the strip's x offset
+static inline void addMoments(FloodData& fd,long long dx,long long w,long long wy,long long wyy)
+{
+  fd.m0 += w;
+  fd.mx += w*dx;
+  fd.my += wy;
+  fd.mxx += w*dx*dx;
+  fd.mxy += wy*dx;
+  fd.myy += wyy;
+}
+
+// Start the moments over, relative to the first pixel of the stencil
+static inline void startMoments(FloodData& fd,Range threshold)
+{
+  fd.has_moments = true;
+  fd.moment_range = threshold;
+  fd.moment_origin = (fd.stencil.lines.size>0) ? Point(fd.stencil.lines.h().x,fd.stencil.lines.h().y0) : Point(0,0);
+  fd.moment_count = 0;
+  fd.m0 = fd.mx = fd.my = fd.mxx = fd.mxy = fd.myy = 0;
+}
+
+// Find centroid (and the moments, so principalAxes can use them)
 void FloodData::findCentroid(const Image& im,Range threshold)
 {
   short I,J;
-  int y;
+  int y,dy;
   long long cI,cx,cy;
+  long long w,wy,wyy;
   cI = cx = cy = 0;
   
+  startMoments(*this,threshold);
   stencil.start();
   while (stencil.advance())
   {
+    w = wy = wyy = 0;
     for (y=stencil.i().y0 ; y<=stencil.i().y1 ; y++)
     {
       I = im.get(stencil.i().x,y);
@@ -1350,8 +1520,14 @@ void FloodData::findCentroid(const Image& im,Range threshold)
       cI += I;
       cx += stencil.i().x*I;
       cy += y*I;
+      dy = y - moment_origin.y;
+      w += I;
+      wy += I*dy;
+      wyy += (long long)I*dy*dy;
     }
+    addMoments(*this,stencil.i().x-moment_origin.x,w,wy,wyy);
   }
+  moment_count = stencil.pixel_count;
   
   centroid = FPoint( ((double)cx)/((double)cI) , ((double)cy)/((double)cI) );
 }
@@ -1366,29 +1542,42 @@ void FloodData::principalAxes(const Image& im,Range threshold)
   double Sxx,Sxy,Syy,Si;
   
   // Least squares fit (standard formula)
-  Si = 0.0;
-  Sxx = Sxy = Syy = 0.0;
-  stencil.start();
-  while (stencil.advance())
+  if (has_moments && moment_range==threshold && moment_count==stencil.pixel_count)
   {
-    a = stencil.i().x - centroid.x;
-    for (y=stencil.i().y0 ; y<=stencil.i().y1 ; y++)
+    // Already have the sums, so shift them from the mean to the centroid (which may have been rounded)
+    Si = (double)m0;
+    a = (double)mx/Si + moment_origin.x - centroid.x;
+    b = (double)my/Si + moment_origin.y - centroid.y;
+    Sxx = ((double)mxx - (double)mx*(double)mx/Si)/Si + a*a;
+    Sxy = ((double)mxy - (double)mx*(double)my/Si)/Si + a*b;
+    Syy = ((double)myy - (double)my*(double)my/Si)/Si + b*b;
+  }
+  else
+  {
+    Si = 0.0;
+    Sxx = Sxy = Syy = 0.0;
+    stencil.start();
+    while (stencil.advance())
     {
-      I = im.get(stencil.i().x,y);
-      if (I<0) I=-I;
-      J = threshold.hi()-I;
-      I -= threshold.lo();
-      if (J<I) I=J;
-      b = y - centroid.y;
-      Si += I;
-      Sxx += I*a*a;
-      Sxy += I*a*b;
-      Syy += I*b*b;
+      a = stencil.i().x - centroid.x;
+      for (y=stencil.i().y0 ; y<=stencil.i().y1 ; y++)
+      {
+        I = im.get(stencil.i().x,y);
+        if (I<0) I=-I;
+        J = threshold.hi()-I;
+        I -= threshold.lo();
+        if (J<I) I=J;
+        b = y - centroid.y;
+        Si += I;
+        Sxx += I*a*a;
+        Sxy += I*a*b;
+        Syy += I*b*b;
+      }
     }
+    Sxx /= Si;
+    Sxy /= Si;
+    Syy /= Si;
   }
-  Sxx /= Si;
-  Sxy /= Si;
-  Syy /= Si;
   f = sqrt( (Sxx-Syy)*(Sxx-Syy)+4*Sxy*Sxy )/2;
   a = 0.5*(Sxx+Syy);
   b = 0.5*(Sxx-Syy);
@@ -1428,25 +1617,590 @@ void FloodData::principalAxes(const Image& im,Range threshold)
     if (b > min_max) min_max = b;
     else if (b < min_min) min_min = b;
   }
-  
-  // Set data: axes (of standard deviation length) and length of object along two axes
-  major *= sqrt(L1);
-  minor *= sqrt(L2);
-  long_axis = maj_max - maj_min;
-  short_axis = min_max - min_min;
+  
+  // Set data: axes (of standard deviation length) and length of object along two axes
+  major *= sqrt(L1);
+  minor *= sqrt(L2);
+  long_axis = maj_max - maj_min;
+  short_axis = min_max - min_min;
+}
+
+
+// Make a copy of a flood data object (only really needed to keep storage straight)
+void FloodData::duplicate(const FloodData& fd)
+{
+  score = fd.score;
+  centroid = fd.centroid;
+  major = fd.major;
+  minor = fd.minor;                         
+  stencil.imitate(fd.stencil);
+  long_axis = fd.long_axis;
+  short_axis = fd.short_axis;
+  has_moments = fd.has_moments;
+  moment_range = fd.moment_range;
+  moment_origin = fd.moment_origin;
+  moment_count = fd.moment_count;
+  m0 = fd.m0; mx = fd.mx; my = fd.my;
+  mxx = fd.mxx; mxy = fd.mxy; myy = fd.myy;
+  bits.forget();
+}
+
+// Pack the stencil if it has changed since we last did (or we never have)
+const MaskBits* FloodData::packedStencil()
+{
+  if (!bits.matches(stencil)) bits.pack(stencil);
+  return (bits.packed) ? &bits : NULL;
+}
+
+// Fraction of our stencil overlapped by theirs and theirs by ours, a word at a time if we can
+FPoint FloodData::overlapRatio(FloodData& fd)
+{
+  const MaskBits* a = packedStencil();
+  const MaskBits* b = (a==NULL) ? NULL : fd.packedStencil();
+  if (b==NULL) return stencil.overlapRatio(fd.stencil);
+  int N = a->countOverlap(*b);
+  if (N==0) return FPoint(0,0);
+  else return FPoint( (float)N/(float)stencil.pixel_count , (float)N/(float)fd.stencil.pixel_count );
+}
+
+// Whether the stencils overlap at all, a word at a time if we can
+bool FloodData::overlaps(FloodData& fd)
+{
+  const MaskBits* a = packedStencil();
+  const MaskBits* b = (a==NULL) ? NULL : fd.packedStencil();
+  if (b==NULL) return stencil.overlaps(fd.stencil);
+  return a->overlaps(*b);
+}
+
+// Binary dump and restore, for checkpoints (the stencil is added to what we have)
+bool FloodData::writeState(FILE* f) const
+{
+  if (!dumpRaw(f,score) || !dumpRaw(f,centroid) || !dumpRaw(f,major) || !dumpRaw(f,minor)) return false;
+  if (!dumpRaw(f,long_axis) || !dumpRaw(f,short_axis)) return false;
+  return stencil.writeState(f);
+}
+bool FloodData::readState(FILE* f)
+{
+  if (!undumpRaw(f,score) || !undumpRaw(f,centroid) || !undumpRaw(f,major) || !undumpRaw(f,minor)) return false;
+  if (!undumpRaw(f,long_axis) || !undumpRaw(f,short_axis)) return false;
+  has_moments = false;
+  bits.forget();
+  return stencil.readState(f);
+}
+
+
+FloodRuns::~FloodRuns()
+{
+  if (runs!=NULL) delete[] runs;
+  if (parent!=NULL) delete[] parent;
+  if (next!=NULL) delete[] next;
+  if (filled!=NULL) delete[] filled;
+  if (column!=NULL) delete[] column;
+  if (values!=NULL) delete[] values;
+  if (queue!=NULL) delete[] queue;
+}
+
+
+// Add a run to the end, making room if need be
+void FloodRuns::addRun(short x,short y0,short y1)
+{
+  if (n_runs>=capacity)
+  {
+    int n = (capacity<64) ? 64 : 2*capacity;
+    Strip *r = new Strip[n];
+    if (runs!=NULL)
+    {
+      memcpy(r,runs,n_runs*sizeof(Strip));
+      delete[] runs;
+      delete[] parent;
+      delete[] next;
+      delete[] filled;
+    }
+    runs = r;
+    parent = new int[n];
+    next = new int[n];
+    filled = new int[n];
+    capacity = n;
+  }
+  runs[n_runs++].set(x,y0,y1);
+}
+
+
+// Find all runs of pixels in T and which of them are connected (side by side, not diagonally)
+void FloodRuns::label(const Image& im,Range T)
+{
+  int x,y,y0,i,j,a,b,step;
+  const short *p;
+  
+  bounds = im.getBounds();
+  int height = 1 + bounds.far.y - bounds.near.y;
+  if (n_columns < 2 + bounds.far.x - bounds.near.x)
+  {
+    if (column!=NULL) delete[] column;
+    n_columns = 2 + bounds.far.x - bounds.near.x;
+    column = new int[n_columns];
+  }
+  if (im.bin>1 && n_values<height)
+  {
+    if (values!=NULL) delete[] values;
+    n_values = height;
+    values = new short[n_values];
+  }
+  
+  // First pass: pull the runs out of each column
+  n_runs = 0;
+  for (x=bounds.near.x ; x<=bounds.far.x ; x++)
+  {
+    column[x-bounds.near.x] = n_runs;
+    if (im.bin<=1)
+    {
+      p = im.pixels + (x-im.bounds.near.x)*im.stride.x;
+      step = im.stride.y;
+    }
+    else
+    {
+      for (y=0;y<height;y++) values[y] = im.get(x,y+bounds.near.y);
+      p = values;
+      step = 1;
+    }
+    for (y=0 ; y<height ; )
+    {
+      while (y<height && T.excludes(p[y*step])) y++;
+      if (y>=height) break;
+      y0 = y;
+      while (y<height && !T.excludes(p[y*step])) y++;
+      addRun(x,y0+bounds.near.y,y-1+bounds.near.y);
+    }
+  }
+  column[1+bounds.far.x-bounds.near.x] = n_runs;
+  
+  // Join runs that touch the run in the previous column; a piece is named by its first run, so parent[i] <= i
+  for (i=0;i<n_runs;i++) parent[i] = i;
+  for (x=bounds.near.x+1 ; x<=bounds.far.x ; x++)
+  {
+    i = column[x-1-bounds.near.x];
+    j = column[x-bounds.near.x];
+    int i_end = j;
+    int j_end = column[x+1-bounds.near.x];
+    while (i<i_end && j<j_end)
+    {
+      if (runs[i].y0<=runs[j].y1 && runs[j].y0<=runs[i].y1)
+      {
+        for (a=i ; parent[a]!=a ; a=parent[a]) parent[a] = parent[parent[a]];
+        for (b=j ; parent[b]!=b ; b=parent[b]) parent[b] = parent[parent[b]];
+        if (a<b) parent[b] = a;
+        else if (b<a) parent[a] = b;
+      }
+      if (runs[i].y1 < runs[j].y1) i++;
+      else j++;
+    }
+  }
+  
+  // Second pass: point every run straight at its piece and chain each piece's runs together in order
+  for (i=0;i<n_runs;i++) { parent[i] = parent[parent[i]]; next[i] = -1; filled[i] = 0; }
+  n_filled = 0;
+  for (i=n_runs-1;i>=0;i--)
+  {
+    if (parent[i]==i) continue;
+    next[i] = next[parent[i]];
+    next[parent[i]] = i;
+  }
+}
+
+
+// Binary search for the run containing p
+int FloodRuns::find(const Point& p) const
+{
+  if (p.x<bounds.near.x || p.x>bounds.far.x) return -1;
+  int lo = column[p.x-bounds.near.x];
+  int hi = column[p.x+1-bounds.near.x] - 1;
+  while (lo<=hi)
+  {
+    int mid = (lo+hi)/2;
+    if (runs[mid].y1 < p.y) lo = mid+1;
+    else if (runs[mid].y0 > p.y) hi = mid-1;
+    else return mid;
+  }
+  return -1;
+}
+
+
+// Follow floodLine's queue of strips out from a run, marking each run it reaches as part of fill n_filled.
+// A strip going on past the last column (or back past the first) can't, and floodLine then never looks
+// back beside it either, so near those columns this can stop short of the whole piece.
+void FloodRuns::trace(int run)
+{
+  int head,tail,i,lo,hi;
+  Strip s;
+  
+  if (n_queue < 1+3*n_runs)  // Each run queues at most three strips
+  {
+    if (queue!=NULL) delete[] queue;
+    n_queue = 1+3*n_runs;
+    queue = new Strip[n_queue];
+  }
+  
+  head = tail = 0;
+  queue[tail++].set(runs[run].x,runs[run].y0,runs[run].y0,0);
+  while (head<tail)
+  {
+    s = queue[head++];
+    
+    // First run in the column that reaches s
+    lo = column[s.x-bounds.near.x];
+    hi = column[s.x+1-bounds.near.x];
+    while (lo<hi)
+    {
+      i = (lo+hi)/2;
+      if (runs[i].y1 < s.y0) lo = i+1;
+      else hi = i;
+    }
+    
+    for (i=lo ; i<column[s.x+1-bounds.near.x] && runs[i].y0<=s.y1 ; i++)
+    {
+      if (filled[i]) continue;
+      filled[i] = n_filled;
+      Strip& r = runs[i];
+      
+      if (s.id>=0 && s.x<bounds.far.x)  // Same order and tests as floodLine
+      {
+        queue[tail++].set(s.x+1,r.y0,r.y1,1);
+        if (s.id>0 && s.x>bounds.near.x)
+        {
+          if (r.y0 < s.y0) queue[tail++].set(s.x-1,r.y0,s.y0-1,-1);
+          if (r.y1 > s.y1) queue[tail++].set(s.x-1,s.y1+1,r.y1,-1);
+        }
+      }
+      if (s.id<=0 && s.x>bounds.near.x)
+      {
+        queue[tail++].set(s.x-1,r.y0,r.y1,-1);
+        if (s.id<0 && s.x<bounds.far.x)
+        {
+          if (r.y0 < s.y0) queue[tail++].set(s.x+1,r.y0,s.y0-1,1);
+          if (r.y1 > s.y1) queue[tail++].set(s.x+1,s.y1+1,r.y1,1);
+        }
+      }
+    }
+  }
+}
+
+
+// Store in data what floodFind would fill starting from a run, with its intensity-weighted centroid and moments
+int FloodRuns::fill(const Image& im,int run,Range T,FloodData* data)
+{
+  int i,y,dy;
+  short I,J;
+  const short *p = NULL;
+  long long cx,cy,sumI;
+  long long w,wy,wyy;
+  int step = im.stride.y;
+  int count = 0;
+  int piece = parent[run];
+  cx = cy = sumI = 0;
+  
+  // Away from the first and last columns floodFind gets the whole piece; next to them, trace it as floodFind does
+  n_filled++;
+  for (i=piece ; i>=0 ; i=next[i]) if (runs[i].x==bounds.near.x || runs[i].x==bounds.far.x) break;
+  if (i<0) for (i=piece ; i>=0 ; i=next[i]) filled[i] = n_filled;
+  else trace(run);
+  
+  data->stencil.flush();
+  data->bits.forget();
+  startMoments(*data,T);
+  for (i=piece ; i>=0 ; i=next[i])
+  {
+    if (filled[i]!=n_filled) continue;
+    Strip& s = runs[i];
+    if (count==0) data->moment_origin = Point(s.x,s.y0);
+    if (im.bin<=1) p = im.pixels + (s.x-im.bounds.near.x)*im.stride.x + (s.y0-im.bounds.near.y)*step;
+    w = wy = wyy = 0;
+    for (y=s.y0 ; y<=s.y1 ; y++)
+    {
+      if (im.bin<=1) { I = *p; p += step; }
+      else I = im.get(s.x,y);
+      J = T.hi()-I;
+      if (J > I-T.lo()) J = I-T.lo();
+      cx += J*s.x;
+      cy += J*y;
+      sumI += J;
+      dy = y - data->moment_origin.y;
+      w += J;
+      wy += J*dy;
+      wyy += (long long)J*dy*dy;
+    }
+    addMoments(*data,s.x-data->moment_origin.x,w,wy,wyy);
+    data->stencil.addStrip(s.x,s.y0,s.y1);
+    count += s.length();
+  }
+  data->moment_count = count;
+  
+  // Runs come out in order, so the stencil is already sorted
+  data->centroid = FPoint( ((double)cx)/((double)sumI) , ((double)cy)/((double)sumI) );
+  data->stencil.findBounds();
+  return count;
+}
+
+
+
+/****************************************************************
+                   Vectorized Pixel Loops
+****************************************************************/
+
+// The loops that touch every loaded pixel every frame (set, copy, adapt, diffCopy, diffAdaptCopy) hand each
+// contiguous run of pixels to one of these; MWT_Kernels.h has the loops, built once per instruction set
+struct ImageKernels
+{
+  SimdLevel level;
+  void (*fill)(short* p,int n,short I);
+  void (*shift[2])(short* p,const short* q,int n,int shift);                     // [left]
+  void (*adapt[2])(short* p,const short* q,int n,int rate,int imrate);           // [left]
+  void (*diff[2])(short* p,const short* q,const short* g,int n,int shift,int depth);  // [divide]
+  void (*diffAdapt[2][2])(short* p,const short* q,short* g,int n,int shift,int rate,int srcrate,int depth);  // [divide][left]
+};
+
+// Division is done in single precision, which is exact as long as numerator plus denominator stays under 2^24
+static const int MAX_VECTOR_DIVIDE_DEPTH = 11;
+
+namespace mwt_scalar
+{
+  struct Lanes
+  {
+    typedef short V;
+    enum { N = 1 };
+    static const SimdLevel level = simd_none;
+    static inline V load(const short* p) { return *p; }
+    static inline void store(short* p,V a) { *p = a; }
+    static inline V set1(short a) { return a; }
+    static inline V add(V a,V b) { return a+b; }
+    static inline V sub(V a,V b) { return a-b; }
+    static inline V shl(V a,int n) { return a<<n; }
+    static inline V sra(V a,int n) { return a>>n; }
+    static inline V divide(V q,V b,int depth) { return ((1+(unsigned int)q)<<(depth+1)) / ((unsigned int)q + (unsigned int)b + 2); }
+  };
+#include "MWT_Kernels.h"
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(MWT_NO_SIMD)
+#define MWT_X86_KERNELS
+#if __GNUC__>=6
+#define MWT_AVX512_KERNELS
+#endif
+#endif
+
+#ifdef MWT_X86_KERNELS
+#include <immintrin.h>
+
+// Each instruction set gets its own namespace compiled for it; which one runs is decided from CPUID at run time
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace mwt_sse2
+{
+  struct Lanes
+  {
+    typedef __m128i V;
+    enum { N = 8 };
+    static const SimdLevel level = simd_sse2;
+    static inline V load(const short* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline void store(short* p,V a) { _mm_storeu_si128((__m128i*)p,a); }
+    static inline V set1(short a) { return _mm_set1_epi16(a); }
+    static inline V add(V a,V b) { return _mm_add_epi16(a,b); }
+    static inline V sub(V a,V b) { return _mm_sub_epi16(a,b); }
+    static inline V shl(V a,int n) { return _mm_sll_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline V sra(V a,int n) { return _mm_sra_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline __m128i divideHalf(__m128i q,__m128i b,__m128i count)
+    {
+      __m128 num = _mm_cvtepi32_ps( _mm_sll_epi32( _mm_add_epi32(q,_mm_set1_epi32(1)) , count ) );
+      __m128 den = _mm_cvtepi32_ps( _mm_add_epi32( _mm_add_epi32(q,b) , _mm_set1_epi32(2) ) );
+      return _mm_cvttps_epi32( _mm_div_ps(num,den) );
+    }
+    static inline V divide(V q,V b,int depth)
+    {
+      __m128i z = _mm_setzero_si128();
+      __m128i count = _mm_cvtsi32_si128(depth+1);
+      return _mm_packs_epi32( divideHalf(_mm_unpacklo_epi16(q,z),_mm_unpacklo_epi16(b,z),count) ,
+                              divideHalf(_mm_unpackhi_epi16(q,z),_mm_unpackhi_epi16(b,z),count) );
+    }
+  };
+#include "MWT_Kernels.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace mwt_avx2
+{
+  struct Lanes
+  {
+    typedef __m256i V;
+    enum { N = 16 };
+    static const SimdLevel level = simd_avx2;
+    static inline V load(const short* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline void store(short* p,V a) { _mm256_storeu_si256((__m256i*)p,a); }
+    static inline V set1(short a) { return _mm256_set1_epi16(a); }
+    static inline V add(V a,V b) { return _mm256_add_epi16(a,b); }
+    static inline V sub(V a,V b) { return _mm256_sub_epi16(a,b); }
+    static inline V shl(V a,int n) { return _mm256_sll_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline V sra(V a,int n) { return _mm256_sra_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline __m256i divideHalf(__m256i q,__m256i b,__m128i count)
+    {
+      __m256 num = _mm256_cvtepi32_ps( _mm256_sll_epi32( _mm256_add_epi32(q,_mm256_set1_epi32(1)) , count ) );
+      __m256 den = _mm256_cvtepi32_ps( _mm256_add_epi32( _mm256_add_epi32(q,b) , _mm256_set1_epi32(2) ) );
+      return _mm256_cvttps_epi32( _mm256_div_ps(num,den) );
+    }
+    static inline V divide(V q,V b,int depth)  // Unpacking and packing both work within 128-bit lanes, so the order survives
+    {
+      __m256i z = _mm256_setzero_si256();
+      __m128i count = _mm_cvtsi32_si128(depth+1);
+      return _mm256_packs_epi32( divideHalf(_mm256_unpacklo_epi16(q,z),_mm256_unpacklo_epi16(b,z),count) ,
+                                 divideHalf(_mm256_unpackhi_epi16(q,z),_mm256_unpackhi_epi16(b,z),count) );
+    }
+  };
+#include "MWT_Kernels.h"
+}
+#pragma GCC pop_options
+
+#ifdef MWT_AVX512_KERNELS
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"  // GCC 12's own avx512 headers trip this
+namespace mwt_avx512
+{
+  struct Lanes
+  {
+    typedef __m512i V;
+    enum { N = 32 };
+    static const SimdLevel level = simd_avx512;
+    static inline V load(const short* p) { return _mm512_loadu_si512((const void*)p); }
+    static inline void store(short* p,V a) { _mm512_storeu_si512((void*)p,a); }
+    static inline V set1(short a) { return _mm512_set1_epi16(a); }
+    static inline V add(V a,V b) { return _mm512_add_epi16(a,b); }
+    static inline V sub(V a,V b) { return _mm512_sub_epi16(a,b); }
+    static inline V shl(V a,int n) { return _mm512_sll_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline V sra(V a,int n) { return _mm512_sra_epi16(a,_mm_cvtsi32_si128(n)); }
+    static inline __m512i divideHalf(__m512i q,__m512i b,__m128i count)
+    {
+      __m512 num = _mm512_cvtepi32_ps( _mm512_sll_epi32( _mm512_add_epi32(q,_mm512_set1_epi32(1)) , count ) );
+      __m512 den = _mm512_cvtepi32_ps( _mm512_add_epi32( _mm512_add_epi32(q,b) , _mm512_set1_epi32(2) ) );
+      return _mm512_cvttps_epi32( _mm512_div_ps(num,den) );
+    }
+    static inline V divide(V q,V b,int depth)  // As for AVX2, within 128-bit lanes
+    {
+      __m512i z = _mm512_setzero_si512();
+      __m128i count = _mm_cvtsi32_si128(depth+1);
+      return _mm512_packs_epi32( divideHalf(_mm512_unpacklo_epi16(q,z),_mm512_unpacklo_epi16(b,z),count) ,
+                                 divideHalf(_mm512_unpackhi_epi16(q,z),_mm512_unpackhi_epi16(b,z),count) );
+    }
+  };
+#include "MWT_Kernels.h"
+}
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#endif
+
+static const ImageKernels* image_kernels = NULL;
+
+// The best of the instruction sets we have kernels for that the CPU (and operating system) supports
+static SimdLevel bestSimdLevel()
+{
+#ifdef MWT_X86_KERNELS
+  __builtin_cpu_init();
+#ifdef MWT_AVX512_KERNELS
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return simd_avx512;
+#endif
+  if (__builtin_cpu_supports("avx2")) return simd_avx2;
+  if (__builtin_cpu_supports("sse2")) return simd_sse2;
+#endif
+  return simd_none;
+}
+
+SimdLevel setSimdLevel(SimdLevel level)
+{
+  SimdLevel best = bestSimdLevel();
+  if (level > best) level = best;
+  switch (level)
+  {
+#ifdef MWT_X86_KERNELS
+#ifdef MWT_AVX512_KERNELS
+    case simd_avx512: image_kernels = &mwt_avx512::table; break;
+#endif
+    case simd_avx2: image_kernels = &mwt_avx2::table; break;
+    case simd_sse2: image_kernels = &mwt_sse2::table; break;
+#endif
+    default: image_kernels = &mwt_scalar::table; break;
+  }
+  return image_kernels->level;
 }
 
+// The best kernels, unless setSimdLevel has already picked some
+static void pickImageKernels()
+{
+  if (image_kernels==NULL) setSimdLevel(simd_avx512);
+}
 
-// Make a copy of a flood data object (only really needed to keep storage straight)
-void FloodData::duplicate(const FloodData& fd)
+#ifndef MWT_NO_THREADS
+static pthread_once_t image_kernels_once = PTHREAD_ONCE_INIT;
+#endif
+
+// The kernels in use, picked once however many threads ask at the same time
+static inline const ImageKernels& currentKernels()
 {
-  score = fd.score;
-  centroid = fd.centroid;
-  major = fd.major;
-  minor = fd.minor;                         
-  stencil.imitate(fd.stencil);
-  long_axis = fd.long_axis;
-  short_axis = fd.short_axis;
+#ifdef MWT_NO_THREADS
+  pickImageKernels();
+#else
+  pthread_once(&image_kernels_once,pickImageKernels);
+#endif
+  return *image_kernels;
+}
+
+SimdLevel getSimdLevel()
+{
+  return currentKernels().level;
+}
+
+// Kernels for a loop over images with the given source depth, with or without division
+static inline const ImageKernels& kernelsFor(bool divide,int depth)
+{
+  if (divide && depth>MAX_VECTOR_DIVIDE_DEPTH) return mwt_scalar::table;
+  return currentKernels();
+}
+
+// Address of pixel (x,y), for handing a run of pixels to a kernel
+static inline short* pixelAt(const Image& im,int x,int y) { return im.pixels + (y-im.bounds.near.y)*im.stride.y + im.stride.x*(x-im.bounds.near.x); }
+
+// A strip of a mask cut down to the images it's applied to: n pixels from (x,y0) on
+struct MaskRun
+{
+  int x;
+  int y0;
+  int n;
+};
+
+// Mask operations pull this many strips out of the list at a time, so the pixel loops run over an array
+static const int MASK_RUN_BATCH = 256;
+
+// Takes the next (up to) MASK_RUN_BATCH strips of m that touch safe, cut down to fit; returns how many, or 0 when m is done
+static int gatherRuns(Mask& m,const Rectangle& safe,MaskRun* runs)
+{
+  int n = 0;
+  int y0,y1;
+  while (n<MASK_RUN_BATCH && m.advance())
+  {
+    if (m.i().x > safe.far.x) { m.end(); break; }
+    if (m.i().x < safe.near.x) continue;
+    y0 = (m.i().y0 < safe.near.y) ? safe.near.y : m.i().y0;
+    y1 = (m.i().y1 > safe.far.y) ? safe.far.y : m.i().y1;
+    if (y0>y1) continue;
+    runs[n].x = m.i().x;
+    runs[n].y0 = y0;
+    runs[n].n = 1+y1-y0;
+    n++;
+  }
+  return n;
 }
 
 
@@ -1466,11 +2220,13 @@ Image::Image(const Image& existing,const Rectangle& region, bool algo) : bin(0),
   {
     pixels=NULL;
     size=Point(0,0);
+    stride=Point(0,1);
     owns_pixels=false;
     return;
   }
   
   size = (bounds.far-bounds.near)+1;
+  stride = Point(size.y,1);
   pixels = new short[ bounds.area() ];
   owns_pixels = true;
   
@@ -1507,6 +2263,20 @@ void Image::set(Mask& m,short I)
   Point p;
   Rectangle b = getBounds();
   int x0,x1,y0,y1;
+  if (bin<=1)
+  {
+    MaskRun runs[MASK_RUN_BATCH];
+    int r,nr;
+    short *q;
+    const ImageKernels& K = kernelsFor(false,depth);
+    m.start();
+    while ((nr = gatherRuns(m,b,runs)) > 0)
+    {
+      if (stride.y==1) for (r=0;r<nr;r++) K.fill(pixelAt(*this,runs[r].x,runs[r].y0),runs[r].n,I);
+      else for (r=0;r<nr;r++) for (q=pixelAt(*this,runs[r].x,runs[r].y0),y0=0 ; y0<runs[r].n ; y0++) q[y0*stride.y] = I;
+    }
+    return;
+  }
   m.start();
   while (m.advance())
   {
@@ -1518,20 +2288,16 @@ void Image::set(Mask& m,short I)
     if (y0 < b.near.y) y0 = b.near.y;
     y1 = m.i().y1;
     if (y1 > b.far.y) y1 = b.far.y;
-    if (bin>1)
-    {
-      x0 = p.x*bin;
-      x1 = x0 + bin - 1;
-      y0 *= bin;
-      y1 *= bin;
-      y1 += bin-1;
-      x0 -= bounds.near.x;
-      x1 -= bounds.near.x;
-      y0 -= bounds.near.y;
-      y1 -= bounds.near.y;
-      for (p.x=x0 ; p.x<=x1 ; p.x++) for (p.y=y0 ; p.y<=y1 ; p.y++) raw(p) = I;
-    }
-    else for (p.y = y0 ; p.y <= y1 ; p.y++) rare(p) = I;  
+    x0 = p.x*bin;
+    x1 = x0 + bin - 1;
+    y0 *= bin;
+    y1 *= bin;
+    y1 += bin-1;
+    x0 -= bounds.near.x;
+    x1 -= bounds.near.x;
+    y0 -= bounds.near.y;
+    y1 -= bounds.near.y;
+    for (p.x=x0 ; p.x<=x1 ; p.x++) for (p.y=y0 ; p.y<=y1 ; p.y++) raw(p) = I;
   }
 }
 
@@ -1744,33 +2510,63 @@ void Image::mimic(const Image& source,Rectangle my_region,Rectangle source_regio
 }
 
 
+// Strided images are walked with the inner loop along whichever axis the source has contiguous;
+// this gives the (outer,inner) steps through an image's memory for that choice
+static inline Point walkSteps(const Image& im,bool x_inner) { return (x_inner) ? Point(im.stride.y,im.stride.x) : im.stride; }
+static inline bool walkAlongX(const Image& source) { return (source.stride.x==1 && source.stride.y!=1); }
+
+
 // Copy a source image onto (a part of) the existing image
 void Image::copy(Point where,const Image& source,Point size,bool fix_depth)
 { 
   int x,y;
-  if (bin <= 1 && source.bin <= 1) // Fast shortcut--grab memory directly
+  if (bin <= 1 && source.bin <= 1 && isColumnMajor() && source.isColumnMajor()) // Fast shortcut--grab memory directly
   {
     Point swhere = where - source.bounds.near;
     where -= bounds.near;
-    short *p = pixels + (where.x*this->size.y + where.y);
-    short *q = source.pixels + (swhere.x*source.size.y + swhere.y);
+    short *p = pixels + (where.x*stride.x + where.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y);
     if (!fix_depth || depth==source.depth)
     {
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y)
+      for (x=0 ; x<size.x ; x++ , q += source.stride.x , p += stride.x)
       {
         if (size.y>3) memcpy(p,q,2*size.y);
         else for (y=0;y<size.y;y++) p[y] = q[y];
       }
     }
+    else
+    {
+      bool left = (depth > source.depth);
+      short shift = (left) ? depth - source.depth : source.depth - depth;
+      const ImageKernels& K = kernelsFor(false,source.depth);
+      for (x=0 ; x<size.x ; x++ , q += source.stride.x , p += stride.x) K.shift[left](p,q,size.y,shift);
+    }
+  }
+  else if (bin <= 1 && source.bin <= 1) // Strided views--still grab memory directly, just not a column at a time
+  {
+    bool x_inner = walkAlongX(source);
+    int n_outer = (x_inner) ? size.y : size.x;
+    int n_inner = (x_inner) ? size.x : size.y;
+    Point ps = walkSteps(*this,x_inner);
+    Point qs = walkSteps(source,x_inner);
+    Point swhere = where - source.bounds.near;
+    where -= bounds.near;
+    short *p = pixels + (where.x*stride.x + where.y*stride.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y*source.stride.y);
+    if (!fix_depth || depth==source.depth)
+    {
+      if (ps.y==1 && qs.y==1) for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x) memcpy(p,q,2*n_inner);
+      else for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x) for (y=0;y<n_inner;y++) p[y*ps.y] = q[y*qs.y];
+    }
     else if (depth > source.depth)
     {
       short shift = depth - source.depth;
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y) for (y=0;y<size.y;y++) p[y] = q[y]<<shift;
+      for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x) for (y=0;y<n_inner;y++) p[y*ps.y] = q[y*qs.y]<<shift;
     }
     else // depth < source.depth
     {
       short shift = source.depth - depth;
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y) for (y=0;y<size.y;y++) p[y] = q[y]>>shift;      
+      for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x) for (y=0;y<n_inner;y++) p[y*ps.y] = q[y*qs.y]>>shift;
     }
   }
   else
@@ -1805,19 +2601,28 @@ void Image::copy(const Image& source,Mask& m,bool fix_depth)
   
   if (bin<=1 && source.bin<=1)
   {
+    bool vector = isColumnMajor() && source.isColumnMajor();  // Strips are contiguous in memory
+    const ImageKernels& K = kernelsFor(false,source.depth);
     Rectangle safe = bounds * source.bounds;
+    MaskRun runs[MASK_RUN_BATCH];
+    int r,nr;
+    short *p,*q;
     m.start();
-    while (m.advance())
+    while ((nr = gatherRuns(m,safe,runs)) > 0)
     {
-      if (m.i().beyond( safe.far )) break;
-      if (m.i().before( safe.near )) continue;
-      y0 = (m.i().y0 < safe.near.y) ? safe.near.y : m.i().y0;
-      y1 = (m.i().y1 > safe.far.y) ? safe.far.y : m.i().y1;
-      if (y0<=y1)
+      for (r=0;r<nr;r++)
       {
-        if (!fix_depth) for (y=y0;y<=y1;y++) rare(m.i().x,y) = source.view(m.i().x,y);
-        else if (depth>source.depth) for (y=y0;y<=y1;y++) rare(m.i().x,y) = source.view(m.i().x,y)<<(depth-source.depth);
-        else /*depth<source.depth*/ for (y=y0;y<=y1;y++) rare(m.i().x,y) = source.view(m.i().x,y)>>(source.depth-depth);
+        p = pixelAt(*this,runs[r].x,runs[r].y0);
+        q = pixelAt(source,runs[r].x,runs[r].y0);
+        if (vector)
+        {
+          if (!fix_depth) memcpy(p,q,2*runs[r].n);
+          else if (depth>source.depth) K.shift[true](p,q,runs[r].n,depth-source.depth);
+          else K.shift[false](p,q,runs[r].n,source.depth-depth);
+        }
+        else if (!fix_depth) for (y=0;y<runs[r].n;y++) p[y*stride.y] = q[y*source.stride.y];
+        else if (depth>source.depth) for (y=0;y<runs[r].n;y++) p[y*stride.y] = q[y*source.stride.y]<<(depth-source.depth);
+        else /*depth<source.depth*/ for (y=0;y<runs[r].n;y++) p[y*stride.y] = q[y*source.stride.y]>>(source.depth-depth);
       }
     }
   }
@@ -1865,13 +2670,23 @@ void Image::adapt(Point where,const Image& im,Point size,int rate)
   if (imrate<0) { irlz=true; imrate = -imrate; }
   if (bin <= 1 && im.bin <= 1)
   {
+    bool x_inner = walkAlongX(im);
+    int n_outer = (x_inner) ? size.y : size.x;
+    int n_inner = (x_inner) ? size.x : size.y;
+    Point ps = walkSteps(*this,x_inner);
+    Point qs = walkSteps(im,x_inner);
     Point swhere = where - im.bounds.near;
     where -= bounds.near;
-    short *p = pixels + (where.x*this->size.y + where.y);
-    short *q = im.pixels + (swhere.x*im.size.y + swhere.y);
-    if (imrate==0) for (x=0;x<size.x;x++,p+=this->size.y,q+=im.size.y) for (y=0;y<size.x;y++) p[y] += q[y] - (p[y]>>rate);
-    else if (irlz) for (x=0;x<size.x;x++,p+=this->size.y,q+=im.size.y) for (y=0;y<size.x;y++) p[y] += (q[y]<<imrate) - (p[y]>>rate);
-    else for (x=0;x<size.x;x++,p+=this->size.y,q+=im.size.y) for (y=0;y<size.x;y++) p[y] += (q[y]>>imrate) - (p[y]>>rate);
+    short *p = pixels + (where.x*stride.x + where.y*stride.y);
+    short *q = im.pixels + (swhere.x*im.stride.x + swhere.y*im.stride.y);
+    if (ps.y==1 && qs.y==1)  // Contiguous runs, so vectorize (imrate of 0 is just a right shift by 0)
+    {
+      const ImageKernels& K = kernelsFor(false,im.depth);
+      for (x=0;x<n_outer;x++,p+=ps.x,q+=qs.x) K.adapt[irlz](p,q,n_inner,rate,imrate);
+    }
+    else if (imrate==0) for (x=0;x<n_outer;x++,p+=ps.x,q+=qs.x) for (y=0;y<n_inner;y++) p[y*ps.y] += q[y*qs.y] - (p[y*ps.y]>>rate);
+    else if (irlz) for (x=0;x<n_outer;x++,p+=ps.x,q+=qs.x) for (y=0;y<n_inner;y++) p[y*ps.y] += (q[y*qs.y]<<imrate) - (p[y*ps.y]>>rate);
+    else for (x=0;x<n_outer;x++,p+=ps.x,q+=qs.x) for (y=0;y<n_inner;y++) p[y*ps.y] += (q[y*qs.y]>>imrate) - (p[y*ps.y]>>rate);
   }
   else
   {
@@ -1901,18 +2716,23 @@ void Image::adapt(const Image& im,Mask &m,int rate)
   if (imrate<0) { irlz=true; imrate = -imrate; }
   if (bin<=1 && im.bin<=1)
   {
+    bool vector = isColumnMajor() && im.isColumnMajor();  // Strips are contiguous in memory
+    const ImageKernels& K = kernelsFor(false,im.depth);
     Rectangle safe = bounds * im.bounds;
+    MaskRun runs[MASK_RUN_BATCH];
+    int r,nr;
+    short *p,*q;
     m.start();
-    while (m.advance())
+    while ((nr = gatherRuns(m,safe,runs)) > 0)
     {
-      if (m.i().beyond( safe.far )) break;
-      if (m.i().before( safe.near )) continue;
-      y0 = (m.i().y0 < safe.near.y) ? safe.near.y : m.i().y0;
-      y1 = (m.i().y1 > safe.far.y) ? safe.far.y : m.i().y1;
-      if (y0>y1) continue;
-      if (imrate==0) for (y=y0;y<=y1;y++) rare(m.i().x,y) += im.view(m.i().x,y) - (rare(m.i().x,y)>>rate);
-      else if (irlz) for (y=y0;y<=y1;y++) rare(m.i().x,y) += (im.view(m.i().x,y)<<imrate) - (rare(m.i().x,y)>>rate);
-      else for (y=y0;y<=y1;y++) rare(m.i().x,y) += (im.view(m.i().x,y)>>imrate) - (rare(m.i().x,y)>>rate);
+      if (vector) for (r=0;r<nr;r++) K.adapt[irlz](pixelAt(*this,runs[r].x,runs[r].y0),pixelAt(im,runs[r].x,runs[r].y0),runs[r].n,rate,imrate);
+      else for (r=0;r<nr;r++)
+      {
+        p = pixelAt(*this,runs[r].x,runs[r].y0);
+        q = pixelAt(im,runs[r].x,runs[r].y0);
+        if (irlz) for (y=0;y<runs[r].n;y++) p[y*stride.y] += (q[y*im.stride.y]<<imrate) - (p[y*stride.y]>>rate);
+        else for (y=0;y<runs[r].n;y++) p[y*stride.y] += (q[y*im.stride.y]>>imrate) - (p[y*stride.y]>>rate);
+      }
     }
   }
   else
@@ -1954,31 +2774,43 @@ void Image::diffCopy(Point where,const Image& source,Point size,const Image& bg)
   int x,y;
   short gray = 1 << source.depth;
   short shift = (source.depth<bg.depth) ? bg.depth-source.depth : 0;
-  if (bin <= 1 && source.bin <= 1) // Fast shortcut--grab memory directly
+  if (bin <= 1 && source.bin <= 1 && isColumnMajor() && source.isColumnMajor() && bg.isColumnMajor()) // Fast shortcut--grab memory directly
   {
-    int shiftmask = 0xFFFF>>shift;
-    int dualgray = ((int)gray) | (((int)gray)<<16);
-    int dualshiftmask = shiftmask | (shiftmask<<16);
-
     Point swhere = where-source.bounds.near;
     Point bgwhere = where - bg.bounds.near;
     where -= bounds.near;
-    short *p = pixels + (where.x*this->size.y + where.y);
-    short *q = source.pixels + (swhere.x*source.size.y + swhere.y);
-    short *g = bg.pixels + (bgwhere.x*bg.size.y + bgwhere.y);
+    short *p = pixels + (where.x*stride.x + where.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y);
+    short *g = bg.pixels + (bgwhere.x*bg.stride.x + bgwhere.y);
+    
+    // Dividing is 2*fg/(fg+bg) . . . slower but better for large changes in background!  Otherwise it's just fg-bg.
+    const ImageKernels& K = kernelsFor(divide_bg,source.depth);
+    for (x=0 ; x<size.x ; x++ , q += source.stride.x , p += stride.x , g += bg.stride.x) K.diff[divide_bg](p,q,g,size.y,shift,source.depth);
+  }
+  else if (bin <= 1 && source.bin <= 1) // Strided views--grab memory directly, one pixel at a time
+  {
+    bool x_inner = walkAlongX(source);
+    int n_outer = (x_inner) ? size.y : size.x;
+    int n_inner = (x_inner) ? size.x : size.y;
+    Point ps = walkSteps(*this,x_inner);
+    Point qs = walkSteps(source,x_inner);
+    Point gs = walkSteps(bg,x_inner);
+    Point swhere = where-source.bounds.near;
+    Point bgwhere = where - bg.bounds.near;
+    where -= bounds.near;
+    short *p = pixels + (where.x*stride.x + where.y*stride.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y*source.stride.y);
+    short *g = bg.pixels + (bgwhere.x*bg.stride.x + bgwhere.y*bg.stride.y);
     
-    if (divide_bg)  // This is 2*fg/(fg+bg) . . . slower but better for large changes in background!
+    if (divide_bg)
     {
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y , g += bg.size.y) for (y=0;y<size.y;y++)
-          p[y] = ((1+(unsigned int)q[y])<<(source.depth+1)) / ((unsigned int)q[y] + (unsigned int)(g[y]>>shift) + 2);
-    }          
-    else  // This is just fg-bg . . . fast!  (Even faster when we use an int to do two short operations at once.)
+      for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x , g += gs.x) for (y=0;y<n_inner;y++)
+          p[y*ps.y] = ((1+(unsigned int)q[y*qs.y])<<(source.depth+1)) / ((unsigned int)q[y*qs.y] + (unsigned int)(g[y*gs.y]>>shift) + 2);
+    }
+    else
     {
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y , g += bg.size.y)
-      {
-        for (y=0;y<size.y-1;y+=2) *(int*)(p+y) = (dualgray + *(int*)(q+y)) - (((*(int*)(g+y))>>shift)&dualshiftmask);
-        for (;y<size.y;y++) p[y] = q[y] - (g[y]>>shift) + gray;
-      }
+      for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x , g += gs.x) for (y=0;y<n_inner;y++)
+          p[y*ps.y] = q[y*qs.y] - (g[y*gs.y]>>shift) + gray;
     }
   }
   else
@@ -2015,31 +2847,28 @@ void Image::diffCopy(const Image& source,Mask& m,const Image& bg)
   short shift = (source.depth<bg.depth) ? bg.depth-source.depth : 0;
   if (bin<=1 && source.bin<=1)
   {
-    int shiftmask = 0xFFFF>>shift;
-    int dualgray = ((int)gray) | (((int)gray)<<16);
-    int dualshiftmask = shiftmask | (shiftmask<<16);
-
+    bool vector = isColumnMajor() && source.isColumnMajor() && bg.isColumnMajor();  // Strips are contiguous in memory
+    const ImageKernels& K = kernelsFor(divide_bg,source.depth);
     Rectangle safe = bounds * source.bounds;
+    MaskRun runs[MASK_RUN_BATCH];
+    int r,nr;
+    short *p,*q,*g;
     m.start();
-    while (m.advance())
+    while ((nr = gatherRuns(m,safe,runs)) > 0)
     {
-      if (m.i().beyond( safe.far )) break;
-      if (m.i().before( safe.near )) continue;
-      y0 = (m.i().y0 < safe.near.y) ? safe.near.y : m.i().y0;
-      y1 = (m.i().y1 > safe.far.y) ? safe.far.y : m.i().y1;
-      if (y0<=y1)
+      for (r=0;r<nr;r++)
       {
-        if (divide_bg)
-          for (y=y0;y<=y1;y++)
+        p = pixelAt(*this,runs[r].x,runs[r].y0);
+        q = pixelAt(source,runs[r].x,runs[r].y0);
+        g = pixelAt(bg,runs[r].x,runs[r].y0);
+        if (vector) K.diff[divide_bg](p,q,g,runs[r].n,shift,source.depth);
+        else if (divide_bg)
+          for (y=0;y<runs[r].n;y++)
           {
-            I_fg = 1+(unsigned int)source.view(m.i().x,y);
-            rare(m.i().x,y) = (I_fg<<(source.depth+1)) / (1 + I_fg + (unsigned int)(bg.view(m.i().x,y)>>shift));
+            I_fg = 1+(unsigned int)q[y*source.stride.y];
+            p[y*stride.y] = (I_fg<<(source.depth+1)) / (1 + I_fg + (unsigned int)(g[y*bg.stride.y]>>shift));
           }
-        else
-        {
-          for (y=y0;y<y1;y++) rareI(m.i().x,y) = (dualgray + source.viewI(m.i().x,y)) - ((bg.viewI(m.i().x,y)>>shift)&dualshiftmask);
-          for (;y<=y1;y++) rare(m.i().x,y) = source.view(m.i().x,y) - (bg.view(m.i().x,y)>>shift) + gray;
-        }
+        else for (y=0;y<runs[r].n;y++) p[y*stride.y] = q[y*source.stride.y] - (g[y*bg.stride.y]>>shift) + gray;
       }
     }
   }
@@ -2094,76 +2923,48 @@ void Image::diffAdaptCopy(Point where,const Image& source,Point size,Image& bg,i
   short srcrate = rate - bg.depth + source.depth;  // Amount to bit shift each time we adapt
   bool sclz = false;  // Was srcrate less than zero?
   if (srcrate<0) { sclz=true; srcrate = -srcrate; }  // Yes, better use left shift instead of "negative right shift". 
-  if (bin <= 1 && source.bin <= 1 && bg.bin <= 1) // Fast shortcut--grab memory directly
-  {
-    // Variables for "vector" processing of two shorts at a time using ints
-    int shiftmask = 0xFFFF>>shift;
-    int ratemask = 0xFFFF>>rate;
-    int srcratemask = (sclz) ? 0 : ((0xFFFF>>srcrate)&0xFFFF);
-    int dualgray = ((int)gray) | (((int)gray)<<16);
-    int dualshiftmask = shiftmask | (shiftmask<<16);
-    int dualratemask = ratemask | (ratemask<<16);
-    int dualsrcratemask = srcratemask | (srcratemask<<16);
-    
-    // Other task-specific variables
+  if (bin <= 1 && source.bin <= 1 && bg.bin <= 1 && isColumnMajor() && source.isColumnMajor() && bg.isColumnMajor()) // Fast shortcut--grab memory directly
+  {
     Point swhere = where-source.bounds.near;
     Point bgwhere = where - bg.bounds.near;
     where -= bounds.near;
-    short *p = pixels + (where.x*this->size.y + where.y);
-    short *q = source.pixels + (swhere.x*source.size.y + swhere.y);
-    short *g = bg.pixels + (bgwhere.x*bg.size.y + bgwhere.y);
-    if (sclz)  // Background is deep--need to shift foreground left even given adaptation rate
+    short *p = pixels + (where.x*stride.x + where.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y);
+    short *g = bg.pixels + (bgwhere.x*bg.stride.x + bgwhere.y);
+    
+    // If the background is deep (sclz), the foreground is shifted left even given the adaptation rate, otherwise right
+    const ImageKernels& K = kernelsFor(divide_bg,source.depth);
+    for (x=0 ; x<size.x ; x++ , q += source.stride.x , p += stride.x , g+= bg.stride.x)
     {
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y , g+= bg.size.y)
-      {
-        if (divide_bg)
-        {
-          for (y=0;y<size.y;y++)
-          { 
-            g[y] += (q[y]<<srcrate) - (g[y]>>rate);
-            p[y] = ((1+(unsigned int)q[y])<<(source.depth+1)) / (2 + (unsigned int)q[y] + (unsigned int)(g[y]>>shift));
-          }
-        }
-        else
-        {
-          for (y=0;y<size.y-1;y+=2)  // Two at a time with ints
-          {
-            *((int*)(g+y)) = *((int*)(g+y)) + ((*(int*)(q+y))<<srcrate) - (((*(int*)(g+y))>>rate)&dualratemask);
-            *((int*)(p+y)) = (dualgray + *((int*)(q+y))) - (((*(int*)(g+y))>>shift)&dualshiftmask);
-          }
-          for (;y<size.y;y++)  // Finish up with shorts (leave as for loop in case we switch to 64 bit mode and use long longs above)
-          {
-            g[y] += (q[y]<<srcrate) - (g[y]>>rate);
-            p[y] = q[y] - (g[y]>>shift) + gray;
-          }
-        }
-      }
+      K.diffAdapt[divide_bg][sclz](p,q,g,size.y,shift,rate,srcrate,source.depth);
     }
-    else  // Need to shift foreground right before updating background.
+  }
+  else if (bin <= 1 && source.bin <= 1 && bg.bin <= 1) // Strided views--grab memory directly, one pixel at a time
+  {
+    bool x_inner = walkAlongX(source);
+    int n_outer = (x_inner) ? size.y : size.x;
+    int n_inner = (x_inner) ? size.x : size.y;
+    Point ps = walkSteps(*this,x_inner);
+    Point qs = walkSteps(source,x_inner);
+    Point gs = walkSteps(bg,x_inner);
+    Point swhere = where-source.bounds.near;
+    Point bgwhere = where - bg.bounds.near;
+    where -= bounds.near;
+    short *p = pixels + (where.x*stride.x + where.y*stride.y);
+    short *q = source.pixels + (swhere.x*source.stride.x + swhere.y*source.stride.y);
+    short *g = bg.pixels + (bgwhere.x*bg.stride.x + bgwhere.y*bg.stride.y);
+    short I,J;
+    for (x=0 ; x<n_outer ; x++ , q += qs.x , p += ps.x , g += gs.x)
     {
-      for (x=0 ; x<size.x ; x++ , q += source.size.y , p += this->size.y , g+= bg.size.y)
+      for (y=0;y<n_inner;y++)
       {
-        if (divide_bg)
-        {
-          for (y=0;y<size.y;y++)
-          {
-            g[y] += (q[y]>>srcrate) - (g[y]>>rate);
-            p[y] = ((1+(unsigned int)q[y])<<(source.depth+1)) / (2 + (unsigned int)q[y] + (unsigned int)(g[y]>>shift));
-          }
-        }
-	else
-        {
-          for (y=0;y<size.y-1;y+=2)  // Batch process with ints
-          {
-            *((int*)(g+y)) = *((int*)(g+y)) + (((*(int*)(q+y))>>srcrate)&dualsrcratemask) - (((*(int*)(g+y))>>rate)&dualratemask);
-            *((int*)(p+y)) = (dualgray + *((int*)(q+y))) - (((*(int*)(g+y))>>shift)&dualshiftmask);
-          }
-          for (;y<size.y;y++)  // Finish with shorts
-          { 
-            g[y] += (q[y]>>srcrate) - (g[y]>>rate);
-            p[y] = q[y] - (g[y]>>shift) + gray;
-          }
-        }
+        J = q[y*qs.y];
+        I = g[y*gs.y];
+        if (sclz) I += (J<<srcrate) - (I>>rate);
+        else I += (J>>srcrate) - (I>>rate);
+        g[y*gs.y] = I;
+        if (divide_bg) p[y*ps.y] = ((1+(unsigned int)J)<<(source.depth+1)) / (2 + (unsigned int)J + (unsigned int)(I>>shift));
+        else p[y*ps.y] = J - (I>>shift) + gray;
       }
     }
   }
@@ -2193,7 +2994,6 @@ void Image::diffAdaptCopy(const Image& source,Mask& m,Image& bg,int rate)
 {
   // Basic variables
   int y,y0,y1;
-  int x,I_fg;
   short gray = 1 << source.depth;
   short shift = (source.depth<bg.depth) ? bg.depth-source.depth : 0;
   short srcrate = rate - bg.depth + source.depth;
@@ -2203,74 +3003,36 @@ void Image::diffAdaptCopy(const Image& source,Mask& m,Image& bg,int rate)
   
   if (bin<=1 && source.bin<=1 && bg.bin<=1)
   {
-    // Variables for "vector" processing of two shorts at a time using ints
-    int shiftmask = 0xFFFF>>shift;
-    int ratemask = 0xFFFF>>rate;
-    int srcratemask = (sclz) ? 0 : ((0xFFFF>>srcrate)&0xFFFF);
-    int dualgray = ((int)gray) | (((int)gray)<<16);
-    int dualshiftmask = shiftmask | (shiftmask<<16);
-    int dualratemask = ratemask | (ratemask<<16);
-    int dualsrcratemask = srcratemask | (srcratemask<<16);  
-  
+    bool vector = isColumnMajor() && source.isColumnMajor() && bg.isColumnMajor();  // Strips are contiguous in memory
+    const ImageKernels& K = kernelsFor(divide_bg,source.depth);
+    short I,J;
     Rectangle safe = bounds * source.bounds * bg.bounds;
+    MaskRun runs[MASK_RUN_BATCH];
+    int r,nr;
+    short *p,*q,*g;
     
     m.start();
-    while (m.advance())
+    while ((nr = gatherRuns(m,safe,runs)) > 0)
     {
-      if (m.i().beyond( safe.far )) break;
-      if (m.i().before( safe.near )) continue;
-      y0 = (m.i().y0 < safe.near.y) ? safe.near.y : m.i().y0;
-      y1 = (m.i().y1 > safe.far.y) ? safe.far.y : m.i().y1;
-      if (y0>y1) continue;
-      x = m.i().x;
-      if (sclz)
-      {
-        if (divide_bg)
-        {
-          for (y=y0;y<=y1;y++)
-          {
-            bg.rare(x,y) += (source.view(x,y)<<srcrate) - (bg.rare(m.i().x,y)>>rate);
-            I_fg = 1+(unsigned int)source.view(x,y);
-            rare(x,y) = (I_fg<<(source.depth+1)) / ( 1 + I_fg + (unsigned int)(bg.rare(x,y)>>shift) );
-          }
-        }
-	else
-        {
-          for (y=y0;y<y1;y+=2) // "Vector" mode
-          {
-            bg.rareI(x,y) = (bg.rareI(x,y) + (source.viewI(x,y)<<srcrate)) - ((bg.rareI(x,y)>>rate)&dualratemask);
-            rareI(x,y) = (dualgray + source.viewI(x,y)) - ((bg.rareI(x,y)>>shift)&dualshiftmask);
-          }
-          for (;y<=y1;y++) // Individual mode to finish any danglers on the end
-	  {
-	    bg.rare(x,y) += (source.view(x,y)<<srcrate) - (bg.rare(x,y)>>rate);
-	    rare(x,y) = source.view(x,y) - (bg.rare(x,y)>>shift) + gray;
-          }
-	}
-      }
-      else
+      for (r=0;r<nr;r++)
       {
-        if (divide_bg)
+        p = pixelAt(*this,runs[r].x,runs[r].y0);
+        q = pixelAt(source,runs[r].x,runs[r].y0);
+        g = pixelAt(bg,runs[r].x,runs[r].y0);
+        if (vector)
         {
-          for (y=y0;y<=y1;y++)
-	  {
-	    bg.rare(m.i().x,y) += (source.view(m.i().x,y)>>srcrate) - (bg.rare(m.i().x,y)>>rate);
-            I_fg = 1+(unsigned int)source.view(m.i().x,y);
-            rare(m.i().x,y) = (I_fg<<(source.depth+1)) / ( 1 + I_fg + (unsigned int)(bg.rare(m.i().x,y)>>shift) );
-          }
+          K.diffAdapt[divide_bg][sclz](p,q,g,runs[r].n,shift,rate,srcrate,source.depth);
+          continue;
         }
-	else
+        for (y=0;y<runs[r].n;y++)
         {
-          for (y=y0;y<y1;y+=2) // "Vector" mode
-          {
-            bg.rareI(x,y) = (bg.rareI(x,y) + ((source.viewI(x,y)>>srcrate)&dualsrcratemask)) - ((bg.rareI(x,y)>>rate)&dualratemask);
-            rareI(x,y) = (dualgray + source.viewI(x,y)) - ((bg.rareI(x,y)>>shift)&dualshiftmask);
-          }
-          for (;y<=y1;y++) // Finish danglers
-          {
-            bg.rare(m.i().x,y) += (source.view(m.i().x,y)>>srcrate) - (bg.rare(m.i().x,y)>>rate);
-            rare(m.i().x,y) = source.view(m.i().x,y) - (bg.rare(m.i().x,y)>>shift) + gray;
-          }
+          J = q[y*source.stride.y];
+          I = g[y*bg.stride.y];
+          if (sclz) I += (J<<srcrate) - (I>>rate);
+          else I += (J>>srcrate) - (I>>rate);
+          g[y*bg.stride.y] = I;
+          if (divide_bg) p[y*stride.y] = ((1+(unsigned int)J)<<(source.depth+1)) / (2 + (unsigned int)J + (unsigned int)(I>>shift));
+          else p[y*stride.y] = J - (I>>shift) + gray;
         }
       }
     }
@@ -2440,7 +3202,7 @@ int Image::floodFind(Point pt,DualRange threshold,Storage< Stackable<Strip> > *s
     head->data.set(p.x,p.y,p.y,0);
     tail=head;
     
-    if (result!=NULL) result->stencil.flush();
+    if (result!=NULL) { result->stencil.flush(); result->has_moments = false; result->bits.forget(); }
     
     while (head!=NULL) floodLine(info,result,head,tail);
     
@@ -2456,50 +3218,36 @@ int Image::floodFind(Point pt,DualRange threshold,Storage< Stackable<Strip> > *s
 
 
 // Fill an entire image in some range
-int Image::floodRect(DualRange threshold,Storage< Stackable<Strip> > *stripstore,Storage< Listable<Strip> > *storemask,
-                     ManagedList<FloodData>& result,Rectangle rect)
+int Image::floodRect(DualRange threshold,ManagedList<FloodData>& result,Rectangle rect) const
 {
   Point pt;
-  FloodInfo info(this,stripstore);
-  FloodData* data;
-  Stackable<Strip> *head,*tail;
+  FloodRuns fr;
+  Range T;
   short I;
+  int i;
   int N_filled = 0;
   
   rect *= bounds;
-  info.T=threshold.keep;
-  if (info.T.lo()<1) info.T.lo()=1;
-  if (info.T.hi()<info.T.lo()) info.T.hi()=info.T.lo();
+  T=threshold.keep;
+  if (T.lo()<1) T.lo()=1;
+  if (T.hi()<T.lo()) T.hi()=T.lo();
   if (threshold.start.lo()<1) threshold.start.lo()=1;
   if (threshold.start.hi()<threshold.start.lo()) threshold.start.hi()=threshold.start.lo();
   
+  fr.label(*this,T);
+  
   for (pt.x = rect.near.x ; pt.x <= rect.far.x ; pt.x++)
   {
     for (pt.y = rect.near.y ; pt.y <= rect.far.y ; pt.y++)
     {
       I = get(pt);
       if (threshold.start.excludes(I)) continue;
+      i = fr.find(pt);
+      if (i<0 || fr.filled[i]) continue;
       
-      head = info.store->create();
-      head->next = NULL;
-      head->data.set(pt.x,pt.y,pt.y,0);
-      tail=head;
-      
-      data = new( result.Append() ) FloodData(storemask);
-      
-      info.freshen();
-      floodLine(info,data,head,tail);
-      if (data->stencil.lines.size>0) pt.y=data->stencil.lines.h().y1+1;  // Skip what we already filled
-      while (head!=NULL) floodLine(info,data,head,tail);
-      
-      if (info.pixel_count==0) result.Backspace();
-      else
-      {
-        data->centroid = FPoint( ((double)info.cx)/((double)info.sumI) , ((double)info.cy)/((double)info.sumI) );
-        data->stencil.sort();
-        data->stencil.findBounds();
-        N_filled++;
-      }
+      fr.fill( *this , i , T , new( result.Append() ) FloodData() );
+      pt.y = fr.runs[i].y1+1;  // Skip what we already filled
+      N_filled++;
     }
   }
   return N_filled;
@@ -2507,23 +3255,24 @@ int Image::floodRect(DualRange threshold,Storage< Stackable<Strip> > *stripstore
 
 
 // Fill an image starting from only the masked pieces
-int Image::floodMask(DualRange threshold,Storage< Stackable<Strip> > *stripstore,Storage< Listable<Strip> > *storemask,
-                     ManagedList<FloodData>& result,Mask &m)
+int Image::floodMask(DualRange threshold,ManagedList<FloodData>& result,Mask &m) const
 {
   Point pt;
-  FloodInfo info(this,stripstore);
-  FloodData* data;
-  Stackable<Strip> *head,*tail;
+  FloodRuns fr;
+  Range T;
   short I;
+  int i;
   int N_filled = 0;
   int y0,y1;
   
-  info.T=threshold.keep;
-  if (info.T.lo()<1) info.T.lo()=1;
-  if (info.T.hi()<info.T.lo()) info.T.hi()=info.T.lo();
+  T=threshold.keep;
+  if (T.lo()<1) T.lo()=1;
+  if (T.hi()<T.lo()) T.hi()=T.lo();
   if (threshold.start.lo()<1) threshold.start.lo()=1;
   if (threshold.start.hi()<threshold.start.lo()) threshold.start.hi()=threshold.start.lo();
   
+  fr.label(*this,T);
+  
   m.start();
   while (m.advance())
   {
@@ -2539,27 +3288,12 @@ int Image::floodMask(DualRange threshold,Storage< Stackable<Strip> > *stripstore
     {
       I = get(pt);
       if (threshold.start.excludes(I)) continue;
+      i = fr.find(pt);
+      if (i<0 || fr.filled[i]) continue;
       
-      head = info.store->create();
-      head->next = NULL;
-      head->data.set(pt.x,pt.y,pt.y,0);
-      tail=head;
-      
-      data = new( result.Append() ) FloodData(storemask);
-      
-      info.freshen();
-      floodLine(info,data,head,tail);
-      if (data->stencil.lines.size>0) pt.y=data->stencil.lines.h().y1+1;  // Skip what we already filled
-      while (head!=NULL) floodLine(info,data,head,tail);
-      
-      if (info.pixel_count==0) result.Backspace();
-      else
-      {
-        data->centroid = FPoint( ((double)info.cx)/((double)info.sumI) , ((double)info.cy)/((double)info.sumI) );
-        data->stencil.sort();
-        data->stencil.findBounds();        
-        N_filled++;
-      }
+      fr.fill( *this , i , T , new( result.Append() ) FloodData() );
+      pt.y = fr.runs[i].y1+1;
+      N_filled++;
     }
   }
   return N_filled;
@@ -2612,7 +3346,8 @@ int Image::writeTiff(FILE *f)
   unsigned char header[(46 + 10*sizeof(TiffIFD)) << 2];  // Way more space than we need
   unsigned char* data;
   
-  if (bin<=1 && depth>8)
+  bool borrowed = (bin<=1 && depth>8 && isColumnMajor() && stride.x==size.y);  // Can write our own memory as is
+  if (borrowed)
   {
     data = (unsigned char*)pixels;
     pixbytes = bounds.area() * sizeof(short);
@@ -2652,7 +3387,7 @@ int Image::writeTiff(FILE *f)
   x = fwrite(header,i,1,f);
   y = fwrite(data,1,pixbytes,f);
   
-  if (!(bin<=1)) delete[] data;
+  if (!borrowed) delete[] data;
   
   if (x!=1 || y !=pixbytes) return 1;
 
@@ -2672,6 +3407,35 @@ int Image::writeTiff(const char *fname)
 }
 
 
+// Binary dump of an image, for checkpoints--only works for images laid out the way they are when we own them
+bool Image::writeState(FILE *f) const
+{
+  if (pixels==NULL || stride.x!=size.y || stride.y!=1) return false;
+  if (!dumpRaw(f,bounds) || !dumpRaw(f,size) || !dumpRaw(f,bin) || !dumpRaw(f,depth) || !dumpRaw(f,divide_bg)) return false;
+  int n = size.x*size.y;
+  return (int)fwrite(pixels,sizeof(short),n,f) == n;
+}
+
+// Create a new image from a binary dump
+Image* Image::readState(FILE *f)
+{
+  Rectangle r;
+  Point sz;
+  short b,d;
+  bool algo;
+  if (!undumpRaw(f,r) || !undumpRaw(f,sz) || !undumpRaw(f,b) || !undumpRaw(f,d) || !undumpRaw(f,algo)) return NULL;
+  if (sz.x<1 || sz.y<1 || sz.x*sz.y > r.area()) return NULL;
+  Image* im = new Image(r,algo);
+  im->size = sz;
+  im->stride = Point(sz.y,1);
+  im->bin = b;
+  im->depth = d;
+  int n = sz.x*sz.y;
+  if ((int)fread(im->pixels,sizeof(short),n,f) != n) { delete im; return NULL; }
+  return im;
+}
+
+
 
 /****************************************************************
                     Unit Test-Style Functions
@@ -2720,11 +3484,10 @@ int test_mwt_image_mask()
 {
   Ellipse ellip( Point(1,2) , 3 );
   ManagedList<Point> mlp(16),mlp1(16),mlp2(16),mlp3(16);
-  Storage< Listable<Strip> > stor(16);
   Mask m1(32);
-  Mask m2(&stor);
-  Mask m3(Rectangle(Point(0,0),Point(5,5)),&stor);
-  Mask m4(ellip,&stor);
+  Mask m2;
+  Mask m3(Rectangle(Point(0,0),Point(5,5)));
+  Mask m4(ellip);
   Mask m5(16);
   Mask m6(7);
   
@@ -2828,6 +3591,35 @@ int test_mwt_image_mask()
   m4.rectangularize( Rectangle( Point(rect.near.x+1,rect.near.y) , Point(rect.far.x-1,rect.far.y) ) );
   if (m4.overlapRatio(m3) != FPoint(1.0,1.0)) return 16;
   
+  m5.flush();
+  for (int i=9 ; i>=0 ; i--) m5.pushStrip( Strip(i,0,i) );
+  m5.start();
+  m5.advance();
+  m5.advance();
+  m5.Delete();
+  if (m5.i().x != 2 || m5.lines.size != 9 || m5.pixel_count != 53) return 17;
+  if (!m5.contains(Point(7,7)) || m5.contains(Point(7,8)) || m5.contains(Point(1,0)) || m5.contains(Point(10,0))) return 18;
+  
+  FloodData fa,fb;
+  fa.stencil.ellipticize( Ellipse( Point(20,40) , Point(12,50) ) );  // Columns more than a word tall, not word-aligned with fb
+  fb.stencil.rectangularize( Rectangle( Point(15,3) , Point(40,70) ) );
+  fb.stencil -= Rectangle( Point(18,20) , Point(22,60) );
+  if (fa.packedStencil()==NULL || fb.packedStencil()==NULL) return 19;
+  if (fa.overlapRatio(fb) != fa.stencil.overlapRatio(fb.stencil) || !fa.overlaps(fb)) return 19;
+  fb.stencil += Point(13,0);
+  if (fb.overlapRatio(fa) != fb.stencil.overlapRatio(fa.stencil) || fb.overlaps(fa) != fb.stencil.overlaps(fa.stencil)) return 20;
+  fb.stencil += Point(20,0);
+  if (fa.overlaps(fb) || fa.overlapRatio(fb) != FPoint(0,0)) return 20;
+  fb.stencil.rectangularize( Rectangle( Point(0,0) , Point(999,299) ) );  // Too big, so strips are used
+  if (fb.packedStencil()!=NULL || fa.overlapRatio(fb) != fa.stencil.overlapRatio(fb.stencil)) return 21;
+  
+  // Moving a strip in the middle keeps the pixel count, the number of strips and the ends, but must still be noticed
+  fb.stencil.rectangularize( Rectangle( Point(20,30) , Point(30,50) ) );
+  if (fb.packedStencil()==NULL || fb.overlapRatio(fa).x != 1.0) return 22;
+  fb.stencil.ii(5) += Point(0,100);
+  fb.stencil.lines.touch();
+  if (fb.overlapRatio(fa) != fb.stencil.overlapRatio(fa.stencil) || fa.overlapRatio(fb) != fa.stencil.overlapRatio(fb.stencil)) return 22;
+  
   return 0;
 }
 
@@ -2844,6 +3636,7 @@ int test_mwt_image_contour()
   m.start();
   m.advance(); m.advance(); m.advance();
   m.i().y0 = 7; m.i().y1 = 8;
+  m.lines.touch();
   
   Contour c( m );
   if (c.size()!=15) return 1;
@@ -2869,7 +3662,6 @@ int test_mwt_image_image()
   int x,y;
   Mask m(32);
   Storage< Stackable<Strip> > ssstor(32);
-  Storage< Listable<Strip> > slstor(32);
   ManagedList<FloodData> mlfd(32,true);
   Image im1(Point(10,11),false),im2(Point(6,6),false);
   im1 = 0;
@@ -2905,24 +3697,24 @@ int test_mwt_image_image()
   }
   im1.diffCopy(im1,m,im1);  // bg subtraction of self == set pixels to 64 in mask
   im1.set(3,3 , 38);
-  x = im1.floodRect( DualRange(40,180,40,180) , &ssstor , &slstor , mlfd , im1.getBounds() );
+  x = im1.floodRect( DualRange(40,180,40,180) , mlfd , im1.getBounds() );
   printf("%d %d\n",x,mlfd.h().stencil.pixel_count);
   if (x != 1 || mlfd.h().stencil.pixel_count!=19) return 5;
   
   //mlfd.flush();
   im1 = 0;
   im2 = 5;
-  Mask m2(Rectangle(Point(2,2),Point(7,7)),&slstor);
+  Mask m2(Rectangle(Point(2,2),Point(7,7)));
   im1.copy(im2,m2);
   for (x=0;x<10;x++) for (y=0;y<11;y++) { if ((y<2 || y>8 || x<2 || x>8) && (im1.get(x,y)==5)) return 6; }
   
   im3 = 55;
-  Mask m3(Rectangle(Point(3,3),Point(6,6)),&slstor);
+  Mask m3(Rectangle(Point(3,3),Point(6,6)));
   im3.adapt(im2,m3,3);
   if (im3.get(2,2)!=55 || im3.get(3,3)!=49 || im3.get(6,6)!=49 || im3.get(7,7)!=55) return 7;
   
-  Mask m4(Rectangle(Point(4,4),Point(5,5)),&slstor);
-  Mask m5(Rectangle(Point(2,2),Point(3,3)),&slstor);
+  Mask m4(Rectangle(Point(4,4),Point(5,5)));
+  Mask m5(Rectangle(Point(2,2),Point(3,3)));
   Image im4( im1.size*2, false );
   Image im5( im2 , im2.getBounds(), false );
   Image im6( im3 , im3.getBounds(), false );
@@ -2949,7 +3741,7 @@ int test_mwt_image_image()
   
   im1.diffCopy(im1,m,im1);
   im1.set(3,3 , 38);
-  x = im1.floodMask( DualRange(40,180,40,180) , &ssstor , &slstor , mlfd , m3 );
+  x = im1.floodMask( DualRange(40,180,40,180) , mlfd , m3 );
   if (x != 1 || mlfd.t().stencil.pixel_count!=19 || mlfd.size!=2) return 14;
   mlfd.t().principalAxes(im1,Range(40,180));
   
@@ -3017,7 +3809,108 @@ int test_mwt_image_image()
 #ifdef UNIT_TEST_OWNER
   im1.writeTiff("test_bin3.tiff");
 #endif
+
+  // Row-major view of someone else's memory should behave just like a normal image
+  short rowbuf[6*5];
+  for (x=0;x<6*5;x++) rowbuf[x] = x;
+  Image rim(rowbuf,Point(5,4),6,false);
+  rim.depth = 8;
+  if (rim.isColumnMajor() || rim.get(3,2) != 2*6+3) return 26;
+  Image cim(Point(5,4),false);
+  cim.depth = 8;
+  cim.copy(rim);
+  for (x=0;x<5;x++) for (y=0;y<4;y++) if (cim.get(x,y) != y*6+x) return 27;
+  Image dim(Point(5,4),false);
+  dim.depth = 8;
+  dim = 2;
+#ifndef DIVIDE_BG
+  cim.diffCopy(Point(0,0),rim,rim.size,dim);
+  for (x=0;x<5;x++) for (y=0;y<4;y++) if (cim.get(x,y) != y*6+x - 2 + (1<<rim.depth)) return 28;
+  cim.depth = 8;
+  rim.diffAdaptCopy(Point(0,0),cim,cim.size,dim,2);
+  for (x=0;x<5;x++) for (y=0;y<4;y++) if (rim.get(x,y) != cim.get(x,y) - dim.get(x,y) + (1<<cim.depth)) return 29;
+#endif
+  if (rowbuf[5] != 5 || rowbuf[11] != 11) return 30;
   
+  // Labeling runs must find the same pieces, in the same order, with the same centroids, as filling from each start pixel,
+  // without touching the image (here a read-only, row-major view of someone else's memory)
+  {
+    short lab_pixels[47*39];
+    Image lab_view(lab_pixels,Point(47,39),47,false), ref(Point(47,39),false);
+    const Image& lab = lab_view;
+    DualRange hysteresis(150,255,60,255);
+    Mask ring(64);
+    ring.ellipticize( Ellipse( Point(23,19) , Point(17,15) ) );
+    for (int pass=0;pass<2;pass++)
+    {
+      unsigned int seed = 42;
+      for (x=0;x<47;x++) for (y=0;y<39;y++)
+      {
+        seed = seed*1103515245u + 12345u;
+        lab_view.set(x,y , (short)(((seed>>8)&0xFF) * (1 + (x/8+y/9)%2) / 2));
+      }
+      ref.copy(lab);
+      ManagedList<FloodData> got(16,true), want(16,true);
+      if (pass==0) x = lab.floodRect( hysteresis , got , lab.getBounds() );
+      else x = lab.floodMask( hysteresis , got , ring );
+      
+      Mask scan(64);
+      if (pass==0) scan.rectangularize( lab.getBounds() );
+      else scan.imitate(ring);
+      scan.start();
+      while (scan.advance()) for (y=scan.i().y0;y<=scan.i().y1;y++)
+      {
+        if (ref.get(scan.i().x,y)<=0 || hysteresis.start.excludes(ref.get(scan.i().x,y))) continue;
+        FloodData* fd = new( want.Append() ) FloodData();
+        if (ref.floodFind( Point(scan.i().x,y) , hysteresis , &ssstor , fd )==0) want.Backspace();
+      }
+      
+      if (x != want.size || got.size != want.size || want.size < 2) return 31;
+      got.start();
+      want.start();
+      while (got.advance() && want.advance())
+      {
+        if (got.i().centroid.x != want.i().centroid.x || got.i().centroid.y != want.i().centroid.y) return 32;
+        if (got.i().stencil.pixel_count != want.i().stencil.pixel_count || got.i().stencil.bounds != want.i().stencil.bounds) return 32;
+        got.i().stencil.start();
+        want.i().stencil.start();
+        while (got.i().stencil.advance() && want.i().stencil.advance()) if (got.i().stencil.i() != want.i().stencil.i()) return 32;
+        
+        // Moments kept while labeling must give the same axes as going back over the pixels
+        if (!got.i().has_moments || want.i().has_moments) return 34;
+        got.i().principalAxes(lab,hysteresis.keep);
+        want.i().principalAxes(ref,hysteresis.keep);
+        if ((got.i().major-want.i().major).length() > 1e-4*(1+want.i().major.length())) return 34;
+        if ((got.i().minor-want.i().minor).length() > 1e-4*(1+want.i().minor.length())) return 34;
+        if (got.i().long_axis != want.i().long_axis || got.i().short_axis != want.i().short_axis) return 34;
+      }
+      for (x=0;x<47;x++) for (y=0;y<39;y++) if (lab.get(x,y) != ((ref.get(x,y)<0) ? -ref.get(x,y) : ref.get(x,y))) return 33;
+    }
+  }
+  
+  // A piece that doubles back from the last (or first) column: the line fill doesn't look back from there,
+  // so filling from (0,0) finds 8 of these 10 pixels, leaving (1,4) and (1,5) for a second piece.  Run labeling must agree.
+  {
+    DualRange hysteresis(150,255,60,255);
+    for (int flip=0;flip<2;flip++)
+    {
+      Image hook(Point(3,6),false);
+      hook = 0;
+      for (y=0;y<6;y++) hook.set(flip?0:2 , y , 200);
+      hook.set(flip?2:0 , 0 , 200);
+      hook.set(1,0 , 200);
+      hook.set(1,4 , 200);
+      hook.set(1,5 , 200);
+      ManagedList<FloodData> got(4,true);
+      x = hook.floodRect( hysteresis , got , hook.getBounds() );
+      if (flip==0 && (x!=2 || got.h().stencil.pixel_count!=8 || got.t().stencil.pixel_count!=2)) return 35;
+      if (flip==1 && (x!=1 || got.h().stencil.pixel_count!=10)) return 35;
+      FloodData fd;
+      if (hook.floodFind( Point(flip?2:0,0) , hysteresis , &ssstor , &fd ) != 8) return 35;
+      if (hook.get(1,5) != 200) return 35;
+    }
+  }
+
 #ifdef BENCHMARK
   Image huge_image(Point(1536,2048));
   Image big_image(Point(600,800));
@@ -3042,9 +3935,166 @@ int test_mwt_image_image()
   return 0;
 }
 
+// Random pixels below 2^bits, from a little generator of our own so every platform gets the same ones
+static void kernel_test_fill(Image& im,int bits,unsigned int& seed)
+{
+  for (int x=im.bounds.near.x;x<=im.bounds.far.x;x++) for (int y=im.bounds.near.y;y<=im.bounds.far.y;y++)
+  {
+    seed = seed*1103515245u + 12345u;
+    im.set(x,y , (short)((seed>>8) & ((1u<<bits)-1)));
+  }
+}
+
+// What diffCopy and diffAdaptCopy should give, one pixel at a time
+static short kernel_test_diff(short J,short I,int shift,int depth,bool divide)
+{
+  if (divide) return ((1+(unsigned int)J)<<(depth+1)) / (2 + (unsigned int)J + (unsigned int)(I>>shift));
+  return J - (I>>shift) + (1<<depth);
+}
+
+// Every vector instruction set the CPU has must give what the one-pixel-at-a-time code gives, bit for bit
+int test_mwt_image_kernels()
+{
+  SimdLevel best = setSimdLevel(simd_avx512);
+  if (setSimdLevel(simd_none)!=simd_none) return 9;
+  
+  unsigned int seed = 1234;
+  const int depths[3] = { 8 , 10 , 12 };  // Division is done in floating point only up to 11 bits
+  const int rates[2] = { 3 , 9 };         // Foreground shifted left, then right, to adapt a 15-bit background
+  Point where(3,2), size(33,41);
+  Mask m(64);
+  m.ellipticize( Ellipse( Point(20,22) , Point(15,19) ) );
+  
+  for (int level=simd_none ; level<=best ; level++)
+  {
+    if (setSimdLevel((SimdLevel)level)!=level) return 9;
+    for (int k=0;k<6;k++)
+    {
+      int d = depths[k%3];
+      int rate = rates[k/3];
+      for (int divide=0;divide<2;divide++)
+      {
+        Image src(Point(40,45),divide!=0), bg(Point(40,45),divide!=0), out(Point(40,45),divide!=0);
+        Image bg0(Point(40,45),false), out0(Point(40,45),false);
+        src.depth = d; bg.depth = bg0.depth = 15; out.depth = out0.depth = d+1;
+        kernel_test_fill(src,d,seed);
+        kernel_test_fill(bg0,15,seed);
+        kernel_test_fill(out0,d,seed);
+        int shift = 15-d;
+        int srcrate = rate-15+d;
+        int x,y;
+        short I;
+        
+        // copy, shifting up to match the deeper image
+        out.copy(out0); bg.copy(bg0);
+        bg.copy(where,src,size,true);
+        for (x=0;x<40;x++) for (y=0;y<45;y++)
+        {
+          I = (x>=where.x && x<where.x+size.x && y>=where.y && y<where.y+size.y) ? (src.get(x,y)<<shift) : bg0.get(x,y);
+          if (bg.get(x,y)!=I) return 1;
+        }
+        bg.copy(bg0);
+        bg.copy(src,m,true);
+        m.start();
+        while (m.advance()) for (y=m.i().y0;y<=m.i().y1;y++) if (bg.get(m.i().x,y) != (src.get(m.i().x,y)<<shift)) return 2;
+        
+        // adapt
+        bg.copy(bg0);
+        bg.adapt(where,src,size,rate);
+        for (x=where.x;x<where.x+size.x;x++) for (y=where.y;y<where.y+size.y;y++)
+        {
+          I = bg0.get(x,y);
+          I += ((srcrate<0) ? (src.get(x,y)<<(-srcrate)) : (src.get(x,y)>>srcrate)) - (I>>rate);
+          if (bg.get(x,y)!=I) return 3;
+        }
+        bg.copy(bg0);
+        bg.adapt(src,m,rate);
+        m.start();
+        while (m.advance()) for (y=m.i().y0;y<=m.i().y1;y++)
+        {
+          I = bg0.get(m.i().x,y);
+          I += ((srcrate<0) ? (src.get(m.i().x,y)<<(-srcrate)) : (src.get(m.i().x,y)>>srcrate)) - (I>>rate);
+          if (bg.get(m.i().x,y)!=I) return 4;
+        }
+        
+        // diffCopy
+        bg.copy(bg0);
+        out.diffCopy(where,src,size,bg);
+        for (x=where.x;x<where.x+size.x;x++) for (y=where.y;y<where.y+size.y;y++)
+        {
+          if (out.get(x,y) != kernel_test_diff(src.get(x,y),bg0.get(x,y),shift,d,divide!=0)) return 5;
+        }
+        out.copy(out0);
+        out.diffCopy(src,m,bg);
+        m.start();
+        while (m.advance()) for (y=m.i().y0;y<=m.i().y1;y++)
+        {
+          if (out.get(m.i().x,y) != kernel_test_diff(src.get(m.i().x,y),bg0.get(m.i().x,y),shift,d,divide!=0)) return 6;
+        }
+        
+        // diffAdaptCopy
+        out.diffAdaptCopy(where,src,size,bg,rate);
+        for (x=where.x;x<where.x+size.x;x++) for (y=where.y;y<where.y+size.y;y++)
+        {
+          I = bg0.get(x,y);
+          I += ((srcrate<0) ? (src.get(x,y)<<(-srcrate)) : (src.get(x,y)>>srcrate)) - (I>>rate);
+          if (bg.get(x,y)!=I || out.get(x,y)!=kernel_test_diff(src.get(x,y),I,shift,d,divide!=0)) return 7;
+        }
+        bg.copy(bg0);
+        out.diffAdaptCopy(src,m,bg,rate);
+        m.start();
+        while (m.advance()) for (y=m.i().y0;y<=m.i().y1;y++)
+        {
+          I = bg0.get(m.i().x,y);
+          I += ((srcrate<0) ? (src.get(m.i().x,y)<<(-srcrate)) : (src.get(m.i().x,y)>>srcrate)) - (I>>rate);
+          if (bg.get(m.i().x,y)!=I || out.get(m.i().x,y)!=kernel_test_diff(src.get(m.i().x,y),I,shift,d,divide!=0)) return 8;
+        }
+      }
+    }
+  }
+  
+  setSimdLevel(best);
+  
+  // Masks with more strips than are handled in one batch, on column-major and row-major images alike
+  Mask many(1024);
+  for (int x=1;x<300;x++) { many.addStrip(x,1,3+x%7); many.addStrip(x,20,20+x%30); }
+  many.findBounds();
+  short row_major[302*56];
+  Image cm(Point(302,56),false), rm(row_major,Point(302,56),302,false);
+  for (int k=0;k<302*56;k++) row_major[k] = 1;
+  cm.set(cm.getBounds(),1);
+  cm.set(many,7);
+  rm.set(many,7);
+  for (int x=0;x<302;x++) for (int y=0;y<56;y++)
+  {
+    short I = (x>=1 && x<300 && ((y>=1 && y<=3+x%7) || (y>=20 && y<=20+x%30))) ? 7 : 1;
+    if (cm.get(x,y)!=I || rm.get(x,y)!=I) return 10;
+  }
+  
+  Image src(Point(302,56),false), bg_cm(Point(302,56),false), out_cm(Point(302,56),false);
+  short bg_row[302*56], out_row[302*56];
+  Image bg_rm(bg_row,Point(302,56),302,false), out_rm(out_row,Point(302,56),302,false);
+  src.depth = 10; bg_cm.depth = bg_rm.depth = 15; out_cm.depth = out_rm.depth = 11;
+  kernel_test_fill(src,10,seed);
+  kernel_test_fill(bg_cm,15,seed);
+  bg_rm.copy(bg_cm);
+  out_cm.set(out_cm.getBounds(),0);
+  out_rm.set(out_rm.getBounds(),0);
+  out_cm.diffAdaptCopy(src,many,bg_cm,5);
+  out_rm.diffAdaptCopy(src,many,bg_rm,5);
+  for (int x=0;x<302;x++) for (int y=0;y<56;y++)
+  {
+    if (out_cm.get(x,y)!=out_rm.get(x,y) || bg_cm.get(x,y)!=bg_rm.get(x,y)) return 11;
+    if ((cm.get(x,y)==7) != (out_cm.get(x,y)!=0)) return 11;
+  }
+  
+  return 0;
+}
+
 int test_mwt_image()
 {
-  return test_mwt_image_strip() + 100*test_mwt_image_mask() + 10000*test_mwt_image_contour() + 1000000*test_mwt_image_image();
+  return test_mwt_image_strip() + 100*test_mwt_image_mask() + 10000*test_mwt_image_contour() + 1000000*test_mwt_image_image()
+    + 100000000*test_mwt_image_kernels();
 }
 
 #ifdef UNIT_TEST_OWNER
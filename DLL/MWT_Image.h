@@ -67,6 +67,115 @@ inline Strip operator+(const Point& p,const Strip& s) { return s+p; }
 
 
 
+/****************************************************************
+                    A Growable Array of Strips
+****************************************************************/
+
+/* NOTE **
+        * Strips sit side by side in one block of memory, with room kept
+        * before the first one so that Push is as cheap as Append.  The
+        * iterator is an index that walks just like ManagedList's, with
+        * -1 playing the part of NULL.  Taking a strip out of the middle
+        * shifts all the ones after it, so Mask builds the result of a set
+        * operation in a second array and swaps it in instead.
+** NOTE **
+        * changes goes up whenever the strips are altered by a method that
+        * adds, removes, reorders or swaps them.  The accessors leave it
+        * alone, so reading costs nothing and is safe from several threads;
+        * code that writes a strip in place through one must call touch().
+** NOTE */
+
+// Contiguous list of strips with a ManagedList-style iterator
+class StripArray
+{
+public:
+  Strip* data;   // Allocated space
+  Strip* base;   // First strip (somewhere inside data)
+  int room;      // Number of strips that fit in data
+  int size;
+  int current;   // Index of current strip, or -1 for none
+  unsigned int changes;  // Goes up every time the strips may have changed
+  
+  StripArray(int n=0) : data(NULL),base(NULL),room(0),size(0),current(-1),changes(0) { if (n>0) makeRoom(0,n); }
+  ~StripArray() { if (data!=NULL) free(data); }
+  
+  void makeRoom(int front,int back);  // Make space for this many more strips before and after the ones we have
+  void swap(StripArray& sa);
+  void imitate(const StripArray& sa);
+  void remove(int k);
+  void sort();  // Stable merge sort
+  inline void flush() { base = data; size = 0; current = -1; changes++; }
+  inline void touch() { changes++; }
+  
+  // Access by position or by iterator
+  inline Strip& operator[](int k) { return base[k]; }
+  inline const Strip& operator[](int k) const { return base[k]; }
+  inline Strip& h() { return base[0]; }
+  inline const Strip& h() const { return base[0]; }
+  inline Strip& t() { return base[size-1]; }
+  inline const Strip& t() const { return base[size-1]; }
+  inline Strip& i() { return base[current]; }
+  inline const Strip& i() const { return base[current]; }
+  
+  // Moving through the strips; the versions taking an index leave our iterator alone
+  inline void start() { current = -1; }
+  inline void start(int& k) const { k = -1; }
+  inline bool advance() { return advance(current); }
+  inline bool advance(int& k) const { if (k+1 >= size) return false; k++; return true; }
+  inline bool retreat() { return retreat(current); }
+  inline bool retreat(int& k) const { if (k<0) return false; k--; return (k>=0); }
+  inline void end() { current = size-1; }
+  inline void Backspace() { remove(current); current--; }
+  inline void Delete() { remove(current); if (current>=size) current = -1; }
+  
+  // Adding strips (copy first in case s is one of ours and we move)
+  inline Strip* Append()
+  {
+    changes++;
+    if (base+size >= data+room) makeRoom(0,1);
+    return base + (size++);
+  }
+  inline Strip* Append(const Strip& s) { Strip c = s; Strip* p = Append(); *p = c; return p; }
+  inline Strip* Push()
+  {
+    changes++;
+    if (base==data) makeRoom(1,0);
+    base--;
+    size++;
+    if (current>=0) current++;
+    return base;
+  }
+  inline Strip* Push(const Strip& s) { Strip c = s; Strip* p = Push(); *p = c; return p; }
+  
+  // First strip at or past column x (strips must be sorted)
+  int findColumn(int x) const
+  {
+    int lo = 0;
+    int hi = size;
+    while (lo < hi)
+    {
+      int mid = (lo+hi)>>1;
+      if (base[mid].x < x) lo = mid+1;
+      else hi = mid;
+    }
+    return lo;
+  }
+  
+  // Total number of pixels
+  int pixels() const
+  {
+    int n = 0;
+    for (int k=0 ; k<size ; k++) n += base[k].length();
+    return n;
+  }
+
+private:
+  StripArray(const StripArray& sa);  // Not copyable--use imitate or swap
+  StripArray& operator=(const StripArray& sa);
+};
+
+
+
 /****************************************************************
                          An Image Mask
 ****************************************************************/
@@ -81,42 +190,36 @@ inline Strip operator+(const Point& p,const Strip& s) { return s+p; }
         * a new mask that is formed from two others, use imitate() on the
         * first and then the +=, -=, etc. set of operators.
 ** NOTE **
-        * The internal lines iterator is used by the overlap/contains
-        * functions.  Make your own Listable<Strip> if you want one
-        * that will be preserved across calls.
+        * The internal lines iterator is used by the contains functions.
+        * Use an int index with lines.advance(k) if you want one that will
+        * be preserved across calls.
+** NOTE **
+        * Strips are kept in a StripArray, which allocates for itself, so
+        * masks need no Storage.
 *********/
 
 // Strips of pixels designating the extent of an object or image mask
 class Mask
 {
 public:
-  ManagedList<Strip> lines;
+  StripArray lines;
   int pixel_count;
   Rectangle bounds;
   
   // Create empty masks or those with a geometrical shape
-  Mask(int nlines) : lines(nlines,false),pixel_count(0) { }
-  Mask(Storage< Listable<Strip> >* store) : lines(store),pixel_count(0) { }
-  Mask(const Rectangle& rect , Storage< Listable<Strip> >* store);
-  Mask(const Ellipse& ellip , Storage< Listable<Strip> >* store);
-  Mask(const Mask& existing , ManagedList<Strip>::CreationType action) // Careful with this one!  Shares storage with existing.
-    : lines(existing.lines,action)
-  {
-    if (action==ManagedList<Strip>::SubordinateCopy)
-    {
-      pixel_count = existing.pixel_count;
-      bounds = existing.bounds;
-    }
-    else pixel_count = 0;
-  }
+  Mask(int nlines=0) : lines(nlines),pixel_count(0) { }
+  Mask(const Rectangle& rect);
+  Mask(const Ellipse& ellip);
   ~Mask() { }
   
-  // Shallow transfer of lines
-  Mask& operator=(Mask& m) { lines=m.lines; pixel_count=m.pixel_count; bounds=m.bounds; return *this; }
+  // Transfer of lines (m is left empty)
+  Mask& operator=(Mask& m) { lines.swap(m.lines); m.lines.flush(); pixel_count=m.pixel_count; bounds=m.bounds; m.pixel_count=0; return *this; }
   // Deep copy of lines
   Mask& imitate(const Mask& m) { lines.imitate(m.lines); pixel_count=m.pixel_count; bounds=m.bounds; return *this; }
   // Throw away all lines
   inline void flush() { lines.flush(); pixel_count = 0; }
+  // Replace our strips with those in sa (which gets our old ones) and recount pixels
+  inline void takeStrips(StripArray& sa) { lines.swap(sa); lines.start(); pixel_count = lines.pixels(); }
   
   // Methods to make mask adopt geometrical shapes
   void rectangularize(const Rectangle& rect);
@@ -125,7 +228,9 @@ public:
   // Shortcut methods for moving through and removing the strips in the mask
   inline void start() { lines.start(); }
   inline Strip& i() { return lines.i(); }
-  inline Strip& ii(Listable<Strip>* ls) { return ls->data; }  // Syntactic sugar for using a separate iterator
+  inline const Strip& i() const { return lines.i(); }
+  inline Strip& ii(int k) { return lines[k]; }  // Syntactic sugar for using a separate iterator
+  inline const Strip& ii(int k) const { return lines[k]; }
   inline bool advance() { return lines.advance(); }
   inline bool retreat() { return lines.retreat(); }
   inline void end() { lines.end(); }
@@ -156,7 +261,7 @@ public:
     s.set(x,y0,y1);
     pixel_count += s.length();
   }
-  inline void sort() { lines.mergeSort(); }
+  inline void sort() { lines.sort(); }
   
   // Handy utility classes
   void findBounds(); // Finds bounding box
@@ -171,15 +276,15 @@ public:
   int contains(ManagedList<Point>& to_test,ManagedList<Point>& inside);  // Everything starts in to_test, those remaining are out
   
   // See if there is any overlap at all
-  bool overlaps(Mask& m,Point offset);
-  bool overlaps(Mask& m) { return overlaps(m,Point(0,0)); }
+  bool overlaps(const Mask& m,Point offset) const;
+  bool overlaps(const Mask& m) const { return overlaps(m,Point(0,0)); }
   
   // Return (fraction we are overlapped by them , fraction they are overlapped by us)
-  FPoint overlapRatio(Mask& m);
+  FPoint overlapRatio(const Mask& m) const;
   
   // Various trimming functions; only use after strips are sorted (these keep the strips sorted)
   void cropTo(const Rectangle& rect);      // Make the mask fit inside the rectangle
-  int countOverlap(Mask& m);               // Count how many pixels overlap in the two masks
+  int countOverlap(const Mask& m) const;   // Count how many pixels overlap in the two masks
   Mask& operator+=(Mask& m);               // Union of the two masks
   Mask& operator-=(Mask& m);               // Remove the second mask
   Mask& operator-=(const Rectangle &rect); // Remove any of the mask in a rectangle
@@ -191,12 +296,14 @@ public:
   {
     lines.start();
     while (lines.advance()) lines.i() += p;
+    lines.touch();
     return *this;
   }
   Mask& operator-=(const Point& p)
   {
     lines.start();
     while (lines.advance()) lines.i() -= p;
+    lines.touch();
     return *this;
   }
   
@@ -214,6 +321,49 @@ public:
   
   // Text output of mask (with newline)
   void println();
+  
+  // Binary dump and restore (for checkpoints); reading appends to the strips we have
+  bool writeState(FILE* f) const;
+  bool readState(FILE* f);
+};
+
+
+
+/****************************************************************
+                   A Mask Packed Into Bits
+****************************************************************/
+
+// One bit per pixel of a mask's bounding box, column by column, so that overlaps between two
+// small masks can be counted 64 pixels at a time.  Bit k of a column's words is y = bounds.near.y+k.
+// Masks whose box would need more than MAX_WORDS words aren't packed--use their strips instead.
+class MaskBits
+{
+public:
+  static const int MAX_WORDS = 4096;
+  
+  unsigned long long* words;
+  int room;            // Words allocated
+  int per_column;      // Words used by each column
+  Rectangle bounds;
+  bool packed;         // False if the mask was empty or too big
+  
+  // The strips we packed and their change count then, so we can tell if they have changed since
+  const StripArray* source;
+  unsigned int changes;
+  
+  MaskBits() : words(NULL),room(0),per_column(0),packed(false),source(NULL),changes(0) { }
+  ~MaskBits() { if (words!=NULL) free(words); }
+  
+  bool pack(const Mask& m);  // Returns packed
+  bool matches(const Mask& m) const;
+  inline void forget() { source = NULL; packed = false; }
+  
+  // Both must be packed
+  int countOverlap(const MaskBits& mb) const;
+  bool overlaps(const MaskBits& mb) const;
+private:
+  MaskBits(const MaskBits& mb);  // Not copyable
+  MaskBits& operator=(const MaskBits& mb);
 };
 
 
@@ -245,7 +395,7 @@ public:
   { findContour(rect); }
   Contour(const Ellipse& ellip) : boundary(4*(ellip.axes.x+ellip.axes.y) , false)
   { findContour(ellip); }
-  Contour(Mask& m) : boundary(2*m.lines.size , false)
+  Contour(const Mask& m) : boundary(2*m.lines.size , false)
   { findContour(m); }
   ~Contour() { }
   
@@ -298,7 +448,7 @@ public:
   inline Contour& imitate(const Contour& c) { if (c.size()>0) { boundary.imitate(c.boundary); } bounds=c.bounds; return *this; }
   void findContour(const Rectangle& r,bool full=true);  // Can be either full or empty representation initially (default full)
   void findContour(const Ellipse& e);
-  void findContour(Mask& m);
+  void findContour(const Mask& m);
   void fillContour();
   void emptyContour();
   
@@ -308,6 +458,10 @@ public:
   
   // Statistics
   void findBounds();
+  
+  // Binary dump and restore (for checkpoints); reading appends to the points we have
+  bool writeState(FILE* f) const;
+  bool readState(FILE* f);
 };
 
 
@@ -397,13 +551,65 @@ public:
   float long_axis;         // Length of object along major axis
   float short_axis;        // Length of object along minor axis
   
-  FloodData(Storage< Listable<Strip> >* sls=NULL) : stencil(sls) { }
+  // Weighted sums of 1, x, y, x^2, xy, y^2 over the stencil (relative to moment_origin), taken while filling or
+  // finding the centroid so principalAxes needn't read the pixels again; only good for weights from moment_range
+  bool has_moments;
+  Range moment_range;
+  Point moment_origin;
+  int moment_count;
+  long long m0,mx,my,mxx,mxy,myy;
+  
+  // The stencil packed into bits the first time overlapRatio or overlaps wants them
+  MaskBits bits;
+  
+  FloodData() : has_moments(false) { }
   ~FloodData() { }
   
   bool operator<(const FloodData& fd) const { return score < fd.score; }
   void findCentroid(const Image& im,Range threshold);  // Find centroid (if not already done by flood algorithm)
   void principalAxes(const Image& im,Range threshold);  // Fill in major & minor axis vectors + lengths
   void duplicate(const FloodData& fd);
+  const MaskBits* packedStencil();       // NULL if the stencil is too big to pack
+  FPoint overlapRatio(FloodData& fd);    // Same answers as stencil.overlapRatio(fd.stencil) and
+  bool overlaps(FloodData& fd);          // stencil.overlaps(fd.stencil), but bitwise when both pack
+  bool writeState(FILE* f) const;  // Binary dump and restore, for checkpoints
+  bool readState(FILE* f);
+};
+
+
+// Connected pieces of an image found a run (in-range strip of a column) at a time
+// label() finds every run and joins runs in neighboring columns that touch (union-find);
+// fill() then hands over what floodFind would fill from a run and marks those runs filled.
+// The image is only read, never marked, so it can be borrowed or shared.
+class FloodRuns
+{
+public:
+  Strip *runs;       // Every run, in order by x then y
+  int *parent;       // Piece each run belongs to, as the index of the piece's first run
+  int *next;         // Next run of the same piece, or -1
+  int *filled;       // Which fill (counting from 1) took each run, or 0 if none has
+  int *column;       // Index of first run in each column, plus one past the last run
+  short *values;     // One column of a binned image
+  Strip *queue;      // Strips waiting to be looked at, as in floodLine (see trace)
+  int n_runs;
+  int n_filled;
+  Rectangle bounds;  // Binned bounds of the labeled image
+  
+  FloodRuns() : runs(NULL),parent(NULL),next(NULL),filled(NULL),column(NULL),values(NULL),queue(NULL),n_runs(0),n_filled(0),
+                capacity(0),n_columns(0),n_values(0),n_queue(0) { }
+  ~FloodRuns();
+  
+  void label(const Image& im,Range T);
+  int find(const Point& p) const;  // Run containing p, or -1 if there isn't one
+  int fill(const Image& im,int run,Range T,FloodData* data);  // Returns the number of pixels filled
+private:
+  int capacity;
+  int n_columns;
+  int n_values;
+  int n_queue;
+  void addRun(short x,short y0,short y1);
+  void trace(int run);
+  FloodRuns(const FloodRuns& fr) { }
 };
 
 
@@ -433,7 +639,25 @@ public:
   elsewhere.  If one image is assigned to another, the one on the left will
   inherit the memory.  If an image is managing its own memory, it will
   delete[] the array(s) when the destructor is called.
+
+**** How Image lays out pixels ****
+  Pixel (x,y), relative to bounds.near, lives at pixels[x*stride.x + y*stride.y].
+  Images that allocate their own memory are column-major, stride = (size.y,1),
+  and most fast paths rely on y being contiguous.  An Image can also borrow
+  a row-major buffer from a camera or decoder without copying it, using
+  Image(buffer,size,row_stride,algo); then stride = (1,row_stride), where
+  row_stride is in shorts and may exceed size.x to skip padding.  A piece of
+  a bigger buffer can be borrowed in place with Image(first,bounds,stride,algo),
+  first pointing at the pixel at bounds.near.  All the
+  accessors, copy/adapt/diffCopy/diffAdaptCopy, mimic and the flood fills
+  work on such views directly; rareI and viewI (two shorts in an int) only
+  make sense when stride.y is 1.
 ** HOWTO */
+
+// Vector instructions the pixel loops can use; the best this CPU has is picked the first time they're needed
+enum SimdLevel { simd_none , simd_sse2 , simd_avx2 , simd_avx512 };
+SimdLevel getSimdLevel();
+SimdLevel setSimdLevel(SimdLevel level);  // Falls back to the best the CPU has below level; returns what it got.  Call before tracking starts
  
 // Holds image data (as shorts), optionally with binning
 class Image
@@ -448,6 +672,7 @@ public:
   
   Rectangle bounds;
   Point size;
+  Point stride;  // Distance in pixels between neighbors in x and in y
   
   short bin;
   short depth;
@@ -456,15 +681,22 @@ public:
   bool divide_bg; 
 
   // Creating and disposing of images
-  Image() : pixels(NULL),bounds(),size(0,0),bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(false),divide_bg(false) { }
+  Image() : pixels(NULL),bounds(),size(0,0),stride(0,1),bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(false),divide_bg(false) { }
   Image(short *raw_image,Point image_size, bool algo)
-    : pixels(raw_image),bounds(Point(0,0),image_size-1),size(image_size),
+    : pixels(raw_image),bounds(Point(0,0),image_size-1),size(image_size),stride(image_size.y,1),
+      bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(false),divide_bg(algo) { }
+  Image(short *raw_image,Point image_size,int row_stride, bool algo)  // Borrows a row-major buffer; row_stride >= image_size.x
+    : pixels(raw_image),bounds(Point(0,0),image_size-1),size(image_size),stride(1,row_stride),
+      bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(false),divide_bg(algo) { }
+  Image(short *raw_image,Rectangle image_bounds,Point image_stride, bool algo)  // Borrows any layout; raw_image is pixel image_bounds.near
+    : pixels(raw_image),bounds(image_bounds),size(image_bounds.size()),stride(image_stride),
       bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(false),divide_bg(algo) { }
   Image(Point image_size, bool algo) : size(image_size),bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(true),divide_bg(algo)
   {
     if (size.x<1) size.x=1;
     if (size.y<1) size.y=1;
     bounds = Rectangle(Point(0,0),size-1);
+    stride = Point(size.y,1);
     pixels = new short[ bounds.area() ];
   }
   Image(Rectangle image_bounds, bool algo) : bounds(image_bounds),bin(0),depth(DEFAULT_BIT_DEPTH),owns_pixels(true),divide_bg(algo)
@@ -472,6 +704,7 @@ public:
     if (bounds.near.x > bounds.far.x) bounds.far.x = bounds.near.x;
     if (bounds.near.y > bounds.far.y) bounds.far.y = bounds.near.y;
     size = bounds.size();
+    stride = Point(size.y,1);
     pixels = new short[ bounds.area() ];
   }
   Image(const Image& existing,const Rectangle &region, bool algo);
@@ -487,12 +720,17 @@ public:
   int getHeight() const { if (bin<=1) return bounds.height(); else return 1 + (bounds.far.y-(bin-1))/bin - (bounds.near.y+(bin-1))/bin; }
   inline int getGray() const { return 1<<(depth-1); }
   
+  // Stuff for memory layout
+  inline bool isColumnMajor() const { return stride.y==1; }
+  inline bool isContiguous() const { return (stride.y==1 && stride.x==size.y) || (stride.x==1 && stride.y==size.x); }
+  
   // Assigning images--pixels are assigned by reference, use clone() to duplicate, copy to transfer pixels
   Image& operator=(Image &im)
   {
     pixels = im.pixels;
     bounds = im.bounds;
     size = im.size;
+    stride = im.stride;
     bin = im.bin;
     owns_pixels = im.owns_pixels;
     im.owns_pixels = false;
@@ -507,18 +745,18 @@ public:
   
   
   // Access to the underlying data
-  inline short& raw(int x,int y) { return pixels[y+size.y*x]; }
-  inline short& raw(Point p) { return pixels[p.y+size.y*p.x]; }
-  inline short peek(int x,int y) const { return pixels[y+size.y*x]; }
-  inline short peek(Point p) const { return pixels[p.y+size.y*p.x]; }
+  inline short& raw(int x,int y) { return pixels[y*stride.y + stride.x*x]; }
+  inline short& raw(Point p) { return pixels[p.y*stride.y + stride.x*p.x]; }
+  inline short peek(int x,int y) const { return pixels[y*stride.y + stride.x*x]; }
+  inline short peek(Point p) const { return pixels[p.y*stride.y + stride.x*p.x]; }
   // Access to the underlying data with offset
-  inline short& rare(int x,int y) { return pixels[(y-bounds.near.y) + size.y*(x-bounds.near.x)]; }
-  inline short& rare(Point p) { return pixels[(p.y-bounds.near.y) + size.y*(p.x-bounds.near.x)]; }
-  inline short view(int x,int y) const { return pixels[(y-bounds.near.y) + size.y*(x-bounds.near.x)]; }
+  inline short& rare(int x,int y) { return pixels[(y-bounds.near.y)*stride.y + stride.x*(x-bounds.near.x)]; }
+  inline short& rare(Point p) { return pixels[(p.y-bounds.near.y)*stride.y + stride.x*(p.x-bounds.near.x)]; }
+  inline short view(int x,int y) const { return pixels[(y-bounds.near.y)*stride.y + stride.x*(x-bounds.near.x)]; }
   inline short view(Point p) const { return peek(p-bounds.near); }
-  // "Vector" access to underlying data (packed in ints)
-  inline int& rareI(int x,int y) { return *((int*)(pixels + ((y-bounds.near.y) + size.y*(x-bounds.near.x)))); }
-  inline int viewI(int x,int y) const { return *((int*)(pixels + ((y-bounds.near.y) + size.y*(x-bounds.near.x)))); }
+  // "Vector" access to underlying data (packed in ints)--column-major only
+  inline int& rareI(int x,int y) { return *((int*)(pixels + ((y-bounds.near.y) + stride.x*(x-bounds.near.x)))); }
+  inline int viewI(int x,int y) const { return *((int*)(pixels + ((y-bounds.near.y) + stride.x*(x-bounds.near.x)))); }
   // Access to data in global coordinates, with binning as needed
   inline short get(int x,int y) const
   {
@@ -578,14 +816,19 @@ public:
   void set(Point p1,Point p2,int width,short I); // Sets a line of specified radius (0=single pixel) from p1 up to but not including p2
   void set(Contour &c,int width,short I);        // Draws a contour as lines--if contour is not made of adjacent pixels, it's still connected
   
-  // Operations to shift and scale image by a constant
-  inline Image& operator=(short I) { for (int i=0;i<size.x*size.y;i++) pixels[i]=I; return *this; }
-  inline Image& operator+=(short I) { for (int i=0;i<size.x*size.y;i++) pixels[i]+=I; return *this; }
+  // Operations to shift and scale image by a constant (padded views go a line at a time)
+#define MWT_IMAGE_EACH_PIXEL(stmt) \
+  if (isContiguous()) { for (int i=0;i<size.x*size.y;i++) pixels[i] stmt; } \
+  else if (stride.x==1) { for (int y=0;y<size.y;y++) { short *p=pixels+y*stride.y; for (int i=0;i<size.x;i++) p[i] stmt; } } \
+  else { for (int x=0;x<size.x;x++) { short *p=pixels+x*stride.x; for (int j=0;j<size.y;j++) p[j*stride.y] stmt; } }
+  inline Image& operator=(short I) { MWT_IMAGE_EACH_PIXEL(=I) return *this; }
+  inline Image& operator+=(short I) { MWT_IMAGE_EACH_PIXEL(+=I) return *this; }
   inline Image& operator+=(Point p) { bounds += p; return *this; }
-  inline Image& operator-=(short I) { for (int i=0;i<size.x*size.y;i++) pixels[i]-=I; return *this; }
+  inline Image& operator-=(short I) { MWT_IMAGE_EACH_PIXEL(-=I) return *this; }
   inline Image& operator-=(Point p) { bounds -= p; return *this; }
-  inline Image& operator<<=(short I) { for (int i=0;i<size.x*size.y;i++) pixels[i]<<=I; return *this; }
-  inline Image& operator>>=(short I) { for (int i=0;i<size.x*size.y;i++) pixels[i]>>=I; return *this; }
+  inline Image& operator<<=(short I) { MWT_IMAGE_EACH_PIXEL(<<=I) return *this; }
+  inline Image& operator>>=(short I) { MWT_IMAGE_EACH_PIXEL(>>=I) return *this; }
+#undef MWT_IMAGE_EACH_PIXEL
   
   // Copy bits of one image to another in various ways
   void mimic(const Image& source , Rectangle my_region , Rectangle source_region , ScaleType method = Subsample);
@@ -600,19 +843,22 @@ public:
   void diffAdaptCopy(Point where,const Image& source,Point size,Image& bg,int rate);  // Same as diffCopy (but bg gets adapted)
   void diffAdaptCopy(const Image& source,Mask& m,Image& bg,int rate);
   
-  // Flood fills--note that resulting strips are unsorted
+  // Flood fills--floodFind marks what it fills by negating it.  floodRect and floodMask label runs with FloodRuns
+  // instead, leaving the image untouched, so they only need to read it.
   void floodLine(FloodInfo& info,FloodData* data,Stackable<Strip>*& head,Stackable<Strip>*& tail);
   int floodFind(Point pt,DualRange threshold,Storage< Stackable<Strip> > *store,FloodData *result);
-  int floodRect(DualRange threshold,Storage< Stackable<Strip> > *stripstore,Storage< Listable<Strip> > *storemask,
-                ManagedList<FloodData>& result,Rectangle rect);
-  int floodMask(DualRange threshold,Storage< Stackable<Strip> > *stripstore,Storage< Listable<Strip> > *storemask,
-                ManagedList<FloodData>& result,Mask &m);
+  int floodRect(DualRange threshold,ManagedList<FloodData>& result,Rectangle rect) const;
+  int floodMask(DualRange threshold,ManagedList<FloodData>& result,Mask &m) const;
   
   // Output and testing
   int makeTiffHeader(unsigned char *buffer);
   int writeTiff(FILE *f);
   int writeTiff(const char *fname);
   void println() const;
+  
+  // Binary dump of an image that owns its pixels, and a new image read back from one (NULL on failure)
+  bool writeState(FILE* f) const;
+  static Image* readState(FILE* f);
 };
 
 
@@ -625,6 +871,7 @@ int test_mwt_image_strip();
 int test_mwt_image_mask();
 int test_mwt_image_contour();
 int test_mwt_image_image();
+int test_mwt_image_kernels();
 int test_mwt_image();
 
 #endif
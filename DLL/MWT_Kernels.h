@@ -0,0 +1,119 @@
+/* Copyright (C) 2007 - 2010 Howard Hughes Medical Institute
+ * Copyright (C) 2007 - 2010 Rex A. Kerr, Nicholas A. Swierczek
+ *
+ * This file is a part of the Multi-Worm Tracker and is distributed under the
+ * terms of the GNU Lesser General Public Licence version 2.1 (LGPL 2.1).
+ * For details, see GPL2.txt and LGPL2.1.txt, or http://www.gnu.org/licences
+ *
+ * To contact the authors, email kerrlab@users.sourceforge.net.
+ */
+
+// No include guard: MWT_Image.cc includes this once per instruction set,
+// each time inside its own namespace with its own Lanes (see there).
+
+
+/****************************************************************
+                 Pixel Loops Over Contiguous Runs
+****************************************************************/
+
+/** HOWTO **
+  Each kernel works on n shorts in a row (one column of a column-major image,
+  or one strip of a mask), Lanes::N at a time, and finishes any that are left
+  one at a time.  Lanes supplies the vector type and the few operations needed;
+  with N==1 it is plain C++.  Every kernel gives exactly what the one-pixel
+  loops in MWT_Image.cc give (pixel values are never negative).  The choices
+  that used to be tested per pixel--shift left or right, subtract or divide--
+  are template parameters, so the loops themselves never branch.
+** HOWTO */
+
+// p = I
+void fillRun(short* p,int n,short I)
+{
+  Lanes::V II = Lanes::set1(I);
+  int i = 0;
+  for ( ; i+Lanes::N<=n ; i+=Lanes::N) Lanes::store( p+i , II );
+  for ( ; i<n ; i++) p[i] = I;
+}
+
+// p = q<<shift or q>>shift
+template <bool left>
+void shiftRun(short* p,const short* q,int n,int shift)
+{
+  int i = 0;
+  for ( ; i+Lanes::N<=n ; i+=Lanes::N)
+  {
+    Lanes::V Q = Lanes::load(q+i);
+    Lanes::store( p+i , (left) ? Lanes::shl(Q,shift) : Lanes::sra(Q,shift) );
+  }
+  for ( ; i<n ; i++) p[i] = (left) ? (q[i]<<shift) : (q[i]>>shift);
+}
+
+// p moves 2^-rate of the way to q, which is shifted by imrate to match p's depth
+template <bool left>
+void adaptRun(short* p,const short* q,int n,int rate,int imrate)
+{
+  int i = 0;
+  for ( ; i+Lanes::N<=n ; i+=Lanes::N)
+  {
+    Lanes::V P = Lanes::load(p+i);
+    Lanes::V Q = Lanes::load(q+i);
+    Q = (left) ? Lanes::shl(Q,imrate) : Lanes::sra(Q,imrate);
+    Lanes::store( p+i , Lanes::sub( Lanes::add(P,Q) , Lanes::sra(P,rate) ) );
+  }
+  for ( ; i<n ; i++) p[i] += ((left) ? (q[i]<<imrate) : (q[i]>>imrate)) - (p[i]>>rate);
+}
+
+// p = q - g>>shift + gray, or 2*q/(q + g>>shift) with a 1 added to each to stay off zero
+template <bool divide>
+void diffRun(short* p,const short* q,const short* g,int n,int shift,int depth)
+{
+  short gray = 1 << depth;
+  Lanes::V G2 = Lanes::set1(gray);
+  int i = 0;
+  for ( ; i+Lanes::N<=n ; i+=Lanes::N)
+  {
+    Lanes::V Q = Lanes::load(q+i);
+    Lanes::V B = Lanes::sra( Lanes::load(g+i) , shift );
+    Lanes::store( p+i , (divide) ? Lanes::divide(Q,B,depth) : Lanes::add( Lanes::sub(Q,B) , G2 ) );
+  }
+  for ( ; i<n ; i++)
+  {
+    if (divide) p[i] = ((1+(unsigned int)q[i])<<(depth+1)) / ((unsigned int)q[i] + (unsigned int)(g[i]>>shift) + 2);
+    else p[i] = q[i] - (g[i]>>shift) + gray;
+  }
+}
+
+// Adapts g towards q (shifted by srcrate), then does diffRun against the adapted g
+template <bool divide,bool left>
+void diffAdaptRun(short* p,const short* q,short* g,int n,int shift,int rate,int srcrate,int depth)
+{
+  short gray = 1 << depth;
+  Lanes::V G2 = Lanes::set1(gray);
+  int i = 0;
+  for ( ; i+Lanes::N<=n ; i+=Lanes::N)
+  {
+    Lanes::V Q = Lanes::load(q+i);
+    Lanes::V G = Lanes::load(g+i);
+    Lanes::V S = (left) ? Lanes::shl(Q,srcrate) : Lanes::sra(Q,srcrate);
+    G = Lanes::add( G , Lanes::sub( S , Lanes::sra(G,rate) ) );
+    Lanes::store( g+i , G );
+    Lanes::V B = Lanes::sra(G,shift);
+    Lanes::store( p+i , (divide) ? Lanes::divide(Q,B,depth) : Lanes::add( Lanes::sub(Q,B) , G2 ) );
+  }
+  for ( ; i<n ; i++)
+  {
+    g[i] += ((left) ? (q[i]<<srcrate) : (q[i]>>srcrate)) - (g[i]>>rate);
+    if (divide) p[i] = ((1+(unsigned int)q[i])<<(depth+1)) / ((unsigned int)q[i] + (unsigned int)(g[i]>>shift) + 2);
+    else p[i] = q[i] - (g[i]>>shift) + gray;
+  }
+}
+
+const ImageKernels table =
+{
+  Lanes::level,
+  fillRun,
+  { shiftRun<false> , shiftRun<true> },
+  { adaptRun<false> , adaptRun<true> },
+  { diffRun<false> , diffRun<true> },
+  { { diffAdaptRun<false,false> , diffAdaptRun<false,true> } , { diffAdaptRun<true,false> , diffAdaptRun<true,true> } }
+};
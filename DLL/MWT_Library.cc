@@ -10,6 +10,7 @@
  
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <iostream>
 #include <new>
 
@@ -74,6 +75,81 @@ void SummaryData::fprint(FILE* f , ManagedList<BlobOriginFate>& mlbof , ManagedL
   if (last_character!='\n') fprintf(f,"\n");
 }
 
+// Binary dump and restore, for checkpoints
+bool SummaryData::writeState(FILE* f) const
+{
+  if (!dumpRaw(f,frame_number) || !dumpRaw(f,frame_time) || !dumpRaw(f,initialized)) return false;
+  if (!dumpRaw(f,n_dancers_tracked) || !dumpRaw(f,n_dancers_good) || !dumpRaw(f,dancer_persistence)) return false;
+  if (!dumpRaw(f,dancer_speed) || !dumpRaw(f,dancer_angularspeed)) return false;
+  if (!dumpRaw(f,dancer_length) || !dumpRaw(f,dancer_relativelength)) return false;
+  if (!dumpRaw(f,dancer_width) || !dumpRaw(f,dancer_relativewidth)) return false;
+  if (!dumpRaw(f,dancer_aspect) || !dumpRaw(f,dancer_relativeaspect)) return false;
+  if (!dumpRaw(f,dancer_endwiggle) || !dumpRaw(f,dancer_pixelcount)) return false;
+  if (!dumpRaw(f,n_speed_updates) || !dumpRaw(f,update_frequency)) return false;
+  return dumpRawList(f,event_list);
+}
+bool SummaryData::readState(FILE* f)
+{
+  if (!undumpRaw(f,frame_number) || !undumpRaw(f,frame_time) || !undumpRaw(f,initialized)) return false;
+  if (!undumpRaw(f,n_dancers_tracked) || !undumpRaw(f,n_dancers_good) || !undumpRaw(f,dancer_persistence)) return false;
+  if (!undumpRaw(f,dancer_speed) || !undumpRaw(f,dancer_angularspeed)) return false;
+  if (!undumpRaw(f,dancer_length) || !undumpRaw(f,dancer_relativelength)) return false;
+  if (!undumpRaw(f,dancer_width) || !undumpRaw(f,dancer_relativewidth)) return false;
+  if (!undumpRaw(f,dancer_aspect) || !undumpRaw(f,dancer_relativeaspect)) return false;
+  if (!undumpRaw(f,dancer_endwiggle) || !undumpRaw(f,dancer_pixelcount)) return false;
+  if (!undumpRaw(f,n_speed_updates) || !undumpRaw(f,update_frequency)) return false;
+  return undumpRawList(f,event_list);
+}
+
+
+// Binary dump of everything that changes as we track, for checkpoints
+bool TrackerEntry::writeState(FILE* f)
+{
+  performance.finishTail();
+  if (!dumpRaw(f,update_frequency) || !dumpRaw(f,references_found) || !dumpRaw(f,statistics_ready)) return false;
+  if (!dumpRawList(f,reference_objects)) return false;
+  if (!dumpRaw(f,summary.size)) return false;
+  Listable<SummaryData>* ls;
+  summary.start(ls);
+  while (summary.advance(ls)) { if (!ls->data.writeState(f)) return false; }
+  return performance.writeState(f);
+}
+
+// Read back what writeState wrote into an entry that hasn't tracked anything yet
+bool TrackerEntry::readState(FILE* f)
+{
+  int n;
+  SummaryData* sd;
+  bool good = undumpRaw(f,update_frequency) && undumpRaw(f,references_found) && undumpRaw(f,statistics_ready);
+  reference_objects.flush();
+  good = good && undumpRawList(f,reference_objects);
+  good = good && undumpRaw(f,n) && n>=0;
+  for ( ; good && n>0 ; n--)
+  {
+    sd = new( summary.Append() ) SummaryData( 0 , 0.0 , &eventstore );
+    good = sd->readState(f);
+  }
+  good = good && performance.readState(f);
+  if (!good) summary.flush();
+  return good;
+}
+
+
+// Checkpoint files start with this, then the version, the frame, and the date used for output
+static const char checkpoint_magic[16] = "MWT checkpoint\n";
+static const int checkpoint_version = 1;
+
+static bool readCheckpointHeader(FILE* f,int& frame,struct tm& date)
+{
+  char magic[16];
+  int version;
+  if (fread(magic,1,16,f)!=16 || memcmp(magic,checkpoint_magic,16)!=0) return false;
+  if (!undumpRaw(f,version) || version!=checkpoint_version || !undumpRaw(f,frame)) return false;
+  memset(&date,0,sizeof(date));
+  return undumpRaw(f,date.tm_year) && undumpRaw(f,date.tm_mon) && undumpRaw(f,date.tm_mday) &&
+         undumpRaw(f,date.tm_hour) && undumpRaw(f,date.tm_min) && undumpRaw(f,date.tm_sec);
+}
+
 
 
 /****************************************************************
@@ -82,7 +158,7 @@ void SummaryData::fprint(FILE* f , ManagedList<BlobOriginFate>& mlbof , ManagedL
 
 // Constructor just creates an array of TrackerEntry pointers and sets them to NULL
 TrackerLibrary::TrackerLibrary()
-  : all_trackers(NULL),default_buffer_size(DEFAULT_DEFAULT_SIZE),active_handles(MAX_TRACKER_HANDLES+1,false),lsstore(1024,false)
+  : all_trackers(NULL),default_buffer_size(DEFAULT_DEFAULT_SIZE),active_handles(MAX_TRACKER_HANDLES+1,false)
 {
   all_trackers = new TrackerEntry*[MAX_TRACKER_HANDLES+1];
   for (int i=0 ; i<=MAX_TRACKER_HANDLES ; i++) all_trackers[i] = NULL;
@@ -355,7 +431,7 @@ int TrackerLibrary::addRectangle(int handle,int left,int right,int top,int botto
   if (p.full_area==NULL) p.setROI( Rectangle( Point(left,top) , Point(right,bottom) ) );
   else
   {
-    Mask m( Rectangle( Point(left,top) , Point(right,bottom) ) , &lsstore );
+    Mask m( Rectangle( Point(left,top) , Point(right,bottom) ) );
     *p.full_area += m;
     p.full_area->findBounds();
   }
@@ -385,7 +461,7 @@ int TrackerLibrary::addEllipse(int handle,int centerx,int centery,int radiusx,in
   if (p.full_area==NULL) p.setROI( Ellipse( Point(centerx,centery) , Point(radiusx,radiusy) ) );
   else
   {
-    Mask m( Ellipse( Point(centerx,centery) , Point(radiusx,radiusy) ) , &lsstore );
+    Mask m( Ellipse( Point(centerx,centery) , Point(radiusx,radiusy) ) );
     *p.full_area += m;
     p.full_area->findBounds();
   }
@@ -440,7 +516,7 @@ int TrackerLibrary::cutEllipse(int handle,int centerx,int centery,int radiusx,in
 
   if (p.full_area!=NULL) p.setROI( Rectangle(Point(0,0) , Point(te->image_width-1,te->image_height-1) ) );
 
-  Mask m( Ellipse( Point(centerx,centery) , Point(radiusx,radiusy) ) , &lsstore );
+  Mask m( Ellipse( Point(centerx,centery) , Point(radiusx,radiusy) ) );
   *p.full_area -= m;
   p.full_area->findBounds();
 
@@ -527,6 +603,20 @@ int TrackerLibrary::setUpdateBandNumber(int handle,int n_bands)
   return handle;
 }
 
+// Make a tracker that starts part way through a movie look for new objects in the same places, frame by frame, as one that started at the beginning
+int TrackerLibrary::setUpdateBandPhase(int handle,int frames)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  
+  TrackerEntry* te = all_trackers[handle];
+
+  if (frames<0) frames = 0;
+  te->performance.band_phase = frames;
+  
+  return handle;
+}
+
 
 // Set the intensity above or below which we will fill a reference object
 int TrackerLibrary::setRefIntensityThreshold(int handle,int intensity_low,int intensity_high)
@@ -694,7 +784,31 @@ int TrackerLibrary::setAdaptationRate(int handle,int alpha)
   te->performance.adapt_rate = alpha;
   
   te->adaptation_rate_known = true;
-  
+
+  return handle;
+}
+
+
+// Keep the background fixed instead of adapting it to each image
+int TrackerLibrary::setStaticBackground(int handle,bool enable)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+
+  all_trackers[handle]->performance.static_background = enable;
+
+  return handle;
+}
+
+
+// Share out the per-object work on each image over this many threads, the caller's included
+int TrackerLibrary::setDancerThreads(int handle,int n_threads)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+
+  all_trackers[handle]->performance.setThreads(n_threads);
+
   return handle;
 }
 
@@ -717,6 +831,19 @@ int TrackerLibrary::scanObjects(int handle,Image& im)
   return n;
 }
 
+// Replace the background outright (e.g. with one stored alongside the images)
+int TrackerLibrary::loadBackground(int handle,Image& im)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  
+  TrackerEntry* te = all_trackers[handle];
+  if (!te->objects_found) return 0;
+	im.divide_bg = te->performance.correction_algorithm;
+  if (!te->performance.loadBackground(&im)) return 0;
+  return handle;
+}
+
 // Finds moving objects and writes stuff back to the image to show what happened
 int TrackerLibrary::showObjects(int handle,Image& im)
 {
@@ -842,6 +969,20 @@ int TrackerLibrary::loadThisImagePiece(int handle,Image& im)
 }
 
 
+// Load the next piece straight out of a buffer the caller owns (row-major, column-major, or part of a bigger image)
+// Only the pixels in piece are read; they must be at the bit depth given to setImageInfo, unbinned
+int TrackerLibrary::loadThisImagePiece(int handle,short *pixels,Rectangle piece,Point stride)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  if (pixels==NULL) return 0;
+  
+  Image im(pixels,piece,stride,false);
+  im.depth = all_trackers[handle]->image_bits;
+  return loadThisImagePiece(handle,im);
+}
+
+
 // Load an image for processing
 int TrackerLibrary::loadImage(int handle,Image& im,float time)
 {
@@ -946,11 +1087,12 @@ int TrackerLibrary::processImage(int handle)
   if (!te->image_loaded || !te->output_started) return 0;
   
   Performance& p = te->performance;
+  SummaryData &sd = te->summary.t();
+  p.report_wiggle = (p.find_dancer_skel) ? &sd.dancer_endwiggle : NULL;  // Filled in once the skeletons are done
   int n_dancers = p.findNext();
   te->image_loaded = false;
   
   // Need to calculate summary statistics
-  SummaryData &sd = te->summary.t();
   
   sd.n_dancers_tracked = p.dancers.size;
   
@@ -1025,67 +1167,6 @@ int TrackerLibrary::processImage(int handle)
     }
   }
   
-  if (p.find_dancer_skel)
-  {
-    // Figure out how far off the center line the nose or tail is pointing (report whichever deviates further)
-    int i;
-    float f;
-    float nose_angle,tail_angle;
-    FPoint nose,tail,noseless,tailless;  // Nose and tail are arbitrary; they refer to two ends, but may not correspond to organism's nose and tail
-    Contour* c;
-    Datum wiggle;
-    p.dancers.start();
-    while (p.dancers.advance())
-    {
-      if (p.dancers.i().n_long_enough > p.dancers.i().frames.length()) continue;
-      if (p.dancers.i().movie.t().skeleton==NULL) continue;
-      c = &(p.dancers.i().movie.t().spine());
-      if (c->size() != Blob::SKELETON_SIZE) continue;
-      
-      c->start();
-      for (i=0 ; (i+1)*5 < Blob::SKELETON_SIZE ; i++) c->advance();  // Pick off first 20% of dancer (nose)
-      nose = c->h() - c->i();
-      for ( ; (i+1)*3 < Blob::SKELETON_SIZE ; i++) c->advance();  // Pick off last 2/3 of dancer (all but nose)
-      noseless = c->i() - c->t();
-      f = nose.length();
-      if (f==0) nose_angle = 0;
-      else
-      {
-        nose /= f;
-        f = noseless.length();
-        if (f==0) nose_angle = 0;
-        else
-        {
-          noseless /= f;
-          nose_angle = nose * noseless;
-        }
-      }
-      
-      c->end();
-      for (i=0 ; (i+1)*5 < Blob::SKELETON_SIZE ; i++) c->retreat();  // Pick off last 20% of dancer (tail)
-      tail = c->t() - c->i();
-      for ( ; (i+1)*3 < Blob::SKELETON_SIZE ; i++) c->retreat();  // Pick off first 2/3 of dancer (all but tail)
-      tailless = c->i() - c->h();
-      f = tail.length();
-      if (f==0) tail_angle = 0;
-      else
-      {
-        tail /= f;
-        f = tailless.length();
-        if (f==0) tail_angle = 0;
-        else
-        {
-          tailless /= f;
-          tail_angle = tail * tailless;
-        }
-      }
-      
-      if (nose_angle < tail_angle) wiggle.add( acos(nose_angle) );
-      else wiggle.add( acos(tail_angle) );
-    } 
-    sd.dancer_endwiggle = wiggle.mean();
-  }
-  
   te->statistics_ready = true;
 
   return n_dancers;
@@ -1122,6 +1203,7 @@ int TrackerLibrary::checkErrors(int handle)
   if (all_trackers[handle]==NULL) return -1;
   
   Performance& p = all_trackers[handle]->performance;
+  p.finishTail();  // Tidying up after the last frame may still have something to say
   int n = p.errors.size;
   p.errors.flush();  // Now that they know how many errors there are, we clear them.
   
@@ -1168,6 +1250,78 @@ int TrackerLibrary::complete(int handle)
   return handle;
 }
 
+// Save everything we need to carry on tracking later; only works between frames
+int TrackerLibrary::saveCheckpoint(int handle,const char *fname)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  
+  TrackerEntry* te = all_trackers[handle];
+  Performance& p = te->performance;
+  if (!te->output_started || !te->objects_found || te->image_loaded || p.date==NULL) return 0;
+  
+  // Write somewhere else first, so a crash part way through leaves the last checkpoint alone
+  char temp_name[ strlen(fname)+5 ];
+  sprintf(temp_name,"%s.tmp",fname);
+  FILE *f = fopen(temp_name,"wb");
+  if (!f) return 0;
+  bool good = (fwrite(checkpoint_magic,1,16,f)==16) && dumpRaw(f,checkpoint_version) && dumpRaw(f,p.current_frame) &&
+              dumpRaw(f,p.date->tm_year) && dumpRaw(f,p.date->tm_mon) && dumpRaw(f,p.date->tm_mday) &&
+              dumpRaw(f,p.date->tm_hour) && dumpRaw(f,p.date->tm_min) && dumpRaw(f,p.date->tm_sec);
+  good = good && te->writeState(f);
+  if (fclose(f)!=0) good = false;
+#ifdef WINDOWS
+  if (good) remove(fname);  // Won't rename over an existing file
+#endif
+  if (good) good = (rename(temp_name,fname)==0);
+  if (!good)
+  {
+    remove(temp_name);
+    return 0;
+  }
+  
+  return handle;
+}
+
+// Carry on from a checkpoint; the handle must have output begun (to the same date) but nothing scanned yet
+int TrackerLibrary::loadCheckpoint(int handle,const char *fname)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  
+  TrackerEntry* te = all_trackers[handle];
+  Performance& p = te->performance;
+  if (!te->output_started || te->objects_found || te->summary.size>0 || p.date==NULL) return 0;
+  
+  FILE *f = fopen(fname,"rb");
+  if (!f) return 0;
+  int frame;
+  struct tm date;
+  bool good = readCheckpointHeader(f,frame,date);
+  if (good)  // Output files have to be the ones the checkpoint refers to
+  {
+    good = date.tm_year==p.date->tm_year && date.tm_mon==p.date->tm_mon && date.tm_mday==p.date->tm_mday &&
+           date.tm_hour==p.date->tm_hour && date.tm_min==p.date->tm_min && date.tm_sec==p.date->tm_sec;
+  }
+  good = good && te->readState(f);
+  fclose(f);
+  if (!good) return 0;
+  
+  te->objects_found = true;
+  te->image_loaded = false;
+  return handle;
+}
+
+// Find out which frame a checkpoint was taken after, and which date its output went to
+bool TrackerLibrary::peekCheckpoint(const char *fname,int& frame,struct tm& date)
+{
+  FILE *f = fopen(fname,"rb");
+  if (!f) return false;
+  bool good = readCheckpointHeader(f,frame,date);
+  fclose(f);
+  return good;
+}
+
 int TrackerLibrary::setDivisionImageCorrectionAlgorithm( int handle )
 {
   if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
@@ -1350,6 +1504,7 @@ float TrackerLibrary::reportEndWiggle(int handle)
   TrackerEntry* te = all_trackers[handle];
   if (!te->statistics_ready) return -1;
   
+  te->performance.finishTail();
   return te->summary.t().dancer_endwiggle;
 }
 
@@ -1365,6 +1520,23 @@ float TrackerLibrary::reportObjectPixelCount(int handle)
   return te->summary.t().dancer_pixelcount;
 }
 
+// Reports where one object is, by ID, as of the last processed image
+int TrackerLibrary::reportObject(int handle,int id,FPoint& centroid,Rectangle& bounds)
+{
+  if (handle<1 || handle>MAX_TRACKER_HANDLES) return -1;
+  if (all_trackers[handle]==NULL) return -1;
+  
+  TrackerEntry* te = all_trackers[handle];
+  if (!te->statistics_ready) return -1;
+  
+  const DancerIndex& di = te->performance.dancerIndex();
+  int k = di.find(id);
+  if (k<0) return 0;
+  centroid = di[k].centroid;
+  bounds = di[k].bounds;
+  return handle;
+}
+
 
 
 /****************************************************************
@@ -1529,6 +1701,19 @@ int test_mwt_library(int bin)
     i = a_library.showResults(h1,arena); if (i!=h1) return 48;
     i = a_library.showResults(h2,arena); if (i!=h2) return 49;
     arena.bin = 0;
+    
+    // Everyone being tracked can be found by ID, and nobody else
+    int n_found = 0;
+    for (int k=0 ; k<1000 ; k++)
+    {
+      FPoint c;
+      Rectangle r;
+      i = a_library.reportObject(h1,k,c,r);
+      if (i==0) continue;
+      if (i!=h1 || k==0 || !r.contains(Point((int)c.x,(int)c.y))) return 52;
+      n_found++;
+    }
+    if (n_found != a_library.reportNumber(h1)) return 53;
 
 #ifndef PERFORMANCE_TEST    
     if ( (j%2) == 0)
@@ -1584,10 +1769,271 @@ int test_mwt_library(int bin)
   return 0;
 }
 
+// Settings shared by the uninterrupted and the checkpointed runs below
+static int checkpoint_test_setup(TrackerLibrary& a_library,int h,int day)
+{
+  int W = 1<<10;
+  int i;
+  a_library.setCombineBlobs(h,true);
+  i = a_library.setImageInfo(h,10,512,512); if (i!=h) return 1;
+  i = a_library.setDate(h,2007,12,day,10,50,33); if (i!=h) return 2;
+  i = a_library.setOutput(h,".","ckpt",true,false,false); if (i!=h) return 3;
+  i = a_library.setDancerBorderSize(h,10); if (i!=h) return 4;
+  i = a_library.setRefIntensityThreshold(h,1,W/2); if (i!=h) return 5;
+  i = a_library.setObjectIntensityThresholds(h,W-W/20,W-W/8); if (i!=h) return 6;
+  i = a_library.setObjectSizeThresholds(h,30,50,10000,15000); if (i!=h) return 7;
+  i = a_library.setObjectPersistenceThreshold(h,8); if (i!=h) return 8;
+  i = a_library.setAdaptationRate(h,4); if (i!=h) return 9;
+  i = a_library.enableOutlining(h,true); if (i!=h) return 10;
+  i = a_library.enableSkeletonization(h,true); if (i!=h) return 11;
+  i = a_library.beginOutput(h); if (i!=h) return 12;
+  i = a_library.setUpdateBandNumber(h,12); if (i!=h) return 13;
+  return 0;
+}
+
+// Text files match line by line, except for the last character (packed outlines end with leftover bits)
+static bool checkpoint_test_same(const char* fname_a,const char* fname_b)
+{
+  char la[4096],lb[4096];
+  FILE *fa = fopen(fname_a,"r");
+  FILE *fb = fopen(fname_b,"r");
+  bool same = (fa!=NULL && fb!=NULL);
+  while (same)
+  {
+    char *ra = fgets(la,4096,fa);
+    char *rb = fgets(lb,4096,fb);
+    if (ra==NULL || rb==NULL) { same = (ra==rb); break; }
+    int na = strlen(la);
+    int nb = strlen(lb);
+    same = (na==nb && (na<2 || strncmp(la,lb,na-2)==0));
+  }
+  if (fa!=NULL) fclose(fa);
+  if (fb!=NULL) fclose(fb);
+  return same;
+}
+
+// Track a movie straight through, then again with a checkpoint part way, a crash, and a resume; output must match
+int test_mwt_library_checkpoint()
+{
+  const int N = 60;
+  const int K = 30;
+  int W = 1<<10;
+  int i,j,h,frame;
+  Image* frames[N];
+  
+  ModelWorm worm1,worm2,worm3;
+  worm1.setPose( 128+FPoint(60,40),FPoint(1,0),0 );
+  worm1.setSize(40,2.5);
+  worm1.setWiggle(4.0,30,0.7,-0.02);
+  worm2.setPose( 128+FPoint(150,30),FPoint(-1,0),0 );
+  worm2.setSize(45,3.0);
+  worm2.setWiggle(4.5,32,0.68,0.02);
+  worm3.setPose( 128+FPoint(125,230),FPoint(0,1),0);
+  worm3.setSize(50,3.0);
+  worm3.setWiggle(5.0,35,0.72,0.01);
+  
+  Mask m(128);
+  Image arena( Point(512,512), false );
+  arena.depth = 10;
+  for (j=0;j<N;j++)
+  {
+    arena = (3*W)/4;
+    worm1.imprint(arena,m,0.4,2);
+    worm2.imprint(arena,m,0.4,2);
+    worm3.imprint(arena,m,0.4,2);
+    frames[j] = new Image(arena,arena.getBounds(),false);
+    worm1.wiggle(0.3);
+    worm2.wiggle(0.3);
+    worm3.wiggle(0.3);
+  }
+  
+  // Straight through
+  TrackerLibrary* a_library = new TrackerLibrary;
+  h = a_library->getNewHandle();
+  i = checkpoint_test_setup(*a_library,h,27); if (i!=0) return 100+i;
+  for (j=0;j<3;j++) a_library->scanObjects(h,*frames[j]);
+  for (j=3;j<N;j++)
+  {
+    i = a_library->loadImage(h,*frames[j],0.4*j); if (i!=h) return 121;
+    if (j==K+2) a_library->markEvent(h,3);
+    a_library->processImage(h);
+  }
+  i = a_library->complete(h); if (i!=h) return 122;
+  delete a_library;
+  
+  // Stop a little after a checkpoint, as if we'd crashed, and then pick up from the checkpoint
+  a_library = new TrackerLibrary;
+  h = a_library->getNewHandle();
+  i = checkpoint_test_setup(*a_library,h,28); if (i!=0) return 100+i;
+  i = a_library->saveCheckpoint(h,"ckpt.checkpoint"); if (i!=0) return 123;  // Nothing scanned yet
+  for (j=0;j<3;j++) a_library->scanObjects(h,*frames[j]);
+  for (j=3;j<K+5;j++)
+  {
+    i = a_library->loadImage(h,*frames[j],0.4*j); if (i!=h) return 124;
+    if (j==K+2) a_library->markEvent(h,3);
+    a_library->processImage(h);
+    if (j==K-1) { i = a_library->saveCheckpoint(h,"ckpt.checkpoint"); if (i!=h) return 125; }
+  }
+  delete a_library;  // Writes out everyone still being tracked, which resuming must undo
+  
+  struct tm date;
+  if (!TrackerLibrary::peekCheckpoint("ckpt.checkpoint",frame,date)) return 126;
+  if (frame != K-3 || date.tm_mday != 28) return 127;
+  a_library = new TrackerLibrary;
+  h = a_library->getNewHandle();
+  i = checkpoint_test_setup(*a_library,h,29); if (i!=0) return 100+i;
+  i = a_library->loadCheckpoint(h,"ckpt.checkpoint"); if (i!=0) return 128;  // Output is going somewhere else
+  delete a_library;
+  a_library = new TrackerLibrary;
+  h = a_library->getNewHandle();
+  i = checkpoint_test_setup(*a_library,h,28); if (i!=0) return 100+i;
+  i = a_library->loadCheckpoint(h,"ckpt.checkpoint"); if (i!=h) return 129;
+  for (j=3+frame;j<N;j++)
+  {
+    i = a_library->loadImage(h,*frames[j],0.4*j); if (i!=h) return 130;
+    if (j==K+2) a_library->markEvent(h,3);
+    a_library->processImage(h);
+  }
+  i = a_library->complete(h); if (i!=h) return 131;
+  delete a_library;
+  remove("ckpt.checkpoint");
+  
+  for (j=0;j<N;j++) delete frames[j];
+  
+  if (!checkpoint_test_same("20071227_105033/ckpt.summary","20071228_105033/ckpt.summary")) return 132;
+  if (!checkpoint_test_same("20071227_105033/ckpt_00000k.blobs","20071228_105033/ckpt_00000k.blobs")) return 133;
+  FILE* f = fopen("20071228_105033/ckpt_00001k.blobs","r");
+  if (f!=NULL) { fclose(f); return 134; }
+  
+  return 0;
+}
+
+// Track a movie whole, then again handing over only the pieces asked for, in place, from a row-major buffer; output must match
+int test_mwt_library_pieces()
+{
+  const int N = 40;
+  int W = 1<<10;
+  int i,j,n,x;
+  
+  ModelWorm worm1,worm2;
+  worm1.setPose( 128+FPoint(60,40),FPoint(1,0),0 );
+  worm1.setSize(40,2.5);
+  worm1.setWiggle(4.0,30,0.7,-0.02);
+  worm2.setPose( 128+FPoint(125,230),FPoint(0,1),0);
+  worm2.setSize(50,3.0);
+  worm2.setWiggle(5.0,35,0.72,0.01);
+  
+  TrackerLibrary a_library;
+  int h1 = a_library.getNewHandle();
+  int h2 = a_library.getNewHandle();
+  i = checkpoint_test_setup(a_library,h1,24); if (i!=0) return 100+i;
+  i = checkpoint_test_setup(a_library,h2,25); if (i!=0) return 100+i;
+  
+  Mask m(128);
+  Image arena( Point(512,512), false );
+  arena.depth = 10;
+  const int row_stride = 512+7;  // Padded, like a decoder's rows
+  short* rows = new short[ row_stride*512 ];
+  Rectangle r;
+  for (j=0;j<N;j++)
+  {
+    arena = (3*W)/4;
+    worm1.imprint(arena,m,0.4,2);
+    worm2.imprint(arena,m,0.4,2);
+    worm1.wiggle(0.3);
+    worm2.wiggle(0.3);
+    if (j<3)
+    {
+      a_library.scanObjects(h1,arena);
+      a_library.scanObjects(h2,arena);
+      continue;
+    }
+    
+    i = a_library.loadImage(h1,arena,0.4*j); if (i!=h1) return 1;
+    
+    // Anything not asked for is garbage, so using it would show
+    for (i=0;i<row_stride*512;i++) rows[i] = 0;
+    n = a_library.prepareImagePieces(h2,0.4*j); if (n<1) return 2;
+    for ( ; n>0 ; n--)
+    {
+      if (a_library.getNextPieceCoords(h2,r)!=h2) return 3;
+      r.cropTo(arena.getBounds());
+      for (x=r.near.x;x<=r.far.x;x++) for (i=r.near.y;i<=r.far.y;i++) rows[i*row_stride + x] = arena.get(Point(x,i));
+      i = a_library.loadThisImagePiece(h2,rows + r.near.y*row_stride + r.near.x,r,Point(1,row_stride)); if (i!=h2) return 4;
+    }
+    if (a_library.getNextPieceCoords(h2,r)!=0) return 5;
+    
+    if (a_library.processImage(h1) != a_library.processImage(h2)) return 6;
+  }
+  delete[] rows;
+  i = a_library.complete(h1); if (i!=h1) return 7;
+  i = a_library.complete(h2); if (i!=h2) return 8;
+  
+  if (!checkpoint_test_same("20071224_105033/ckpt.summary","20071225_105033/ckpt.summary")) return 9;
+  if (!checkpoint_test_same("20071224_105033/ckpt_00000k.blobs","20071225_105033/ckpt_00000k.blobs")) return 10;
+  
+  return 0;
+}
+
+// Track a movie with many worms on one thread and on several; output must match
+int test_mwt_library_threads()
+{
+  const int N = 40;
+  const int M = 9;
+  int W = 1<<10;
+  int i,j;
+  
+  ModelWorm worms[M];
+  for (j=0;j<M;j++)
+  {
+    worms[j].setPose( 64+FPoint(120*(j%3)+30,120*(j/3)+40) , (j%2) ? FPoint(1,0) : FPoint(0,1) , 0 );
+    worms[j].setSize(35+2*j,2.5+0.1*j);
+    worms[j].setWiggle(4.0+0.2*j,30+j,0.7,(j%2) ? 0.02 : -0.02);
+  }
+  
+  TrackerLibrary a_library;
+  int h1 = a_library.getNewHandle();
+  int h2 = a_library.getNewHandle();
+  i = checkpoint_test_setup(a_library,h1,22); if (i!=0) return 100+i;
+  i = checkpoint_test_setup(a_library,h2,23); if (i!=0) return 100+i;
+  i = a_library.setDancerThreads(h2,4); if (i!=h2) return 1;
+  
+  Mask m(128);
+  Image arena( Point(512,512), false );
+  arena.depth = 10;
+  for (j=0;j<N;j++)
+  {
+    arena = (3*W)/4;
+    for (i=0;i<M;i++) { worms[i].imprint(arena,m,0.4,2); worms[i].wiggle(0.3); }
+    if (j<3)
+    {
+      a_library.scanObjects(h1,arena);
+      a_library.scanObjects(h2,arena);
+      continue;
+    }
+    i = a_library.loadImage(h1,arena,0.4*j); if (i!=h1) return 2;
+    i = a_library.loadImage(h2,arena,0.4*j); if (i!=h2) return 3;
+    i = a_library.processImage(h1);
+    if (i<M/2) return 4;
+    if (i != a_library.processImage(h2)) return 5;
+    if (j%8==0 && a_library.reportEndWiggle(h1) != a_library.reportEndWiggle(h2)) return 10;  // Now and then wait for the skeletons
+  }
+  i = a_library.complete(h1); if (i!=h1) return 6;
+  i = a_library.complete(h2); if (i!=h2) return 7;
+  
+  if (!checkpoint_test_same("20071222_105033/ckpt.summary","20071223_105033/ckpt.summary")) return 8;
+  if (!checkpoint_test_same("20071222_105033/ckpt_00000k.blobs","20071223_105033/ckpt_00000k.blobs")) return 9;
+  
+  return 0;
+}
+
 #ifdef UNIT_TEST_OWNER
 int main(int argc,char *argv[])
 {
   int i = test_mwt_library(1);
+  if (i==0) i = test_mwt_library_checkpoint();
+  if (i==0) i = test_mwt_library_pieces();
+  if (i==0) i = test_mwt_library_threads();
   if (argc<=1 || strcmp(argv[1],"-quiet") || i) printf("MWT_Library test result is %d\n",i);
   return i>0;
 }
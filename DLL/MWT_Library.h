@@ -72,6 +72,10 @@ public:
   
   // Output to file
   void fprint(FILE* f , ManagedList<BlobOriginFate>& mlbof, ManagedList<BlobOutputFate>& mlbf);
+  
+  // Binary dump and restore, for checkpoints
+  bool writeState(FILE* f) const;
+  bool readState(FILE* f);
 };
 
 
@@ -160,6 +164,10 @@ public:
     output_date->tm_min = minute;
     output_date->tm_sec = second;
   }
+  
+  // Binary dump and restore of tracking and summary state, for checkpoints
+  bool writeState(FILE* f);
+  bool readState(FILE* f);
 };
 
 
@@ -175,7 +183,6 @@ public:
   TrackerEntry** all_trackers;
   int default_buffer_size;
   ManagedList<int> active_handles;
-  Storage< Listable<Strip> > lsstore;
   
   TrackerLibrary();
   ~TrackerLibrary();
@@ -203,6 +210,7 @@ public:
   int getBitDepth(int handle);
   int setDancerBorderSize(int handle,int border);
   int setUpdateBandNumber(int handle,int n_bands);
+  int setUpdateBandPhase(int handle,int frames);  // Scan bands as if this many frames came before the first one
   
 	
   // Preparing and getting feedback on the region of interest
@@ -231,7 +239,10 @@ public:
   int setObjectSizeThresholds(int handle,int small_size,int small_good_size,int large_good_size,int large_size);
   int setObjectPersistenceThreshold(int handle,int frames);
   int setAdaptationRate(int handle,int alpha);
+  int setStaticBackground(int handle,bool enable=true);  // Never adapt; the caller supplies the background with loadBackground
+  int setDancerThreads(int handle,int n_threads);  // Track the objects in each image on this many threads (default 1); output is the same
   int scanObjects(int handle,Image& im);
+  int loadBackground(int handle,Image& im);  // Replaces the background; only works after a scanObjects
   int showObjects(int handle,Image& im);
   
   // Controls for what statistical data to collect
@@ -243,6 +254,7 @@ public:
   int prepareImagePieces(int handle,float time);
   int getNextPieceCoords(int handle,Rectangle& coords);
   int loadThisImagePiece(int handle,Image& im); 
+  int loadThisImagePiece(int handle,short *pixels,Rectangle piece,Point stride);  // Reads the piece in place; pixels is its near corner
   int loadImage(int handle,Image& im,float time);  // Prepares, gets, and loads all pieces at once
   int loadImageAsPieces(int handle,Image& im,float time);  // Inefficient version of loadImage with an extra copy of image pieces (useful for testing)
   int showLoaded(int handle,Image& im);
@@ -252,6 +264,12 @@ public:
   int checkErrors(int handle);
   int complete(int handle);  // Must call this to save summary information!
   
+  // Checkpoints: save everything about a handle between frames, and carry on from it later in a new handle
+  // that has been set up and had its output begun the same way (with the date from peekCheckpoint) but not scanned
+  int saveCheckpoint(int handle,const char *fname);
+  int loadCheckpoint(int handle,const char *fname);
+  static bool peekCheckpoint(const char *fname,int& frame,struct tm& date);  // Frame the checkpoint was taken after
+  
 	// Image correction algorithm
 	int setDivisionImageCorrectionAlgorithm( int handle );
 	int setSubtractionImageCorrectionAlgorithm( int handle );
@@ -272,6 +290,9 @@ public:
   float reportRelativeAspect(int handle);  // Reports current (width/length) / mean (width/length)
   float reportEndWiggle(int handle);  // Angle of turned head or tail
 	float reportObjectPixelCount(int handle); // Reports mean pixel count of found objects.
+  
+  // A single object, by the ID it has in the output; returns 0 if it isn't being tracked any more
+  int reportObject(int handle,int id,FPoint& centroid,Rectangle& bounds);
 };
 
 
@@ -281,6 +302,9 @@ public:
 ****************************************************************/
 
 int mwt_test_library(int bin);
+int test_mwt_library_checkpoint();
+int test_mwt_library_pieces();
+int test_mwt_library_threads();
 
 #endif
 
@@ -104,6 +104,18 @@ int test_mwt_lists_listable()
   }
   if (lph->next->data.x != 8) return 9;
   
+  // Nearly sorted again, which is what insertion sort is for
+  Listable<Point>::mergeSort(lph,lpt);
+  lph->next->next->data.x = 1;
+  lpt->data.x = -1;
+  Listable<Point>::insertionSort(lph,lpt);
+  if (lph->data.x != -1 || lph->prev != NULL || lpt->next != NULL || lpt->data.x != 8) return 10;
+  for (lq=NULL,lp=lph;lp!=NULL;lq=lp,lp=lp->next)
+  {
+    if (lq!=NULL && (lp->data < lq->data || lp->prev != lq)) return 11;
+  }
+  if (lph->next->next->data.x != 1) return 12;
+  
   return 0;
 }
 
@@ -936,6 +936,41 @@ public:
     for ( tail=head,result=head->next ; result!=NULL ; tail=result,result=result->next ) { result->prev = tail; }
   }
   
+  // Insertion sort: only does work for items that are out of place, so it's quick on lists that are
+  // nearly sorted already.  Like mergeSort it is stable, so the two leave a list in the same order.
+  static void insertionSort(Listable<Node>*& head , Listable<Node>*& tail)
+  {
+    Listable<Node> *item,*after,*spot;
+    if (head==NULL) return;
+    for (item=head->next ; item!=NULL ; item=after)
+    {
+      after = item->next;
+      if (!(item->data < item->prev->data)) continue;
+      
+      // Take it out (its own links are left alone for now)
+      item->prev->next = after;
+      if (after!=NULL) after->prev = item->prev;
+      else tail = item->prev;
+      
+      // Put it after the nearest earlier item that it isn't less than
+      for (spot=item->prev->prev ; spot!=NULL && item->data < spot->data ; spot=spot->prev) { }
+      if (spot==NULL)
+      {
+        item->prev = NULL;
+        item->next = head;
+        head->prev = item;
+        head = item;
+      }
+      else
+      {
+        item->prev = spot;
+        item->next = spot->next;
+        spot->next->prev = item;
+        spot->next = item;
+      }
+    }
+  }
+  
   static void joinR(Listable<Node>*& head , Listable<Node>*& tail , Listable<Node>* join_head , Listable<Node>* join_tail)
   {
     if (join_head==NULL) return;
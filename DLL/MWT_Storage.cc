@@ -167,6 +167,123 @@ int test_mwt_storage_dual()
   return 0;
 }
 
+// Counts how many are alive, to see that a shared Storage calls destructors like any other
+struct StorageTally
+{
+  static int alive;
+  int n;
+  StorageTally() : n(0) { alive++; }
+  ~StorageTally() { alive--; }
+};
+int StorageTally::alive = 0;
+
+#ifndef MWT_NO_THREADS
+struct StorageSharedJob
+{
+  Storage< Listable<int> >* store;
+  int id;
+  int bad;
+};
+
+// Builds up and thins out a list of its own, all from the shared storage, many times over
+void* test_mwt_storage_shared_job(void* job)
+{
+  StorageSharedJob& ssj = *(StorageSharedJob*)job;
+  ManagedList<int> ml(ssj.store);
+  int i,k;
+  for (k=0;k<20;k++)
+  {
+    for (i=0;i<1000;i++) ml.Append( ssj.id*1000000 + k*1000 + i );
+    ml.start();
+    while (ml.advance()) { if (ml.i()&0x1) ml.Backspace(); }
+  }
+  
+  ssj.bad = (ml.size != 20*500) ? 1 : 0;
+  ml.start();
+  while (ml.advance())
+  {
+    if (ml.i()/1000000 != ssj.id) ssj.bad = 2;
+    if ((ml.i()%1000)&0x1) ssj.bad = 3;
+  }
+  ml.flush();
+  return NULL;
+}
+#endif
+
+int test_mwt_storage_shared()
+{
+  int i;
+  Stackable<StorageTally> *lt=NULL;
+  Storage< Stackable<StorageTally> >* slt = new Storage< Stackable<StorageTally> >(64,true,true);
+  
+  for (i=0;i<300;i++) slt->create()->pushOnto(lt);
+  if (StorageTally::alive != 300) return 1;
+  for (i=0;i<100;i++) slt->destroy( Stackable<StorageTally>::pop(lt) );
+  if (StorageTally::alive != 200) return 2;
+  delete slt;
+  if (StorageTally::alive != 0) return 3;
+  
+  // Borrowers count what they have out, and what one gives back the next can use
+  lt = NULL;
+  slt = new Storage< Stackable<StorageTally> >(64,true,true);
+  Storage< Stackable<StorageTally> >* b1 = new Storage< Stackable<StorageTally> >(slt,16,false);
+  Storage< Stackable<StorageTally> >* b2 = new Storage< Stackable<StorageTally> >(slt,16,false);
+  for (i=0;i<50;i++) b1->create()->pushOnto(lt);
+  if (b1->n_used != 50 || !b1->ctor_dtor || StorageTally::alive != 50) return 7;
+  b1->destroyList(lt);
+  if (b1->n_used != 0 || StorageTally::alive != 0) return 8;
+  delete b1;
+  for (i=0;i<50;i++) b2->create()->pushOnto(lt);
+  if (b2->n_used != 50 || slt->shared->blocks->next != NULL) return 9;
+  b2->destroyList(lt);
+  delete b2;
+  delete slt;
+  Storage< Listable<int> > loner(NULL,16,false);
+  if (loner.shared != NULL || loner.block_size != 16) return 10;
+  
+#ifndef MWT_NO_THREADS
+  const int N = 4;
+  StorageSharedJob jobs[N];
+  pthread_t threads[N];
+  Storage< Listable<int> >* sli = new Storage< Listable<int> >(256,false,true);
+  for (i=0;i<N;i++)
+  {
+    jobs[i].store = sli;
+    jobs[i].id = i+1;
+    jobs[i].bad = -1;
+    if (pthread_create(&threads[i],NULL,test_mwt_storage_shared_job,&jobs[i])!=0) return 4;
+  }
+  for (i=0;i<N;i++) pthread_join(threads[i],NULL);
+  for (i=0;i<N;i++) if (jobs[i].bad!=0) return 5;
+  
+  // Everything the threads had went back to the pool when they exited, so filling every block needs no new ones
+  int n_blocks = 0;
+  StorageShare< Listable<int> >::Block* b;
+  for (b=sli->shared->blocks ; b!=NULL ; b=b->next) n_blocks++;
+  ManagedList<int>* ml = new ManagedList<int>(sli);
+  for (i=0;i<n_blocks*sli->block_size;i++) ml->Append(i);
+  for (b=sli->shared->blocks ; b!=NULL ; b=b->next) n_blocks--;
+  if (n_blocks != 0) return 6;
+  delete ml;
+  delete sli;
+  
+  // More shared Storages at once than there could ever be pthread keys for, each with a slot of its own
+  const int M = 1500;
+  Storage< Listable<int> >** many = new Storage< Listable<int> >*[M];
+  for (i=0;i<M;i++)
+  {
+    many[i] = new Storage< Listable<int> >(4,false,true);
+    many[i]->create()->data = i;
+    if (many[i]->shared->slot < 0 || (i>0 && many[i]->shared->slot == many[i-1]->shared->slot)) return 11;
+  }
+  for (i=0;i<M;i++) if (many[i]->shared->blocks->items[0].data != i) return 11;
+  for (i=0;i<M;i++) delete many[i];
+  delete[] many;
+#endif
+  
+  return 0;
+}
+
 int test_mwt_storage()
 {
   return test_mwt_storage_arrays() + 100*test_mwt_storage_storage() + 10000*test_mwt_storage_list() + 1000000*test_mwt_storage_dual();
@@ -176,6 +293,7 @@ int test_mwt_storage()
 int main(int argc,char *argv[])
 {
   int i = test_mwt_storage();
+  if (i==0) i = test_mwt_storage_shared();
   if (argc<=1 || strcmp(argv[1],"-quiet") || i) printf("MWT_Storage test result is %d\n",i);
   return i>0;
 }
@@ -13,7 +13,11 @@
 
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <new>
+#ifndef MWT_NO_THREADS
+#include <pthread.h>
+#endif
 #include "MWT_Lists.h"
 
 
@@ -99,8 +103,326 @@ public:
         * It is safe to allocate a whole bunch of things with Storage and then
         * just delete the whole storage--if you've asked for it to use
         * destructors, it will clean everything up properly.
+** NOTE **
+        * A Storage is for one thread at a time unless it's made shared
+        * (third constructor argument); then any number of threads can create
+        * from it and destroy into it at once (see StorageShare).  Lists that
+        * use it still belong to one thread each.  All shared Storages file
+        * their per-thread caches under a single pthread key (see
+        * StorageThreads), so there's no limit on how many there can be.
+** NOTE **
+        * A Storage can also borrow from a shared one, so lots of short-lived
+        * owners can draw on one pool without a block each.  A borrower only
+        * counts what it has out (n_used); deleting it gives nothing back, so
+        * destroy everything you created from it first.
 ** NOTE */
 
+#ifndef MWT_NO_THREADS
+// The one pthread key under which every shared Storage keeps its threads' caches.  Each thread's value
+// is a table with a slot per share; a share takes a free slot when it's made and frees it when it's
+// deleted, and the serial number it was given tells a cache of its own from one an earlier share left
+// in the same slot.  If the key can't be made, shares get slot -1 and find caches by thread instead.
+class StorageThreads
+{
+public:
+  struct Entry { void* cache; unsigned int serial; };
+  struct Table { Entry* entries; int n; };  // One per thread
+  struct Registry
+  {
+    pthread_once_t once;
+    int key_error;             // What pthread_key_create said; we only have a key if it's 0
+    pthread_key_t key;
+    pthread_mutex_t lock;      // Guards the rest, and is held while exiting threads give caches back
+    unsigned int last_serial;
+    int n_slots;
+    unsigned int* live;        // Serial of the share in each slot, 0 if it's free
+    void (**retire)(void*);    // How that share takes back a thread's cache
+  };
+  
+  // Everything is constant-initialized, so there's just the one however many files include us
+  static Registry& registry()
+  {
+    static Registry r = { PTHREAD_ONCE_INIT , 0 , 0 , PTHREAD_MUTEX_INITIALIZER , 0 , 0 , NULL , NULL };
+    return r;
+  }
+  
+  // Take a slot for a new share, or -1 if there's no key
+  static int enroll(unsigned int& serial,void (*retire)(void*))
+  {
+    Registry& r = registry();
+    pthread_once(&r.once,makeKey);
+    serial = 0;
+    if (r.key_error!=0) return -1;
+    pthread_mutex_lock(&r.lock);
+    int k;
+    for (k=0 ; k<r.n_slots && r.live[k]!=0 ; k++) { }
+    if (k==r.n_slots)
+    {
+      int n = (r.n_slots<8) ? 8 : 2*r.n_slots;
+      r.live = (unsigned int*)realloc(r.live , n*sizeof(unsigned int));
+      r.retire = (void (**)(void*))realloc(r.retire , n*sizeof(void (*)(void*)));
+      for (int i=r.n_slots;i<n;i++) r.live[i] = 0;
+      r.n_slots = n;
+    }
+    if (++r.last_serial==0) r.last_serial = 1;  // 0 means free
+    serial = r.live[k] = r.last_serial;
+    r.retire[k] = retire;
+    pthread_mutex_unlock(&r.lock);
+    return k;
+  }
+  // The share in slot is going away; no exiting thread will hand it anything from now on
+  static void release(int slot)
+  {
+    if (slot<0) return;
+    Registry& r = registry();
+    pthread_mutex_lock(&r.lock);
+    r.live[slot] = 0;
+    pthread_mutex_unlock(&r.lock);
+  }
+  
+  // This thread's cache for the share in slot, or NULL if it hasn't filed one
+  static inline void* find(int slot,unsigned int serial)
+  {
+    Table* t = (Table*)pthread_getspecific(registry().key);
+    if (t==NULL || slot>=t->n || t->entries[slot].serial!=serial) return NULL;
+    return t->entries[slot].cache;
+  }
+  // File cache as this thread's for the share in slot; false if the key wouldn't take our table
+  static bool file(int slot,unsigned int serial,void* cache)
+  {
+    Registry& r = registry();
+    Table* t = (Table*)pthread_getspecific(r.key);
+    if (t==NULL)
+    {
+      t = (Table*)malloc(sizeof(Table));
+      t->entries = NULL;
+      t->n = 0;
+      if (pthread_setspecific(r.key,t)!=0) { free(t); return false; }
+    }
+    if (slot >= t->n)
+    {
+      int n = (2*t->n > slot) ? 2*t->n : slot+1;
+      t->entries = (Entry*)realloc(t->entries , n*sizeof(Entry));
+      for (int i=t->n;i<n;i++) { t->entries[i].cache = NULL; t->entries[i].serial = 0; }
+      t->n = n;
+    }
+    t->entries[slot].cache = cache;
+    t->entries[slot].serial = serial;
+    return true;
+  }
+  
+private:
+  static void makeKey()
+  {
+    Registry& r = registry();
+    r.key_error = pthread_key_create(&r.key,leave);
+  }
+  // A thread is exiting: its caches go back to those shares that are still alive
+  static void leave(void* table)
+  {
+    Table* t = (Table*)table;
+    Registry& r = registry();
+    pthread_mutex_lock(&r.lock);
+    for (int k=0 ; k<t->n && k<r.n_slots ; k++)
+    {
+      if (t->entries[k].cache!=NULL && t->entries[k].serial!=0 && r.live[k]==t->entries[k].serial) r.retire[k](t->entries[k].cache);
+    }
+    pthread_mutex_unlock(&r.lock);
+    free(t->entries);
+    free(t);
+  }
+};
+#endif
+
+// The free items of a shared Storage.  Each thread keeps its own cache and only visits
+// the common pool when its cache runs dry (then it takes the whole pool) or has more
+// than two batches (then it gives one back).  The pool is a lock-free stack that is only
+// ever pushed onto or emptied all at once, so it can't suffer from ABA; the block list
+// is push-only.  With MWT_NO_THREADS there's a single cache and no atomics.
+template <class T> class StorageShare
+{
+public:
+  struct Cache  // n never overcounts head's list
+  {
+    T* head;
+    int n;
+    StorageShare<T>* owner;
+    Cache* next;
+#ifndef MWT_NO_THREADS
+    pthread_t thread;
+#endif
+  };
+  struct Block { T* items; Block* next; };
+  
+  T* volatile pool;
+  Cache* volatile caches;
+  Block* volatile blocks;
+  int block_size;
+  int batch;
+  bool ctor_dtor;
+#ifndef MWT_NO_THREADS
+  int slot;             // Ours in StorageThreads, or -1 if there's no key
+  unsigned int serial;
+#endif
+  
+  StorageShare(int n_items,bool use_ctor_dtor) :
+    pool(NULL),caches(NULL),blocks(NULL),block_size( (n_items<1) ? 1 : n_items ),ctor_dtor(use_ctor_dtor)
+  {
+    batch = (block_size<4) ? 1 : block_size/4;
+#ifndef MWT_NO_THREADS
+    slot = StorageThreads::enroll(serial,retire);
+#endif
+  }
+  ~StorageShare()  // Only once every other thread is done with it
+  {
+#ifndef MWT_NO_THREADS
+    StorageThreads::release(slot);
+#endif
+    Block *b;
+    Cache *c;
+    T *t;
+    if (ctor_dtor)
+    {
+      int n_blocks = 0;
+      for (b=blocks ; b!=NULL ; b=b->next) n_blocks++;
+      char* destructorable = new char[n_blocks*block_size];
+      for (int i=0;i<n_blocks*block_size;i++) destructorable[i] = 1;
+      for (t=pool ; t!=NULL ; t=t->next) mark(destructorable,t);
+      for (c=caches ; c!=NULL ; c=c->next) for (t=c->head ; t!=NULL ; t=t->next) mark(destructorable,t);
+      int j = 0;
+      for (b=blocks ; b!=NULL ; b=b->next,j++) for (int i=0;i<block_size;i++) if (destructorable[j*block_size+i]) b->items[i].~T();
+      delete[] destructorable;
+    }
+    while (blocks!=NULL) { b=blocks; blocks=b->next; delete[] (char*)b->items; delete b; }
+    while (caches!=NULL) { c=caches; caches=c->next; delete c; }
+  }
+  
+  T* create(bool use_ctor)
+  {
+    Cache* c = mine();
+    if (c->head==NULL) refill(c);
+    T* t = c->head;
+    c->head = t->next;
+    if (c->n>0) c->n--;
+    t->next = NULL;
+    if (use_ctor) { t = new(t) T(); }
+    return t;
+  }
+  void destroy(T* dead)
+  {
+    if (ctor_dtor) { dead->~T(); }
+    Cache* c = mine();
+    dead->next = c->head;
+    c->head = dead;
+    if (++c->n >= 2*batch) spill(c);
+  }
+  
+private:
+  // Sets *p to now if it was was; returns what it really was.  Only used on lists of things with a next.
+#ifndef MWT_NO_THREADS
+  template <class P> static inline P* swapIn(P* volatile* p,P* was,P* now) { return __sync_val_compare_and_swap(p,was,now); }
+  template <class P> static inline P* takeAll(P* volatile* p) { return __sync_lock_test_and_set(p,(P*)NULL); }
+#else
+  template <class P> static inline P* swapIn(P* volatile* p,P* was,P* now) { P* is = *p; if (is==was) *p = now; return is; }
+  template <class P> static inline P* takeAll(P* volatile* p) { P* all = *p; *p = NULL; return all; }
+#endif
+  
+  // Put head...tail onto the front of a list that is only pushed onto or taken all at once
+  template <class P> static void pushOnto(P* volatile* p,P* head,P* tail)
+  {
+    P* was = NULL;  // Just a guess; the first swap tells us if it's wrong
+    for (;;)
+    {
+      tail->next = was;
+      P* is = swapIn(p,was,head);
+      if (is==was) return;
+      was = is;
+    }
+  }
+  
+  // The calling thread's cache; the first time, it's looked for by thread (one left by an exited thread
+  // with the same ID will do) or made, then filed under the key
+  Cache* mine()
+  {
+#ifndef MWT_NO_THREADS
+    Cache* c = (slot<0) ? NULL : (Cache*)StorageThreads::find(slot,serial);
+    if (c!=NULL) return c;
+    pthread_t self = pthread_self();
+    for (c=swapIn(&caches,(Cache*)NULL,(Cache*)NULL) ; c!=NULL ; c=c->next) if (pthread_equal(c->thread,self)) break;  // Swap so we see what was pushed
+#else
+    Cache* c = caches;
+#endif
+    if (c==NULL)
+    {
+      c = new Cache;
+      c->head = NULL;
+      c->n = 0;
+      c->owner = this;
+#ifndef MWT_NO_THREADS
+      c->thread = self;
+#endif
+      pushOnto(&caches,c,c);
+    }
+#ifndef MWT_NO_THREADS
+    if (slot>=0) StorageThreads::file(slot,serial,c);
+#endif
+    return c;
+  }
+  
+  // Take the whole pool, or else a fresh block (we don't know how big the pool was, only that it wasn't empty)
+  void refill(Cache* c)
+  {
+    c->head = takeAll(&pool);
+    if (c->head!=NULL) { c->n = 1; return; }
+    
+    Block* b = new Block;
+    b->items = (T*) new char[block_size*sizeof(T)];
+    for (int i=0;i<block_size-1;i++) b->items[i].next = b->items+i+1;
+    b->items[block_size-1].next = NULL;
+    pushOnto(&blocks,b,b);
+    c->head = b->items;
+    c->n = block_size;
+  }
+  
+  // Give a batch back to the pool
+  void spill(Cache* c)
+  {
+    T* last = c->head;
+    for (int i=1;i<batch;i++) last = last->next;
+    T* give = c->head;
+    c->head = last->next;
+    c->n -= batch;
+    pushOnto(&pool,give,last);
+  }
+  
+#ifndef MWT_NO_THREADS
+  // A thread is exiting (see StorageThreads); its cache goes back to the pool (the Cache itself is freed with the share)
+  static void retire(void* cache)
+  {
+    Cache* c = (Cache*)cache;
+    if (c->head==NULL) return;
+    T* last;
+    for (last=c->head ; last->next!=NULL ; last=last->next) { }
+    pushOnto(&(c->owner->pool),c->head,last);
+    c->head = NULL;
+    c->n = 0;
+  }
+#endif
+  
+  void mark(char* destructorable,T* t)
+  {
+    int j = 0;
+    for (Block* b=blocks ; b!=NULL ; b=b->next,j++)
+    {
+      ptrdiff_t delta = (ptrdiff_t)t - (ptrdiff_t)b->items;
+      if (delta >= 0 && delta < (ptrdiff_t)(sizeof(T)*block_size)) { destructorable[j*block_size + delta/sizeof(T)] = 0; return; }
+    }
+  }
+  
+  StorageShare(const StorageShare<T>& ss);
+};
+
+
 // Storage class provides memory for arbitrary lists of classes
 template <class T> class Storage
 {
@@ -109,12 +431,29 @@ public:
   T *defunct;
   T *unused;
   int block_size;
-  int n_used;
+  int n_used;               // When borrowing, how many of the lender's items we have out
   bool ctor_dtor;
+  StorageShare<T> *shared;  // If non-NULL, everything goes through here instead
+  bool owns_share;          // If not, we're borrowing someone else's
   
-  Storage(int n_items,bool use_ctor_dtor=false) : used_storage(NULL),defunct(NULL),n_used(0),ctor_dtor(use_ctor_dtor)
+  Storage(int n_items,bool use_ctor_dtor=false,bool share=false) :
+    used_storage(NULL),defunct(NULL),n_used(0),ctor_dtor(use_ctor_dtor),shared(NULL),owns_share(share)
+  {
+    if (share) { shared = new StorageShare<T>(n_items,use_ctor_dtor); block_size=shared->block_size; unused=NULL; }
+    else if (n_items==0) { block_size=0; unused=NULL; }
+    else
+    {
+      block_size = (n_items<1) ? 1 : n_items;
+      unused = (T*) new char[block_size*sizeof(T)];
+    }
+  }
+  // Borrow from a shared Storage (which must outlive us) instead of keeping any memory of our own;
+  // if lender is NULL or isn't shared, this is the same as Storage(n_items,use_ctor_dtor)
+  Storage(Storage<T>* lender,int n_items,bool use_ctor_dtor) :
+    used_storage(NULL),defunct(NULL),n_used(0),ctor_dtor(use_ctor_dtor),shared(NULL),owns_share(false)
   {
-    if (n_items==0) { block_size=0; unused=NULL; }
+    if (lender!=NULL && lender->shared!=NULL) { shared=lender->shared; block_size=shared->block_size; ctor_dtor=shared->ctor_dtor; unused=NULL; }
+    else if (n_items==0) { block_size=0; unused=NULL; }
     else
     {
       block_size = (n_items<1) ? 1 : n_items;
@@ -152,11 +491,14 @@ public:
       unused = NULL;
     }
     if (used_storage) { delete used_storage; used_storage=NULL; }
+    if (shared && owns_share) delete shared;
+    shared = NULL;
   }
   
   // Create an item from the store, calling default constructor if requested
   T* create(bool use_ctor)
   {
+    if (shared) { if (!owns_share) n_used++; return shared->create(use_ctor); }
     T *t;
     if (defunct)
     {
@@ -184,13 +526,20 @@ public:
   // Free memory.  Don't try to free NULL pointers!
   void destroy(T *dead)
   {
+    if (shared) { if (!owns_share) n_used--; shared->destroy(dead); return; }
     if (ctor_dtor) { dead->~T(); }
     dead->next = defunct;
     defunct = dead;
   }
   void destroyList(T*& dead_head , T*& dead_tail)
   {
-    if (ctor_dtor)
+    if (shared)
+    {
+      T *t;
+      while (dead_head!=NULL) { t = dead_head; dead_head = dead_head->next; shared->destroy(t); if (!owns_share) n_used--; }
+      dead_tail = NULL;
+    }
+    else if (ctor_dtor)
     {
       T *t = dead_head;
       while (t!=NULL)
@@ -212,7 +561,12 @@ public:
   }
   void destroyList(T*& dead_head)
   {
-    if (ctor_dtor)
+    if (shared)
+    {
+      T *t;
+      while (dead_head!=NULL) { t = dead_head; dead_head = dead_head->next; shared->destroy(t); if (!owns_share) n_used--; }
+    }
+    else if (ctor_dtor)
     {
       T *t = dead_head;
       while (t!=NULL)
@@ -650,6 +1004,7 @@ public:
   // Merge sorts using < or function pointer
   inline void mergeSort() { Listable<T>::mergeSort(list_head,list_tail); }
   inline void mergeSort(int (*lessThan)(T*,T*,void*) , void *data) { Listable<T>::mergeSort(list_head,list_tail,lessThan,data); }
+  inline void insertionSort() { Listable<T>::insertionSort(list_head,list_tail); }  // Same order as mergeSort, faster if nearly sorted
 };
 
 
@@ -837,6 +1192,43 @@ public:
 
 
 
+/****************************************************************
+                 Binary Dumps of Plain Data
+****************************************************************/
+
+/* NOTE **
+        * These write items exactly as they sit in memory, so only use
+        * them on data without pointers, and only read the result back
+        * with the same build on the same kind of machine.
+** NOTE */
+
+template <class T> inline bool dumpRaw(FILE* f,const T& t) { return fwrite(&t,sizeof(T),1,f)==1; }
+template <class T> inline bool undumpRaw(FILE* f,T& t) { return fread(&t,sizeof(T),1,f)==1; }
+
+// Whole list of plain data: count first, then the items
+template <class T> bool dumpRawList(FILE* f,const ManagedList<T>& ml)
+{
+  if (!dumpRaw(f,ml.size)) return false;
+  Listable<T>* lt;
+  ml.start(lt);
+  while (ml.advance(lt)) { if (!dumpRaw(f,lt->data)) return false; }
+  return true;
+}
+// Appends to whatever is already in the list
+template <class T> bool undumpRawList(FILE* f,ManagedList<T>& ml)
+{
+  int n;
+  T t;
+  if (!undumpRaw(f,n) || n<0) return false;
+  for ( ; n>0 ; n--)
+  {
+    if (!undumpRaw(f,t)) return false;
+    ml.Append(t);
+  }
+  return true;
+}
+
+
 /****************************************************************
                     Unit Test-Style Functions
 ****************************************************************/
@@ -845,6 +1237,7 @@ int test_mwt_storage_arrays();
 int test_mwt_storage_storage();
 int test_mwt_storage_list();
 int test_mwt_storage_dual();
+int test_mwt_storage_shared();
 int test_mwt_storage();
 
 
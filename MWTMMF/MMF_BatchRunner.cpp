@@ -0,0 +1,221 @@
+/*
+ * File:   MMF_BatchRunner.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <fstream>
+#include <sstream>
+#include "MMF_BatchRunner.h"
+#include "MultiStackReader.h"
+#include "tictoc/tictoc.h"
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+using namespace std;
+
+MMF_BatchRunner::MMF_BatchRunner(const MMF_MWT_Processor &settings, int numWorkers, double memoryBudgetMB) :
+settings(settings), numWorkers(numWorkers), memoryBudgetMB(memoryBudgetMB), nextJob(0), running(0), memoryInUse(0), progress(NULL) {
+    if (this->numWorkers <= 0) {
+        this->numWorkers = numCores();
+    }
+    if (this->memoryBudgetMB <= 0) {
+        this->memoryBudgetMB = physicalMemoryMB() / 2;
+    }
+    //with several files going at once, each one's log has to go to its own file, and there's no one window to show
+    this->settings.writeLog = true;
+    if (this->settings.previewOutput == "window") {
+        this->settings.windowOutputUpdateInterval = -1;
+    }
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&memoryFreed, NULL);
+}
+
+MMF_BatchRunner::~MMF_BatchRunner() {
+    pthread_cond_destroy(&memoryFreed);
+    pthread_mutex_destroy(&lock);
+}
+
+int MMF_BatchRunner::numCores() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (si.dwNumberOfProcessors > 0) ? (int) si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int) n : 1;
+#endif
+}
+
+//0 if it can't be found out
+double MMF_BatchRunner::physicalMemoryMB() {
+#ifdef _WIN32
+    MEMORYSTATUSEX ms;
+    ms.dwLength = sizeof(ms);
+    return GlobalMemoryStatusEx(&ms) ? ms.ullTotalPhys / (1024.0 * 1024.0) : 0;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    return (pages > 0 && pagesize > 0) ? (double) pages * pagesize / (1024.0 * 1024.0) : 0;
+#endif
+}
+
+void MMF_BatchRunner::addFile(const string &mmfname, const string &outpath, const string &outname) {
+    Job j;
+    j.mmfname = mmfname;
+    j.outpath = outpath;
+    j.outname = outname;
+    j.status = -2;
+    j.seconds = 0;
+    j.memoryMB = 0;
+    j.worker = -1;
+    jobs.push_back(j);
+}
+
+int MMF_BatchRunner::addManifest(const char *manifestName) {
+    ifstream ifs(manifestName);
+    if (!ifs.good()) {
+        return -1;
+    }
+    int n = 0;
+    string line;
+    while (getline(ifs, line)) {
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line.erase(line.length() - 1);
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        //tabs only, so that file names may have spaces in them
+        string field[3];
+        size_t start = 0;
+        for (int k = 0; k < 3 && start != string::npos; ++k) {
+            size_t tab = line.find('\t', start);
+            field[k] = line.substr(start, (tab == string::npos) ? string::npos : tab - start);
+            start = (tab == string::npos) ? tab : tab + 1;
+        }
+        if (field[0].empty()) {
+            continue;
+        }
+        addFile(field[0], field[1], field[2]);
+        ++n;
+    }
+    return n;
+}
+
+int MMF_BatchRunner::run(ostream &progress) {
+    this->progress = &progress;
+    nextJob = 0;
+    running = 0;
+    memoryInUse = 0;
+    int nworkers = (numWorkers < (int) jobs.size()) ? numWorkers : (int) jobs.size();
+    progress << "processing " << jobs.size() << " files with " << nworkers << " workers and a memory budget of " << memoryBudgetMB << " MB" << endl;
+
+    Worker *workers = new Worker[nworkers];
+    int k;
+    for (k = 0; k < nworkers; ++k) {
+        workers[k].runner = this;
+        workers[k].index = k;
+        workers[k].threaded = (pthread_create(&workers[k].thread, NULL, workerThreadEntry, workers + k) == 0);
+    }
+    //if no threads could be had at all, work through the list here
+    bool any = false;
+    for (k = 0; k < nworkers; ++k) {
+        any = any || workers[k].threaded;
+    }
+    if (!any && nworkers > 0) {
+        workLoop(0);
+    }
+    for (k = 0; k < nworkers; ++k) {
+        if (workers[k].threaded) {
+            pthread_join(workers[k].thread, NULL);
+        }
+    }
+    delete[] workers;
+
+    int nfailed = 0;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        nfailed += (jobs[j].status != 0);
+    }
+    this->progress = NULL;
+    return nfailed;
+}
+
+void *MMF_BatchRunner::workerThreadEntry(void *worker) {
+    Worker *w = (Worker *) worker;
+    w->runner->workLoop(w->index);
+    return NULL;
+}
+
+void MMF_BatchRunner::workLoop(int worker) {
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        if (nextJob >= jobs.size()) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        Job &job = jobs[nextJob++];
+        pthread_mutex_unlock(&lock);
+        runJob(job, worker);
+    }
+}
+
+void MMF_BatchRunner::runJob(Job &job, int worker) {
+    job.worker = worker;
+
+    //the frame size is all we need to know how much room the file will take
+    {
+        MultiStackReader sr(job.mmfname.c_str());
+        CvSize sz = sr.getImageSize();
+        if (sr.isError()) {
+            job.status = 1;
+            pthread_mutex_lock(&lock);
+            *progress << job.mmfname << ": could not be read: " << sr.getError() << endl;
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        job.memoryMB = settings.memoryEstimate(sz.width, sz.height) / (1024.0 * 1024.0);
+    }
+
+    pthread_mutex_lock(&lock);
+    while (running > 0 && memoryInUse + job.memoryMB > memoryBudgetMB) {
+        pthread_cond_wait(&memoryFreed, &lock);
+    }
+    ++running;
+    memoryInUse += job.memoryMB;
+    pthread_mutex_unlock(&lock);
+
+    MMF_MWT_Processor mp(settings); // process() changes startFrame and endFrame, so every file needs its own copy
+    TICTOC::tictoc tim;
+    tim.tic("process");
+    job.status = mp.process(job.mmfname.c_str(), job.outpath.empty() ? NULL : job.outpath.c_str(), job.outname.empty() ? NULL : job.outname.c_str());
+    tim.toc("process");
+    job.seconds = tim.getStatistics("process");
+
+    pthread_mutex_lock(&lock);
+    --running;
+    memoryInUse -= job.memoryMB;
+    pthread_cond_broadcast(&memoryFreed);
+    *progress << job.mmfname << ": ";
+    if (job.status == 0) {
+        *progress << "done in " << job.seconds << " s" << endl;
+    } else {
+        *progress << "processing failed with return value: " << job.status << endl;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void MMF_BatchRunner::writeReport(ostream &os) const {
+    os << "#mmf\tstatus\tseconds\tmemory (MB)\tworker" << endl;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        const Job &job = jobs[j];
+        os << job.mmfname << '\t' << job.status << '\t' << job.seconds << '\t' << job.memoryMB << '\t' << job.worker << endl;
+    }
+}
+
+MMF_BatchRunner::MMF_BatchRunner(const MMF_BatchRunner& orig) {
+}
@@ -0,0 +1,109 @@
+/*
+ * File:   MMF_BatchRunner.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_BATCHRUNNER_H
+#define	MMF_BATCHRUNNER_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <pthread.h>
+#include "MMF_MWT_Processor.h"
+
+/* MMF_BatchRunner runs the same settings over many MMFs in one process
+ *
+ * files are handed out in order to a pool of numWorkers threads; each file gets
+ * its own copy of the settings and so its own TrackerLibrary handle, exactly as if
+ * mmf2mwt had been run on it alone
+ *
+ * before a file is started, its memory use is estimated from its frame size
+ * (MMF_MWT_Processor::memoryEstimate); a worker waits until the files already running
+ * leave room for it under memoryBudgetMB.  a file that is over budget by itself is
+ * still run, but only once nothing else is running
+ *
+ * each file's log always goes to outputpath/outputprefix.mwtlog, since the logs of
+ * files running at the same time would otherwise be mixed together on cout
+ */
+class MMF_BatchRunner {
+public:
+
+    /* one file in the batch; outpath and outname may be empty, meaning the defaults
+     * process() picks from the mmf name
+     * status is process()'s return value (-2 until the file has been run)
+     */
+    struct Job {
+        std::string mmfname;
+        std::string outpath;
+        std::string outname;
+        int status;
+        double seconds;
+        double memoryMB;
+        int worker;
+    };
+
+    /* MMF_BatchRunner(const MMF_MWT_Processor &settings, int numWorkers = 0, double memoryBudgetMB = 0);
+     * numWorkers <= 0 uses one worker per core; memoryBudgetMB <= 0 uses half of physical memory
+     */
+    MMF_BatchRunner(const MMF_MWT_Processor &settings, int numWorkers = 0, double memoryBudgetMB = 0);
+    virtual ~MMF_BatchRunner();
+
+    void addFile(const std::string &mmfname, const std::string &outpath = std::string(), const std::string &outname = std::string());
+
+    /* int addManifest(const char *manifestName);
+     * one file per line: mmfname[<tab>outputpath[<tab>outputprefix]]
+     * blank lines and lines starting with # are skipped
+     * returns the number of files added, or -1 if the manifest could not be read
+     */
+    int addManifest(const char *manifestName);
+
+    /* int run(std::ostream &progress);
+     * processes every file added so far; a line is written to progress as each one finishes
+     * returns the number of files that failed
+     */
+    int run(std::ostream &progress);
+
+    /* void writeReport(std::ostream &os) const;
+     * one tab separated line per file: name, status, seconds, estimated MB, worker
+     */
+    void writeReport(std::ostream &os) const;
+
+    const std::vector<Job> &getJobs() const { return jobs; }
+    int getNumWorkers() const { return numWorkers; }
+    double getMemoryBudgetMB() const { return memoryBudgetMB; }
+
+    static int numCores();
+    static double physicalMemoryMB();
+
+protected:
+    MMF_MWT_Processor settings;
+    int numWorkers;
+    double memoryBudgetMB;
+    std::vector<Job> jobs;
+
+    size_t nextJob;
+    int running;        // files currently holding part of the memory budget
+    double memoryInUse;
+    std::ostream *progress;
+    pthread_mutex_t lock;
+    pthread_cond_t memoryFreed;
+
+    struct Worker {
+        MMF_BatchRunner *runner;
+        int index;
+        pthread_t thread;
+        bool threaded;
+    };
+    void workLoop(int worker);
+    void runJob(Job &job, int worker);
+    static void *workerThreadEntry(void *worker);
+
+private:
+    MMF_BatchRunner(const MMF_BatchRunner& orig);
+};
+
+#endif	/* MMF_BATCHRUNNER_H */
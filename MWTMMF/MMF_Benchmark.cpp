@@ -0,0 +1,139 @@
+/*
+ * File:   MMF_Benchmark.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "MMF_Benchmark.h"
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <time.h>
+    #include <sys/resource.h>
+#endif
+using namespace std;
+
+MMF_Benchmark::MMF_Benchmark() : startTime(0), stopTime(0) {
+    pthread_mutex_init(&lock, NULL);
+}
+
+MMF_Benchmark::~MMF_Benchmark() {
+    pthread_mutex_destroy(&lock);
+}
+
+double MMF_Benchmark::now() {
+#ifdef _WIN32
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double) count.QuadPart / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1E-9 * ts.tv_nsec;
+#endif
+}
+
+double MMF_Benchmark::peakMemoryMB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? pmc.PeakWorkingSetSize / (1024.0 * 1024.0) : 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return 0;
+    }
+    #ifdef __APPLE__
+        return ru.ru_maxrss / (1024.0 * 1024.0); // bytes
+    #else
+        return ru.ru_maxrss / 1024.0; // kilobytes
+    #endif
+#endif
+}
+
+void MMF_Benchmark::begin() {
+    startTime = stopTime = now();
+}
+
+void MMF_Benchmark::end() {
+    stopTime = now();
+}
+
+void MMF_Benchmark::addSample(const char* stage, double seconds) {
+    pthread_mutex_lock(&lock);
+    samples[stage].push_back(seconds);
+    pthread_mutex_unlock(&lock);
+}
+
+void MMF_Benchmark::addFrame(int frame, int nobj) {
+    pthread_mutex_lock(&lock);
+    objects[frame] = nobj;
+    pthread_mutex_unlock(&lock);
+}
+
+string MMF_Benchmark::jsonString(const string &s) {
+    string out("\"");
+    for (size_t j = 0; j < s.length(); ++j) {
+        char c = s[j];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buf[8];
+            sprintf(buf, "\\u%04x", (unsigned char) c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+//nearest rank: the smallest sample that at least fraction p of the samples are no larger than
+static double percentile(const vector<double> &sorted, double p) {
+    int k = (int) ceil(p * sorted.size()) - 1;
+    return sorted[k < 0 ? 0 : k];
+}
+
+void MMF_Benchmark::writeJson(ostream& os, const string &mmfname, int startFrame, int endFrame) const {
+    pthread_mutex_lock(&lock);
+    double seconds = getSeconds();
+    int nframes = endFrame - startFrame;
+    os << "{" << endl;
+    os << "  \"mmf\": " << jsonString(mmfname) << "," << endl;
+    os << "  \"startFrame\": " << startFrame << "," << endl;
+    os << "  \"endFrame\": " << endFrame - 1 << "," << endl;
+    os << "  \"frames\": " << nframes << "," << endl;
+    os << "  \"seconds\": " << seconds << "," << endl;
+    os << "  \"framesPerSecond\": " << (seconds > 0 ? nframes / seconds : 0) << "," << endl;
+    os << "  \"peakMemoryMB\": " << peakMemoryMB() << "," << endl;
+    os << "  \"stages\": {";
+    for (map<string, vector<double> >::const_iterator it = samples.begin(); it != samples.end(); ++it) {
+        vector<double> sorted(it->second);
+        sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (size_t j = 0; j < sorted.size(); ++j) {
+            total += sorted[j];
+        }
+        os << (it == samples.begin() ? "" : ",") << endl << "    " << jsonString(it->first) << ": {\"count\": " << sorted.size()
+                << ", \"meanMs\": " << 1000 * total / sorted.size() << ", \"p50Ms\": " << 1000 * percentile(sorted, 0.5)
+                << ", \"p99Ms\": " << 1000 * percentile(sorted, 0.99) << ", \"maxMs\": " << 1000 * sorted.back() << "}";
+    }
+    os << endl << "  }," << endl;
+    os << "  \"objectsPerFrame\": [";
+    for (int j = startFrame; j < endFrame; ++j) {
+        map<int, int>::const_iterator it = objects.find(j);
+        os << (j == startFrame ? "" : ", ") << (it == objects.end() ? -1 : it->second);
+    }
+    os << "]" << endl << "}" << endl;
+    pthread_mutex_unlock(&lock);
+}
+
+MMF_Benchmark::MMF_Benchmark(const MMF_Benchmark& orig) {
+}
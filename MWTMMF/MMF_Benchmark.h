@@ -0,0 +1,76 @@
+/*
+ * File:   MMF_Benchmark.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_BENCHMARK_H
+#define	MMF_BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <pthread.h>
+
+/* MMF_Benchmark collects the time every stage took on every frame, and the number
+ * of objects found in every frame, so that a run can be written out as JSON
+ *
+ * unlike tictoc, which only keeps running totals, every sample is kept, so the
+ * report can give the median, 99th percentile and worst case of each stage
+ *
+ * samples may be added from several threads at once (the decode thread,
+ * tile or shard threads); begin() and end() bracket the frames being timed
+ */
+class MMF_Benchmark {
+public:
+    MMF_Benchmark();
+    virtual ~MMF_Benchmark();
+
+    /* static double now();
+     * seconds since some fixed time, at the best resolution the system has
+     */
+    static double now();
+
+    /* static double peakMemoryMB();
+     * the most memory this process has had resident so far, or 0 if it can't be found out
+     */
+    static double peakMemoryMB();
+
+    void begin();
+    void end();
+
+    /* void addSample(const char *stage, double seconds);
+     * one frame's worth of time spent in stage
+     */
+    void addSample(const char *stage, double seconds);
+
+    /* void addFrame(int frame, int nobj);
+     * the number of objects the tracker found in frame
+     */
+    void addFrame(int frame, int nobj);
+
+    /* void writeJson(std::ostream &os, const std::string &mmfname, int startFrame, int endFrame) const;
+     * frames per second, peak memory, latency of each stage (mean, p50, p99 and max, in ms)
+     * and objects found in each frame from startFrame to endFrame - 1 (-1 for frames not tracked)
+     */
+    void writeJson(std::ostream &os, const std::string &mmfname, int startFrame, int endFrame) const;
+
+    double getSeconds() const { return stopTime - startTime; }
+
+protected:
+    std::map<std::string, std::vector<double> > samples;
+    std::map<int, int> objects;
+    double startTime;
+    double stopTime;
+    mutable pthread_mutex_t lock;
+
+    static std::string jsonString(const std::string &s);
+
+private:
+    MMF_Benchmark(const MMF_Benchmark& orig);
+};
+
+#endif	/* MMF_BENCHMARK_H */
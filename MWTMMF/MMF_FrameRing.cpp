@@ -0,0 +1,329 @@
+/*
+ * File:   MMF_FrameRing.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <cstring>
+#include <algorithm>
+#include "MMF_FrameRing.h"
+#include "MWT_Image_CV.h"
+#include "MultiStackReader.h"
+#include "BackgroundRemovedImage.h"
+#include "MMF_Benchmark.h"
+#include "cv.h"
+using namespace std;
+
+MMF_FrameRing::MMF_FrameRing(MultiStackReader *sr, const IplImage *prototype, int imbits, int readAhead) :
+benchmark(NULL), usePatches(false), convertFrames(true), deliverBackground(false), sr(sr), threaded(false), running(false), nextFrame(0), endFrame(0), head(0), filled(0), finished(true), stopping(false),
+background(NULL), backgroundGeneration(0), deliveredGeneration(-1), imbits(imbits) {
+    nslots = (readAhead > 0) ? readAhead + 1 : 1;
+    slots = new Slot[nslots];
+    for (int k = 0; k < nslots; k++) {
+        slots[k].frame = -1;
+        slots[k].status = 0;
+        slots[k].src = cvCloneImage(prototype);
+        slots[k].im = new MWT_Image_CV(prototype);
+        slots[k].im->depth = imbits;
+        slots[k].backgroundGeneration = -1;
+        slots[k].backgroundChanged = false;
+        slots[k].background = NULL;
+    }
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+    pthread_cond_init(&notFull, NULL);
+}
+
+MMF_FrameRing::~MMF_FrameRing() {
+    stop();
+    for (int k = 0; k < nslots; k++) {
+        delete slots[k].im;
+        delete slots[k].background;
+        cvReleaseImage(&slots[k].src);
+    }
+    delete[] slots;
+    if (background != NULL) {
+        cvReleaseImage(&background);
+    }
+    pthread_cond_destroy(&notFull);
+    pthread_cond_destroy(&notEmpty);
+    pthread_mutex_destroy(&lock);
+}
+
+bool MMF_FrameRing::start(int startFrame, int endFrame) {
+    stop();
+    nextFrame = startFrame;
+    this->endFrame = endFrame;
+    head = 0;
+    filled = 0;
+    finished = (startFrame >= endFrame);
+    stopping = false;
+    deliveredGeneration = -1; //the first frame always carries the background
+    threaded = false;
+    if (nslots == 1 || finished) {
+        return true;
+    }
+    // if no thread can be had, acquire() falls back to decoding into the first slot itself
+    running = (pthread_create(&decoder, NULL, decodeThreadEntry, this) == 0);
+    threaded = running;
+    return threaded;
+}
+
+void MMF_FrameRing::stop() {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&notFull);
+    pthread_cond_broadcast(&notEmpty);
+    pthread_mutex_unlock(&lock);
+    pthread_join(decoder, NULL);
+    running = false;
+    finished = true;
+}
+
+//decodes one frame into slot; on failure slot->status and slot->error say what went wrong
+void MMF_FrameRing::decodeInto(Slot* slot, int frame) {
+    slot->frame = frame;
+    slot->status = 0;
+    slot->error.clear();
+    slot->backgroundChanged = false;
+    if (usePatches) {
+        loadPatches(slot, frame);
+        if (deliverBackground && slot->status == 0) {
+            loadBackground(slot, frame);
+        }
+        return;
+    }
+
+    double t0 = (benchmark != NULL) ? MMF_Benchmark::now() : 0;
+    decodeTimer.tic("load frame");
+    sr->getFrame(frame, &slot->src);
+    decodeTimer.toc("load frame");
+    if (benchmark != NULL) {
+        benchmark->addSample("load frame", MMF_Benchmark::now() - t0);
+    }
+    if (sr->isError()) {
+        slot->status = 26;
+        slot->error = sr->getError();
+        return;
+    }
+    if (slot->src == NULL) {
+        slot->status = 27;
+        return;
+    }
+
+    if (convertFrames) {
+        t0 = (benchmark != NULL) ? MMF_Benchmark::now() : 0;
+        decodeTimer.tic("convertFromIPL");
+        slot->im->setImageDataFromIplImage(slot->src);
+        decodeTimer.toc("convertFromIPL");
+        if (benchmark != NULL) {
+            benchmark->addSample("convertFromIPL", MMF_Benchmark::now() - t0);
+        }
+    }
+    if (deliverBackground) {
+        loadBackground(slot, frame);
+    }
+}
+
+//if the mmf background is not the one handed out with the last frame, gives slot a converted copy of it
+void MMF_FrameRing::loadBackground(Slot* slot, int frame) {
+    decodeTimer.tic("load background");
+    if (!usePatches) {
+        //the reader has just built this frame from it, so this costs no more disk reads
+        const BackgroundRemovedImage *bri = sr->getBackgroundRemovedImage(frame);
+        if (bri == NULL || bri->backgroundIm == NULL) {
+            decodeTimer.toc("load background");
+            return;
+        }
+        updateBackground(bri->backgroundIm);
+    }
+    if (background != NULL && deliveredGeneration != backgroundGeneration) {
+        if (slot->background == NULL) {
+            slot->background = new MWT_Image_CV(background);
+            slot->background->depth = imbits;
+        } else {
+            slot->background->setImageDataFromIplImage(background);
+        }
+        slot->backgroundChanged = true;
+        deliveredGeneration = backgroundGeneration;
+    }
+    decodeTimer.toc("load background");
+}
+
+//builds frame in slot from the mmf's background and foreground patches, touching only what changed since
+//the slot's last frame; on failure slot->status and slot->error say what went wrong
+void MMF_FrameRing::loadPatches(Slot* slot, int frame) {
+    double t0 = (benchmark != NULL) ? MMF_Benchmark::now() : 0;
+    decodeTimer.tic("load frame");
+    const BackgroundRemovedImage *bri = sr->getBackgroundRemovedImage(frame);
+    decodeTimer.toc("load frame");
+    if (benchmark != NULL) {
+        benchmark->addSample("load frame", MMF_Benchmark::now() - t0);
+    }
+    if (sr->isError()) {
+        slot->status = 26;
+        slot->error = sr->getError();
+        return;
+    }
+    if (bri == NULL || bri->backgroundIm == NULL) {
+        slot->status = 27;
+        return;
+    }
+
+    t0 = (benchmark != NULL) ? MMF_Benchmark::now() : 0;
+    decodeTimer.tic("convertFromIPL");
+    updateBackground(bri->backgroundIm);
+    if (slot->backgroundGeneration != backgroundGeneration) {
+        cvCopy(background, slot->src, NULL);
+        slot->im->setImageDataFromIplImage(background);
+        slot->backgroundGeneration = backgroundGeneration;
+    } else {
+        for (size_t k = 0; k < slot->patches.size(); ++k) {
+            copyRegion(background, slot->src, slot->im, slot->patches[k]);
+        }
+    }
+    slot->patches.clear();
+    for (size_t k = 0; k < bri->differencesFromBackground.size(); ++k) {
+        CvRect r = bri->differencesFromBackground[k].first;
+        copyRegion(bri->differencesFromBackground[k].second, slot->src, slot->im, r);
+        slot->patches.push_back(r);
+    }
+    decodeTimer.toc("convertFromIPL");
+    if (benchmark != NULL) {
+        benchmark->addSample("convertFromIPL", MMF_Benchmark::now() - t0);
+    }
+}
+
+//copies from (all of it, or the part of it at r if it is as big as to) to r in to and im
+//r is cut down to fit in to (and in from, for a patch) so the two rois always come out the same size
+void MMF_FrameRing::copyRegion(const IplImage* from, IplImage* to, MWT_Image_CV* im, CvRect r) {
+    bool whole = (from->width == to->width && from->height == to->height);
+    int x0 = max(r.x, 0);
+    int y0 = max(r.y, 0);
+    int x1 = min(r.x + r.width, to->width);
+    int y1 = min(r.y + r.height, to->height);
+    if (!whole) {
+        x1 = min(x1, r.x + from->width);
+        y1 = min(y1, r.y + from->height);
+    }
+    if (x1 <= x0 || y1 <= y0) {
+        return;
+    }
+    //a header of our own, so the roi can be set on an image we only get to read
+    IplImage view = *from;
+    view.roi = NULL;
+    if (whole) {
+        cvSetImageROI(&view, cvRect(x0, y0, x1 - x0, y1 - y0));
+    } else {
+        cvSetImageROI(&view, cvRect(x0 - r.x, y0 - r.y, x1 - x0, y1 - y0));
+    }
+    cvSetImageROI(to, cvRect(x0, y0, x1 - x0, y1 - y0));
+    cvCopy(&view, to, NULL);
+    cvResetImageROI(to);
+    im->setRegionFromIplImage(&view, x0, y0);
+    cvResetImageROI(&view);
+}
+
+//makes background a copy of bg; returns true (and bumps backgroundGeneration) if that changed it
+//the reader may free a background and get the same address for the next one, so the same pointer is no proof
+//of the same image: the whole of it is compared, which costs far less than converting a frame
+bool MMF_FrameRing::updateBackground(const IplImage* bg) {
+    bool same = (background != NULL && background->width == bg->width && background->height == bg->height
+            && background->depth == bg->depth);
+    if (same) {
+        int rowBytes = bg->width * (bg->depth & 255) / 8;
+        for (int y = 0; y < bg->height && same; ++y) {
+            same = (memcmp(bg->imageData + y*bg->widthStep, background->imageData + y*background->widthStep, rowBytes) == 0);
+        }
+    }
+    if (same) {
+        return false;
+    }
+    if (background == NULL || background->width != bg->width || background->height != bg->height || background->depth != bg->depth) {
+        if (background != NULL) {
+            cvReleaseImage(&background);
+        }
+        background = cvCloneImage(bg);
+    } else {
+        cvCopy(bg, background, NULL);
+    }
+    backgroundGeneration++;
+    return true;
+}
+
+void MMF_FrameRing::decodeLoop() {
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        if (filled == nslots && !stopping) {
+            decodeTimer.tic("decode stall");
+            while (filled == nslots && !stopping) {
+                pthread_cond_wait(&notFull, &lock);
+            }
+            decodeTimer.toc("decode stall");
+        }
+        if (stopping || nextFrame >= endFrame) {
+            finished = true;
+            pthread_cond_broadcast(&notEmpty);
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        Slot *slot = slots + (head + filled) % nslots;
+        int frame = nextFrame++;
+        pthread_mutex_unlock(&lock);
+
+        // the slot is not visible to the tracker until filled is bumped, so decode without the lock
+        decodeInto(slot, frame);
+
+        pthread_mutex_lock(&lock);
+        filled++;
+        if (slot->status != 0) {
+            finished = true; // the tracker quits on the first bad frame, so there is no point reading further
+        }
+        pthread_cond_signal(&notEmpty);
+        pthread_mutex_unlock(&lock);
+        if (slot->status != 0) {
+            return;
+        }
+    }
+}
+
+void *MMF_FrameRing::decodeThreadEntry(void* ring) {
+    ((MMF_FrameRing *) ring)->decodeLoop();
+    return NULL;
+}
+
+MMF_FrameRing::Slot *MMF_FrameRing::acquire() {
+    if (!running) {
+        if (nextFrame >= endFrame) {
+            return NULL;
+        }
+        decodeInto(slots, nextFrame++);
+        return slots;
+    }
+    pthread_mutex_lock(&lock);
+    while (filled == 0 && !finished) {
+        pthread_cond_wait(&notEmpty, &lock);
+    }
+    Slot *slot = (filled > 0) ? slots + head : NULL;
+    pthread_mutex_unlock(&lock);
+    return slot;
+}
+
+void MMF_FrameRing::release(Slot* slot) {
+    if (!running || slot == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    head = (head + 1) % nslots;
+    filled--;
+    pthread_cond_signal(&notFull);
+    pthread_mutex_unlock(&lock);
+}
+
+MMF_FrameRing::MMF_FrameRing(const MMF_FrameRing& orig) {
+}
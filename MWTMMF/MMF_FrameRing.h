@@ -0,0 +1,161 @@
+/*
+ * File:   MMF_FrameRing.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_FRAMERING_H
+#define	MMF_FRAMERING_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "cxtypes.h"
+#include "tictoc/tictoc.h"
+
+class MultiStackReader;
+class MWT_Image_CV;
+class MMF_Benchmark;
+
+/* MMF_FrameRing decodes frames from a MultiStackReader ahead of the tracker
+ *
+ * frames startFrame..endFrame-1 are read, widened to short and transposed
+ * into preallocated MWT_Image_CVs on a separate decode thread, and handed
+ * to the tracker in order through a bounded ring
+ *
+ * if readAhead > 0, the ring holds readAhead+1 slots, so that up to readAhead
+ * frames can be decoded while the tracker works on the current one;
+ * the decode thread waits ("decode stall") whenever all slots are full
+ *
+ * if readAhead <= 0, no thread is started and each frame is decoded on the
+ * calling thread inside acquire(), exactly as the serial loop used to do
+ *
+ * with usePatches set, frames are not rebuilt in full: each slot is left as it was
+ * (the background plus the foreground patches of the last frame it held), the old
+ * patches are put back to background and the new frame's patches are copied in, so the
+ * work per frame goes with the foreground area rather than with the whole image
+ *
+ * with convertFrames cleared (and usePatches not set), frames are only read, and slot->im
+ * is left for the tracker to fill in with just the parts it needs
+ *
+ * with deliverBackground set, the frame that first uses a new mmf background also
+ * carries that background, converted for the tracker, so that a tracker that does
+ * not adapt its own background can be handed the mmf's instead
+ *
+ * once the ring is started, the MultiStackReader belongs to the decode thread
+ * and must not be touched by anybody else until stop() returns
+ */
+class MMF_FrameRing {
+public:
+
+    /* one decoded frame
+     * src is the frame as it came from the stack reader (used for display)
+     * im is the converted tracker image
+     * status is 0 on success, otherwise the error code process() should return
+     * (26 = stack reader error, 27 = no frame returned); error holds the reader's message
+     */
+    struct Slot {
+        int frame;
+        int status;
+        std::string error;
+        IplImage *src;
+        MWT_Image_CV *im;
+        std::vector<CvRect> patches; // foreground patches src and im hold on top of the background (usePatches only)
+        int backgroundGeneration;    // background src and im were last filled from, or -1
+        bool backgroundChanged;      // the mmf background changed at this frame (deliverBackground only)
+        MWT_Image_CV *background;    // and this is it, converted; NULL until the first one
+    };
+
+    /* MMF_FrameRing(MultiStackReader *sr, const IplImage *prototype, int imbits, int readAhead);
+     * prototype is any frame of the right size and depth (e.g. the background);
+     * every slot is allocated up front from it, so no images are created while running
+     */
+    MMF_FrameRing(MultiStackReader *sr, const IplImage *prototype, int imbits, int readAhead);
+    virtual ~MMF_FrameRing();
+
+    /* bool start(int startFrame, int endFrame);
+     * begins decoding frames [startFrame, endFrame); returns false if the decode thread
+     * could not be created (in which case the ring falls back to serial decoding)
+     */
+    bool start(int startFrame, int endFrame);
+
+    /* Slot *acquire();
+     * waits for the next frame and returns it, or NULL once all frames have been handed out
+     * the slot stays valid until release() is called; check slot->status before using it
+     */
+    Slot *acquire();
+    void release(Slot *slot);
+
+    /* void stop();
+     * abandons any frames not yet consumed and joins the decode thread; safe to call repeatedly
+     * acquire() must not be called again until the next start()
+     */
+    void stop();
+
+    bool isThreaded() const { return threaded; }
+    int getReadAhead() const { return nslots - 1; }
+
+    /* timing of the decode stage ("load frame", "convertFromIPL", "decode stall")
+     * only read this after stop(); in serial mode it is filled in by acquire() instead
+     */
+    TICTOC::tictoc decodeTimer;
+
+    /* if set, every frame's "load frame" and "convertFromIPL" times are also added to it
+     * (from the decode thread); set it before start()
+     */
+    MMF_Benchmark *benchmark;
+
+    /* build frames from the mmf's background and foreground patches (see above)
+     * rather than asking the reader for whole frames; set it before start()
+     */
+    bool usePatches;
+
+    /* convert every frame into slot->im (the default); if cleared, only slot->src is
+     * filled in, unless usePatches is set; set it before start()
+     */
+    bool convertFrames;
+
+    /* mark the frames where the mmf background changes and hand over the new background
+     * with them (slot->backgroundChanged, slot->background); set it before start()
+     */
+    bool deliverBackground;
+
+protected:
+    MultiStackReader *sr;
+    Slot *slots;
+    int nslots;
+    bool threaded;  // decoding was handed to a separate thread by start()
+    bool running;   // that thread has not been joined yet
+
+    int nextFrame;
+    int endFrame;
+    int head;       // slot the tracker reads next
+    int filled;     // slots decoded and not yet released
+    bool finished;  // decode thread will not fill any more slots
+    bool stopping;  // consumer has asked the decode thread to quit
+
+    pthread_t decoder;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+
+    IplImage *background;       // copy of the background the patches go on (usePatches only)
+    int backgroundGeneration;   // bumped every time the background changes
+    int deliveredGeneration;    // background handed out with the last frame decoded (deliverBackground only)
+    int imbits;
+
+    void decodeInto(Slot *slot, int frame);
+    void loadPatches(Slot *slot, int frame);
+    void loadBackground(Slot *slot, int frame);
+    bool updateBackground(const IplImage *bg);
+    static void copyRegion(const IplImage *from, IplImage *to, MWT_Image_CV *im, CvRect r);
+    void decodeLoop();
+    static void *decodeThreadEntry(void *ring);
+
+private:
+    MMF_FrameRing(const MMF_FrameRing& orig);
+};
+
+#endif	/* MMF_FRAMERING_H */
@@ -12,15 +12,29 @@
 #include <cstdlib>
 #include <iostream>
 #include <cstring>
+#include <cfloat>
+#include <pthread.h>
 #include "MWT_Image.h"
 #include "MWT_Library.h"
 #include "tictoc/tictoc.h"
 #include "MWT_Image_CV.h"
+#include "MMF_FrameRing.h"
+#include "MMF_TrackStitcher.h"
+#include "MMF_TileTracker.h"
+#include "MMF_TileMerger.h"
+#include "MMF_Benchmark.h"
+#include "MMF_PreviewRenderer.h"
 #include "MultiStackReader.h"
+#include "BackgroundRemovedImage.h"
 #include "MMF_MWT_Processor.h"
 #include "highgui.h"
 #include "cv.h"
 #include "yaml-cpp/yaml.h"
+#ifdef _WIN32
+    #include <direct.h>
+#else
+    #include <unistd.h>
+#endif
 using namespace std;
 
 #ifndef readYamlKey
@@ -42,7 +56,9 @@ int MMF_MWT_Processor::process(const char* mmf_filename, const char* output_path
       return -1;
   }
   string outpath = allmmfs[0];
-  cout << "first mmf name = " << outpath << endl << endl;
+  if (benchmark == NULL) {
+      cout << "first mmf name = " << outpath << endl << endl;
+  }
   size_t ind = outpath.find_last_of("/\\");
   string outname = outpath.substr(ind+1);
   outpath = outpath.substr(0,ind + 1);
@@ -52,43 +68,136 @@ int MMF_MWT_Processor::process(const char* mmf_filename, const char* output_path
 
  
   string fname = ((output_path == NULL) ? outpath : string(output_path)) +  ((output_prefix == NULL) ? outname : string(output_prefix)) + ".mwtlog";
+  string checkpointName = fname.substr(0, fname.length() - 7) + ".checkpoint";
+
+  //checkpoints only cover a single tracker running through the movie from start to end
+  bool serial = numTilesX * numTilesY <= 1 && numShards <= 1;
+  bool resume = false;
+  int checkpointFrame = 0;
+  struct tm checkpointDate;
+  if (resumeFromCheckpoint && serial) {
+      resume = TrackerLibrary::peekCheckpoint(checkpointName.c_str(), checkpointFrame, checkpointDate);
+  }
+
   ofstream *outstream = NULL;
-  if (writeLog) {
-      outstream = new ofstream(fname.c_str());
+  stringstream benchmarkLog; //only shown if the benchmark fails
+  if (writeLog && benchmark == NULL) {
+      outstream = new ofstream(fname.c_str(), resume ? ios::app : ios::out);
       if (!outstream->good()) {
           delete outstream;
           outstream = NULL;
       }
   }
-  ostream& logstream = (outstream == NULL) ? cout : *outstream;
-
-  a_library.setSubtractionImageCorrectionAlgorithm(h1);
-  a_library.setCombineBlobs(h1,true);
+  ostream& logstream = (benchmark != NULL) ? benchmarkLog : (outstream == NULL) ? cout : *outstream;
 
   logstream << "processing " << mmf_filename << endl << "with these settings: " << endl << *this << endl << endl;
+  if (resumeFromCheckpoint && !resume) {
+      logstream << (serial ? "no checkpoint found at " + checkpointName + "; starting from the beginning" : "can't resume tiles or shards from a checkpoint; starting from the beginning") << endl << endl;
+  }
+  if (checkpointInterval > 0 && !serial) {
+      logstream << "(no checkpoints while tracking in tiles or shards)" << endl << endl;
+  }
 
   MultiStackReader sr(mmf_filename);
   if (sr.isError()) {
       logstream << "Failed to load: " << mmf_filename << endl << "Error: " << sr.getError() << endl;
+      delete outstream;
       return 1;
   }
 
   CvSize sz = sr.getImageSize();
   if (sr.isError()) {
       logstream << "Error reading from: " << mmf_filename << endl << "Error: " << sr.getError() << endl;
+      delete outstream;
       return 2;
   }
 
-  int imbits = 8;
+  //i = a_library.setDate(h1,2007,12,26,10,50,33); if (i!=h1) return 4;
+
+  //a resumed run writes into the same dated directory as the run that saved the checkpoint
+  i = setupTracker(a_library, h1, sz.width, sz.height, output_path == NULL ? outpath.c_str() : output_path, output_prefix == NULL ? outname.c_str() : output_prefix, resume ? &checkpointDate : NULL);
+  if (i != 0) {
+      delete outstream;
+      return i;
+  }
+
+  TrackerEntry* te = a_library.all_trackers[h1];
+  if (te==NULL) {
+      logstream << "h1 points to null handle in tracker library" << endl;
+      delete outstream;
+      return -1;  
+  }
+  const char *base_directory = te->performance.base_directory;
+  const char *prefix = te->prefix_string;
+  #ifdef _WIN32
+    const char sep = '\\';
+  #else
+    const char sep = '/';
+  #endif
+  stringstream mdatname;
+  mdatname << (base_directory) << sep << (prefix) << ".mdat";
+  logstream << "creating meta data file: " << mdatname.str() << endl << endl;
+  sr.createSupplementalDataFile(mdatname.str().c_str());
+  if (sr.isError()) {
+      logstream << "Error creating meta data file: " << mdatname.str() << endl << "Error: " << sr.getError() << endl;
+      delete outstream;
+      return 23;
+  }
+  logstream << "meta data saved!" << endl;
+
+  startFrame = startFrame < 0 ? 0 : startFrame;
+  endFrame = endFrame < 0 ? sr.getTotalFrames() : endFrame + 1;
+  endFrame = endFrame > sr.getTotalFrames() ? sr.getTotalFrames() : endFrame;
   
-  i = a_library.setImageInfo(h1,imbits,sz.width,sz.height); if (i!=h1) return 3;
-  a_library.setRectangle(h1, 0, sz.width, 0, sz.height);
+  logstream << "startFrame = " << startFrame << "; endFrame = " << endFrame << endl << endl;
+
+  int status;
+  if (benchmark != NULL) {
+      benchmark->begin();
+  }
+  if (numTilesX * numTilesY > 1) {
+      //the handle above only made the output directory and the .mdat; the tiles do the tracking
+      if (numShards > 1) {
+          logstream << "tiles and shards can't be combined; tracking in tiles" << endl << endl;
+      }
+      status = processTiles(sr, te, sz.width, sz.height, logstream);
+  } else if (numShards > 1) {
+      status = processShards(mmf_filename, te, logstream);
+  } else {
+      bool checkpoints = resume || checkpointInterval > 0;
+      status = trackFrames(a_library, vector<int>(1, h1), sr, 0, resume ? startFrame + checkpointFrame : startFrame, endFrame, windowOutputUpdateInterval > 0, logstream,
+              checkpoints ? checkpointName.c_str() : NULL, resume);
+  }
+  if (benchmark != NULL) {
+      benchmark->end();
+      removeBenchmarkOutput(base_directory, prefix);
+      if (status != 0) {
+          cerr << benchmarkLog.str();
+      }
+  }
+  if (outstream != NULL) {
+      delete(outstream);
+  }
 
+  return status;
+}
 
-  //i = a_library.setDate(h1,2007,12,26,10,50,33); if (i!=h1) return 4;
+//applies our settings to a fresh tracker handle and starts its output; returns 0 or the error code process() should return
+int MMF_MWT_Processor::setupTracker(TrackerLibrary &a_library, int h1, int width, int height, const char *path, const char *prefix, const struct tm *date) const {
+  int i;
+  int imbits = 8;
+
+  a_library.setSubtractionImageCorrectionAlgorithm(h1);
+  a_library.setCombineBlobs(h1,true);
+
+  i = a_library.setImageInfo(h1,imbits,width,height); if (i!=h1) return 3;
+  a_library.setRectangle(h1, 0, width, 0, height);
 
+  if (date != NULL) {
+      a_library.setDate(h1, date->tm_year, date->tm_mon + 1, date->tm_mday, date->tm_hour, date->tm_min, date->tm_sec);
+  }
     
-  i = a_library.setOutput(h1,output_path == NULL ? outpath.c_str() : output_path, output_prefix == NULL ? outname.c_str() : output_prefix,true,false,false); if (i!=h1) return 4;
+  i = a_library.setOutput(h1,path,prefix,true,false,false); if (i!=h1) return 4;
   
   
   i = a_library.setDancerBorderSize(h1,dancerBorderSize);
@@ -100,6 +209,9 @@ int MMF_MWT_Processor::process(const char* mmf_filename, const char* output_path
   i = a_library.setObjectSizeThresholds(h1,minObjectArea,minNewObjectArea,maxNewObjectArea,maxObjectArea); if (i!=h1) return 12;
   i = a_library.setObjectPersistenceThreshold(h1,minFramesObjectMustPersist); if (i!=h1) return 13;
   i = a_library.setAdaptationRate(h1,adpatationAlpha); if (i!=h1) return 14;
+  i = a_library.setStaticBackground(h1,staticBackground); if (i!=h1) return 17;
+  //tiles and shards already keep the cores busy, one tracker each
+  i = a_library.setDancerThreads(h1, (numShards > 1 || numTilesX * numTilesY > 1) ? 1 : dancerThreads); if (i!=h1) return 18;
   i = a_library.enableOutlining(h1,true); if (i!=h1) return 15;
   i = a_library.enableSkeletonization(h1,true); if (i!=h1) return 16;
 
@@ -109,119 +221,189 @@ int MMF_MWT_Processor::process(const char* mmf_filename, const char* output_path
   i = a_library.beginOutput(h1); if (i!=h1) return 20;
   i = a_library.setUpdateBandNumber(h1,updateBandNumber); if (i!=h1) return 21;
   i = a_library.setVelocityIntegrationTime(h1,1.0); if (i!=h1) return 22;
+  return 0;
+}
 
-  TrackerEntry* te = a_library.all_trackers[h1];
-  if (te==NULL) {
-      logstream << "h1 points to null handle in tracker library" << endl;
-      return -1;  
+//loads the next frame into h by asking it which pieces it needs (sitters, dancers and the background band) and
+//converting only those from src into im, which is then handed over in place; the rest of im is left as it was
+//returns h, or what the library returned if it failed; the time spent converting is added to convertSeconds
+static int loadNeededRegions(TrackerLibrary &a_library, int h, IplImage *src, MWT_Image_CV &im, float time, double &convertSeconds) {
+  int n = a_library.prepareImagePieces(h, time);
+  if (n < 1) {
+      return n;
   }
-  const char *base_directory = te->performance.base_directory;
-  const char *prefix = te->prefix_string;
-  #ifdef _WIN32
-    const char sep = '\\';
-  #else
-    const char sep = '/';
-  #endif
-  stringstream mdatname;
-  mdatname << (base_directory) << sep << (prefix) << ".mdat";
-  logstream << "creating meta data file: " << mdatname.str() << endl << endl;
-  sr.createSupplementalDataFile(mdatname.str().c_str());
-  if (sr.isError()) {
-      logstream << "Error creating meta data file: " << mdatname.str() << endl << "Error: " << sr.getError() << endl;
-      return 23;
+  //a header of our own, so the roi can be set without touching src
+  IplImage view = *src;
+  view.roi = NULL;
+  Rectangle r;
+  for ( ; n > 0; n--) {
+      int i = a_library.getNextPieceCoords(h, r); if (i != h) return i;
+      r.cropTo(im.getBounds());
+      if (r.width() < 1 || r.height() < 1) {
+          //nothing of it is in the frame, but the tracker still has to be handed it to move on
+          i = a_library.loadThisImagePiece(h, im); if (i != h) return i;
+          continue;
+      }
+      double t0 = MMF_Benchmark::now();
+      cvSetImageROI(&view, cvRect(r.near.x, r.near.y, r.width(), r.height()));
+      im.setRegionFromIplImage(&view, r.near.x, r.near.y);
+      convertSeconds += MMF_Benchmark::now() - t0;
+      short *first = im.pixels + (r.near.x - im.bounds.near.x)*im.stride.x + (r.near.y - im.bounds.near.y)*im.stride.y;
+      i = a_library.loadThisImagePiece(h, first, r, im.stride); if (i != h) return i;
   }
-  logstream << "meta data saved!" << endl;
-  
-  IplImage *src = NULL;
-  IplImage *src16 = NULL;
+  return h;
+}
 
-  IplImage *dst = NULL;
-  IplImage *color = NULL;
+//tracks frames [first, end) of sr on a handle set up by setupTracker, starting from the background around backgroundFrame,
+//and writes out the summary; returns 0 or the error code process() should return
+//with staticBackground, it starts from the mmf's background at backgroundFrame instead, and is handed each new one as it comes up
+//with a checkpointName, the first handle's state is saved there every checkpointInterval frames (counted from startFrame),
+//and if resume is set, the handle starts from the state saved there instead of the background
+//with convertNeededRegionsOnly and a single handle, only the parts of each frame the tracker asks for are converted
+int MMF_MWT_Processor::trackFrames(TrackerLibrary &a_library, const vector<int> &handles, MultiStackReader &sr, int backgroundFrame, int first, int end, bool display, ostream &logstream,
+        const char *checkpointName, bool resume) const {
+  int i;
+  int h1 = handles[0];
+  int imbits = a_library.getBitDepth(h1);
+
+  IplImage *src = NULL;
 
 
-  sr.getBackground(0, &src, 10*frame_rate);
+  if (staticBackground) {
+      const BackgroundRemovedImage *bri = sr.getBackgroundRemovedImage(backgroundFrame);
+      if (bri != NULL && bri->backgroundIm != NULL) {
+          src = cvCloneImage(bri->backgroundIm);
+      }
+  } else {
+      sr.getBackground(backgroundFrame, &src, 10*frame_rate);
+  }
   if (src == NULL || sr.isError()) {
       logstream << "failed to read initial background from disk " << endl;
       logstream << "stackReaderError: " << sr.getError() << endl;
       return 25;
   }
-  src16 = cvCreateImage(cvGetSize(src), IPL_DEPTH_16S, 1);
-  cvConvert(src, src16);
-
-  MWT_Image_CV im0(src16);
+  MWT_Image_CV im0(src);
   im0.depth = imbits;
 
-  MWT_Image_CV im(src16);
-  im.depth = imbits;
-
-  a_library.scanObjects(h1, im0); // initializes the background
-
-  if (windowOutputUpdateInterval > 0) {
-      cvNamedWindow("mwt image", 0);
-      color = cvCreateImage(cvGetSize(src), IPL_DEPTH_8U, 3);
+  MMF_TileTracker tiles(a_library, handles);
+  if (resume) {
+      if (a_library.loadCheckpoint(h1, checkpointName) != h1) {
+          logstream << "failed to resume from checkpoint " << checkpointName << endl;
+          return 53;
+      }
+      logstream << "resumed from checkpoint " << checkpointName << "; carrying on from frame " << first << endl << endl;
+  } else {
+      tiles.scanObjects(im0); // initializes the background
+  }
+  if (!tiles.start()) {
+      logstream << "could not start tile threads; tracking tiles one after another" << endl;
+  }
+  display = display && handles.size() == 1;
+
+  MMF_PreviewRenderer preview(src, imbits, display ? (previewQueueFrames > 0 ? previewQueueFrames : 1) : 0);
+  if (display) {
+      MMF_PreviewRenderer::Target target = MMF_PreviewRenderer::window;
+      MMF_PreviewRenderer::targetFromString(previewOutput, target);
+      TrackerEntry *te = a_library.all_trackers[h1];
+      string name = (target == MMF_PreviewRenderer::window) ? string("mwt image") : string(te->performance.base_directory) + te->prefix_string + "_preview";
+      if (target == MMF_PreviewRenderer::video) {
+          name += ".avi";
+      }
+      if (!preview.start(target, name, frame_rate / windowOutputUpdateInterval)) {
+          logstream << "could not start preview thread; drawing previews on the tracker thread" << endl;
+      }
   }
   TICTOC::tictoc tim;
 
-  startFrame = startFrame < 0 ? 0 : startFrame;
-  endFrame = endFrame < 0 ? sr.getTotalFrames() : endFrame + 1;
-  endFrame = endFrame > sr.getTotalFrames() ? sr.getTotalFrames() : endFrame;
-  
-  logstream << "startFrame = " << startFrame << "; endFrame = " << endFrame << endl << endl;
-
-  for (int j=startFrame;j < endFrame;j++)
+  //from here until ring.stop(), sr belongs to the decode thread
+  MMF_FrameRing ring(&sr, src, imbits, readAheadFrames);
+  ring.benchmark = benchmark;
+  ring.usePatches = useMMFPatches;
+  ring.deliverBackground = staticBackground;
+  //with patches the ring already converts only what changed, and tiles each want their own pieces of the same frame
+  bool pieces = convertNeededRegionsOnly && !useMMFPatches && handles.size() == 1;
+  ring.convertFrames = !pieces;
+  if (!ring.start(first, end)) {
+      logstream << "could not start decode thread; decoding frames on the tracker thread" << endl;
+  }
+  int status = 0;
+  for (MMF_FrameRing::Slot *slot; ; ring.release(slot))
   {
+      double loopStart = MMF_Benchmark::now();
       tim.tic("loop");
 
-      tim.tic("load frame");
-      sr.getFrame(j, &src);
-      if (sr.isError()) {
-          logstream << "frame #" << j << ":  error in stack reader! " << endl << sr.getError() << endl << endl;
-          return 26;
+      tim.tic("tracker stall");
+      slot = ring.acquire();
+      tim.toc("tracker stall");
+      if (benchmark != NULL) {
+          benchmark->addSample("tracker stall", MMF_Benchmark::now() - loopStart);
+      }
+      if (slot == NULL) {
+          tim.toc("loop");
+          break;
+      }
+      int j = slot->frame;
+      if (slot->status == 26) {
+          logstream << "frame #" << j << ":  error in stack reader! " << endl << slot->error << endl << endl;
       }
-      if (src == NULL) {
+      if (slot->status == 27) {
           logstream << "failed to load frame # " << j << endl;
-          return 27;
       }
-      
-      tim.toc("load frame");
-
-      tim.tic("convertTo16S");
-      cvConvert(src, src16);
-      tim.toc("convertTo16S");
-
-      tim.tic("convertFromIPL");
-      im.setImageDataFromIplImage(src16);
-      tim.toc("convertFromIPL");
+      if (slot->status != 0) {
+          status = slot->status;
+          break;
+      }
+      MWT_Image_CV &im = *(slot->im);
+      if (slot->backgroundChanged) {
+          tim.tic("load background");
+          tiles.loadBackground(*(slot->background));
+          tim.toc("load background");
+      }
 
+      double processStart = MMF_Benchmark::now();
       tim.tic("mwt processing");
-      i = a_library.loadImage(h1,im,j/frame_rate); if (i!=h1) return 39;  // Wholistic image loading
-      int nobj = a_library.processImage(h1);      
+      int nobj;
+      if (pieces) {
+          double convertSeconds = 0;
+          i = loadNeededRegions(a_library, h1, slot->src, im, j/frame_rate, convertSeconds);
+          if (benchmark != NULL) {
+              benchmark->addSample("convertFromIPL", convertSeconds);
+          }
+          if (i != h1) { status = 39; break; }
+          nobj = a_library.processImage(h1);
+      } else {
+          nobj = tiles.processFrame(im, j/frame_rate); if (nobj < 0) { status = 39; break; }  // Wholistic image loading
+      }
       tim.toc("mwt processing");
+      if (benchmark != NULL) {
+          benchmark->addSample("mwt processing", MMF_Benchmark::now() - processStart);
+          benchmark->addFrame(j, nobj);
+      }
+
+      if (checkpointName != NULL && checkpointInterval > 0 && (j + 1 - startFrame) % checkpointInterval == 0) {
+          tim.tic("checkpoint");
+          if (a_library.saveCheckpoint(h1, checkpointName) != h1) {
+              logstream << "failed to save checkpoint after frame " << j << endl;
+          }
+          tim.toc("checkpoint");
+      }
 
       tim.tic("image display and output");
-      if (windowOutputUpdateInterval > 0 && (j%windowOutputUpdateInterval == 0)) {
-          bool scaleToRange = true;
-          im.set(im.bounds, 0);
-          tim.tic ("showObjects");
-          i = a_library.showObjects(h1, im);// if (i!=h1) return 49;
-          tim.toc("showObjects");
-         
-          tim.tic ("convertToIpl");
-          im.toIplImage8U(&dst, scaleToRange);
-          tim.toc ("convertToIpl");
-
-          tim.tic ("image display");
-          cvConvertImage(src, color, 0);
-          cvSetImageCOI(color, 1);
-          cvCopy(dst, color, NULL);
-          cvShowImage("mwt image", color);
-          tim.toc ("image display");
-
-          tim.tic ("waitkey");
-          if (tolower(cvWaitKey(1)) == 'q') {
+      if (display && (j%windowOutputUpdateInterval == 0)) {
+          //only the snapshot is taken here; the render thread does the rest, and if it is behind the preview is skipped
+          MMF_PreviewRenderer::Slot *snapshot = preview.claim();
+          if (snapshot != NULL) {
+              tim.tic ("showObjects");
+              snapshot->frame = j;
+              snapshot->objects->set(snapshot->objects->bounds, 0);
+              a_library.showObjects(h1, *(snapshot->objects));
+              cvCopy(slot->src, snapshot->src, NULL);
+              tim.toc("showObjects");
+              preview.post(snapshot);
+          }
+          if (preview.quitRequested()) {
              break;
           }
-          tim.toc("waitkey");
           logstream << "frame " << j << " , " << nobj << " objs found " << tim.getStatistics("loop")*1000 << " ms average processing time" << endl;
 
       }
@@ -229,20 +411,233 @@ int MMF_MWT_Processor::process(const char* mmf_filename, const char* output_path
 //      
 
       tim.toc("loop");
+      if (benchmark != NULL) {
+          benchmark->addSample("loop", MMF_Benchmark::now() - loopStart);
+      }
+  }
+  ring.stop();
+  tiles.stop();
+  preview.stop();
+  if (status != 0) {
+      return status;
   }
+  if (display) {
+      logstream << "preview: " << preview.getNumRendered() << " frames drawn" << (preview.isThreaded() ? " on the preview thread" : "")
+              << ", " << preview.getNumDropped() << " skipped because it was behind" << endl << endl;
+  }
+  logstream << "decode stage (" << (ring.isThreaded() ? "" : "not ") << "threaded, " << ring.getReadAhead() << " frames read ahead):" << endl;
+  logstream << ring.decodeTimer.generateReport() << endl;
+  logstream << "tracker stage:" << endl;
   logstream << tim.generateReport() << endl;
 
-  i = a_library.complete(h1); if (i!=h1) return 50;
+  for (size_t k = 0; k < handles.size(); ++k) {
+      i = a_library.complete(handles[k]); if (i!=handles[k]) return 50;
+  }
+  if (checkpointName != NULL) {
+      remove(checkpointName); //the run is finished, so there is nothing to resume
+  }
 
-  if (outstream != NULL) {
-      delete(outstream);
+  return 0;
+}
+
+//one chunk of the movie, tracked on its own thread with its own reader and tracker
+struct MMF_MWT_Processor::ShardJob {
+    const MMF_MWT_Processor *mp;
+    const char *mmf_filename;
+    const char *path;
+    string prefix;
+    const struct tm *date;
+    int background; // frame whose background the tracker starts from
+    int warmup; // first frame tracked
+    int first;  // first frame this shard is responsible for
+    int end;
+    int status;
+    stringstream log;
+    pthread_t thread;
+    bool threaded;
+};
+
+void *MMF_MWT_Processor::shardThreadEntry(void *job) {
+    ShardJob *sj = (ShardJob *) job;
+    sj->status = sj->mp->trackShard(*sj);
+    return NULL;
+}
+
+int MMF_MWT_Processor::trackShard(ShardJob &job) const {
+  TrackerLibrary a_library;
+  int h1 = a_library.getNewHandle();
+
+  MultiStackReader sr(job.mmf_filename);
+  if (sr.isError()) {
+      job.log << "Failed to load: " << job.mmf_filename << endl << "Error: " << sr.getError() << endl;
+      return 1;
+  }
+  CvSize sz = sr.getImageSize();
+  if (sr.isError()) {
+      job.log << "Error reading from: " << job.mmf_filename << endl << "Error: " << sr.getError() << endl;
+      return 2;
+  }
+  int i = setupTracker(a_library, h1, sz.width, sz.height, job.path, job.prefix.c_str(), job.date);
+  if (i != 0) {
+      return i;
+  }
+  //new dancers are looked for one band of the image at a time, in an order set by the frame number; a shard that
+  //doesn't pick up where a serial run would be finds them frames later, too late to continue the last shard's
+  i = a_library.setUpdateBandPhase(h1, job.warmup - startFrame); if (i != h1) return 24;
+  return trackFrames(a_library, vector<int>(1, h1), sr, job.background, job.warmup, job.end, false, job.log);
+}
+
+//splits [startFrame, endFrame) into numShards chunks, tracks them all at once, and stitches the results
+//into te's output files as if te had tracked the whole movie itself
+int MMF_MWT_Processor::processShards(const char *mmf_filename, TrackerEntry *te, ostream &logstream) {
+  int nframes = endFrame - startFrame;
+  int nshards = (numShards < nframes) ? numShards : nframes;
+  nshards = (nshards < 1) ? 1 : nshards;
+  int overlap = (shardOverlapFrames > 0) ? shardOverlapFrames : 0;
+  ShardJob *jobs = new ShardJob[nshards];
+  int k;
+  for (k = 0; k < nshards; ++k) {
+      jobs[k].mp = this;
+      jobs[k].mmf_filename = mmf_filename;
+      jobs[k].path = te->path_string;
+      jobs[k].date = te->performance.date;
+      jobs[k].first = startFrame + (int) (((double) nframes * k) / nshards);
+      jobs[k].end = startFrame + (int) (((double) nframes * (k + 1)) / nshards);
+      jobs[k].warmup = (jobs[k].first - overlap < startFrame) ? startFrame : jobs[k].first - overlap;
+      jobs[k].background = (k == 0) ? 0 : jobs[k].warmup; //the first shard starts just like a serial run
+      jobs[k].status = 0;
+      stringstream pre;
+      pre << te->prefix_string << "_shard" << k;
+      jobs[k].prefix = pre.str();
+  }
+  logstream << "tracking " << nframes << " frames in " << nshards << " shards; each shard starts " << overlap << " frames early" << endl << endl;
+  if (windowOutputUpdateInterval > 0) {
+      logstream << "(no display while tracking in shards)" << endl << endl;
   }
 
+  for (k = 0; k < nshards; ++k) {
+      jobs[k].threaded = (pthread_create(&jobs[k].thread, NULL, shardThreadEntry, jobs + k) == 0);
+      if (!jobs[k].threaded) {
+          shardThreadEntry(jobs + k);
+      }
+  }
+  int status = 0;
+  for (k = 0; k < nshards; ++k) {
+      if (jobs[k].threaded) {
+          pthread_join(jobs[k].thread, NULL);
+      }
+      logstream << "shard " << k << ": frames " << jobs[k].first << " to " << jobs[k].end - 1 << " (tracked from " << jobs[k].warmup << ")"
+              << (jobs[k].threaded ? "" : " on the main thread") << endl << jobs[k].log.str() << endl;
+      if (jobs[k].status != 0 && status == 0) {
+          logstream << "shard " << k << " failed with return value " << jobs[k].status << endl;
+          status = jobs[k].status;
+      }
+  }
+
+  if (status == 0) {
+      MMF_TrackStitcher stitcher(te->performance.base_directory, te->prefix_string);
+      for (k = 0; k < nshards && status == 0; ++k) {
+          if (!stitcher.addShard(jobs[k].prefix, jobs[k].warmup - startFrame, jobs[k].first - startFrame + 1, jobs[k].end - startFrame)) {
+              status = 51;
+          }
+      }
+      if (status == 0 && !stitcher.finish()) {
+          status = 51;
+      }
+      if (status != 0) {
+          logstream << "failed to stitch shards together: " << stitcher.getError() << endl;
+      } else {
+          logstream << "stitched " << stitcher.getNumStitched() << " dancers across shard boundaries; " << stitcher.getNumUnmatched() << " were not picked up by the next shard and end at the boundary" << endl;
+          for (k = 0; k < nshards; ++k) {
+              stitcher.removeShardFiles(jobs[k].prefix);
+          }
+      }
+  }
+  delete[] jobs;
+  return status;
+}
+
+
+//splits the field of view into numTilesX by numTilesY overlapping tiles, tracks each one with its own handle
+//(all on the same frames, each on its own thread), and merges the results into te's output files
+int MMF_MWT_Processor::processTiles(MultiStackReader &sr, TrackerEntry *te, int width, int height, ostream &logstream) {
+  int nx = (numTilesX < 1) ? 1 : numTilesX;
+  int ny = (numTilesY < 1) ? 1 : numTilesY;
+  int overlap = (tileOverlapPixels > 0) ? tileOverlapPixels : 0;
+  TrackerLibrary *tile_library = new TrackerLibrary;
+  vector<int> handles;
+  vector<string> prefixes;
+  MMF_TileMerger merger(te->performance.base_directory, te->prefix_string, (overlap > 2) ? 0.5*overlap : 1.0);
+  logstream << "tracking in " << nx << " by " << ny << " tiles, overlapping by " << overlap << " pixels" << endl;
+  if (windowOutputUpdateInterval > 0) {
+      logstream << "(no display while tracking in tiles)" << endl;
+  }
+  for (int ty = 0; ty < ny; ++ty) {
+      for (int tx = 0; tx < nx; ++tx) {
+          //the cores split the image evenly; the outer ones reach to infinity so that every centroid has an owner
+          int x0 = (int) (((double) width * tx) / nx);
+          int x1 = (int) (((double) width * (tx + 1)) / nx);
+          int y0 = (int) (((double) height * ty) / ny);
+          int y1 = (int) (((double) height * (ty + 1)) / ny);
+          stringstream pre;
+          pre << te->prefix_string << "_tile" << handles.size();
+          int h = tile_library->getNewHandle();
+          if (h < 0) {
+              logstream << "could not get a tracker handle for tile " << handles.size() << endl;
+              delete tile_library;
+              return 52;
+          }
+          int i = setupTracker(*tile_library, h, width, height, te->path_string, pre.str().c_str(), te->performance.date);
+          if (i != 0) {
+              delete tile_library;
+              return i;
+          }
+          tile_library->setRectangle(h, x0 - overlap, x1 - 1 + overlap, y0 - overlap, y1 - 1 + overlap);
+          merger.addTile(pre.str(), (tx == 0) ? -FLT_MAX : x0, (tx == nx - 1) ? FLT_MAX : x1, (ty == 0) ? -FLT_MAX : y0, (ty == ny - 1) ? FLT_MAX : y1);
+          logstream << "tile " << handles.size() << ": x " << x0 << " to " << x1 - 1 << ", y " << y0 << " to " << y1 - 1 << endl;
+          handles.push_back(h);
+          prefixes.push_back(pre.str());
+      }
+  }
+  logstream << endl;
+
+  int status = trackFrames(*tile_library, handles, sr, 0, startFrame, endFrame, false, logstream);
+  delete tile_library; // the tiles' output files are only closed when their handles go away
+  if (status != 0) {
+      return status;
+  }
+  if (!merger.merge()) {
+      logstream << "failed to merge tiles: " << merger.getError() << endl;
+      return 52;
+  }
+  logstream << "merged " << handles.size() << " tiles; " << merger.getNumHandoffs() << " dancers were handed from one tile to another" << endl;
+  for (size_t k = 0; k < prefixes.size(); ++k) {
+      merger.removeShardFiles(prefixes[k]);
+  }
   return 0;
 }
 
+//deletes what a benchmark run wrote: prefix's .summary, .blobs and .mdat files in directory, and directory itself if nothing else is in it
+void MMF_MWT_Processor::removeBenchmarkOutput(const char *directory, const char *prefix) {
+    MMF_TrackStitcher output(directory, prefix);
+    output.removeShardFiles(prefix);
+    remove((string(directory) + prefix + ".mdat").c_str());
+    rmdir(directory);
+}
+
+//rough number of bytes process() needs for a movie with frames this size:
+//each frame in the read-ahead ring is held as it came from the mmf (8 bits) and converted (16 bits),
+//and the tracker keeps a background, a band image and working copies at 16 bits
+double MMF_MWT_Processor::memoryEstimate(int width, int height) const {
+    double pixels = (double) width * height;
+    int slots = (readAheadFrames > 0) ? readAheadFrames + 1 : 1;
+    int trackers = (numShards > 1) ? numShards : 1;
+    double perSlot = staticBackground ? 5.0 : 3.0; //a slot may also carry a converted background
+    return trackers * pixels * (perSlot * slots + 8.0);
+}
 
 MMF_MWT_Processor::MMF_MWT_Processor(const MMF_MWT_Processor& orig) {
+    *this = orig;
 }
 
 MMF_MWT_Processor::~MMF_MWT_Processor() {
@@ -277,6 +672,20 @@ YAML::Emitter& MMF_MWT_Processor::yamlBody(YAML::Emitter& out) const {
     writeYamlKey(out, updateBandNumber);
     writeYamlKey(out, windowOutputUpdateInterval);
     writeYamlKey(out, writeLog);
+    writeYamlKey(out, readAheadFrames);
+    writeYamlKey(out, useMMFPatches);
+    writeYamlKey(out, staticBackground);
+    writeYamlKey(out, convertNeededRegionsOnly);
+    writeYamlKey(out, numShards);
+    writeYamlKey(out, shardOverlapFrames);
+    writeYamlKey(out, numTilesX);
+    writeYamlKey(out, numTilesY);
+    writeYamlKey(out, tileOverlapPixels);
+    writeYamlKey(out, dancerThreads);
+    writeYamlKey(out, checkpointInterval);
+    writeYamlKey(out, resumeFromCheckpoint);
+    writeYamlKey(out, previewOutput);
+    writeYamlKey(out, previewQueueFrames);
     
     /*
     out << YAML::Key << "frame_rate" << YAML::Value << frame_rate;
@@ -325,6 +734,20 @@ void MMF_MWT_Processor::fromYaml(const YAML::Node& node) {
     readYamlKey(node, updateBandNumber);
     readYamlKey(node, windowOutputUpdateInterval);
     readYamlKey(node, writeLog);
+    readYamlKey(node, readAheadFrames);
+    readYamlKey(node, useMMFPatches);
+    readYamlKey(node, staticBackground);
+    readYamlKey(node, convertNeededRegionsOnly);
+    readYamlKey(node, numShards);
+    readYamlKey(node, shardOverlapFrames);
+    readYamlKey(node, numTilesX);
+    readYamlKey(node, numTilesY);
+    readYamlKey(node, tileOverlapPixels);
+    readYamlKey(node, dancerThreads);
+    readYamlKey(node, checkpointInterval);
+    readYamlKey(node, resumeFromCheckpoint);
+    readYamlKey(node, previewOutput);
+    readYamlKey(node, previewQueueFrames);
      
 }
 
@@ -14,6 +14,14 @@
 
 #include "yaml-cpp/yaml.h"
 #include <iostream>
+#include <vector>
+#include <ctime>
+
+class TrackerLibrary;
+class TrackerEntry;
+class MultiStackReader;
+class MMF_Benchmark;
+
 class MMF_MWT_Processor {
 public:
     double frame_rate;
@@ -27,17 +35,37 @@ public:
     int startFrame;
     int endFrame;
     bool writeLog;
+    int readAheadFrames; //frames decoded ahead of the tracker on a separate thread; 0 decodes on the tracker thread
+    bool useMMFPatches; //build each frame from the mmf's background and foreground patches, touching only the patches
+    bool staticBackground; //track against the backgrounds stored in the mmf instead of adapting one per pixel
+    bool convertNeededRegionsOnly; //convert only the parts of each frame the tracker asks for, rather than whole frames
+    int numShards; //split the frames into this many chunks, track them in parallel and stitch the tracks together; 1 tracks serially
+    int shardOverlapFrames; //each chunk but the first starts tracking this many frames before the part it is responsible for
+    int numTilesX; //split the field of view into numTilesX by numTilesY tiles, each tracked on its own core; 1 by 1 tracks it whole
+    int numTilesY;
+    int tileOverlapPixels; //each tile also watches this many pixels of its neighbours, so dancers can be handed over
+    int dancerThreads; //share out the work on each worm in a frame over this many threads; 1 does it all on the tracker thread
+    int checkpointInterval; //save the tracker's state every this many frames so an interrupted run can be resumed; 0 never saves it
+    bool resumeFromCheckpoint; //carry on from the saved state, if there is one, instead of starting over
+    std::string previewOutput; //where the windowOutputUpdateInterval previews go: "window", "video" or "images"
+    int previewQueueFrames; //previews waiting to be drawn before the tracker starts skipping them
 
     int adpatationAlpha;
     int updateBandNumber;
     int dancerBorderSize;
     int minFramesObjectMustPersist;
 
+    //not a setting: if set, process() times every stage of every frame into it, sends the log nowhere,
+    //and deletes the output files once it is done
+    MMF_Benchmark *benchmark;
+
 
     MMF_MWT_Processor() {
+        benchmark = NULL;
         setToDefaults();
     }
     int process(const char *mmf_filename, const char* output_path = NULL, const char* output_prefix = NULL);
+    double memoryEstimate(int width, int height) const; //bytes
     MMF_MWT_Processor(const MMF_MWT_Processor& orig);
     virtual ~MMF_MWT_Processor();
 
@@ -59,9 +87,33 @@ public:
         startFrame = 0;
         endFrame = -1;
         writeLog = false;
+        readAheadFrames = 4;
+        useMMFPatches = false;
+        staticBackground = false;
+        convertNeededRegionsOnly = false;
+        numShards = 1;
+        shardOverlapFrames = 300;
+        numTilesX = 1;
+        numTilesY = 1;
+        tileOverlapPixels = 100;
+        dancerThreads = 1;
+        checkpointInterval = 0;
+        resumeFromCheckpoint = false;
+        previewOutput = "window";
+        previewQueueFrames = 2;
     }
 protected:
         YAML::Emitter& yamlBody (YAML::Emitter& out) const;
+
+        struct ShardJob;
+        int setupTracker(TrackerLibrary &a_library, int h1, int width, int height, const char *path, const char *prefix, const struct tm *date) const;
+        int trackFrames(TrackerLibrary &a_library, const std::vector<int> &handles, MultiStackReader &sr, int backgroundFrame, int first, int end, bool display, std::ostream &logstream,
+                const char *checkpointName = NULL, bool resume = false) const;
+        int trackShard(ShardJob &job) const;
+        int processShards(const char *mmf_filename, TrackerEntry *te, std::ostream &logstream);
+        static void *shardThreadEntry(void *job);
+        int processTiles(MultiStackReader &sr, TrackerEntry *te, int width, int height, std::ostream &logstream);
+        static void removeBenchmarkOutput(const char *directory, const char *prefix);
     private:
 
 };
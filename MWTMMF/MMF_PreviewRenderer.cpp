@@ -0,0 +1,190 @@
+/*
+ * File:   MMF_PreviewRenderer.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <cstdio>
+#include <cctype>
+#include "MMF_PreviewRenderer.h"
+#include "MWT_Image_CV.h"
+#include "cv.h"
+#include "highgui.h"
+using namespace std;
+
+MMF_PreviewRenderer::MMF_PreviewRenderer(const IplImage *prototype, int imbits, int numSlots) :
+target(window), fps(30), threaded(false), head(0), filled(0), stopping(false), quit(false), nrendered(0), ndropped(0),
+objects8U(NULL), objects16S(NULL), color(NULL), writer(NULL), windowOpen(false) {
+    nslots = (numSlots > 0) ? numSlots : 0;
+    slots = new Slot[nslots];
+    for (int k = 0; k < nslots; k++) {
+        slots[k].frame = -1;
+        slots[k].src = cvCloneImage(prototype);
+        slots[k].objects = new MWT_Image_CV(prototype);
+        slots[k].objects->depth = imbits;
+    }
+    if (nslots > 0) {
+        color = cvCreateImage(cvGetSize(prototype), IPL_DEPTH_8U, 3);
+    }
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&notEmpty, NULL);
+}
+
+MMF_PreviewRenderer::~MMF_PreviewRenderer() {
+    stop();
+    if (writer != NULL) {
+        cvReleaseVideoWriter(&writer);
+    }
+    if (color != NULL) {
+        cvReleaseImage(&color);
+    }
+    if (objects8U != NULL) {
+        cvReleaseImage(&objects8U);
+    }
+    if (objects16S != NULL) {
+        cvReleaseImage(&objects16S);
+    }
+    for (int k = 0; k < nslots; k++) {
+        delete slots[k].objects;
+        cvReleaseImage(&slots[k].src);
+    }
+    delete[] slots;
+    pthread_cond_destroy(&notEmpty);
+    pthread_mutex_destroy(&lock);
+}
+
+bool MMF_PreviewRenderer::targetFromString(const string &s, Target &target) {
+    if (s == "window") {
+        target = window;
+    } else if (s == "video") {
+        target = video;
+    } else if (s == "images") {
+        target = images;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool MMF_PreviewRenderer::start(Target target, const string &name, double fps) {
+    stop();
+    if (nslots == 0) {
+        return false;
+    }
+    this->target = target;
+    this->name = name;
+    this->fps = (fps > 0) ? fps : 1;
+    head = 0;
+    filled = 0;
+    stopping = false;
+    quit = false;
+    threaded = (pthread_create(&renderer, NULL, renderThreadEntry, this) == 0);
+    return threaded;
+}
+
+void MMF_PreviewRenderer::stop() {
+    if (!threaded) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&notEmpty);
+    pthread_mutex_unlock(&lock);
+    pthread_join(renderer, NULL);
+    threaded = false;
+}
+
+MMF_PreviewRenderer::Slot *MMF_PreviewRenderer::claim() {
+    if (!threaded) {
+        return slots;
+    }
+    pthread_mutex_lock(&lock);
+    Slot *slot = (filled < nslots) ? slots + (head + filled) % nslots : NULL;
+    if (slot == NULL) {
+        ndropped++;
+    }
+    pthread_mutex_unlock(&lock);
+    return slot;
+}
+
+void MMF_PreviewRenderer::post(Slot *slot) {
+    if (!threaded) {
+        render(slot);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    filled++;
+    pthread_cond_signal(&notEmpty);
+    pthread_mutex_unlock(&lock);
+}
+
+void MMF_PreviewRenderer::renderLoop() {
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (filled == 0 && !stopping) {
+            pthread_cond_wait(&notEmpty, &lock);
+        }
+        if (filled == 0) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        Slot *slot = slots + head;
+        pthread_mutex_unlock(&lock);
+
+        // the tracker won't claim this slot again until filled drops, so draw it without the lock
+        render(slot);
+
+        pthread_mutex_lock(&lock);
+        head = (head + 1) % nslots;
+        filled--;
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void *MMF_PreviewRenderer::renderThreadEntry(void *preview) {
+    ((MMF_PreviewRenderer *) preview)->renderLoop();
+    return NULL;
+}
+
+void MMF_PreviewRenderer::render(Slot *slot) {
+    bool scaleToRange = true;
+    slot->objects->toIplImage8U(&objects8U, scaleToRange, &objects16S);
+    cvConvertImage(slot->src, color, 0);
+    cvSetImageCOI(color, 1);
+    cvCopy(objects8U, color, NULL);
+    cvSetImageCOI(color, 0);
+    nrendered++;
+
+    switch (target) {
+        case window:
+            //highgui windows belong to the thread that made them, so make it here
+            if (!windowOpen) {
+                cvNamedWindow(name.c_str(), 0);
+                windowOpen = true;
+            }
+            cvShowImage(name.c_str(), color);
+            if (tolower(cvWaitKey(1)) == 'q') {
+                quit = true;
+            }
+            break;
+        case video:
+            if (writer == NULL) {
+                writer = cvCreateVideoWriter(name.c_str(), CV_FOURCC('M', 'J', 'P', 'G'), fps, cvGetSize(color), 1);
+            }
+            if (writer != NULL) {
+                cvWriteFrame(writer, color);
+            }
+            break;
+        case images: {
+            char num[16];
+            sprintf(num, "_%06d.jpg", slot->frame);
+            cvSaveImage((name + num).c_str(), color);
+            break;
+        }
+    }
+}
+
+MMF_PreviewRenderer::MMF_PreviewRenderer(const MMF_PreviewRenderer& orig) {
+}
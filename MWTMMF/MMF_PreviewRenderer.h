@@ -0,0 +1,113 @@
+/*
+ * File:   MMF_PreviewRenderer.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_PREVIEWRENDERER_H
+#define	MMF_PREVIEWRENDERER_H
+
+#include <string>
+#include <pthread.h>
+#include "cxtypes.h"
+
+class MWT_Image_CV;
+struct CvVideoWriter;
+
+/* MMF_PreviewRenderer draws what the tracker sees on a separate thread, so that
+ * showing it does not hold up tracking
+ *
+ * the tracker claims a slot, draws the objects into slot->objects (showObjects),
+ * copies the frame it came from into slot->src, and posts it; everything after that
+ * (scaling to 8 bits, colouring, showing the window or writing the file) happens on
+ * the render thread.  the red and green channels are the frame, the blue channel the objects
+ *
+ * the ring holds a few slots; if all of them are still waiting to be drawn, claim()
+ * returns NULL and the tracker skips the preview for that frame instead of waiting
+ *
+ * a preview goes to a window (pressing q in it asks the tracker to stop, see quitRequested()),
+ * a video file, or a numbered image file per preview frame
+ *
+ * if the render thread can't be started, post() draws the slot on the calling thread,
+ * as the tracking loop used to do
+ */
+class MMF_PreviewRenderer {
+public:
+    enum Target { window, video, images };
+
+    struct Slot {
+        int frame;
+        IplImage *src;
+        MWT_Image_CV *objects;
+    };
+
+    /* MMF_PreviewRenderer(const IplImage *prototype, int imbits, int numSlots);
+     * prototype is any frame of the right size and depth (e.g. the background);
+     * every slot is allocated up front from it; with numSlots <= 0 nothing is,
+     * and the renderer can't be started
+     */
+    MMF_PreviewRenderer(const IplImage *prototype, int imbits, int numSlots);
+    virtual ~MMF_PreviewRenderer();
+
+    /* bool start(Target target, const std::string &name, double fps);
+     * name is the window's title, the video file (written at fps frames per second),
+     * or the start of the image file names (name_NNNNNN.jpg, NNNNNN being the frame)
+     * returns false if the render thread could not be created
+     */
+    bool start(Target target, const std::string &name, double fps);
+
+    /* Slot *claim();
+     * a slot to draw the next preview into, or NULL if the render thread is behind
+     */
+    Slot *claim();
+    void post(Slot *slot);
+
+    /* void stop();
+     * draws whatever has been posted, then joins the render thread; safe to call repeatedly
+     */
+    void stop();
+
+    bool quitRequested() const { return quit; }
+    bool isThreaded() const { return threaded; }
+    int getNumRendered() const { return nrendered; }
+    int getNumDropped() const { return ndropped; }
+
+    static bool targetFromString(const std::string &s, Target &target);
+
+protected:
+    Slot *slots;
+    int nslots;
+    Target target;
+    std::string name;
+    double fps;
+    bool threaded;
+
+    int head;       // slot the render thread draws next
+    int filled;     // slots posted and not yet drawn
+    bool stopping;
+    volatile bool quit;
+    int nrendered;
+    int ndropped;
+
+    // only touched by whichever thread renders
+    IplImage *objects8U;
+    IplImage *objects16S;
+    IplImage *color;
+    CvVideoWriter *writer;
+    bool windowOpen;
+
+    pthread_t renderer;
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+
+    void render(Slot *slot);
+    void renderLoop();
+    static void *renderThreadEntry(void *preview);
+
+private:
+    MMF_PreviewRenderer(const MMF_PreviewRenderer& orig);
+};
+
+#endif	/* MMF_PREVIEWRENDERER_H */
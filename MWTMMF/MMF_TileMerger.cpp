@@ -0,0 +1,378 @@
+/*
+ * File:   MMF_TileMerger.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <cstdlib>
+#include <climits>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "MMF_TileMerger.h"
+using namespace std;
+
+MMF_TileMerger::MMF_TileMerger(const string &directory, const string &prefix, double matchDistance) :
+MMF_TrackStitcher(directory, prefix, matchDistance) {
+}
+
+MMF_TileMerger::~MMF_TileMerger() {
+}
+
+void MMF_TileMerger::addTile(const string &tilePrefix, float x0, float x1, float y0, float y1) {
+    Tile t;
+    t.prefix = tilePrefix;
+    t.x0 = x0;
+    t.x1 = x1;
+    t.y0 = y0;
+    t.y1 = y1;
+    tiles.push_back(t);
+}
+
+int MMF_TileMerger::ownerOf(float x, float y) const {
+    for (size_t k = 0; k < tiles.size(); ++k) {
+        if (x >= tiles[k].x0 && x < tiles[k].x1 && y >= tiles[k].y0 && y < tiles[k].y1) {
+            return (int) k;
+        }
+    }
+    return -1;
+}
+
+//reads all of one tile's dancers and its summary
+bool MMF_TileMerger::readTile(int tile) {
+    const string &tilePrefix = tiles[tile].prefix;
+    size_t firstTrack = tracks.size();
+    for (int fid = 0; ; ++fid) {
+        ifstream is(blobsFileName(directory, tilePrefix, fid).c_str());
+        if (!is.good()) {
+            break;
+        }
+        string line;
+        while (getline(is, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            if (line[0] == '%') {
+                TileTrack tt;
+                tt.tile = tile;
+                tt.id = atoi(line.c_str() + 1);
+                tt.ended = -1;
+                tracks.push_back(tt);
+                trackOf[make_pair(tile, tt.id)] = (int) tracks.size() - 1;
+                continue;
+            }
+            if (tracks.size() == firstTrack) {
+                error = "blob data before any dancer ID in " + blobsFileName(directory, tilePrefix, fid);
+                return false;
+            }
+            TileBlob b;
+            b.frame = atoi(line.c_str());
+            if (!centroidOf(line, b.x, b.y)) {
+                error = "could not read blob in " + blobsFileName(directory, tilePrefix, fid) + ": " + line;
+                return false;
+            }
+            b.owner = ownerOf(b.x, b.y);
+            b.segment = -1;
+            b.line = line;
+            tracks.back().blobs.push_back(b);
+            blobsAt[tile][b.frame].push_back(make_pair((int) tracks.size() - 1, (int) tracks.back().blobs.size() - 1));
+        }
+    }
+
+    vector<SummaryLine> lines;
+    map<int, int> ended;
+    if (!readSummary(tilePrefix, 0, INT_MIN, INT_MAX, lines, ended)) {
+        return false;
+    }
+    for (size_t k = 0; k < lines.size(); ++k) {
+        tileSummaries[tile][lines[k].frame] = lines[k];
+    }
+    for (size_t t = firstTrack; t < tracks.size(); ++t) {
+        TileTrack &tt = tracks[t];
+        if (tt.blobs.empty()) {
+            continue;
+        }
+        tt.ended = ended.count(tt.id) ? ended[tt.id] : tt.blobs.back().frame + 1;
+    }
+    return true;
+}
+
+//the track of tile that has a blob of its own (i.e. in its core) near (x,y) in frame, or -1
+int MMF_TileMerger::findCounterpart(int tile, int frame, float x, float y, int &blob) const {
+    map<int, vector<pair<int, int> > >::const_iterator at = blobsAt[tile].find(frame);
+    if (at == blobsAt[tile].end()) {
+        return -1;
+    }
+    int best = -1;
+    double bestd = matchDistance;
+    for (size_t k = 0; k < at->second.size(); ++k) {
+        const TileBlob &b = tracks[at->second[k].first].blobs[at->second[k].second];
+        if (b.owner != tile) {
+            continue;
+        }
+        double d = sqrt((double) (b.x - x)*(b.x - x) + (double) (b.y - y)*(b.y - y));
+        if (d <= bestd) {
+            bestd = d;
+            best = at->second[k].first;
+            blob = at->second[k].second;
+        }
+    }
+    return best;
+}
+
+//splits every tile's dancers into the runs of frames that are kept, and links up the hand-offs between tiles
+void MMF_TileMerger::findSegments() {
+    vector<pair<int, pair<int, int> > > handoffs; // segment -> (track, blob) it hands the dancer to
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        TileTrack &tt = tracks[t];
+        int current = -1;
+        for (size_t b = 0; b < tt.blobs.size(); ++b) {
+            TileBlob &blob = tt.blobs[b];
+            bool keep = (blob.owner == tt.tile);
+            if (!keep && current >= 0) {
+                //we had it last frame and it is now in somebody else's core; keep it unless they have it too
+                int cb = -1;
+                int ct = (blob.owner < 0) ? -1 : findCounterpart(blob.owner, blob.frame, blob.x, blob.y, cb);
+                if (ct >= 0) {
+                    handoffs.push_back(make_pair(current, make_pair(ct, cb)));
+                } else {
+                    keep = true;
+                }
+            }
+            if (!keep) {
+                if (current >= 0) {
+                    segments[current].end = (int) b;
+                }
+                current = -1;
+                continue;
+            }
+            if (current < 0) {
+                Segment s;
+                s.track = (int) t;
+                s.begin = (int) b;
+                s.end = (int) tt.blobs.size();
+                s.next = -1;
+                s.handedIn = false;
+                s.chain = -1;
+                segments.push_back(s);
+                current = (int) segments.size() - 1;
+            }
+            blob.segment = current;
+        }
+    }
+    for (size_t k = 0; k < handoffs.size(); ++k) {
+        int target = tracks[handoffs[k].second.first].blobs[handoffs[k].second.second].segment;
+        if (target < 0 || segments[target].handedIn) {
+            continue; //two dancers ran into the same one; only the first goes on
+        }
+        segments[handoffs[k].first].next = target;
+        segments[target].handedIn = true;
+        ++nStitched;
+    }
+    for (size_t t = 0; t < tracks.size(); ++t) {
+        for (size_t b = 0; b < tracks[t].blobs.size(); ++b) {
+            if (tracks[t].blobs[b].segment < 0) {
+                ++dropped[tracks[t].tile][tracks[t].blobs[b].frame];
+            }
+        }
+    }
+}
+
+//merged ID of tile's dancer id in frame (or the frame before, when it was just lost), or -1 if it wasn't kept then
+int MMF_TileMerger::chainAt(int tile, int id, int frame) const {
+    map<pair<int, int>, int>::const_iterator it = trackOf.find(make_pair(tile, id));
+    if (it == trackOf.end() || tracks[it->second].blobs.empty()) {
+        return -1;
+    }
+    const TileTrack &tt = tracks[it->second];
+    for (int f = frame; f >= frame - 1; --f) {
+        int b = f - tt.blobs[0].frame;
+        if (b >= 0 && b < (int) tt.blobs.size() && tt.blobs[b].frame == f && tt.blobs[b].segment >= 0) {
+            return segments[tt.blobs[b].segment].chain;
+        }
+    }
+    return -1;
+}
+
+//follows every dancer from tile to tile and writes it out in one piece
+bool MMF_TileMerger::writeChains() {
+    vector<pair<pair<int, pair<int, int> >, int> > heads; // ((first frame, (tile, tile's ID)), segment)
+    for (size_t s = 0; s < segments.size(); ++s) {
+        if (!segments[s].handedIn) {
+            const Segment &seg = segments[s];
+            const TileTrack &tt = tracks[seg.track];
+            heads.push_back(make_pair(make_pair(tt.blobs[seg.begin].frame, make_pair(tt.tile, tt.id)), (int) s));
+        }
+    }
+    sort(heads.begin(), heads.end());
+
+    vector<Track> merged(heads.size());
+    vector<pair<int, int> > order; // (ended, index into merged)
+    for (size_t h = 0; h < heads.size(); ++h) {
+        Track &t = merged[h];
+        t.id = ++maxID;
+        t.first = heads[h].first.first;
+        t.last = t.first - 1;
+        bool flip = false;
+        int s;
+        for (s = heads[h].second; s >= 0; s = segments[s].next) {
+            Segment &seg = segments[s];
+            seg.chain = t.id;
+            const TileTrack &tt = tracks[seg.track];
+            if (!t.lines.empty()) {
+                //the next tile may have picked the other end as the head; keep the first choice
+                float ux, uy, vx, vy;
+                if (majorAxisOf(t.lines.back(), ux, uy) && majorAxisOf(tt.blobs[seg.begin].line, vx, vy)) {
+                    flip = (ux * vx + uy * vy < 0);
+                }
+            }
+            for (int b = seg.begin; b < seg.end; ++b) {
+                if (tt.blobs[b].frame <= t.last) {
+                    continue;
+                }
+                t.lines.push_back(flip ? flipBlobLine(tt.blobs[b].line) : tt.blobs[b].line);
+                t.last = tt.blobs[b].frame;
+            }
+            t.ended = (seg.end == (int) tt.blobs.size()) ? tt.ended : t.last + 1;
+        }
+        order.push_back(make_pair(t.ended, (int) h));
+    }
+
+    //same order a single tracker would have written them in
+    sort(order.begin(), order.end());
+    for (size_t k = 0; k < order.size(); ++k) {
+        if (!writeTrack(merged[order[k].second])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//adds up the per-frame statistics of several tiles; counts are summed, everything else is averaged over the good dancers
+//drop[j] of tile j's dancers are also some other tile's, and are left out of both
+string MMF_TileMerger::combineStats(const vector<const SummaryLine *> &lines, const vector<int> &drop) {
+    const int NSTATS = 12;
+    double time = 0;
+    int tracked = 0;
+    int good = 0;
+    double sum[NSTATS];
+    double plain[NSTATS];
+    for (int k = 0; k < NSTATS; ++k) {
+        sum[k] = plain[k] = 0;
+    }
+    for (size_t j = 0; j < lines.size(); ++j) {
+        istringstream is(lines[j]->stats);
+        int nt = 0;
+        int ng = 0;
+        double v[NSTATS];
+        is >> time >> nt >> ng;
+        nt = (nt > drop[j]) ? nt - drop[j] : 0;
+        ng = (ng > drop[j]) ? ng - drop[j] : 0;
+        for (int k = 0; k < NSTATS; ++k) {
+            v[k] = 0;
+            is >> v[k];
+            sum[k] += ng * v[k];
+            plain[k] += v[k];
+        }
+        tracked += nt;
+        good += ng;
+    }
+    double mean[NSTATS];
+    for (int k = 0; k < NSTATS; ++k) {
+        mean[k] = (good > 0) ? sum[k] / good : (lines.empty() ? 0 : plain[k] / lines.size());
+    }
+    char buffer[512];
+    sprintf(buffer, " %.3f  %d %d %.1f  %.2f %.3f  %.1f %.3f  %.1f %.3f  %.3f %.3f  %.3f %.3f",
+            time, tracked, good, mean[0], mean[1], mean[2], mean[3], mean[4], mean[5], mean[6], mean[7], mean[8], mean[9], mean[10]);
+    return string(buffer);
+}
+
+//one summary line per frame, with the origin/fate lists in terms of the merged IDs
+void MMF_TileMerger::mergeSummaries() {
+    map<int, vector<pair<int, int> > > extra; // frame -> origin/fate pairs for dancers that start or stop at a tile border
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const Segment &seg = segments[s];
+        const TileTrack &tt = tracks[seg.track];
+        if (!seg.handedIn && seg.begin > 0) {
+            extra[tt.blobs[seg.begin].frame].push_back(make_pair(0, seg.chain));
+        }
+        if (seg.next < 0 && seg.end < (int) tt.blobs.size()) {
+            extra[tt.blobs[seg.end - 1].frame + 1].push_back(make_pair(seg.chain, 0));
+        }
+    }
+
+    map<int, vector<const SummaryLine *> > frames;
+    map<int, vector<int> > frameTiles;
+    for (size_t k = 0; k < tileSummaries.size(); ++k) {
+        for (map<int, SummaryLine>::const_iterator it = tileSummaries[k].begin(); it != tileSummaries[k].end(); ++it) {
+            frames[it->first].push_back(&it->second);
+            frameTiles[it->first].push_back((int) k);
+        }
+    }
+    for (map<int, vector<const SummaryLine *> >::iterator it = frames.begin(); it != frames.end(); ++it) {
+        SummaryLine sl;
+        sl.frame = it->first;
+        vector<int> drop;
+        for (size_t j = 0; j < it->second.size(); ++j) {
+            map<int, int>::const_iterator d = dropped[frameTiles[it->first][j]].find(it->first);
+            drop.push_back((d == dropped[frameTiles[it->first][j]].end()) ? 0 : d->second);
+        }
+        sl.stats = combineStats(it->second, drop);
+        vector<string> events;
+        for (size_t j = 0; j < it->second.size(); ++j) {
+            const SummaryLine &tl = *(it->second[j]);
+            int tile = frameTiles[it->first][j];
+            istringstream is(tl.events);
+            string ev;
+            while (is >> ev) {
+                if (find(events.begin(), events.end(), ev) == events.end()) {
+                    events.push_back(ev);
+                    sl.events += " " + ev;
+                }
+            }
+            for (size_t f = 0; f < tl.fates.size(); ++f) {
+                int ido = tl.fates[f].first;
+                int idf = tl.fates[f].second;
+                int mo = (ido == 0) ? 0 : chainAt(tile, ido, sl.frame);
+                int mf = (idf == 0) ? 0 : chainAt(tile, idf, sl.frame);
+                if (mo < 0 || mf < 0 || mo == mf) {
+                    continue; //happened where this tile's dancers weren't being kept
+                }
+                pair<int, int> p(mo, mf);
+                if (find(sl.fates.begin(), sl.fates.end(), p) == sl.fates.end()) {
+                    sl.fates.push_back(p);
+                }
+            }
+        }
+        vector<pair<int, int> > &ex = extra[sl.frame];
+        for (size_t j = 0; j < ex.size(); ++j) {
+            if (find(sl.fates.begin(), sl.fates.end(), ex[j]) == sl.fates.end()) {
+                sl.fates.push_back(ex[j]);
+            }
+        }
+        summary.push_back(sl);
+    }
+}
+
+bool MMF_TileMerger::merge() {
+    blobsAt.assign(tiles.size(), map<int, vector<pair<int, int> > >());
+    tileSummaries.assign(tiles.size(), map<int, SummaryLine>());
+    dropped.assign(tiles.size(), map<int, int>());
+    for (size_t k = 0; k < tiles.size(); ++k) {
+        if (!readTile((int) k)) {
+            return false;
+        }
+    }
+    findSegments();
+    if (!writeChains()) {
+        return false;
+    }
+    mergeSummaries();
+    return finish();
+}
+
+MMF_TileMerger::MMF_TileMerger(const MMF_TileMerger& orig) : MMF_TrackStitcher(orig.directory, orig.prefix) {
+}
@@ -0,0 +1,107 @@
+/*
+ * File:   MMF_TileMerger.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_TILEMERGER_H
+#define	MMF_TILEMERGER_H
+
+#include "MMF_TrackStitcher.h"
+
+/* MMF_TileMerger joins the output of several trackers that each watched one
+ * (overlapping) tile of the same movie over the same frames into a single
+ * .summary and set of .blobs files
+ *
+ * every tile has a core; the cores of all the tiles cover the field of view without
+ * overlapping, and a blob belongs to the tile whose core holds its centroid.  a dancer
+ * is kept by the tile it is in until it walks into another tile's core and that tile
+ * has a blob in the same place (within matchDistance pixels) in that frame; from then
+ * on the other tile's dancer carries on under the same ID, with its head at the same end
+ * what a tile saw of a dancer before it first came into that tile's core is dropped
+ *
+ * IDs are handed out in the order the dancers appear.  the per-frame statistics in
+ * the summary add up the counts of all the tiles and average the rest over the tiles,
+ * weighted by how many good dancers each had; a tile's blobs that were dropped in favour
+ * of another tile's (i.e. its copies of dancers in an overlap) are taken off its counts
+ * and its weight, so each dancer counts once
+ */
+class MMF_TileMerger : public MMF_TrackStitcher {
+public:
+    /* the two tiles see a dancer in an overlap against their own backgrounds and may cut it
+     * off at different edges, so their centroids can be several pixels apart; matchDistance
+     * should be a good fraction of the overlap (processTiles uses half of it)
+     */
+    MMF_TileMerger(const std::string &directory, const std::string &prefix, double matchDistance);
+    virtual ~MMF_TileMerger();
+
+    /* void addTile(const std::string &tilePrefix, float x0, float x1, float y0, float y1);
+     * the tile's core is x0 <= x < x1, y0 <= y < y1
+     */
+    void addTile(const std::string &tilePrefix, float x0, float x1, float y0, float y1);
+
+    /* bool merge();
+     * reads every tile's .summary and .blobs files and writes the merged ones
+     * returns false (see getError()) if something could not be read or written
+     */
+    bool merge();
+
+    // dancers passed from one tile to another (getNumStitched() also counts these)
+    int getNumHandoffs() const { return nStitched; }
+
+protected:
+    struct Tile {
+        std::string prefix;
+        float x0;
+        float x1;
+        float y0;
+        float y1;
+    };
+    struct TileBlob {
+        int frame;
+        float x;
+        float y;
+        int owner;      // tile whose core holds the centroid
+        int segment;    // segment this blob was kept in, or -1
+        std::string line;
+    };
+    struct TileTrack {
+        int tile;
+        int id;
+        int ended;
+        std::vector<TileBlob> blobs;
+    };
+    // a run of blobs of one TileTrack that is kept
+    struct Segment {
+        int track;
+        int begin;
+        int end;        // one past the last blob
+        int next;       // segment the dancer was handed to, or -1
+        bool handedIn;  // some other segment hands the dancer to this one
+        int chain;      // ID in the merged output
+    };
+
+    std::vector<Tile> tiles;
+    std::vector<TileTrack> tracks;
+    std::vector<Segment> segments;
+    std::map<std::pair<int, int>, int> trackOf; // (tile, tile's ID) -> track
+    std::vector<std::map<int, std::vector<std::pair<int, int> > > > blobsAt; // per tile: frame -> (track, blob)
+    std::vector<std::map<int, SummaryLine> > tileSummaries;
+    std::vector<std::map<int, int> > dropped; // per tile: frame -> blobs not kept
+
+    int ownerOf(float x, float y) const;
+    bool readTile(int tile);
+    int findCounterpart(int tile, int frame, float x, float y, int &blob) const;
+    void findSegments();
+    int chainAt(int tile, int id, int frame) const;
+    bool writeChains();
+    void mergeSummaries();
+    static std::string combineStats(const std::vector<const SummaryLine *> &lines, const std::vector<int> &drop);
+
+private:
+    MMF_TileMerger(const MMF_TileMerger& orig);
+};
+
+#endif	/* MMF_TILEMERGER_H */
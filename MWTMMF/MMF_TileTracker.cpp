@@ -0,0 +1,177 @@
+/*
+ * File:   MMF_TileTracker.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include "MWT_Library.h"
+#include "MMF_TileTracker.h"
+using namespace std;
+
+MMF_TileTracker::MMF_TileTracker(TrackerLibrary &library, const vector<int> &handles) :
+library(library), handles(handles), threaded(false), frame(NULL), frameTime(0), generation(0), remaining(0), stopping(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&framePosted, NULL);
+    pthread_cond_init(&frameDone, NULL);
+}
+
+MMF_TileTracker::~MMF_TileTracker() {
+    stop();
+    pthread_cond_destroy(&frameDone);
+    pthread_cond_destroy(&framePosted);
+    pthread_mutex_destroy(&lock);
+}
+
+bool MMF_TileTracker::start() {
+    stop();
+    stopping = false;
+    generation = 0;
+    if (handles.size() < 2) {
+        return true;
+    }
+    workers.resize(handles.size());
+    size_t k;
+    for (k = 0; k < workers.size(); ++k) {
+        workers[k].tracker = this;
+        workers[k].index = (int) k;
+        workers[k].result = 0;
+        if (pthread_create(&workers[k].thread, NULL, workerThreadEntry, &workers[k]) != 0) {
+            break;
+        }
+    }
+    threaded = true;
+    if (k < workers.size()) {
+        //couldn't get them all; put back the ones we got and do it all here
+        workers.resize(k);
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void MMF_TileTracker::stop() {
+    if (!threaded) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&framePosted);
+    pthread_mutex_unlock(&lock);
+    for (size_t k = 0; k < workers.size(); ++k) {
+        pthread_join(workers[k].thread, NULL);
+    }
+    workers.clear();
+    threaded = false;
+}
+
+//loadImage sets divide_bg on the image it is given, so every handle gets its own view of the frame
+void MMF_TileTracker::makeView(Image &view, const Image &im) {
+    view.pixels = im.pixels;
+    view.bounds = im.bounds;
+    view.size = im.size;
+    view.stride = im.stride;
+    view.bin = im.bin;
+    view.depth = im.depth;
+    view.divide_bg = im.divide_bg;
+}
+
+int MMF_TileTracker::scanObjects(Image &background) {
+    int nobj = 0;
+    for (size_t k = 0; k < handles.size(); ++k) {
+        Image view;
+        makeView(view, background);
+        nobj += library.scanObjects(handles[k], view);
+    }
+    return nobj;
+}
+
+int MMF_TileTracker::loadBackground(Image &background) {
+    int nloaded = 0;
+    for (size_t k = 0; k < handles.size(); ++k) {
+        Image view;
+        makeView(view, background);
+        if (library.loadBackground(handles[k], view) == handles[k]) {
+            nloaded++;
+        }
+    }
+    return nloaded;
+}
+
+int MMF_TileTracker::trackOne(int index, Image &im, float time) {
+    Image view;
+    makeView(view, im);
+    int h = handles[index];
+    if (library.loadImage(h, view, time) != h) {
+        return -1;
+    }
+    return library.processImage(h);
+}
+
+void MMF_TileTracker::workLoop(int index) {
+    int seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        while (generation == seen && !stopping) {
+            pthread_cond_wait(&framePosted, &lock);
+        }
+        if (stopping) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        seen = generation;
+        Image *im = frame;
+        float time = frameTime;
+        pthread_mutex_unlock(&lock);
+
+        int result = trackOne(index, *im, time);
+
+        pthread_mutex_lock(&lock);
+        workers[index].result = result;
+        if (--remaining == 0) {
+            pthread_cond_signal(&frameDone);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void *MMF_TileTracker::workerThreadEntry(void *worker) {
+    Worker *w = (Worker *) worker;
+    w->tracker->workLoop(w->index);
+    return NULL;
+}
+
+int MMF_TileTracker::processFrame(Image &im, float time) {
+    int nobj = 0;
+    if (!threaded) {
+        for (size_t k = 0; k < handles.size(); ++k) {
+            int n = trackOne((int) k, im, time);
+            if (n < 0) {
+                return -1;
+            }
+            nobj += n;
+        }
+        return nobj;
+    }
+    pthread_mutex_lock(&lock);
+    frame = &im;
+    frameTime = time;
+    remaining = (int) workers.size();
+    ++generation;
+    pthread_cond_broadcast(&framePosted);
+    while (remaining > 0) {
+        pthread_cond_wait(&frameDone, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+    for (size_t k = 0; k < workers.size(); ++k) {
+        if (workers[k].result < 0) {
+            return -1;
+        }
+        nobj += workers[k].result;
+    }
+    return nobj;
+}
+
+MMF_TileTracker::MMF_TileTracker(const MMF_TileTracker& orig) : library(orig.library) {
+}
@@ -0,0 +1,97 @@
+/*
+ * File:   MMF_TileTracker.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_TILETRACKER_H
+#define	MMF_TILETRACKER_H
+
+#include <vector>
+#include <pthread.h>
+
+class TrackerLibrary;
+class Image;
+
+/* MMF_TileTracker runs one frame through several tracker handles at once
+ *
+ * each handle is meant to watch its own part of the field of view (set with
+ * TrackerLibrary::setRectangle), so that every part is tracked by its own
+ * Performance on its own core
+ *
+ * processFrame() hands the same frame to every handle and returns once all of
+ * them have loaded and processed it; the frame is only read, so the handles share it
+ *
+ * with a single handle, or if start() could not get the threads, everything
+ * happens on the calling thread, exactly as calling loadImage and processImage directly
+ */
+class MMF_TileTracker {
+public:
+    MMF_TileTracker(TrackerLibrary &library, const std::vector<int> &handles);
+    virtual ~MMF_TileTracker();
+
+    /* bool start();
+     * starts one thread per handle; returns false if they could not be created
+     * (in which case processFrame works through the handles on the calling thread)
+     */
+    bool start();
+
+    /* int scanObjects(Image &background);
+     * TrackerLibrary::scanObjects for every handle, on the calling thread; returns the total number of objects
+     */
+    int scanObjects(Image &background);
+
+    /* int loadBackground(Image &background);
+     * TrackerLibrary::loadBackground for every handle, on the calling thread, between frames;
+     * returns the number of handles whose background was replaced
+     */
+    int loadBackground(Image &background);
+
+    /* int processFrame(Image &im, float time);
+     * returns the total number of objects found, or -1 if loadImage failed for any handle
+     */
+    int processFrame(Image &im, float time);
+
+    /* void stop();
+     * joins the threads; safe to call repeatedly
+     */
+    void stop();
+
+    bool isThreaded() const { return threaded; }
+    int getNumHandles() const { return (int) handles.size(); }
+
+protected:
+    TrackerLibrary &library;
+    std::vector<int> handles;
+    bool threaded;
+
+    struct Worker {
+        MMF_TileTracker *tracker;
+        int index;
+        int result;     // objects found in the current frame, or -1
+        pthread_t thread;
+    };
+    std::vector<Worker> workers;
+
+    Image *frame;
+    float frameTime;
+    int generation;     // bumped every time a frame is posted
+    int remaining;      // workers still busy with the current frame
+    bool stopping;
+
+    pthread_mutex_t lock;
+    pthread_cond_t framePosted;
+    pthread_cond_t frameDone;
+
+    static void makeView(Image &view, const Image &im);
+    int trackOne(int index, Image &im, float time);
+    void workLoop(int index);
+    static void *workerThreadEntry(void *worker);
+
+private:
+    MMF_TileTracker(const MMF_TileTracker& orig);
+};
+
+#endif	/* MMF_TILETRACKER_H */
@@ -0,0 +1,644 @@
+/*
+ * File:   MMF_TrackStitcher.cpp
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include "MWT_Library.h"
+#include "MMF_TrackStitcher.h"
+using namespace std;
+
+//pulls the centroid out of a line of a .blobs file: frame time x y ...
+bool MMF_TrackStitcher::centroidOf(const string &line, float &x, float &y) {
+    return sscanf(line.c_str(), "%*d %*f %f %f", &x, &y) == 2;
+}
+
+//and the major axis, which also says which end the tracker thinks is which
+bool MMF_TrackStitcher::majorAxisOf(const string &line, float &x, float &y) {
+    return sscanf(line.c_str(), "%*d %*f %*f %*f %*d %f %f", &x, &y) == 2;
+}
+
+//replaces the frame number at the start of a line of a .blobs file
+string MMF_TrackStitcher::renumberBlobLine(const string &line, int frame) {
+    stringstream ss;
+    ss << frame << line.substr(line.find(' '));
+    return ss.str();
+}
+
+//turns a line of a .blobs file head for tail: the major axis changes sign and the skeleton runs the other way
+string MMF_TrackStitcher::flipBlobLine(const string &line) {
+    size_t pc = line.find('%');
+    string head = line.substr(0, pc);
+    size_t pos = 0;
+    for (int k = 0; k < 7 && pos != string::npos; ++k) {
+        pos = head.find_first_not_of(' ', pos);
+        if (pos == string::npos) {
+            break;
+        }
+        if (k >= 5 && head.compare(pos, 5, "0.000") != 0) {
+            if (head[pos] == '-') {
+                head.erase(pos, 1);
+            } else {
+                head.insert(pos, "-");
+            }
+        }
+        pos = head.find(' ', pos);
+    }
+    if (pc == string::npos) {
+        return head;
+    }
+    if (line.compare(pc, 2, "%%") == 0) {
+        return head + line.substr(pc);
+    }
+    size_t outline = line.find("%%", pc);
+    istringstream skel(line.substr(pc + 1, (outline == string::npos) ? string::npos : outline - pc - 1));
+    vector<int> xy;
+    int v;
+    while (skel >> v) {
+        xy.push_back(v);
+    }
+    stringstream ss;
+    ss << head << '%';
+    for (size_t k = xy.size(); k >= 2; k -= 2) {
+        ss << ' ' << xy[k - 2] << ' ' << xy[k - 1];
+    }
+    if (outline != string::npos) {
+        ss << ' ' << line.substr(outline);
+    }
+    return ss.str();
+}
+
+MMF_TrackStitcher::MMF_TrackStitcher(const string &directory, const string &prefix, double matchDistance) :
+directory(directory), prefix(prefix), matchDistance(matchDistance), maxID(0), nStitched(0), nUnmatched(0),
+out(NULL), outputCount(0), nextFileID(0) {
+}
+
+MMF_TrackStitcher::~MMF_TrackStitcher() {
+    if (out != NULL) {
+        fclose(out);
+    }
+}
+
+string MMF_TrackStitcher::blobsFileName(const string &directory, const string &prefix, int fileID) {
+    char num[16];
+    sprintf(num, "_%05dk.blobs", fileID); //same pattern Performance::prepareOutput uses for combined blobs
+    return directory + prefix + num;
+}
+
+string MMF_TrackStitcher::summaryFileName(const string &directory, const string &prefix) {
+    return directory + prefix + ".summary";
+}
+
+void MMF_TrackStitcher::removeShardFiles(const string &shardPrefix) const {
+    remove(summaryFileName(directory, shardPrefix).c_str());
+    for (int fid = 0; remove(blobsFileName(directory, shardPrefix, fid).c_str()) == 0; ++fid)
+        ;
+}
+
+//first pass over a shard's .blobs files: where each dancer starts and stops, and where it was just before the boundary
+bool MMF_TrackStitcher::scanShard(const string &shardPrefix, int frameOffset, int boundary, vector<TrackInfo> &info) {
+    for (int fid = 0; ; ++fid) {
+        ifstream is(blobsFileName(directory, shardPrefix, fid).c_str());
+        if (!is.good()) {
+            return true;
+        }
+        string line;
+        while (getline(is, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            if (line[0] == '%') {
+                TrackInfo ti;
+                ti.id = atoi(line.c_str() + 1);
+                ti.first = -1;
+                ti.last = -1;
+                ti.atBoundary = false;
+                info.push_back(ti);
+                continue;
+            }
+            if (info.empty()) {
+                error = "blob data before any dancer ID in " + blobsFileName(directory, shardPrefix, fid);
+                return false;
+            }
+            TrackInfo &ti = info.back();
+            int frame = atoi(line.c_str()) + frameOffset;
+            if (ti.first < 0) {
+                ti.first = frame;
+            }
+            ti.last = frame;
+            if (frame == boundary) {
+                ti.atBoundary = centroidOf(line, ti.x, ti.y) && majorAxisOf(line, ti.mx, ti.my);
+            }
+        }
+    }
+}
+
+bool MMF_TrackStitcher::addShard(const string &shardPrefix, int frameOffset, int firstOwned, int lastOwned) {
+    vector<TrackInfo> info;
+    if (!scanShard(shardPrefix, frameOffset, firstOwned - 1, info)) {
+        return false;
+    }
+
+    //pair up dancers across the boundary, closest pairs first
+    vector<pair<double, pair<int, int> > > pairs;
+    for (size_t u = 0; u < pending.size(); ++u) {
+        float ux, uy;
+        if (pending[u].lines.empty() || !centroidOf(pending[u].lines.back(), ux, uy)) {
+            continue;
+        }
+        //the two shards' backgrounds differ, so the outlines can too, by up to about how far the dancer moves in a frame
+        double reach = matchDistance;
+        float px, py;
+        if (pending[u].lines.size() >= 2 && centroidOf(pending[u].lines[pending[u].lines.size() - 2], px, py)) {
+            reach += sqrt((double) (ux - px)*(ux - px) + (double) (uy - py)*(uy - py));
+        }
+        for (size_t t = 0; t < info.size(); ++t) {
+            if (!info[t].atBoundary) {
+                continue;
+            }
+            double d = sqrt((double) (info[t].x - ux)*(info[t].x - ux) + (double) (info[t].y - uy)*(info[t].y - uy));
+            if (d <= reach) {
+                pairs.push_back(make_pair(d, make_pair((int) u, (int) t)));
+            }
+        }
+    }
+    sort(pairs.begin(), pairs.end());
+    vector<int> match(info.size(), -1);
+    vector<bool> flip(info.size(), false);
+    vector<bool> continued(pending.size(), false);
+    map<int, int> ids; //shard ID -> output ID, for dancers that continue one from the last shard
+    for (size_t p = 0; p < pairs.size(); ++p) {
+        int u = pairs[p].second.first;
+        int t = pairs[p].second.second;
+        if (continued[u] || match[t] >= 0) {
+            continue;
+        }
+        continued[u] = true;
+        match[t] = u;
+        ids[info[t].id] = pending[u].id;
+        //the new shard may have picked the other end as the head; keep the old choice
+        float ux, uy;
+        if (majorAxisOf(pending[u].lines.back(), ux, uy)) {
+            flip[t] = (ux * info[t].mx + uy * info[t].my < 0);
+        }
+    }
+
+    vector<SummaryLine> lines;
+    map<int, int> ended;
+    if (!readSummary(shardPrefix, frameOffset, firstOwned, lastOwned, lines, ended)) {
+        return false;
+    }
+
+    //whatever the last shard was tracking and this one did not pick up is lost at the boundary
+    vector<int> lost;
+    vector<int> found;
+    for (size_t u = 0; u < pending.size(); ++u) {
+        if (!continued[u]) {
+            lost.push_back(pending[u].id);
+            pending[u].ended = firstOwned;
+            ++nUnmatched;
+            if (!writeTrack(pending[u])) {
+                return false;
+            }
+        }
+    }
+
+    //new dancers get the next free IDs, in the order the shard created them, as one tracker would have
+    set<int> fresh;
+    for (size_t t = 0; t < info.size(); ++t) {
+        if (match[t] < 0 && info[t].last >= firstOwned) {
+            fresh.insert(info[t].id);
+        }
+    }
+    for (size_t k = 0; k < lines.size(); ++k) {
+        for (size_t j = 0; j < lines[k].fates.size(); ++j) {
+            fresh.insert(lines[k].fates[j].first);
+            fresh.insert(lines[k].fates[j].second);
+        }
+    }
+    fresh.erase(0);
+    for (set<int>::iterator it = fresh.begin(); it != fresh.end(); ++it) {
+        if (!ids.count(*it)) {
+            ids[*it] = ++maxID;
+        }
+    }
+
+    //second pass: copy blobs from the frames this shard owns
+    vector<Track> stillTracking;
+    Track t;
+    bool open = false;
+    bool flipping = false;
+    size_t index = 0;
+    for (int fid = 0; ; ++fid) {
+        ifstream is(blobsFileName(directory, shardPrefix, fid).c_str());
+        if (!is.good()) {
+            break;
+        }
+        string line;
+        while (getline(is, line)) {
+            if (line.empty()) {
+                continue;
+            }
+            if (line[0] == '%') {
+                if (open && !finishTrack(t, lastOwned, stillTracking)) {
+                    return false;
+                }
+                const TrackInfo &ti = info[index];
+                flipping = flip[index];
+                int u = match[index++];
+                open = true;
+                t.lines.clear();
+                if (u >= 0) {
+                    //continues a dancer from the last shard
+                    t.id = pending[u].id;
+                    t.first = pending[u].first;
+                    t.lines.swap(pending[u].lines);
+                    ++nStitched;
+                } else if (ti.last >= firstOwned) {
+                    t.id = ids[ti.id];
+                    t.first = (ti.first < firstOwned) ? firstOwned : ti.first;
+                    if (ti.first < firstOwned) {
+                        found.push_back(t.id);
+                    }
+                } else {
+                    open = false; //the last shard has already written out everything this dancer did
+                    continue;
+                }
+                t.last = ti.last;
+                t.ended = ended.count(ti.id) ? ended[ti.id] : ti.last;
+                continue;
+            }
+            int frame = atoi(line.c_str()) + frameOffset;
+            if (open && frame >= firstOwned) {
+                t.lines.push_back(renumberBlobLine(flipping ? flipBlobLine(line) : line, frame));
+            }
+        }
+    }
+    if (open && !finishTrack(t, lastOwned, stillTracking)) {
+        return false;
+    }
+    pending.swap(stillTracking);
+
+    //and now the origin/fate lists can be put in terms of the new IDs
+    for (size_t k = 0; k < lines.size(); ++k) {
+        SummaryLine &sl = lines[k];
+        vector<pair<int, int> > fates;
+        if (sl.frame == firstOwned) {
+            for (size_t j = 0; j < lost.size(); ++j) {
+                fates.push_back(make_pair(lost[j], 0));
+            }
+        }
+        for (size_t j = 0; j < sl.fates.size(); ++j) {
+            int ido = sl.fates[j].first;
+            int idf = sl.fates[j].second;
+            fates.push_back(make_pair((ido == 0) ? 0 : ids[ido], (idf == 0) ? 0 : ids[idf]));
+        }
+        if (sl.frame == firstOwned) {
+            for (size_t j = 0; j < found.size(); ++j) {
+                fates.push_back(make_pair(0, found[j]));
+            }
+        }
+        sl.fates.swap(fates);
+        summary.push_back(sl);
+    }
+    return true;
+}
+
+//reads the summary lines for the frames a shard owns, and the frame each dancer was written out in
+bool MMF_TrackStitcher::readSummary(const string &shardPrefix, int frameOffset, int firstOwned, int lastOwned, vector<SummaryLine> &lines, map<int, int> &ended) {
+    ifstream is(summaryFileName(directory, shardPrefix).c_str());
+    if (!is.good()) {
+        error = "could not read " + summaryFileName(directory, shardPrefix);
+        return false;
+    }
+    string line;
+    while (getline(is, line)) {
+        size_t sp = line.find(' ');
+        if (sp == string::npos) {
+            continue;
+        }
+        SummaryLine sl;
+        sl.frame = atoi(line.c_str()) + frameOffset;
+        size_t pc = line.find('%');
+        sl.stats = line.substr(sp, (pc == string::npos) ? string::npos : pc - sp);
+        sl.stats.erase(sl.stats.find_last_not_of(' ') + 1);
+        if (pc != string::npos) {
+            istringstream lists(line.substr(pc));
+            string tok;
+            int mode = 0;
+            while (lists >> tok) {
+                if (tok == "%") {
+                    mode = 1;
+                } else if (tok == "%%") {
+                    mode = 2;
+                } else if (tok == "%%%") {
+                    mode = 3;
+                } else if (mode == 1) {
+                    sl.events += " " + tok;
+                } else if (mode == 2) {
+                    int ido = atoi(tok.c_str());
+                    int idf = (lists >> tok) ? atoi(tok.c_str()) : 0;
+                    sl.fates.push_back(make_pair(ido, idf));
+                } else if (mode == 3) {
+                    ended[atoi(tok.c_str())] = sl.frame;
+                    lists >> tok; //file and offset are redone when we write the blobs out again
+                }
+            }
+        }
+        if (sl.frame >= firstOwned && sl.frame <= lastOwned) {
+            lines.push_back(sl);
+        }
+    }
+    return true;
+}
+
+//same bookkeeping as Performance::getFileHandle, so the files split where a single tracker would split them
+FILE *MMF_TrackStitcher::nextBlobsFile() {
+    if (outputCount < Performance::MAX_BLOBS_PER_FILE) {
+        outputCount++;
+    } else {
+        if (out != NULL) {
+            fclose(out);
+            out = NULL;
+        }
+        outputCount = 0;
+    }
+    if (out == NULL) {
+        string fname = blobsFileName(directory, prefix, nextFileID++);
+        out = fopen(fname.c_str(), "w");
+        if (out == NULL) {
+            error = "could not open " + fname;
+        }
+    }
+    return out;
+}
+
+//dancers still being tracked when the shard stopped wait to see if the next shard continues them
+bool MMF_TrackStitcher::finishTrack(const Track &t, int lastOwned, vector<Track> &stillTracking) {
+    if (t.last >= lastOwned) {
+        stillTracking.push_back(t);
+        return true;
+    }
+    return writeTrack(t);
+}
+
+bool MMF_TrackStitcher::writeTrack(const Track &t) {
+    FILE *f = nextBlobsFile();
+    if (f == NULL) {
+        return false;
+    }
+    long offset = ftell(f);
+    fprintf(f, "%% %d\n", t.id);
+    for (size_t k = 0; k < t.lines.size(); ++k) {
+        fputs(t.lines[k].c_str(), f);
+        fputc('\n', f);
+    }
+    OutputFate of;
+    of.frame = t.ended;
+    of.id = t.id;
+    of.fileID = nextFileID - 1;
+    of.offset = offset;
+    outputFates.push_back(of);
+    return true;
+}
+
+bool MMF_TrackStitcher::finish() {
+    for (size_t u = 0; u < pending.size(); ++u) {
+        if (!writeTrack(pending[u])) {
+            return false;
+        }
+    }
+    pending.clear();
+    if (out != NULL) {
+        fclose(out);
+        out = NULL;
+    }
+
+    string fname = summaryFileName(directory, prefix);
+    FILE *f = fopen(fname.c_str(), "w");
+    if (f == NULL) {
+        error = "could not open " + fname;
+        return false;
+    }
+    stable_sort(outputFates.begin(), outputFates.end(), frameOrder);
+    size_t of = 0;
+    for (size_t k = 0; k < summary.size(); ++k) {
+        SummaryLine &sl = summary[k];
+        while (of < outputFates.size() && outputFates[of].frame < sl.frame) {
+            ++of;
+        }
+        size_t ofEnd = of;
+        while (ofEnd < outputFates.size() && outputFates[ofEnd].frame == sl.frame) {
+            ++ofEnd;
+        }
+        bool more = !sl.events.empty() || !sl.fates.empty() || ofEnd > of;
+        fprintf(f, "%d%s%c", sl.frame, sl.stats.c_str(), more ? ' ' : '\n');
+        if (!sl.events.empty()) {
+            fprintf(f, "%%%s", sl.events.c_str());
+        }
+        if (!sl.fates.empty()) {
+            fprintf(f, " %%%%");
+            for (size_t j = 0; j < sl.fates.size(); ++j) {
+                fprintf(f, " %d %d", sl.fates[j].first, sl.fates[j].second);
+            }
+        }
+        if (ofEnd > of) {
+            fprintf(f, " %%%%%%");
+            for (; of < ofEnd; ++of) {
+                fprintf(f, " %d %d.%ld", outputFates[of].id, outputFates[of].fileID, outputFates[of].offset);
+            }
+        }
+        if (more) {
+            fprintf(f, "\n");
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+MMF_TrackStitcher::MMF_TrackStitcher(const MMF_TrackStitcher& orig) {
+}
+
+#ifdef UNIT_TEST_OWNER
+#include <cstring>
+#include "MWT_Model.h"
+
+//settings for every tracker in the test below; phase is where in the movie the tracker starts
+static int test_shard_setup(TrackerLibrary &a_library, int h, const char *prefix, int phase) {
+    int W = 1 << 10;
+    int i;
+    a_library.setCombineBlobs(h, true);
+    i = a_library.setImageInfo(h, 10, 512, 512); if (i != h) return 1;
+    i = a_library.setDate(h, 2007, 12, 30, 10, 50, 33); if (i != h) return 2;
+    i = a_library.setOutput(h, ".", prefix, true, false, false); if (i != h) return 3;
+    i = a_library.setDancerBorderSize(h, 10); if (i != h) return 4;
+    i = a_library.setRefIntensityThreshold(h, 1, W/2); if (i != h) return 5;
+    i = a_library.setObjectIntensityThresholds(h, W - W/20, W - W/8); if (i != h) return 6;
+    i = a_library.setObjectSizeThresholds(h, 30, 50, 10000, 15000); if (i != h) return 7;
+    i = a_library.setObjectPersistenceThreshold(h, 8); if (i != h) return 8;
+    i = a_library.setAdaptationRate(h, 4); if (i != h) return 9;
+    i = a_library.enableOutlining(h, true); if (i != h) return 10;
+    i = a_library.enableSkeletonization(h, true); if (i != h) return 11;
+    i = a_library.beginOutput(h); if (i != h) return 12;
+    i = a_library.setUpdateBandNumber(h, 12); if (i != h) return 13;
+    i = a_library.setUpdateBandPhase(h, phase); if (i != h) return 14;
+    return 0;
+}
+
+//tracks frames [first, end) the way trackFrames does, from an empty background; returns 0 or an error code
+static int test_shard_track(Image **frames, Image &background, int first, int end, const char *prefix, string &directory) {
+    TrackerLibrary a_library;
+    int h = a_library.getNewHandle();
+    int i = test_shard_setup(a_library, h, prefix, first); if (i != 0) return i;
+    a_library.scanObjects(h, background);
+    for (int j = first; j < end; ++j) {
+        i = a_library.loadImage(h, *frames[j], 0.4*j); if (i != h) return 20;
+        a_library.processImage(h);
+    }
+    directory = a_library.all_trackers[h]->performance.base_directory;
+    i = a_library.complete(h); if (i != h) return 21;
+    return 0;
+}
+
+//the dancers of a .blobs file, as ID, then first frame, last frame and number of blobs, and every blob's centroid
+static bool test_shard_read(const string &fname, vector<int> &tracks, vector<float> &centroids) {
+    ifstream is(fname.c_str());
+    if (!is.good()) {
+        return false;
+    }
+    string line;
+    while (getline(is, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '%') {
+            tracks.push_back(atoi(line.c_str() + 1));
+            tracks.push_back(-1);
+            tracks.push_back(-1);
+            tracks.push_back(0);
+            continue;
+        }
+        float x, y;
+        if (tracks.empty() || sscanf(line.c_str(), "%*d %*f %f %f", &x, &y) != 2) {
+            return false;
+        }
+        int frame = atoi(line.c_str());
+        int n = tracks.size();
+        if (tracks[n - 3] < 0) {
+            tracks[n - 3] = frame;
+        }
+        tracks[n - 2] = frame;
+        tracks[n - 1]++;
+        centroids.push_back(x);
+        centroids.push_back(y);
+    }
+    return true;
+}
+
+//summary lines without the statistics that depend on how long each tracker has been running (e.g. persistence):
+//frame, time, the number of dancers and of those that have persisted, and the origin/fate and output lists
+static bool test_shard_summary(const string &fname, vector<string> &lines) {
+    ifstream is(fname.c_str());
+    if (!is.good()) {
+        return false;
+    }
+    string line;
+    while (getline(is, line)) {
+        istringstream ss(line);
+        string frame, time, n, np;
+        ss >> frame >> time >> n >> np;
+        size_t pc = line.find('%');
+        lines.push_back(frame + " " + time + " " + n + " " + np + ((pc == string::npos) ? string() : line.substr(pc)));
+    }
+    return true;
+}
+
+//track a movie straight through, then again in three overlapping shards and stitch them; the dancers must come out the same,
+//including one that turns up just before a boundary and one that leaves just after it
+int test_mmf_trackstitcher_shards() {
+    const int N = 90;
+    const int B1 = 30;
+    const int B2 = 60;
+    const int OVERLAP = 20;
+    int W = 1 << 10;
+    int i, j;
+    Image *frames[N];
+
+    ModelWorm worm1, worm2, worm3;
+    worm1.setPose(128 + FPoint(60, 40), FPoint(1, 0), 0);
+    worm1.setSize(40, 2.5);
+    worm1.setWiggle(4.0, 30, 0.7, -0.02);
+    worm2.setPose(128 + FPoint(150, 30), FPoint(-1, 0), 0);
+    worm2.setSize(45, 3.0);
+    worm2.setWiggle(4.5, 32, 0.68, 0.02);
+    worm3.setPose(128 + FPoint(125, 230), FPoint(0, 1), 0);
+    worm3.setSize(50, 3.0);
+    worm3.setWiggle(5.0, 35, 0.72, 0.01);
+
+    Mask m(128);
+    Image arena(Point(512, 512), false);
+    arena.depth = 10;
+    arena = (3*W)/4;
+    Image background(arena, arena.getBounds(), false);
+    for (j = 0; j < N; j++) {
+        arena = (3*W)/4;
+        worm1.imprint(arena, m, 0.4, 2);
+        if (j < B1 + 3) worm2.imprint(arena, m, 0.4, 2);
+        if (j >= B2 - 4) worm3.imprint(arena, m, 0.4, 2);
+        frames[j] = new Image(arena, arena.getBounds(), false);
+        worm1.wiggle(0.3);
+        worm2.wiggle(0.3);
+        worm3.wiggle(0.3);
+    }
+
+    string directory;
+    i = test_shard_track(frames, background, 0, N, "serial", directory); if (i != 0) return 100 + i;
+    i = test_shard_track(frames, background, 0, B1, "shard0", directory); if (i != 0) return 200 + i;
+    i = test_shard_track(frames, background, B1 - OVERLAP, B2, "shard1", directory); if (i != 0) return 300 + i;
+    i = test_shard_track(frames, background, B2 - OVERLAP, N, "shard2", directory); if (i != 0) return 400 + i;
+    for (j = 0; j < N; j++) delete frames[j];
+
+    MMF_TrackStitcher stitcher(directory, "stitched");
+    if (!stitcher.addShard("shard0", 0, 1, B1)) return 1;
+    if (!stitcher.addShard("shard1", B1 - OVERLAP, B1 + 1, B2)) return 2;
+    if (!stitcher.addShard("shard2", B2 - OVERLAP, B2 + 1, N)) return 3;
+    if (!stitcher.finish()) return 4;
+    if (stitcher.getNumStitched() < 2 || stitcher.getNumUnmatched() != 0) return 5;
+    stitcher.removeShardFiles("shard0");
+    stitcher.removeShardFiles("shard1");
+    stitcher.removeShardFiles("shard2");
+
+    vector<int> serialTracks, stitchedTracks;
+    vector<float> serialCentroids, stitchedCentroids;
+    if (!test_shard_read(MMF_TrackStitcher::blobsFileName(directory, "serial", 0), serialTracks, serialCentroids)) return 6;
+    if (!test_shard_read(MMF_TrackStitcher::blobsFileName(directory, "stitched", 0), stitchedTracks, stitchedCentroids)) return 7;
+    if (serialTracks.size() < 4*4) return 8;
+    if (serialTracks != stitchedTracks) return 9;
+    //the shards' backgrounds have only had OVERLAP frames to adapt, so the centroids may be a little off
+    for (size_t k = 0; k < serialCentroids.size(); ++k) {
+        if (fabs(serialCentroids[k] - stitchedCentroids[k]) > 0.5) return 10;
+    }
+
+    vector<string> serialSummary, stitchedSummary;
+    if (!test_shard_summary(MMF_TrackStitcher::summaryFileName(directory, "serial"), serialSummary)) return 11;
+    if (!test_shard_summary(MMF_TrackStitcher::summaryFileName(directory, "stitched"), stitchedSummary)) return 12;
+    if (serialSummary.size() != (size_t) N) return 13;
+    if (serialSummary != stitchedSummary) return 14;
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int i = test_mmf_trackstitcher_shards();
+    if (argc <= 1 || strcmp(argv[1], "-quiet") || i) printf("MMF_TrackStitcher test result is %d\n", i);
+    return i > 0;
+}
+#endif
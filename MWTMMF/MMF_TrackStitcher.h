@@ -0,0 +1,135 @@
+/*
+ * File:   MMF_TrackStitcher.h
+ *
+ * (C) Marc Gershow; licensed under the Creative Commons Attribution Share Alike 3.0 United States License.
+ * To view a copy of this license, visit http://creativecommons.org/licenses/by-sa/3.0/us/ or send a letter to
+ * Creative Commons, 171 Second Street, Suite 300, San Francisco, California, 94105, USA.
+ */
+
+#ifndef MMF_TRACKSTITCHER_H
+#define	MMF_TRACKSTITCHER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+
+/* MMF_TrackStitcher joins the output of several trackers that each ran over one
+ * chunk of the same movie into a single .summary and set of .blobs files,
+ * numbered as if one tracker had run over the whole movie
+ *
+ * each chunk (shard) may start some frames before the part it is responsible for
+ * (its "owned" frames), so that its background has adapted and it has found the dancers
+ * by then; everything a shard saw before its first owned frame is discarded
+ * a shard's tracker starts from a fresh background, not from the last shard's, and should
+ * be told where in the movie it starts (TrackerLibrary::setUpdateBandPhase) so that it
+ * looks for new dancers in the same frames as the last shard did
+ *
+ * a dancer the previous shard was still tracking when it stopped is continued by the
+ * dancer of this shard whose blob in the frame before the boundary is closest to its
+ * last blob; the continuation keeps the old ID (and its head stays at the same end)
+ * the two blobs were cut out against different backgrounds, so they need not have the
+ * same outline; they match if they are within matchDistance pixels plus however far the
+ * dancer moved in the frame before.  dancers left over on either side are recorded
+ * as lost / found at the boundary
+ * all other dancers from a shard get the next unused IDs in the order they were created, and the
+ * origin/fate lists in the summary are rewritten to match
+ *
+ * shards must be added in order; output is written to directory/prefix as it goes,
+ * and the summary is written by finish()
+ */
+class MMF_TrackStitcher {
+public:
+    MMF_TrackStitcher(const std::string &directory, const std::string &prefix, double matchDistance = 1.0);
+    virtual ~MMF_TrackStitcher();
+
+    /* bool addShard(const std::string &shardPrefix, int frameOffset, int firstOwned, int lastOwned);
+     * reads directory/shardPrefix.summary and directory/shardPrefix_NNNNNk.blobs
+     * frameOffset is added to the shard's frame numbers to get frame numbers of the whole run;
+     * firstOwned and lastOwned are the (whole run) frames the shard is responsible for
+     * returns false (see getError()) if the shard's output could not be read or the output could not be written
+     */
+    bool addShard(const std::string &shardPrefix, int frameOffset, int firstOwned, int lastOwned);
+
+    /* bool finish();
+     * writes out dancers still being tracked at the end and then the summary
+     */
+    bool finish();
+
+    /* void removeShardFiles(const std::string &shardPrefix);
+     * deletes a shard's .summary and .blobs files
+     */
+    void removeShardFiles(const std::string &shardPrefix) const;
+
+    const std::string &getError() const { return error; }
+    int getNumStitched() const { return nStitched; }
+    int getNumUnmatched() const { return nUnmatched; }
+
+    static std::string blobsFileName(const std::string &directory, const std::string &prefix, int fileID);
+    static std::string summaryFileName(const std::string &directory, const std::string &prefix);
+
+protected:
+    struct Track {
+        int id;
+        int first;
+        int last;
+        int ended;  // frame the dancer was written out in
+        std::vector<std::string> lines; // blob lines, already renumbered
+    };
+    struct TrackInfo {
+        int id;
+        int first;
+        int last;
+        bool atBoundary;  // has a blob in the frame before the boundary
+        float x;
+        float y;
+        float mx;
+        float my;
+    };
+    struct SummaryLine {
+        int frame;
+        std::string stats;   // everything after the frame number and before any lists
+        std::string events;  // event list, if any, as printed
+        std::vector<std::pair<int, int> > fates;
+    };
+    struct OutputFate {
+        int frame;
+        int id;
+        int fileID;
+        long offset;
+    };
+
+    std::string directory;
+    std::string prefix;
+    double matchDistance;
+    std::string error;
+
+    std::vector<SummaryLine> summary;
+    std::vector<Track> pending;   // dancers the last shard was still tracking when it stopped
+    int maxID;
+    int nStitched;
+    int nUnmatched;
+
+    FILE *out;
+    int outputCount;
+    int nextFileID;
+    std::vector<OutputFate> outputFates;
+
+    bool scanShard(const std::string &shardPrefix, int frameOffset, int boundary, std::vector<TrackInfo> &info);
+    bool readSummary(const std::string &shardPrefix, int frameOffset, int firstOwned, int lastOwned, std::vector<SummaryLine> &lines, std::map<int, int> &ended);
+    FILE *nextBlobsFile();
+    bool writeTrack(const Track &t);
+    bool finishTrack(const Track &t, int lastOwned, std::vector<Track> &stillTracking);
+    static bool frameOrder(const OutputFate &a, const OutputFate &b) { return a.frame < b.frame; }
+
+    // reading and rewriting single lines of .blobs files
+    static bool centroidOf(const std::string &line, float &x, float &y);
+    static bool majorAxisOf(const std::string &line, float &x, float &y);
+    static std::string renumberBlobLine(const std::string &line, int frame);
+    static std::string flipBlobLine(const std::string &line);
+
+private:
+    MMF_TrackStitcher(const MMF_TrackStitcher& orig);
+};
+
+#endif	/* MMF_TRACKSTITCHER_H */
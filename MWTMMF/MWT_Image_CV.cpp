@@ -11,6 +11,15 @@
 #include <iostream>
 #include "MWT_Image_CV.h"
 #include "cv.h"
+#include <pthread.h>
+//the AVX2 loops are built with GCC's target pragma and picked at run time, so -mavx2 is not needed
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=9)) && \
+    (defined(__x86_64__) || defined(__i386__)) && !defined(MWT_NO_SIMD)
+#define MWT_CV_AVX2_KERNELS
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace std;
 //note that because MWT_Image stores data is column ordered format & IplImage stores data
 //in row order, the IplImage header represents the transpose of the MWT Image
@@ -65,8 +74,8 @@ IplImage *MWT_Image_CV::MWTImagetoIplImage(const Image& src, IplImage** dst) {
     return dstim;
 }
 
-IplImage *MWT_Image_CV::MWTImagetoIplImage8U(const Image &src, IplImage **dst, bool scaleToRange) {
-    IplImage *temp = MWTImagetoIplImage(src, NULL);
+IplImage *MWT_Image_CV::MWTImagetoIplImage8U(const Image &src, IplImage **dst, bool scaleToRange, IplImage **keepTemp) {
+    IplImage *temp = MWTImagetoIplImage(src, keepTemp);
     IplImage *dstim;
 
     if (dst != NULL && *dst != NULL){
@@ -93,28 +102,36 @@ IplImage *MWT_Image_CV::MWTImagetoIplImage8U(const Image &src, IplImage **dst, b
     }
     cvConvertScale(temp, dstim, scale, shift);
 
-    cvReleaseImage(&temp);
+    if (keepTemp == NULL) {
+        cvReleaseImage(&temp);
+    }
     if (dst != NULL) {
         *dst = dstim;
     }
     return dstim;
 }
 
-IplImage *MWT_Image_CV::toIplImage8U(IplImage** dst, bool scaleToRange) const {
-    return MWTImagetoIplImage8U(*this, dst, scaleToRange);
+IplImage *MWT_Image_CV::toIplImage8U(IplImage** dst, bool scaleToRange, IplImage **temp) const {
+    return MWTImagetoIplImage8U(*this, dst, scaleToRange, temp);
 }
 
 void MWT_Image_CV::setImageDataFromIplImage(const IplImage* src) {
     if (src == NULL) {
         return;
     }
-    if (size != sizeOfIplImageOrROI(src)) {
+    //borrowed pixels may be laid out any which way, so they are swapped for our own
+    if (size != sizeOfIplImageOrROI(src) || !owns_pixels) {
         if (owns_pixels) {
             delete[] pixels;
         }
         size = sizeOfIplImageOrROI(src);
         bounds = Rectangle(Point(0,0),size-1);
         pixels = new short[ bounds.area() ];
+        owns_pixels = true;
+    }
+    stride = Point(size.y,1);  //cvTranspose below writes column-major, whatever stride was left over
+    if (widenTransposeFromIplImage(src)) {
+        return;
     }
     IplImage *temp = NULL;
     if (src->depth != IPL_DEPTH_16S) {
@@ -133,6 +150,233 @@ void MWT_Image_CV::setImageDataFromIplImage(const IplImage* src) {
 
 }
 
+//converts one source pixel the way cvConvert to 16S would (16U saturates at 32767)
+template <class T> static inline short widenPixel(T p) { return (short) p; }
+template <> inline short widenPixel<unsigned short>(unsigned short p) { return (short) (p > 32767 ? 32767 : p); }
+
+//scalar copy of the w x h block at (x0,y0), pixel (x,y) going to dst[x*dstStride.x + y*dstStride.y];
+//used for ragged edges, for images that are not column-major, and when no SIMD is available
+template <class T>
+static void widenTransposeScalar(const char *src, int srcStep, short *dst, Point dstStride, int x0, int y0, int w, int h) {
+    for (int y = y0; y < y0 + h; y++) {
+        const T *row = (const T *) (src + y*srcStep);
+        short *col = dst + y*dstStride.y;
+        for (int x = x0; x < x0 + w; x++) {
+            col[x*dstStride.x] = widenPixel<T>(row[x]);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+//8x8 transpose of shorts: on entry r[k] is source row k, on exit r[k] is source column k
+//with 256 bit registers the same sequence transposes the low and high 128 bit lanes independently
+#define MWT_TRANSPOSE_8x8_16(r, UNPACKLO16, UNPACKHI16, UNPACKLO32, UNPACKHI32, UNPACKLO64, UNPACKHI64, T) { \
+    T t0 = UNPACKLO16(r[0], r[1]), t1 = UNPACKHI16(r[0], r[1]); \
+    T t2 = UNPACKLO16(r[2], r[3]), t3 = UNPACKHI16(r[2], r[3]); \
+    T t4 = UNPACKLO16(r[4], r[5]), t5 = UNPACKHI16(r[4], r[5]); \
+    T t6 = UNPACKLO16(r[6], r[7]), t7 = UNPACKHI16(r[6], r[7]); \
+    T u0 = UNPACKLO32(t0, t2), u1 = UNPACKHI32(t0, t2); \
+    T u2 = UNPACKLO32(t1, t3), u3 = UNPACKHI32(t1, t3); \
+    T u4 = UNPACKLO32(t4, t6), u5 = UNPACKHI32(t4, t6); \
+    T u6 = UNPACKLO32(t5, t7), u7 = UNPACKHI32(t5, t7); \
+    r[0] = UNPACKLO64(u0, u4); r[1] = UNPACKHI64(u0, u4); \
+    r[2] = UNPACKLO64(u1, u5); r[3] = UNPACKHI64(u1, u5); \
+    r[4] = UNPACKLO64(u2, u6); r[5] = UNPACKHI64(u2, u6); \
+    r[6] = UNPACKLO64(u3, u7); r[7] = UNPACKHI64(u3, u7); \
+}
+
+template <class T> static inline __m128i widenLoad8(const T *p);
+template <> inline __m128i widenLoad8<unsigned char>(const unsigned char *p) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p), _mm_setzero_si128());
+}
+template <> inline __m128i widenLoad8<short>(const short *p) {
+    return _mm_loadu_si128((const __m128i *) p);
+}
+template <> inline __m128i widenLoad8<unsigned short>(const unsigned short *p) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    return _mm_subs_epu16(v, _mm_subs_epu16(v, _mm_set1_epi16(32767))); // min(v,32767) without SSE4.1
+}
+
+template <class T>
+static inline void widenTranspose8x8(const char *src, int srcStep, short *dst, int dstStride, int x, int y) {
+    __m128i r[8];
+    for (int k = 0; k < 8; k++) {
+        r[k] = widenLoad8<T>((const T *) (src + (y + k)*srcStep) + x);
+    }
+    MWT_TRANSPOSE_8x8_16(r, _mm_unpacklo_epi16, _mm_unpackhi_epi16, _mm_unpacklo_epi32, _mm_unpackhi_epi32,
+            _mm_unpacklo_epi64, _mm_unpackhi_epi64, __m128i);
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_si128((__m128i *) (dst + (x + k)*dstStride + y), r[k]);
+    }
+}
+#endif
+
+//transposes 16 columns at a time, from x up to at most xend, over rows [y0,y1) (a multiple of 8 of them);
+//returns the first column it left for the narrower loops
+typedef int (*WidenColumns16)(const char *src, int srcStep, short *dst, int dstStride, int x, int xend, int y0, int y1);
+
+#ifdef MWT_CV_AVX2_KERNELS
+//compiled for AVX2 whatever the build flags say; only ever called once CPUID has said the cpu has it
+#pragma GCC push_options
+#pragma GCC target("avx2")
+template <class T> static inline __m256i widenLoad16(const T *p);
+template <> inline __m256i widenLoad16<unsigned char>(const unsigned char *p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) p));
+}
+template <> inline __m256i widenLoad16<short>(const short *p) {
+    return _mm256_loadu_si256((const __m256i *) p);
+}
+template <> inline __m256i widenLoad16<unsigned short>(const unsigned short *p) {
+    return _mm256_min_epu16(_mm256_loadu_si256((const __m256i *) p), _mm256_set1_epi16(32767));
+}
+
+//8 source rows by 16 source columns: the low lanes hold columns x..x+7 and the high lanes x+8..x+15
+template <class T>
+static inline void widenTranspose16x8(const char *src, int srcStep, short *dst, int dstStride, int x, int y) {
+    __m256i r[8];
+    for (int k = 0; k < 8; k++) {
+        r[k] = widenLoad16<T>((const T *) (src + (y + k)*srcStep) + x);
+    }
+    MWT_TRANSPOSE_8x8_16(r, _mm256_unpacklo_epi16, _mm256_unpackhi_epi16, _mm256_unpacklo_epi32, _mm256_unpackhi_epi32,
+            _mm256_unpacklo_epi64, _mm256_unpackhi_epi64, __m256i);
+    for (int k = 0; k < 8; k++) {
+        _mm_storeu_si128((__m128i *) (dst + (x + k)*dstStride + y), _mm256_castsi256_si128(r[k]));
+        _mm_storeu_si128((__m128i *) (dst + (x + k + 8)*dstStride + y), _mm256_extracti128_si256(r[k], 1));
+    }
+}
+
+template <class T>
+static int widenColumns16Avx2(const char *src, int srcStep, short *dst, int dstStride, int x, int xend, int y0, int y1) {
+    for (; x + 16 <= xend; x += 16) {
+        for (int y = y0; y < y1; y += 8) {
+            widenTranspose16x8<T>(src, srcStep, dst, dstStride, x, y);
+        }
+    }
+    return x;
+}
+#pragma GCC pop_options
+#endif
+
+//the 16 column loops for each source type, or NULL where the cpu (or compiler) has none
+struct WidenKernels {
+    WidenColumns16 u8, u16, s16;
+};
+static WidenKernels widen_kernels = { NULL, NULL, NULL };
+static pthread_once_t widen_kernels_once = PTHREAD_ONCE_INIT;
+
+static void pickWidenKernels() {
+#ifdef MWT_CV_AVX2_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        widen_kernels.u8 = widenColumns16Avx2<unsigned char>;
+        widen_kernels.u16 = widenColumns16Avx2<unsigned short>;
+        widen_kernels.s16 = widenColumns16Avx2<short>;
+    }
+#endif
+}
+
+//the kernels in use, picked once however many threads ask at the same time
+static inline const WidenKernels& currentWidenKernels() {
+    pthread_once(&widen_kernels_once, pickWidenKernels);
+    return widen_kernels;
+}
+
+/* walks the image in TILE x TILE tiles so that the rows being read and the columns being
+ * written both stay in cache; inside a tile the SIMD kernels do 16 (with wide) or 8 columns at a time
+ * dst must be column-major, one column every dstStride shorts
+ */
+template <class T>
+static void widenTranspose(const char *src, int srcStep, short *dst, int dstStride, int w, int h, WidenColumns16 wide) {
+    const int TILE = 64;
+    const Point colStride(dstStride, 1);
+    for (int ty = 0; ty < h; ty += TILE) {
+        int th = (h - ty < TILE) ? h - ty : TILE;
+        int th8 = th & ~7;
+        for (int tx = 0; tx < w; tx += TILE) {
+            int tw = (w - tx < TILE) ? w - tx : TILE;
+            int x = tx;
+            if (wide != NULL && th8 > 0) {
+                x = wide(src, srcStep, dst, dstStride, x, tx + tw, ty, ty + th8);
+            }
+#if defined(__SSE2__)
+            for (; x + 8 <= tx + tw; x += 8) {
+                for (int y = ty; y < ty + th8; y += 8) {
+                    widenTranspose8x8<T>(src, srcStep, dst, dstStride, x, y);
+                }
+            }
+#else
+            th8 = 0;
+#endif
+            if (x < tx + tw) {
+                widenTransposeScalar<T>(src, srcStep, dst, colStride, x, ty, tx + tw - x, th);
+            }
+            if (th8 < th) {
+                widenTransposeScalar<T>(src, srcStep, dst, colStride, tx, ty + th8, x - tx, th - th8);
+            }
+        }
+    }
+}
+
+//column-major destinations get the tiled SIMD transpose, anything else is copied pixel by pixel
+template <class T>
+static void widenInto(const char *src, int srcStep, short *dst, Point dstStride, int w, int h, WidenColumns16 wide) {
+    if (dstStride.y == 1) {
+        widenTranspose<T>(src, srcStep, dst, dstStride.x, w, h, wide);
+    } else {
+        widenTransposeScalar<T>(src, srcStep, dst, dstStride, 0, 0, w, h);
+    }
+}
+
+bool MWT_Image_CV::widenTransposeFromIplImage(const IplImage* src) {
+    if (src == NULL || pixels == NULL) {
+        return false;
+    }
+    CvRect roi = cvGetImageROI(src);
+    int w = min(roi.width, size.x);
+    int h = min(roi.height, size.y);
+    return widenTransposeInto(src, w, h, pixels, stride);
+}
+
+bool MWT_Image_CV::setRegionFromIplImage(const IplImage* src, int x, int y) {
+    //patches are never meant to hang off the top or left, so rather than clip them say no
+    if (src == NULL || pixels == NULL || x < bounds.near.x || y < bounds.near.y) {
+        return false;
+    }
+    CvRect roi = cvGetImageROI(src);
+    int w = min(roi.width, bounds.far.x + 1 - x);
+    int h = min(roi.height, bounds.far.y + 1 - y);
+    if (w <= 0 || h <= 0) {
+        return src->nChannels == 1;
+    }
+    return widenTransposeInto(src, w, h, pixels + (x - bounds.near.x)*stride.x + (y - bounds.near.y)*stride.y, stride);
+}
+
+//the first w x h pixels of src's roi go to dst, pixel (x,y) landing at dst[x*dstStride.x + y*dstStride.y]
+bool MWT_Image_CV::widenTransposeInto(const IplImage* src, int w, int h, short* dst, Point dstStride) {
+    if (src->nChannels != 1) {
+        return false;
+    }
+    const WidenKernels &k = currentWidenKernels();
+    CvRect roi = cvGetImageROI(src);
+    const char *row0;
+    switch (src->depth) {
+        case IPL_DEPTH_8U:
+            row0 = src->imageData + roi.y*src->widthStep + roi.x;
+            widenInto<unsigned char>(row0, src->widthStep, dst, dstStride, w, h, k.u8);
+            return true;
+        case IPL_DEPTH_16U:
+            row0 = src->imageData + roi.y*src->widthStep + roi.x*sizeof(unsigned short);
+            widenInto<unsigned short>(row0, src->widthStep, dst, dstStride, w, h, k.u16);
+            return true;
+        case IPL_DEPTH_16S:
+            row0 = src->imageData + roi.y*src->widthStep + roi.x*sizeof(short);
+            widenInto<short>(row0, src->widthStep, dst, dstStride, w, h, k.s16);
+            return true;
+        default:
+            return false;
+    }
+}
+
 void MWT_Image_CV::setBitDepthFromIplImage(const IplImage* src) {
     if (src == NULL) {
         return;
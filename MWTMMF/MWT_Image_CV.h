@@ -82,36 +82,60 @@ public:
     static IplImage *MWTImagetoIplImage(const Image &src, IplImage **dst = NULL);
     IplImage *toIplImage(IplImage **dst = NULL) const;
 
-    /*  IplImage *toIplImage8U(IplImage **dst = NULL, bool scaleToRange = false) const;
-     *  static IplImage *MWTImagetoIplImage8U(const Image &src, IplImage **dst = NULL, bool scaleToRange = false);
+    /*  IplImage *toIplImage8U(IplImage **dst = NULL, bool scaleToRange = false, IplImage **temp = NULL) const;
+     *  static IplImage *MWTImagetoIplImage8U(const Image &src, IplImage **dst = NULL, bool scaleToRange = false, IplImage **temp = NULL);
      *
      *  convert an MWT image to an 8-bit IPL image;
      *    if scaleToRange is true,
      *       the smallest value in src becomes 0 in dst and the largest becomes 255
      *    if scaleToRange is false,
      *       dstvalue = srcvalue << (src.depth - 8) - 128
-     *     
+     *
+     *  the conversion goes through a 16S image; if temp is given, that image is kept in *temp
+     *  (reused the same way as dst), so converting every frame doesn't allocate one each time
      */
-    IplImage *toIplImage8U(IplImage **dst = NULL, bool scaleToRange = false) const;
-    static IplImage *MWTImagetoIplImage8U(const Image &src, IplImage **dst = NULL, bool scaleToRange = false);
+    IplImage *toIplImage8U(IplImage **dst = NULL, bool scaleToRange = false, IplImage **temp = NULL) const;
+    static IplImage *MWTImagetoIplImage8U(const Image &src, IplImage **dst = NULL, bool scaleToRange = false, IplImage **temp = NULL);
 
     virtual ~MWT_Image_CV();
     MWT_Image_CV();
 
     /* void setImageDataFromIplImage (const IplImage *src);
      * sets data to a copy of src,
-     * if src is a different size from this image,
+     * if src is a different size from this image, or pixels are borrowed,
      * we delete pixels (if this image owns_pixels), then create new
-     * memory of the appropriate size
+     * memory of the appropriate size; either way the image ends up column-major
      *
      * if src->roi is not NULL, only the area within src->roi is copied
      *
+     * single channel 8U, 16U and 16S images are widened and transposed straight into pixels
+     * (see widenTransposeFromIplImage), so there is no need to cvConvert them to 16S first;
+     * other depths go through a temporary 16S image
+     *
      * we do not adjust image bit depth
      */
     void setImageDataFromIplImage (const IplImage *src);
     void setBitDepthFromIplImage (const IplImage *src);
 
+    /* bool setRegionFromIplImage (const IplImage *src, int x, int y);
+     * copies src (or its roi) into this image with its top left corner at column x, row y
+     * of the IplImage this image came from, leaving every other pixel alone;
+     * whatever falls past the far edge of bounds is cut off, and (x,y) must not lie before bounds.near
+     * returns false, without touching pixels, if src is not a single channel 8U, 16U or 16S image
+     */
+    bool setRegionFromIplImage (const IplImage *src, int x, int y);
+
 protected:
+    /* bool widenTransposeFromIplImage (const IplImage *src);
+     * copies src (or its roi) into bounds, converting to short and transposing in one pass;
+     * 16U values above 32767 saturate, as cvConvert would
+     * pixels are written through stride; column-major images go in cache-sized tiles with SSE2
+     * or, when the cpu has it, AVX2 inner loops (chosen once at run time, no -mavx2 needed),
+     * and plain loops for the edges, other layouts, or when neither is available
+     * returns false, without touching pixels, if src is not a single channel 8U, 16U or 16S image
+     */
+    bool widenTransposeFromIplImage (const IplImage *src);
+    static bool widenTransposeInto (const IplImage *src, int w, int h, short *dst, Point dstStride);
     static IplImage *createImageHeaderForMWTImage(const Image &im); //note that image is transposed 
     static Rectangle cvRectangleToMWTRectangle (const CvRect& cvr);
     static CvRect mwtRectangleToCvRectangle (const Rectangle& r);
@@ -13,6 +13,8 @@
 #include "MWT_Image_CV.h"
 #include "MWT_Library.h"
 #include "MMF_MWT_Processor.h"
+#include "MMF_BatchRunner.h"
+#include "MMF_Benchmark.h"
 
 #include "StackReader.h"
 #include "highgui.h"
@@ -38,6 +40,8 @@ int testMMF_MWT_Processor (void);
 void properUsage (const char *argv);
 int parseArguments (int argc, char **argv, ParamsT &p) ;
 int runProgram (int argc, char **argv);
+int runBatch (int argc, char **argv);
+int runBenchmark (int argc, char **argv);
 void badargs (ParamsT &p, int argc, char **argv);
 
 #define defaultSettingsFile "defaultMWTSettings.txt"
@@ -53,6 +57,12 @@ int main(int argc, char** argv) {
 int runProgram (int argc, char **argv) {
     ParamsT p;
     int rv;
+    if (argc > 1 && string(argv[1]) == "--batch") {
+        return runBatch(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "--benchmark") {
+        return runBenchmark(argc, argv);
+    }
     if ((rv = parseArguments(argc, argv, p)) || !p.valid) {
         return rv;
     }
@@ -82,6 +92,128 @@ int runProgram (int argc, char **argv) {
     }
     return rv;
 }
+// mmf2mwt --batch settingsFile.txt [--workers n] [--memory MB] [--report report.txt] [--manifest list.txt] [a.mmf b.mmf ...]
+int runBatch (int argc, char **argv) {
+    if (argc < 3) {
+        properUsage(programName);
+        return 1;
+    }
+    MMF_MWT_Processor mp;
+    ifstream ifs(argv[2]);
+    if (!ifs.good()) {
+        cout << "batch file not found: " << argv[2] << endl;
+        return 1;
+    }
+    ifs >> mp;
+
+    int workers = 0;
+    double memory = 0;
+    string reportname;
+    vector<string> manifests;
+    vector<string> files;
+    for (int j = 3; j < argc; ++j) {
+        string arg(argv[j]);
+        bool hasValue = (j + 1 < argc);
+        if (arg == "--workers" && hasValue) {
+            workers = atoi(argv[++j]);
+        } else if (arg == "--memory" && hasValue) {
+            memory = atof(argv[++j]);
+        } else if (arg == "--report" && hasValue) {
+            reportname = argv[++j];
+        } else if (arg == "--manifest" && hasValue) {
+            manifests.push_back(argv[++j]);
+        } else if (arg.compare(0, 2, "--") == 0) {
+            cout << "unknown or incomplete option: " << arg << endl;
+            properUsage(programName);
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    MMF_BatchRunner runner(mp, workers, memory);
+    for (size_t j = 0; j < manifests.size(); ++j) {
+        if (runner.addManifest(manifests[j].c_str()) < 0) {
+            cout << "manifest not found: " << manifests[j] << endl;
+            return 1;
+        }
+    }
+    for (size_t j = 0; j < files.size(); ++j) {
+        runner.addFile(files[j]);
+    }
+    if (runner.getJobs().empty()) {
+        cout << "no mmfs to process" << endl;
+        return 1;
+    }
+
+    int nfailed = runner.run(cout);
+    if (reportname.empty()) {
+        runner.writeReport(cout);
+    } else {
+        ofstream os(reportname.c_str());
+        runner.writeReport(os);
+    }
+    cout << runner.getJobs().size() - nfailed << " of " << runner.getJobs().size() << " files processed successfully" << endl;
+    return nfailed;
+}
+// mmf2mwt --benchmark settingsFile.txt a.mmf [--frames first last] [--json results.json] [--scratch path]
+int runBenchmark (int argc, char **argv) {
+    if (argc < 4) {
+        properUsage(programName);
+        return 1;
+    }
+    MMF_MWT_Processor mp;
+    ifstream ifs(argv[2]);
+    if (!ifs.good()) {
+        cout << "batch file not found: " << argv[2] << endl;
+        return 1;
+    }
+    ifs >> mp;
+    string mmfname(argv[3]);
+
+    string jsonname;
+#ifdef _WIN32
+    string scratch = getenv("TEMP") != NULL ? string(getenv("TEMP")) + "\\" : string(".\\");
+#else
+    string scratch = "/tmp/";
+#endif
+    for (int j = 4; j < argc; ++j) {
+        string arg(argv[j]);
+        if (arg == "--frames" && j + 2 < argc) {
+            mp.startFrame = atoi(argv[++j]);
+            mp.endFrame = atoi(argv[++j]);
+        } else if (arg == "--json" && j + 1 < argc) {
+            jsonname = argv[++j];
+        } else if (arg == "--scratch" && j + 1 < argc) {
+            scratch = argv[++j];
+        } else {
+            cout << "unknown or incomplete option: " << arg << endl;
+            properUsage(programName);
+            return 1;
+        }
+    }
+
+    //nothing but the tracking itself is timed, and nothing is kept
+    MMF_Benchmark benchmark;
+    mp.benchmark = &benchmark;
+    mp.writeLog = false;
+    mp.windowOutputUpdateInterval = -1;
+    mp.checkpointInterval = 0;
+    mp.resumeFromCheckpoint = false;
+    int rv = mp.process(mmfname.c_str(), scratch.c_str(), "mmf2mwt_benchmark");
+    if (rv != 0) {
+        cout << "benchmark failed with return value: " << rv << endl;
+        return rv;
+    }
+    //process() has turned startFrame and endFrame into the range it actually tracked, [startFrame, endFrame)
+    if (jsonname.empty()) {
+        benchmark.writeJson(cout, mmfname, mp.startFrame, mp.endFrame);
+    } else {
+        ofstream os(jsonname.c_str());
+        benchmark.writeJson(os, mmfname, mp.startFrame, mp.endFrame);
+    }
+    return 0;
+}
 void badargs (ParamsT &p, int argc, char **argv) {
     cout << "Your command: ";
     for (int j = 0; j < argc; ++j) {
@@ -150,6 +282,16 @@ void properUsage (const char *argv) {
     cout << argv << " imagestack.mmf settingsFile.txt pathToOutput outputPrefix" << endl << "runs MWT on imagestack.mmf using settings defined in settingsFile.txt" << endl;
     cout << "data is stored in pathToOutput/datestring/outputPrefix.blobs etc." << endl;
     cout << "--------------" << endl;
+    cout << argv << " --batch settingsFile.txt [--workers n] [--memory MB] [--report report.txt] [--manifest list.txt] [a.mmf b.mmf ...]" << endl;
+    cout << "runs MWT on every mmf given and every mmf listed in list.txt (one per line: mmf<tab>outputpath<tab>outputprefix; the last two are optional)," << endl;
+    cout << "using settings defined in settingsFile.txt, up to n files at a time (default: one per core) within MB megabytes (default: half of memory)" << endl;
+    cout << "a line per file with its return value and time is written to report.txt (default: the screen)" << endl;
+    cout << "--------------" << endl;
+    cout << argv << " --benchmark settingsFile.txt imagestack.mmf [--frames first last] [--json results.json] [--scratch path]" << endl;
+    cout << "times every stage of tracking frames first to last (default: startFrame to endFrame in settingsFile.txt) without keeping any output," << endl;
+    cout << "and writes frames per second, peak memory, per-stage latency and objects per frame to results.json (default: the screen)" << endl;
+    cout << "output is written to a dated directory in path (default: the temp directory) while running and deleted afterwards" << endl;
+    cout << "--------------" << endl;
     cout << endl << endl << "other parsing options available if someone wants to write them" <<endl;
 }
 
@@ -44,7 +44,8 @@ OBJECTFILES= \
 	${OBJECTDIR}/_ext/1360890869/MWT_DLL.o \
 	${OBJECTDIR}/_ext/1360890869/MWT_Lists.o \
 	${OBJECTDIR}/_ext/1360890869/MWT_Storage.o \
-	${OBJECTDIR}/MWT_Image_CV.o
+	${OBJECTDIR}/MWT_Image_CV.o \
+	${OBJECTDIR}/MMF_FrameRing.o
 
 
 # C Compiler Flags
@@ -61,7 +62,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=-L../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/lib ../Image-Stack-Compressor/WindowsBinaries/image_stack_compressor.lib -lcv -lcxcore -lhighgui ../yaml-cpp/./WindowsBinaries/libyaml-cpp.lib
+LDLIBSOPTIONS=-L../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/lib ../Image-Stack-Compressor/WindowsBinaries/image_stack_compressor.lib -lcv -lcxcore -lhighgui ../yaml-cpp/./WindowsBinaries/libyaml-cpp.lib -lpthread -lpsapi
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -130,6 +131,41 @@ ${OBJECTDIR}/MWT_Image_CV.o: MWT_Image_CV.cpp
 	${RM} $@.d
 	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MWT_Image_CV.o MWT_Image_CV.cpp
 
+${OBJECTDIR}/MMF_PreviewRenderer.o: MMF_PreviewRenderer.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_PreviewRenderer.o MMF_PreviewRenderer.cpp
+
+${OBJECTDIR}/MMF_Benchmark.o: MMF_Benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_Benchmark.o MMF_Benchmark.cpp
+
+${OBJECTDIR}/MMF_TileMerger.o: MMF_TileMerger.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_TileMerger.o MMF_TileMerger.cpp
+
+${OBJECTDIR}/MMF_TileTracker.o: MMF_TileTracker.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_TileTracker.o MMF_TileTracker.cpp
+
+${OBJECTDIR}/MMF_BatchRunner.o: MMF_BatchRunner.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_BatchRunner.o MMF_BatchRunner.cpp
+
+${OBJECTDIR}/MMF_TrackStitcher.o: MMF_TrackStitcher.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_TrackStitcher.o MMF_TrackStitcher.cpp
+
+${OBJECTDIR}/MMF_FrameRing.o: MMF_FrameRing.cpp 
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} $@.d
+	$(COMPILE.cc) -g -I../DLL -I../Image-Stack-Compressor -I../Image-Stack-Compressor/Necessary\ Libraries\ and\ Includes/CV/headers -I../yaml-cpp/include/ -MMD -MP -MF $@.d -o ${OBJECTDIR}/MMF_FrameRing.o MMF_FrameRing.cpp
+
 # Subprojects
 .build-subprojects:
 	cd ../Image-Stack-Compressor && ${MAKE}  -f Makefile CONF=Windows